@@ -0,0 +1,611 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+
+#include "mh.h"
+#include "mhdev.h"
+#include "poller.h"
+#include "sim.h"
+#include "logger.h"
+#include "timeutil.h"
+#include "config.h"
+
+#define MAX_SIZES 16
+
+/* syscall counting - all wrapped functions forward to real ones, only calls
+ * made by benchmarking thread are counted (simulator runs in the same
+ * process) */
+static _Thread_local int counting = 0;
+static _Thread_local uint64_t syscalls = 0;
+
+#define COUNT() do { if (counting) syscalls++; } while (0)
+
+int __real_open(const char *pathname, int flags, int mode);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+int __real_ppoll(struct pollfd *fds, nfds_t nfds,
+    const struct timespec *tmo_p, const sigset_t *sigmask);
+int __real_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+    int timeout);
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int __real_tcgetattr(int fd, struct termios *termios_p);
+int __real_tcsetattr(int fd, int optional_actions,
+    const struct termios *termios_p);
+long __real_syscall(long number, ...);
+
+int __wrap_open(const char *pathname, int flags, int mode)
+{
+  COUNT();
+  return __real_open(pathname, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+  COUNT();
+  return __real_close(fd);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+  COUNT();
+  return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+  COUNT();
+  return __real_write(fd, buf, count);
+}
+
+int __wrap_ppoll(struct pollfd *fds, nfds_t nfds,
+    const struct timespec *tmo_p, const sigset_t *sigmask)
+{
+  COUNT();
+  return __real_ppoll(fds, nfds, tmo_p, sigmask);
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+    int timeout)
+{
+  COUNT();
+  return __real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+  COUNT();
+  return __real_epoll_ctl(epfd, op, fd, event);
+}
+
+int __wrap_tcgetattr(int fd, struct termios *termios_p)
+{
+  COUNT();
+  return __real_tcgetattr(fd, termios_p);
+}
+
+int __wrap_tcsetattr(int fd, int optional_actions,
+    const struct termios *termios_p)
+{
+  COUNT();
+  return __real_tcsetattr(fd, optional_actions, termios_p);
+}
+
+/* io_uring has no libc wrappers, so its calls go through syscall() */
+long __wrap_syscall(long number, ...)
+{
+  long args[6];
+  va_list ap;
+  int i;
+
+  va_start(ap, number);
+  for (i = 0; i < 6; i++)
+  {
+    args[i] = va_arg(ap, long);
+  }
+  va_end(ap);
+
+  COUNT();
+  return __real_syscall(number, args[0], args[1], args[2], args[3], args[4],
+      args[5]);
+}
+
+typedef struct {
+  mhopt_t opts; /**< serial parameters of simulated sensors */
+  char **devices; /**< names of simulated sensors */
+  int count; /**< number of devices */
+  int64_t *latencies; /**< latency of every successful sample in ns */
+  size_t samples; /**< number of successful samples */
+  size_t errors; /**< number of failed samples */
+  void *state; /**< engine specific state */
+} bench_t;
+
+typedef struct {
+  const char *name;
+  int (*setup)(bench_t *bench);
+  int (*round)(bench_t *bench);
+  void (*teardown)(bench_t *bench);
+} engine_t;
+
+static void record(bench_t *bench, int error, int64_t latency)
+{
+  if (error)
+  {
+    bench->errors++;
+    return;
+  }
+  bench->latencies[bench->samples++] = latency;
+}
+
+/* process_command - open, configure and close device for every sample */
+static int oneshot_round(bench_t *bench)
+{
+  struct timespec start, end;
+  mhopt_t opts = bench->opts;
+  int i, err;
+
+  for (i = 0; i < bench->count; i++)
+  {
+    opts.device = bench->devices[i];
+    timespec_now(&start);
+    err = process_command(&opts);
+    timespec_now(&end);
+    record(bench, err, timespec_diff_ns(&end, &start));
+  }
+
+  return 0;
+}
+
+/* mhdev - keep handles open, read devices one after another */
+static int handle_setup(bench_t *bench)
+{
+  mhdev_t **devs;
+  mhopt_t opts = bench->opts;
+  int i;
+
+  devs = calloc(bench->count, sizeof(mhdev_t*));
+  if (devs == NULL)
+  {
+    return -1;
+  }
+  bench->state = devs;
+  for (i = 0; i < bench->count; i++)
+  {
+    opts.device = bench->devices[i];
+    devs[i] = mhdev_open(&opts);
+    if (devs[i] == NULL)
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int handle_round(bench_t *bench)
+{
+  mhdev_t **devs = bench->state;
+  struct timespec start, end;
+  uint16_t concentration;
+  int i, err;
+
+  for (i = 0; i < bench->count; i++)
+  {
+    timespec_now(&start);
+    err = mhdev_read_gas(devs[i], &concentration);
+    timespec_now(&end);
+    record(bench, err, timespec_diff_ns(&end, &start));
+  }
+
+  return 0;
+}
+
+static void handle_teardown(bench_t *bench)
+{
+  mhdev_t **devs = bench->state;
+  int i;
+
+  for (i = 0; devs != NULL && i < bench->count; i++)
+  {
+    mhdev_close(devs[i]);
+  }
+  free(devs);
+}
+
+/* poller - all devices concurrently from one epoll loop */
+static int poller_setup(bench_t *bench)
+{
+  poller_t *poller = calloc(1, sizeof(poller_t));
+
+  if (poller == NULL)
+  {
+    return -1;
+  }
+  bench->state = poller;
+  if (poller_open(poller, &bench->opts, bench->devices, bench->count))
+  {
+    free(poller);
+    bench->state = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int poller_round(bench_t *bench)
+{
+  poller_t *poller = bench->state;
+  int i;
+
+  if (poller_cycle(poller) < 0)
+  {
+    return -1;
+  }
+  for (i = 0; i < poller->count; i++)
+  {
+    record(bench, poller->devs[i].error, poller->devs[i].latency);
+  }
+
+  return 0;
+}
+
+static void poller_teardown(bench_t *bench)
+{
+  if (bench->state != NULL)
+  {
+    poller_close(bench->state);
+    free(bench->state);
+  }
+}
+
+#ifdef HAVE_IO_URING
+/* poller with io_uring backend - whole cycle submitted in batches */
+static int uring_setup(bench_t *bench)
+{
+  if (poller_setup(bench))
+  {
+    return -1;
+  }
+  if (poller_use_uring(bench->state))
+  {
+    poller_teardown(bench);
+    bench->state = NULL;
+    return -1;
+  }
+  return 0;
+}
+#endif
+
+static engine_t engines[] = {
+  {"process_command", NULL, oneshot_round, NULL},
+  {"mhdev", handle_setup, handle_round, handle_teardown},
+  {"poller", poller_setup, poller_round, poller_teardown},
+#ifdef HAVE_IO_URING
+  {"poller_uring", uring_setup, poller_round, poller_teardown},
+#endif
+};
+
+static int compare_latency(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+
+  return (x > y) - (x < y);
+}
+
+static double percentile(bench_t *bench, double p)
+{
+  size_t index;
+
+  if (bench->samples == 0)
+  {
+    return 0;
+  }
+  index = p * (bench->samples - 1) + 0.5;
+  return bench->latencies[index] / 1000.0;
+}
+
+/**
+ * \brief Serve simulated sensors from child process
+ *
+ * Parent keeps only descriptor used to stop simulation, so descriptors of
+ * devices opened by engines are not shifted by the ones held by simulator.
+ */
+static pid_t serve(sim_t *sim)
+{
+  pid_t pid;
+  int i;
+
+  pid = fork();
+  if (pid == -1)
+  {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0)
+  {
+    sim_run(sim);
+    sim_close(sim);
+    _exit(0);
+  }
+
+  for (i = 0; i < sim->opts.count; i++)
+  {
+    close(sim->sensors[i].master);
+    close(sim->sensors[i].slave);
+    sim->sensors[i].master = sim->sensors[i].slave = -1;
+  }
+  close(sim->epfd);
+  sim->epfd = -1;
+
+  return pid;
+}
+
+/**
+ * \brief Run single engine against given number of simulated sensors and
+ * print results as one JSON object per line
+ */
+static int run(engine_t *engine, int count, int rounds, int64_t latency,
+    mhopt_t *opts)
+{
+  simopt_t simopts = {
+    .count = count,
+    .latency = latency,
+    .waveform = WAVE_RANDOM,
+    .ppm = 600,
+    .amplitude = 200,
+    .seed = 1,
+  };
+  bench_t bench;
+  sim_t sim;
+  pid_t pid;
+  struct timespec start, end, cpu_start, cpu_end;
+  int64_t wall, cpu;
+  int i, err = 0;
+
+  memset(&bench, 0, sizeof(bench));
+  if (sim_open(&sim, &simopts))
+  {
+    ERROR("unable to simulate %d sensors", count);
+    return -1;
+  }
+  if ((pid = serve(&sim)) == -1)
+  {
+    sim_close(&sim);
+    return -1;
+  }
+
+  bench.opts = *opts;
+  bench.count = count;
+  bench.devices = calloc(count, sizeof(char*));
+  bench.latencies = calloc((size_t)count * rounds, sizeof(int64_t));
+  if (bench.devices == NULL || bench.latencies == NULL)
+  {
+    err = -1; goto cleanup;
+  }
+  for (i = 0; i < count; i++)
+  {
+    bench.devices[i] = sim.sensors[i].name;
+  }
+
+  if (engine->setup != NULL && engine->setup(&bench))
+  {
+    ERROR("%s: setup for %d devices failed", engine->name, count);
+    err = -1; goto cleanup;
+  }
+
+  counting = 1;
+  syscalls = 0;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  timespec_now(&start);
+  for (i = 0; i < rounds && err == 0; i++)
+  {
+    size_t samples = bench.samples;
+
+    err = engine->round(&bench);
+    /* engine is unable to handle this many devices, do not waste time */
+    if (bench.samples == samples)
+    {
+      err = -1;
+    }
+  }
+  timespec_now(&end);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  counting = 0;
+
+  if (engine->teardown != NULL)
+  {
+    engine->teardown(&bench);
+  }
+
+  wall = timespec_diff_ns(&end, &start);
+  cpu = timespec_diff_ns(&cpu_end, &cpu_start);
+  qsort(bench.latencies, bench.samples, sizeof(int64_t), compare_latency);
+  printf("{\"engine\": \"%s\", \"devices\": %d, \"sim_latency_us\": %lld, "
+      "\"samples\": %zu, \"errors\": %zu, "
+      "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, "
+      "\"samples_per_sec\": %.1f, \"cpu_us_per_sample\": %.2f, "
+      "\"syscalls_per_sample\": %.2f}\n",
+      engine->name, count, (long long)(latency), bench.samples, bench.errors,
+      percentile(&bench, 0.5), percentile(&bench, 0.99),
+      percentile(&bench, 0.999),
+      bench.samples * (double)NSEC_PER_SEC / (wall > 0 ? wall : 1),
+      bench.samples ? cpu / 1000.0 / bench.samples : 0,
+      bench.samples ? (double)syscalls / bench.samples : 0);
+  fflush(stdout);
+
+cleanup:
+  sim_stop(&sim);
+  waitpid(pid, NULL, 0);
+  sim_close(&sim);
+  free(bench.devices);
+  free(bench.latencies);
+  return err;
+}
+
+/**
+ * \brief Allow as many descriptors as hard limit permits
+ */
+static void raise_fd_limit()
+{
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+void help(char *progname)
+{
+  printf("Usage: %s [-n LIST] [-r ROUNDS] [-l TIME] [-t TIME] [-e ENGINE]\n"
+      "\n"
+      "Measure latency and throughput of reading simulated sensors. Results\n"
+      "are printed as one JSON object per engine and number of devices.\n"
+      "\n"
+      "  -n, --devices=LIST  comma separated numbers of devices\n"
+      "                      (default: 1,10,100,1000)\n"
+      "  -r, --rounds=ROUNDS number of samples taken from every device\n"
+      "                      (default: 20)\n"
+      "  -l, --latency=TIME  simulated response latency (default: 0)\n"
+      "  -t, --timeout=TIME  timeout of single try (default: 100ms)\n"
+      "  -e, --engine=ENGINE run only given engine, can be repeated\n"
+      "  -h, --help          print this help information and exit\n"
+      "\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+  int sizes[MAX_SIZES] = {1, 10, 100, 1000};
+  int size_count = 4;
+  int selected[sizeof(engines)/sizeof(engine_t)] = {0};
+  int any_selected = 0;
+  int rounds = 20;
+  int64_t latency = 0;
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .command = CMD_GAS_CONCENTRATION,
+    .timeout = 100000,
+    .tries = 1,
+  };
+  char *token;
+  int c, i, j, err = 0;
+
+  while (1) {
+    static struct option long_options[] = {
+      {"devices", required_argument, 0, 'n' },
+      {"rounds", required_argument, 0, 'r' },
+      {"latency", required_argument, 0, 'l' },
+      {"timeout", required_argument, 0, 't' },
+      {"engine", required_argument, 0, 'e' },
+      {"help", no_argument, 0, 'h' },
+      {0, 0, 0, 0 }
+    };
+
+    c = getopt_long(argc, argv, "n:r:l:t:e:h", long_options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        size_count = 0;
+        for (token = strtok(optarg, ","); token != NULL && size_count <
+            MAX_SIZES; token = strtok(NULL, ","))
+        {
+          sizes[size_count++] = atol(token);
+        }
+        break;
+
+      case 'r':
+        rounds = atol(optarg);
+        break;
+
+      case 'l':
+        if (parse_timeout(optarg, &latency))
+        {
+          ERROR("invalid latency: %s", optarg);
+          return 1;
+        }
+        break;
+
+      case 't':
+        if (parse_timeout(optarg, &opts.timeout))
+        {
+          ERROR("invalid timeout: %s", optarg);
+          return 1;
+        }
+        break;
+
+      case 'e':
+        for (i = 0; i < sizeof(engines)/sizeof(engine_t); i++)
+        {
+          if (strcmp(engines[i].name, optarg) == 0)
+          {
+            selected[i] = any_selected = 1;
+            break;
+          }
+        }
+        if (i == sizeof(engines)/sizeof(engine_t))
+        {
+          ERROR("unknown engine: %s", optarg);
+          return 1;
+        }
+        break;
+
+      case 'h':
+        help(argv[0]);
+        return 0;
+
+      default:
+        return 1;
+    }
+  }
+
+  raise_fd_limit();
+
+  for (i = 0; i < sizeof(engines)/sizeof(engine_t); i++)
+  {
+    if (any_selected && !selected[i])
+    {
+      continue;
+    }
+    for (j = 0; j < size_count; j++)
+    {
+      if (sizes[j] < 1 || run(&engines[i], sizes[j], rounds, latency, &opts))
+      {
+        err = 1;
+      }
+    }
+  }
+
+  return err;
+}
@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "arbiter.h"
+
+#define ARB_MAGIC "MHZ14AQU"
+#define ARB_VERSION 1
+#define CHECK_INTERVAL_NS (100 * NSEC_PER_MSEC) /**< how often waiter checks
+                                                  *  whether head of queue
+                                                  *  is still alive */
+#define UNKNOWN_GRACE_NS NSEC_PER_SEC /**< how long ticket may stay at head
+                                        *  without owner before skipping it */
+#define POLL_INTERVAL_NS (2 * NSEC_PER_MSEC) /**< sleep between attempts to
+                                               *  open or lock busy device */
+#define NO_OWNER 0 /**< ticket taken, but owner not stored yet */
+#define ABANDONED -1 /**< owner of ticket stopped waiting */
+
+static const char *queue_dirs[] = { "/run/lock", "/tmp" };
+
+struct arb_queue {
+  char magic[8]; /**< ARB_MAGIC */
+  uint32_t version; /**< ARB_VERSION */
+  _Atomic uint32_t next; /**< next ticket to be handed out */
+  _Atomic uint32_t serving; /**< ticket whose owner may open device now */
+  _Atomic int32_t owners[ARB_QUEUE_SIZE]; /**< pid holding ticket at index
+                                            *  ticket % ARB_QUEUE_SIZE */
+  _Atomic uint64_t acquisitions; /**< number of times device was taken */
+  _Atomic uint64_t contended; /**< acquisitions that had to wait */
+  _Atomic uint64_t timeouts; /**< waits given up after wait time */
+  _Atomic uint64_t recovered; /**< tickets skipped after owner was gone */
+  _Atomic uint64_t wait_ns; /**< total time of contended acquisitions */
+  _Atomic uint64_t max_wait_ns; /**< longest contended acquisition */
+};
+
+typedef struct {
+  const char *device; /**< name of device */
+  struct arb_queue *queue; /**< shared queue (NULL - unordered waiting) */
+  uint32_t ticket; /**< own place in queue */
+  uint32_t ahead; /**< number of waiters ahead at arrival */
+  int queued; /**< non-zero if ticket has to be passed on when leaving */
+  int contended; /**< non-zero if device was busy */
+  int has_deadline; /**< zero if waiting is not bounded */
+  struct timespec start; /**< time of arrival */
+  struct timespec deadline; /**< time after which waiting is given up */
+  uint32_t unknown_ticket; /**< head of queue seen without owner */
+  int unknown_valid; /**< non-zero if unknown_ticket is set */
+  struct timespec unknown_since; /**< when unknown_ticket was first seen */
+} arb_t;
+
+static void futex(_Atomic uint32_t *addr, int op, uint32_t val,
+    struct timespec *timeout)
+{
+  /* not private, queue is shared between processes */
+  syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static int queue_path(const char *dir, const struct stat *st, char *path,
+    size_t size)
+{
+  int len;
+
+  /* device numbers do not depend on name under which device was opened */
+  if (S_ISCHR(st->st_mode))
+  {
+    len = snprintf(path, size, "%s/mhz14a.%u.%u", dir, major(st->st_rdev),
+        minor(st->st_rdev));
+  }
+  else
+  {
+    len = snprintf(path, size, "%s/mhz14a.%llx.%llx", dir,
+        (unsigned long long) st->st_dev, (unsigned long long) st->st_ino);
+  }
+  return len < 0 || (size_t) len >= size ? -1 : 0;
+}
+
+static struct arb_queue *map_queue(int fd, const char *path)
+{
+  struct arb_queue *queue = NULL;
+  struct stat st;
+  int fresh = 0;
+
+  /* only one process may initialize new file */
+  if (flock(fd, LOCK_EX) == -1)
+  {
+    perror("flock");
+    return NULL;
+  }
+  if (fstat(fd, &st) == -1)
+  {
+    perror("fstat");
+    return NULL;
+  }
+  if (st.st_uid == geteuid() && (st.st_mode & 0666) != 0666)
+  {
+    /* every user of device has to be able to queue for it */
+    fchmod(fd, 0666);
+  }
+  if (st.st_size == 0)
+  {
+    if (ftruncate(fd, sizeof(*queue)) == -1)
+    {
+      perror("ftruncate");
+      return NULL;
+    }
+    fresh = 1;
+  }
+  else if (st.st_size != sizeof(*queue))
+  {
+    WARNING("%s is not a device queue", path);
+    return NULL;
+  }
+
+  queue = mmap(NULL, sizeof(*queue), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+      0);
+  if (queue == MAP_FAILED)
+  {
+    perror("mmap");
+    return NULL;
+  }
+  if (fresh)
+  {
+    memcpy(queue->magic, ARB_MAGIC, sizeof(queue->magic));
+    queue->version = ARB_VERSION;
+  }
+  else if (memcmp(queue->magic, ARB_MAGIC, sizeof(queue->magic)) != 0 ||
+      queue->version != ARB_VERSION)
+  {
+    WARNING("%s is not a device queue", path);
+    munmap(queue, sizeof(*queue));
+    return NULL;
+  }
+
+  return queue;
+}
+
+static struct arb_queue *open_queue(const char *device)
+{
+  struct arb_queue *queue = NULL;
+  struct stat st;
+  char path[PATH_MAX];
+  size_t i;
+  int fd;
+
+  if (stat(device, &st) == -1)
+  {
+    return NULL;
+  }
+
+  for (i = 0; i < sizeof(queue_dirs) / sizeof(queue_dirs[0]); i++)
+  {
+    if (queue_path(queue_dirs[i], &st, path, sizeof(path)))
+    {
+      continue;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0666);
+    if (fd == -1)
+    {
+      DEBUG("unable to open queue %s: %s", path, strerror(errno));
+      continue;
+    }
+    queue = map_queue(fd, path);
+    /* closing descriptor drops initialization lock */
+    close(fd);
+    if (queue != NULL)
+    {
+      DEBUG("%s: using queue %s", device, path);
+      break;
+    }
+  }
+
+  return queue;
+}
+
+static int take_ticket(arb_t *arb)
+{
+  struct arb_queue *queue = arb->queue;
+  uint32_t serving;
+  uint32_t next;
+
+  do
+  {
+    /* serving loaded first, so it never appears to be past next */
+    serving = atomic_load(&queue->serving);
+    next = atomic_load(&queue->next);
+    if (next - serving >= ARB_QUEUE_SIZE)
+    {
+      return -1;
+    }
+  } while (!atomic_compare_exchange_weak(&queue->next, &next, next + 1));
+
+  arb->ticket = next;
+  arb->ahead = next - serving;
+  arb->queued = 1;
+  atomic_store(&queue->owners[next % ARB_QUEUE_SIZE], getpid());
+  return 0;
+}
+
+/**
+ * \brief Let owner of following ticket in, if ticket is still being served
+ *
+ * \return non-zero if ticket was passed on by this call
+ */
+static int pass_on(struct arb_queue *queue, uint32_t ticket)
+{
+  uint32_t expected = ticket;
+
+  /* slot will be reused by ticket ARB_QUEUE_SIZE places later */
+  atomic_store(&queue->owners[ticket % ARB_QUEUE_SIZE], NO_OWNER);
+  if (!atomic_compare_exchange_strong(&queue->serving, &expected, ticket + 1))
+  {
+    return 0;
+  }
+  futex(&queue->serving, FUTEX_WAKE, INT_MAX, NULL);
+  return 1;
+}
+
+/**
+ * \brief Skip ticket at head of queue if nobody is going to use it
+ *
+ * \return non-zero if head was skipped
+ */
+static int skip_head(arb_t *arb, uint32_t head, const struct timespec *now)
+{
+  struct arb_queue *queue = arb->queue;
+  int32_t owner = atomic_load(&queue->owners[head % ARB_QUEUE_SIZE]);
+
+  if (owner == NO_OWNER)
+  {
+    /* owner is between taking ticket and storing its pid or has died there */
+    if (!arb->unknown_valid || arb->unknown_ticket != head)
+    {
+      arb->unknown_ticket = head;
+      arb->unknown_since = *now;
+      arb->unknown_valid = 1;
+      return 0;
+    }
+    if (timespec_diff_ns(now, &arb->unknown_since) < UNKNOWN_GRACE_NS)
+    {
+      return 0;
+    }
+  }
+  else if (owner != ABANDONED && (kill(owner, 0) == 0 || errno != ESRCH))
+  {
+    return 0;
+  }
+
+  if (pass_on(queue, head))
+  {
+    DEBUG("%s: skipped ticket %u of process %d, which is gone", arb->device,
+        head, owner);
+    atomic_fetch_add(&queue->recovered, 1);
+  }
+  return 1;
+}
+
+static int wait_turn(arb_t *arb)
+{
+  struct arb_queue *queue = arb->queue;
+  struct timespec now;
+  struct timespec timeout;
+  uint32_t serving;
+  int64_t left = CHECK_INTERVAL_NS;
+
+  while ((serving = atomic_load(&queue->serving)) != arb->ticket)
+  {
+    timespec_now(&now);
+    if (arb->has_deadline &&
+        (left = timespec_diff_ns(&arb->deadline, &now)) <= 0)
+    {
+      /* following waiters will skip the ticket */
+      atomic_store(&queue->owners[arb->ticket % ARB_QUEUE_SIZE], ABANDONED);
+      arb->queued = 0;
+      return -1;
+    }
+    if (skip_head(arb, serving, &now))
+    {
+      continue;
+    }
+
+    if (left > CHECK_INTERVAL_NS)
+    {
+      left = CHECK_INTERVAL_NS;
+    }
+    timeout.tv_sec = left / NSEC_PER_SEC;
+    timeout.tv_nsec = left % NSEC_PER_SEC;
+    futex(&queue->serving, FUTEX_WAIT, serving, &timeout);
+  }
+
+  return 0;
+}
+
+/**
+ * \brief Sleep before next attempt to take busy device
+ *
+ * \return 0 if waiting may go on, -1 if wait time is over
+ */
+static int pause_turn(arb_t *arb)
+{
+  struct timespec now;
+  struct timespec pause = { 0, POLL_INTERVAL_NS };
+  int64_t left;
+
+  arb->contended = 1;
+  if (arb->has_deadline)
+  {
+    timespec_now(&now);
+    left = timespec_diff_ns(&arb->deadline, &now);
+    if (left <= 0)
+    {
+      return -1;
+    }
+    if (left < POLL_INTERVAL_NS)
+    {
+      pause.tv_nsec = left;
+    }
+  }
+  nanosleep(&pause, NULL);
+  return 0;
+}
+
+static int lock_device(arb_t *arb, int fd)
+{
+  while (flock(fd, LOCK_EX | LOCK_NB) == -1)
+  {
+    if (errno != EWOULDBLOCK)
+    {
+      /* e.g. locks not supported, exclusive open is still attempted */
+      perror("flock");
+      break;
+    }
+    if (pause_turn(arb))
+    {
+      return -1;
+    }
+  }
+
+  if (ioctl(fd, TIOCEXCL) == -1)
+  {
+    DEBUG("%s: exclusive mode not supported: %s", arb->device,
+        strerror(errno));
+  }
+  return 0;
+}
+
+static void account(arb_t *arb)
+{
+  struct arb_queue *queue = arb->queue;
+  struct timespec now;
+  uint64_t waited;
+  uint64_t max;
+
+  if (queue != NULL)
+  {
+    atomic_fetch_add(&queue->acquisitions, 1);
+  }
+  if (!arb->contended && arb->ahead == 0)
+  {
+    return;
+  }
+
+  timespec_now(&now);
+  waited = timespec_diff_ns(&now, &arb->start);
+  INFO("%s: busy, got exclusive access after %lldus with %u waiting ahead",
+      arb->device, (long long) (waited / NSEC_PER_USEC), arb->ahead);
+  if (queue == NULL)
+  {
+    return;
+  }
+
+  atomic_fetch_add(&queue->contended, 1);
+  atomic_fetch_add(&queue->wait_ns, waited);
+  max = atomic_load(&queue->max_wait_ns);
+  while (waited > max &&
+      !atomic_compare_exchange_weak(&queue->max_wait_ns, &max, waited));
+  if (waited > max)
+  {
+    max = waited;
+  }
+  INFO("%s: %llu acquisitions, %llu contended (mean wait %lldus, max "
+      "%lldus), %llu timeouts, %llu abandoned tickets skipped", arb->device,
+      (unsigned long long) atomic_load(&queue->acquisitions),
+      (unsigned long long) atomic_load(&queue->contended),
+      (long long) (atomic_load(&queue->wait_ns) /
+        atomic_load(&queue->contended) / NSEC_PER_USEC),
+      (long long) (max / NSEC_PER_USEC),
+      (unsigned long long) atomic_load(&queue->timeouts),
+      (unsigned long long) atomic_load(&queue->recovered));
+}
+
+static void leave(arb_t *arb)
+{
+  if (arb->queue == NULL)
+  {
+    return;
+  }
+  if (arb->queued)
+  {
+    pass_on(arb->queue, arb->ticket);
+  }
+  munmap(arb->queue, sizeof(*arb->queue));
+}
+
+static int give_up(arb_t *arb)
+{
+  struct timespec now;
+
+  timespec_now(&now);
+  ERROR("%s: device busy, gave up waiting after %lldms", arb->device,
+      (long long) (timespec_diff_ns(&now, &arb->start) / NSEC_PER_MSEC));
+  if (arb->queue != NULL)
+  {
+    atomic_fetch_add(&arb->queue->timeouts, 1);
+  }
+  leave(arb);
+  errno = EBUSY;
+  return -8;
+}
+
+int arb_open(const char *device, int flags, int64_t wait)
+{
+  arb_t arb;
+  int fd = -1;
+  int err = 0;
+
+  if (wait < 0)
+  {
+    if ((fd = open(device, flags)) == -1)
+    {
+      perror("open");
+    }
+    return fd;
+  }
+
+  memset(&arb, 0, sizeof(arb));
+  arb.device = device;
+  timespec_now(&arb.start);
+  arb.deadline = arb.start;
+  timespec_add_ns(&arb.deadline, wait * NSEC_PER_USEC);
+  arb.has_deadline = wait > 0;
+
+  arb.queue = open_queue(device);
+  if (arb.queue != NULL && take_ticket(&arb))
+  {
+    WARNING("%s: too many processes waiting, not keeping order", device);
+    munmap(arb.queue, sizeof(*arb.queue));
+    arb.queue = NULL;
+  }
+  if (arb.queue != NULL && wait_turn(&arb))
+  {
+    return give_up(&arb);
+  }
+
+  /* exclusive mode set by another process makes open fail */
+  while ((fd = open(device, flags)) == -1 && errno == EBUSY)
+  {
+    if (pause_turn(&arb))
+    {
+      return give_up(&arb);
+    }
+  }
+  if (fd == -1)
+  {
+    err = errno;
+    perror("open");
+    leave(&arb);
+    errno = err;
+    return -1;
+  }
+
+  if (lock_device(&arb, fd))
+  {
+    close(fd);
+    return give_up(&arb);
+  }
+  account(&arb);
+  leave(&arb);
+  return fd;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ARBITER_H
+#define ARBITER_H
+
+#include <stdint.h>
+
+#define ARB_QUEUE_SIZE 64 /**< maximum number of processes waiting for device */
+
+/**
+ * \brief Open device for exclusive use, waiting for other users in turn
+ *
+ * Processes opening the same device take tickets from a queue shared through
+ * small memory-mapped file in /run/lock (or /tmp), and are let in one by one
+ * in order of arrival. Process whose turn it is opens the device, takes
+ * exclusive flock() on it and sets TIOCEXCL, so programs not using the queue,
+ * but respecting locks, are kept out as well. Lock is released by closing the
+ * descriptor. Tickets of processes that gave up or died are skipped.
+ *
+ * When queue file cannot be used, device is still opened and locked, only
+ * without ordering of waiters. Time spent waiting and totals of contention
+ * statistics kept in the queue file are logged whenever device was busy.
+ *
+ * \param device Name of device
+ * \param flags Flags for open()
+ * \param wait Microseconds to wait for device (0 - infinity, negative - open
+ * without arbitration and locking)
+ *
+ * \return file descriptor or negative value on error
+ * \retval -1 device could not be opened
+ * \retval -8 device was not available within wait time
+ */
+int arb_open(const char *device, int flags, int64_t wait);
+
+#endif // ARBITER_H
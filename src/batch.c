@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "poller.h"
+#include "batch.h"
+
+int batch_load_devices(const char *path, char ***devices, int *count)
+{
+  FILE *fp;
+  char *line = NULL, *start, *end, **list;
+  size_t size = 0;
+  int ret = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+
+  while (getline(&line, &size, fp) != -1)
+  {
+    start = line;
+    while (isspace((unsigned char) *start))
+    {
+      start++;
+    }
+    end = start + strlen(start);
+    while (end > start && isspace((unsigned char) end[-1]))
+    {
+      end--;
+    }
+    *end = '\0';
+    if (*start == '\0' || *start == '#')
+    {
+      continue;
+    }
+
+    list = realloc(*devices, (*count + 1) * sizeof(char*));
+    if (list == NULL)
+    {
+      perror("realloc");
+      ret = -2;
+      break;
+    }
+    *devices = list;
+    list[*count] = strdup(start);
+    if (list[*count] == NULL)
+    {
+      perror("strdup");
+      ret = -2;
+      break;
+    }
+    (*count)++;
+  }
+  if (ret == 0 && ferror(fp))
+  {
+    perror(path);
+    ret = -1;
+  }
+
+  free(line);
+  fclose(fp);
+  return ret;
+}
+
+/**
+ * \brief Print string as JSON string literal
+ */
+static void print_json_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      fprintf(out, "\\%c", *s);
+    }
+    else if ((unsigned char) *s < 0x20)
+    {
+      fprintf(out, "\\u%04x", *s);
+    }
+    else
+    {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/**
+ * \brief Print string as CSV field, quoting it only if needed
+ */
+static void print_csv_field(FILE *out, const char *s)
+{
+  if (strpbrk(s, ",\"\r\n") == NULL)
+  {
+    fputs(s, out);
+    return;
+  }
+  fputc('"', out);
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '"')
+    {
+      fputc('"', out);
+    }
+    fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+static void print_json(FILE *out, poller_t *poller)
+{
+  int i;
+
+  fputs("[\n", out);
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    fputs("  {\"device\": ", out);
+    print_json_string(out, dev->device);
+    if (dev->state == POLL_DONE)
+    {
+      fprintf(out, ", \"ppm\": %d", dev->gas_concentration);
+    }
+    else
+    {
+      fputs(", \"ppm\": null", out);
+    }
+    fprintf(out, ", \"latency_us\": %lld, \"error\": %d}%s\n",
+        (long long)(dev->latency / NSEC_PER_USEC), dev->error,
+        i + 1 < poller->count ? "," : "");
+  }
+  fputs("]\n", out);
+}
+
+static void print_csv(FILE *out, poller_t *poller)
+{
+  int i;
+
+  fputs("device,ppm,latency_us,error\n", out);
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    print_csv_field(out, dev->device);
+    if (dev->state == POLL_DONE)
+    {
+      fprintf(out, ",%d", dev->gas_concentration);
+    }
+    else
+    {
+      fputc(',', out);
+    }
+    fprintf(out, ",%lld,%d\n", (long long)(dev->latency / NSEC_PER_USEC),
+        dev->error);
+  }
+}
+
+int run_batch(mhopt_t *opts, batchopt_t *bopts, FILE *out)
+{
+  poller_t poller;
+  struct timespec limit;
+  int ok;
+
+  if (bopts->device_count < 1)
+  {
+    ERROR("batch requires at least one device");
+    return -1;
+  }
+
+  /* deadline is counted from start, so opening devices is included */
+  timespec_now(&limit);
+  timespec_add_ns(&limit, bopts->deadline * NSEC_PER_USEC);
+
+  /* device that cannot be opened must not prevent reading the others */
+  if (poller_open_lenient(&poller, opts, bopts->devices, bopts->device_count,
+        bopts->deadline != 0 ? &limit : NULL))
+  {
+    return -1;
+  }
+  if (bopts->uring && poller_use_uring(&poller))
+  {
+    WARNING("io_uring is not available, using epoll");
+  }
+
+  ok = poller_cycle_until(&poller, bopts->deadline != 0 ? &limit : NULL);
+  if (ok < 0)
+  {
+    poller_close(&poller);
+    return -1;
+  }
+  bopts->failed = poller.count - ok;
+
+  switch (bopts->format)
+  {
+    case BATCH_CSV:
+      print_csv(out, &poller);
+      break;
+    default:
+      print_json(out, &poller);
+      break;
+  }
+  fflush(out);
+
+  poller_close(&poller);
+  return 0;
+}
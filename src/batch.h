@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mh.h"
+
+typedef enum {
+  BATCH_JSON = 0, /**< JSON array of objects */
+  BATCH_CSV, /**< CSV with header line */
+} batchformat_t;
+
+typedef struct {
+  char **devices; /**< list of UART devices to be read */
+  int device_count; /**< number of entries in devices */
+  int64_t deadline; /**< microseconds in which whole batch has to finish
+                      *  (0 - bounded only by timeout of tries) */
+  batchformat_t format; /**< format of output */
+  int uring; /**< read devices through io_uring instead of epoll, if
+               *  available */
+  int failed; /**< output - number of devices that could not be read */
+} batchopt_t;
+
+/**
+ * \brief Append devices listed in file to list of devices
+ *
+ * File contains one device per line. Empty lines and lines starting with #
+ * are ignored, as well as whitespace around device names.
+ *
+ * \param path Filename of device list
+ * \param devices List of devices to be extended, reallocated as needed
+ * \param count Number of entries in list, updated
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be read
+ * \retval -2 out of memory
+ */
+int batch_load_devices(const char *path, char ***devices, int *count);
+
+/**
+ * \brief Read gas concentration from all devices once and print results
+ *
+ * All devices are opened and read concurrently, so the whole batch takes only
+ * as long as the slowest device, and never longer than deadline, if given.
+ * Devices that cannot be opened are reported as failed without affecting the
+ * others. For every device, in order of the list, its name, concentration,
+ * latency in microseconds and error code (same as in \link execute_command
+ * \endlink, 0 on success) are printed.
+ *
+ * \param opts Serial parameters, timeout and tries shared by all devices
+ * \param bopts List of devices and output parameters
+ * \param out Stream to print results to
+ *
+ * \return success indicator
+ * \retval 0 batch was performed, bopts->failed tells how many devices failed
+ * \retval -1 batch could not be performed
+ */
+int run_batch(mhopt_t *opts, batchopt_t *bopts, FILE *out);
+
+#endif // BATCH_H
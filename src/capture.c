@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "capture.h"
+
+struct capture {
+  int fd; /**< descriptor of capture file */
+  pthread_mutex_t lock; /**< guards buffers and counters below */
+  pthread_cond_t wake; /**< wakes writer up */
+  pthread_t writer; /**< thread writing full buffers to file */
+  uint8_t *buffers[2]; /**< preallocated buffers */
+  size_t used[2]; /**< number of bytes in every buffer */
+  int active; /**< index of buffer records are appended to */
+  int full; /**< non-zero if the other buffer waits to be written */
+  int stopping; /**< non-zero if writer has to flush and exit */
+  uint64_t dropped; /**< records dropped because both buffers were full */
+  int failed; /**< non-zero after write error was reported */
+};
+
+static int64_t to_ns(const struct timespec *ts)
+{
+  return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * \brief Write whole buffer to capture file
+ */
+static void write_buffer(capture_t *capture, const uint8_t *buf, size_t count)
+{
+  ssize_t written;
+
+  while (count > 0)
+  {
+    written = write(capture->fd, buf, count);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (!capture->failed)
+      {
+        ERROR("capture: %s", strerror(errno));
+        capture->failed = 1;
+      }
+      return;
+    }
+    buf += written;
+    count -= written;
+  }
+}
+
+/**
+ * \brief Make the other buffer active, handing current one to writer
+ *
+ * Has to be called with lock of capture held and no buffer waiting.
+ */
+static void swap_buffers(capture_t *capture)
+{
+  capture->full = 1;
+  capture->active ^= 1;
+}
+
+static void *write_records(void *arg)
+{
+  capture_t *capture = arg;
+  struct timespec timeout;
+  int timed_out = 0;
+  int idx;
+
+  pthread_mutex_lock(&capture->lock);
+  while (1)
+  {
+    if (!capture->full && capture->used[capture->active] > 0 &&
+        (timed_out || capture->stopping))
+    {
+      /* do not keep records in memory for long */
+      swap_buffers(capture);
+    }
+    if (capture->full)
+    {
+      idx = capture->active ^ 1;
+      pthread_mutex_unlock(&capture->lock);
+      write_buffer(capture, capture->buffers[idx], capture->used[idx]);
+      pthread_mutex_lock(&capture->lock);
+      capture->used[idx] = 0;
+      capture->full = 0;
+      timed_out = 0;
+      continue;
+    }
+    if (capture->stopping)
+    {
+      break;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += CAPTURE_FLUSH_INTERVAL / 1000;
+    timeout.tv_nsec += (CAPTURE_FLUSH_INTERVAL % 1000) * NSEC_PER_MSEC;
+    if (timeout.tv_nsec >= NSEC_PER_SEC)
+    {
+      timeout.tv_sec++;
+      timeout.tv_nsec -= NSEC_PER_SEC;
+    }
+    timed_out = pthread_cond_timedwait(&capture->wake, &capture->lock,
+        &timeout) == ETIMEDOUT;
+  }
+  pthread_mutex_unlock(&capture->lock);
+
+  return NULL;
+}
+
+capture_t *capture_open(const char *path)
+{
+  capture_header_t header;
+  struct timespec real, mono;
+  capture_t *capture;
+  int err;
+
+  capture = calloc(1, sizeof(*capture));
+  if (capture == NULL)
+  {
+    perror("calloc");
+    return NULL;
+  }
+
+  capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (capture->fd < 0)
+  {
+    err = errno;
+    perror(path);
+    goto error;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &real);
+  timespec_now(&mono);
+  memset(&header, 0, sizeof(header));
+  header.magic = CAPTURE_MAGIC;
+  header.version = CAPTURE_VERSION;
+  header.record_size = sizeof(capture_record_t);
+  header.realtime = to_ns(&real);
+  header.monotonic = to_ns(&mono);
+  write_buffer(capture, (const uint8_t*) &header, sizeof(header));
+  if (capture->failed)
+  {
+    err = EIO;
+    goto error;
+  }
+
+  capture->buffers[0] = malloc(2 * CAPTURE_BUFFER_SIZE);
+  if (capture->buffers[0] == NULL)
+  {
+    err = errno;
+    perror("malloc");
+    goto error;
+  }
+  /* touch buffers now, so page faults do not happen during transfers */
+  memset(capture->buffers[0], 0, 2 * CAPTURE_BUFFER_SIZE);
+  capture->buffers[1] = capture->buffers[0] + CAPTURE_BUFFER_SIZE;
+
+  pthread_mutex_init(&capture->lock, NULL);
+  pthread_cond_init(&capture->wake, NULL);
+  if ((err = pthread_create(&capture->writer, NULL, write_records, capture)))
+  {
+    ERROR("unable to start capture writer");
+    pthread_cond_destroy(&capture->wake);
+    pthread_mutex_destroy(&capture->lock);
+    goto error;
+  }
+  INFO("Capturing UART traffic to %s", path);
+
+  return capture;
+
+error:
+  if (capture->fd >= 0)
+  {
+    close(capture->fd);
+  }
+  free(capture->buffers[0]);
+  free(capture);
+  errno = err;
+  return NULL;
+}
+
+void capture_close(capture_t *capture)
+{
+  if (capture == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&capture->lock);
+  capture->stopping = 1;
+  pthread_cond_signal(&capture->wake);
+  pthread_mutex_unlock(&capture->lock);
+  pthread_join(capture->writer, NULL);
+
+  if (capture->dropped > 0)
+  {
+    WARNING("%llu capture records dropped",
+        (unsigned long long) capture->dropped);
+  }
+  pthread_cond_destroy(&capture->wake);
+  pthread_mutex_destroy(&capture->lock);
+  close(capture->fd);
+  free(capture->buffers[0]);
+  free(capture);
+}
+
+/**
+ * \brief Append single record to active buffer
+ */
+static void append(capture_t *capture, int64_t time, int channel,
+    capdir_t direction, const void *buf, size_t count)
+{
+  capture_record_t record;
+  size_t need = sizeof(record) + count;
+  uint8_t *dst;
+
+  memset(&record, 0, sizeof(record));
+  record.time = time;
+  record.channel = channel;
+  record.length = count;
+  record.direction = direction;
+
+  pthread_mutex_lock(&capture->lock);
+  if (capture->used[capture->active] + need > CAPTURE_BUFFER_SIZE)
+  {
+    if (capture->full)
+    {
+      /* writer is behind, losing record is better than stalling IO */
+      capture->dropped++;
+      pthread_mutex_unlock(&capture->lock);
+      return;
+    }
+    swap_buffers(capture);
+    pthread_cond_signal(&capture->wake);
+  }
+  dst = capture->buffers[capture->active] + capture->used[capture->active];
+  memcpy(dst, &record, sizeof(record));
+  memcpy(dst + sizeof(record), buf, count);
+  capture->used[capture->active] += need;
+  pthread_mutex_unlock(&capture->lock);
+}
+
+void capture_io(capture_t *capture, int channel, capdir_t direction,
+    const void *buf, size_t count)
+{
+  const uint8_t *bytes = buf;
+  struct timespec now;
+  size_t len;
+
+  timespec_now(&now);
+  do
+  {
+    len = count < CAPTURE_MAX_DATA ? count : CAPTURE_MAX_DATA;
+    append(capture, to_ns(&now), channel, direction, bytes, len);
+    bytes += len;
+    count -= len;
+  } while (count > 0);
+}
+
+void capture_device(capture_t *capture, int channel, const char *device)
+{
+  size_t len = strlen(device);
+
+  /* name must fit in single record */
+  capture_io(capture, channel, CAPTURE_OPEN, device,
+      len < CAPTURE_MAX_DATA ? len : CAPTURE_MAX_DATA);
+}
+
+uint64_t capture_dropped(capture_t *capture)
+{
+  uint64_t count;
+
+  pthread_mutex_lock(&capture->lock);
+  count = capture->dropped;
+  pthread_mutex_unlock(&capture->lock);
+
+  return count;
+}
+
+int capture_open_reader(capture_reader_t *reader, FILE *fp)
+{
+  reader->fp = fp;
+  if (fread(&reader->header, sizeof(reader->header), 1, fp) != 1 ||
+      reader->header.magic != CAPTURE_MAGIC ||
+      reader->header.version != CAPTURE_VERSION ||
+      reader->header.record_size != sizeof(capture_record_t))
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+int capture_next(capture_reader_t *reader, capture_record_t *record,
+    uint8_t *data)
+{
+  if (fread(record, sizeof(*record), 1, reader->fp) != 1)
+  {
+    return 0;
+  }
+  if (record->length > CAPTURE_MAX_DATA || record->direction > CAPTURE_OPEN ||
+      record->channel < 0)
+  {
+    return -1;
+  }
+  if (fread(data, 1, record->length, reader->fp) != record->length)
+  {
+    return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC 0x5043484d /**< "MHCP" at the beginning of file */
+#define CAPTURE_VERSION 1 /**< version of file format */
+#define CAPTURE_BUFFER_SIZE (256 * 1024) /**< size of each of two buffers */
+#define CAPTURE_MAX_DATA 256 /**< maximum payload of single record, longer
+                               *  transfers are split */
+#define CAPTURE_FLUSH_INTERVAL 1000 /**< milliseconds after which partially
+                                      *  filled buffer is written anyway */
+
+typedef enum {
+  CAPTURE_TX = 0, /**< bytes written to device */
+  CAPTURE_RX, /**< bytes read from device */
+  CAPTURE_OPEN, /**< device was opened, payload holds its name */
+} capdir_t;
+
+/**
+ * \brief Header at the beginning of capture file
+ *
+ * Both clocks are sampled at the same instant, so monotonic time of every
+ * record can be converted to wall time.
+ */
+typedef struct {
+  uint32_t magic; /**< CAPTURE_MAGIC */
+  uint16_t version; /**< CAPTURE_VERSION */
+  uint16_t record_size; /**< size of record header */
+  int64_t realtime; /**< wall time of start of capture in ns since epoch */
+  int64_t monotonic; /**< monotonic time of start of capture in ns */
+} capture_header_t;
+
+/**
+ * \brief Header of single record, followed by length bytes of payload
+ */
+typedef struct {
+  int64_t time; /**< monotonic time of transfer in ns */
+  int32_t channel; /**< descriptor of device (mapped to device name by the
+                     *  latest CAPTURE_OPEN record) */
+  uint16_t length; /**< number of payload bytes */
+  uint8_t direction; /**< one of \link capdir_t \endlink */
+  uint8_t reserved;
+} capture_record_t;
+
+typedef struct {
+  FILE *fp; /**< capture being read */
+  capture_header_t header; /**< header of capture */
+} capture_reader_t;
+
+/**
+ * \brief Capture of traffic of devices, shared by all handles recording to it
+ */
+typedef struct capture capture_t;
+
+/**
+ * \brief Start capturing traffic into file
+ *
+ * Capture is attached to devices through capture member of \link mhopt_t
+ * \endlink, devices without one are not captured at all. Records are appended
+ * to one of two preallocated buffers, the other one being written to file by
+ * background thread, so capturing never waits for disk. If both buffers are
+ * full, records are dropped and counted instead.
+ *
+ * \param path Filename of capture, truncated if it exists
+ *
+ * \return capture or NULL on error (errno set)
+ */
+capture_t *capture_open(const char *path);
+
+/**
+ * \brief Write all buffered records, stop capturing and free capture
+ *
+ * Devices recording to capture must not be used anymore.
+ *
+ * \param capture Opened capture or NULL (nothing is done)
+ */
+void capture_close(capture_t *capture);
+
+/**
+ * \brief Record bytes transferred to or from device
+ *
+ * Safe to be called from many threads.
+ *
+ * \param capture Opened capture
+ * \param channel Descriptor of device
+ * \param direction Direction of transfer
+ * \param buf Transferred bytes
+ * \param count Number of bytes in buf
+ */
+void capture_io(capture_t *capture, int channel, capdir_t direction,
+    const void *buf, size_t count);
+
+/**
+ * \brief Record that device has been opened as descriptor
+ *
+ * \param capture Opened capture
+ * \param channel Descriptor of device
+ * \param device Name of device
+ */
+void capture_device(capture_t *capture, int channel, const char *device);
+
+/**
+ * \brief Get number of records dropped because buffers were full
+ *
+ * \param capture Opened capture
+ *
+ * \return number of records dropped since capture was opened
+ */
+uint64_t capture_dropped(capture_t *capture);
+
+/**
+ * \brief Open capture file for reading
+ *
+ * \param reader Reader to initialize
+ * \param fp Stream positioned at the beginning of capture
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 stream is not a capture or has unsupported version
+ */
+int capture_open_reader(capture_reader_t *reader, FILE *fp);
+
+/**
+ * \brief Read next record of capture
+ *
+ * \param reader Initialized reader
+ * \param record Output record header
+ * \param data Output payload, at least CAPTURE_MAX_DATA bytes
+ *
+ * \return reading indicator
+ * \retval 1 record was read
+ * \retval 0 end of capture (incomplete last record is ignored)
+ * \retval -1 record is corrupted
+ */
+int capture_next(capture_reader_t *reader, capture_record_t *record,
+    uint8_t *data);
+
+#endif // CAPTURE_H
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "poller.h"
+#include "store.h"
+#include "live.h"
+#include "rollup.h"
+#include "history.h"
+#include "metrics.h"
+#include "profile.h"
+#include "daemon.h"
+
+#define FLUSH_INTERVAL 1000 /**< maximum delay of output in ms */
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int signum)
+{
+  stop_requested = 1;
+}
+
+/**
+ * \brief Append results of finished cycle to store, rollups and history and
+ * publish them as latest readings
+ *
+ * \param store Opened store or NULL
+ * \param live Shared memory opened for writing or NULL
+ * \param rollup Rollups opened for writing or NULL
+ * \param history History opened for appending or NULL
+ * \param poller Poller after finished cycle
+ */
+static void record_cycle(store_t *store, live_t *live, rollup_t *rollup,
+    history_t *history, poller_t *poller)
+{
+  struct timespec mono, wall;
+  store_record_t record;
+  int64_t offset;
+  int i;
+
+  /* transactions are timed with monotonic clock, wall time is derived */
+  timespec_now(&mono);
+  clock_gettime(CLOCK_REALTIME, &wall);
+  offset = timespec_diff_ns(&wall, &mono);
+
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    if (dev->state != POLL_DONE && dev->state != POLL_FAILED)
+    {
+      continue;
+    }
+    memset(&record, 0, sizeof(record));
+    record.mono = dev->started.tv_sec * NSEC_PER_SEC + dev->started.tv_nsec +
+      dev->latency;
+    record.wall = record.mono + offset;
+    record.device = i;
+    record.ppm = dev->state == POLL_DONE ? dev->gas_concentration : 0;
+    record.status = dev->error;
+    if (store != NULL)
+    {
+      store_append(store, &record);
+    }
+    if (live != NULL)
+    {
+      live_publish(live, &record);
+    }
+    if (rollup != NULL)
+    {
+      rollup_add(rollup, &record);
+    }
+    if (history != NULL && dev->state == POLL_DONE)
+    {
+      history_append(history, i, record.wall / NSEC_PER_MSEC, record.ppm);
+    }
+  }
+
+  if (rollup != NULL)
+  {
+    /* periods end even if no device answered */
+    rollup_advance(rollup, mono.tv_sec * NSEC_PER_SEC + mono.tv_nsec + offset);
+  }
+}
+
+int run_daemon(mhopt_t *opts, daemonopt_t *dopts)
+{
+  int i;
+  poller_t poller;
+  store_t store_file, *store = NULL;
+  live_t live_area, *live = NULL;
+  rollup_t rollup_files, *rollup = NULL;
+  history_t history_file, *history = NULL;
+  metrics_t *metrics = NULL;
+  filter_t *filters = NULL;
+  char filtered[64];
+  struct timespec next, now, flushed;
+  struct sigaction sa;
+  int64_t interval, late, missed;
+  int polling = 0;
+  int err = 0;
+
+  if (dopts->device_count < 1 || dopts->interval < 1)
+  {
+    ERROR("daemon requires at least one device and positive interval");
+    return -2;
+  }
+
+  if (dopts->filters.alpha > 0 || dopts->filters.average > 0 ||
+      dopts->filters.median > 0)
+  {
+    /* state of all filters is allocated once, updates do not allocate */
+    filters = calloc(dopts->device_count, sizeof(*filters));
+    if (filters == NULL)
+    {
+      perror("calloc");
+      return -2;
+    }
+    for (i = 0; i < dopts->device_count; i++)
+    {
+      if (filter_init(&filters[i], &dopts->filters))
+      {
+        ERROR("invalid filter parameters");
+        err = -2;
+        goto error;
+      }
+    }
+  }
+
+  /* open and configure all devices only once */
+  err = poller_open(&poller, opts, dopts->devices, dopts->device_count);
+  if (err)
+  {
+    err = err == -1 ? -1 : -2;
+    goto error;
+  }
+  polling = 1;
+  /* stop request ends cycle at once, other signals do not disturb it */
+  poller.cancel = &stop_requested;
+  if (dopts->uring && poller_use_uring(&poller))
+  {
+    WARNING("io_uring is not available, using epoll");
+  }
+
+  if (dopts->store != NULL)
+  {
+    if (store_open(&store_file, dopts->store, dopts->store_size,
+          dopts->devices, dopts->device_count))
+    {
+      ERROR("unable to open store %s", dopts->store);
+      err = -3;
+      goto error;
+    }
+    store = &store_file;
+  }
+
+  if (dopts->metrics != NULL)
+  {
+    metrics = metrics_open(dopts->metrics, dopts->devices,
+        dopts->device_count);
+    if (metrics == NULL)
+    {
+      ERROR("unable to serve metrics on %s", dopts->metrics);
+      err = -4;
+      goto error;
+    }
+  }
+
+  if (dopts->shm != NULL)
+  {
+    if (live_open(&live_area, dopts->shm, dopts->devices,
+          dopts->device_count))
+    {
+      ERROR("unable to publish readings in %s", dopts->shm);
+      err = -5;
+      goto error;
+    }
+    live = &live_area;
+  }
+
+  if (dopts->rollup != NULL)
+  {
+    if (rollup_open(&rollup_files, dopts->rollup, dopts->devices,
+          dopts->device_count))
+    {
+      ERROR("unable to open rollups %s", dopts->rollup);
+      err = -6;
+      goto error;
+    }
+    rollup = &rollup_files;
+  }
+
+  if (dopts->history != NULL)
+  {
+    if (history_open(&history_file, dopts->history, dopts->devices,
+          dopts->device_count))
+    {
+      ERROR("unable to open history %s", dopts->history);
+      err = -7;
+      goto error;
+    }
+    history = &history_file;
+  }
+
+  /* no SA_RESTART, so waiting is interrupted on stop request */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  dopts->cycles = dopts->skipped = dopts->failed = 0;
+  dopts->jitter_sum = dopts->jitter_max = 0;
+  interval = dopts->interval * NSEC_PER_MSEC;
+  timespec_now(&next);
+  flushed = next;
+  while (!stop_requested)
+  {
+    PROFILE_CHECK();
+    if (poller_cycle(&poller) < 0)
+    {
+      if (stop_requested)
+      {
+        break;
+      }
+      /* try again in the next slot instead of spinning */
+      ERROR("polling cycle failed");
+      dopts->failed += poller.count;
+    }
+    else
+    {
+      dopts->cycles++;
+      for (i = 0; i < poller.count; i++)
+      {
+        polldev_t *dev = &poller.devs[i];
+        if (dev->state != POLL_DONE)
+        {
+          dopts->failed++;
+          if (dopts->plain)
+          {
+            /* keep one line per sample, so lines still match cycles */
+            printf("error %d\n", dev->error);
+          }
+          continue;
+        }
+        filtered[0] = '\0';
+        if (filters != NULL)
+        {
+          filter_update(&filters[i], dev->gas_concentration);
+          filter_format(&filters[i], filtered, sizeof(filtered));
+        }
+        if (dopts->plain)
+        {
+          printf("%d%s\n", dev->gas_concentration, filtered);
+        }
+        else
+        {
+          printf("%s %d%s\n", dev->device, dev->gas_concentration, filtered);
+        }
+      }
+      if (store != NULL || live != NULL || rollup != NULL || history != NULL)
+      {
+        record_cycle(store, live, rollup, history, &poller);
+      }
+      for (i = 0; metrics != NULL && i < poller.count; i++)
+      {
+        metrics_publish(metrics, i, &poller.devs[i]);
+      }
+    }
+    if (dopts->count > 0 && dopts->cycles >= dopts->count)
+    {
+      break;
+    }
+
+    /* schedule on absolute time, so processing time does not add drift */
+    timespec_add_ns(&next, interval);
+    timespec_now(&now);
+    late = timespec_diff_ns(&now, &next);
+    if (late >= 0)
+    {
+      /* cycle overran, skip to first deadline still ahead to keep phase */
+      missed = late / interval + 1;
+      dopts->skipped += missed;
+      timespec_add_ns(&next, missed * interval);
+    }
+
+    /* batch output, but never hold it longer than flush interval */
+    if (timespec_diff_ns(&next, &flushed) >= FLUSH_INTERVAL * NSEC_PER_MSEC)
+    {
+      fflush(stdout);
+      flushed = next;
+    }
+
+    while (!stop_requested &&
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+    if (!stop_requested)
+    {
+      timespec_now(&now);
+      late = timespec_diff_ns(&now, &next);
+      dopts->jitter_sum += late;
+      if (late > dopts->jitter_max)
+      {
+        dopts->jitter_max = late;
+      }
+    }
+  }
+  fflush(stdout);
+  INFO("sampling finished, closing devices");
+
+error:
+  if (metrics != NULL)
+  {
+    metrics_close(metrics);
+  }
+  if (history != NULL)
+  {
+    history_close(history);
+  }
+  if (rollup != NULL)
+  {
+    rollup_close(rollup);
+  }
+  if (live != NULL)
+  {
+    live_close(live);
+  }
+  if (store != NULL)
+  {
+    store_close(store);
+  }
+  if (polling)
+  {
+    poller_close(&poller);
+  }
+  free(filters);
+  return err;
+}
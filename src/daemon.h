@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+#include "mh.h"
+#include "filter.h"
+
+typedef struct {
+  char **devices; /**< list of UART devices to be polled */
+  int device_count; /**< number of entries in devices */
+  int interval; /**< number of milliseconds between consecutive samples */
+  char *store; /**< filename of store for readings (NULL - do not store) */
+  uint64_t store_size; /**< number of records kept in store */
+  char *metrics; /**< filename of Unix socket serving metrics (NULL -
+                   *  disabled) */
+  char *shm; /**< name of shared memory object publishing latest readings
+               *  (NULL - disabled) */
+  char *rollup; /**< prefix of files with per-second, per-minute and hourly
+                  *  aggregates (NULL - disabled) */
+  char *history; /**< filename of compressed history of valid readings
+                   *  (NULL - disabled) */
+  int count; /**< number of cycles to perform (0 - until interrupted) */
+  int plain; /**< print concentration only, without device name */
+  filteropt_t filters; /**< smoothing filters printed after concentration */
+  int uring; /**< poll devices through io_uring instead of epoll, if
+               *  available */
+  int cycles; /**< output - number of cycles performed */
+  int failed; /**< output - number of readings that failed */
+  int skipped; /**< output - number of deadlines missed because cycle took
+                 *  longer than interval */
+  int64_t jitter_sum; /**< output - sum of wake-up delays after deadlines in
+                        *  ns */
+  int64_t jitter_max; /**< output - maximum wake-up delay in ns */
+} daemonopt_t;
+
+/**
+ * \brief Poll devices periodically until interrupted or count is reached
+ *
+ * Every device is opened and configured once, then gas concentration is read
+ * from all of them concurrently every interval using the same descriptors.
+ * Cycles are scheduled on absolute deadlines, so they do not drift. If cycle
+ * overruns, deadlines that already passed are skipped rather than executed
+ * back to back. Each successful reading is printed to stdout as device name
+ * followed by concentration (or concentration only in plain mode) and values
+ * of enabled filters of the device after that reading. In plain mode failed
+ * reading is printed as word error followed by its error code. Output is
+ * flushed in batches, at most once per second. If store is given, result of
+ * every transaction, including failed ones, is also appended to it. If metrics
+ * socket is given, counters of every device are published after each cycle.
+ * If shared memory object is given, result of every transaction becomes the
+ * latest sample of its device there. If rollup prefix is given, every
+ * transaction is also aggregated into periods of second, minute and hour,
+ * and each period is appended to file of its resolution once it ends. If
+ * history is given, valid readings are appended to it in compressed chunks.
+ *
+ * \param opts Serial parameters shared by all devices
+ * \param dopts List of devices and sampling parameters
+ *
+ * \return success indicator
+ * \retval 0 stopped by signal or after count cycles (failed readings are
+ * counted in dopts)
+ * \retval -1 device could not be opened
+ * \retval -2 invalid parameters
+ * \retval -3 store could not be opened
+ * \retval -4 metrics socket could not be created
+ * \retval -5 shared memory object could not be created
+ * \retval -6 rollup files could not be opened
+ * \retval -7 history could not be opened
+ */
+int run_daemon(mhopt_t *opts, daemonopt_t *dopts);
+
+#endif // DAEMON_H
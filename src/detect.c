@@ -0,0 +1,587 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "capture.h"
+#include "arbiter.h"
+#include "detect.h"
+
+#define MAX_EVENTS 64
+#define CACHE_LINE 512
+
+typedef struct {
+  int epfd; /**< epoll instance driving all devices */
+  const lineopt_t *candidates; /**< settings to try */
+  int count; /**< number of candidates */
+  int64_t timeout; /**< ns sensor may take to respond */
+  pkt_t request; /**< request sent at every setting */
+  int pending; /**< number of devices still being detected */
+  capture_t *capture; /**< capture recording traffic or NULL */
+} detector_t;
+
+static const char modeparities[] = {'N', 'E', 'O'};
+
+int detect_candidates(lineopt_t *candidates, int max)
+{
+  int order[speeds_count];
+  int i, d, s, p, n = 0, first = 0;
+  size_t j, k = 0;
+
+  for (j = 0; j < speeds_count; j++)
+  {
+    if (speeds[j].baudrate == 9600)
+    {
+      first = j;
+    }
+  }
+  /* 9600 bauds, then faster speeds, then slower ones down to 50 */
+  for (j = first; j < speeds_count; j++)
+  {
+    order[k++] = j;
+  }
+  for (i = first - 1; i >= 0; i--)
+  {
+    if (speeds[i].baudrate != 0)
+    {
+      order[k++] = i;
+    }
+  }
+
+  for (j = 0; j < k; j++)
+  {
+    for (d = 8; d >= 5; d--)
+    {
+      for (p = 0; p < sizeof(modeparities); p++)
+      {
+        for (s = 10; s <= 20; s += 10)
+        {
+          if (n == max)
+          {
+            return n;
+          }
+          candidates[n].baudrate = speeds[order[j]].baudrate;
+          candidates[n].databits = d;
+          candidates[n].parity = modeparities[p];
+          candidates[n].stopbits = s;
+          n++;
+        }
+      }
+    }
+  }
+
+  return n;
+}
+
+/**
+ * \brief Compute time needed to transfer given number of bytes in ns
+ */
+static int64_t wire_time(const lineopt_t *line, size_t bytes)
+{
+  int bits = 1 + line->databits + line->stopbits / 10;
+
+  if (toupper(line->parity) == 'E' || toupper(line->parity) == 'O')
+  {
+    bits++;
+  }
+  return (int64_t) bytes * bits * NSEC_PER_SEC / line->baudrate;
+}
+
+static int same_line(const lineopt_t *a, const lineopt_t *b)
+{
+  return a->baudrate == b->baudrate && a->databits == b->databits &&
+    toupper(a->parity) == toupper(b->parity) && a->stopbits == b->stopbits;
+}
+
+static int set_events(detector_t *det, detectdev_t *dev, uint32_t events)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = dev;
+  if (epoll_ctl(det->epfd, EPOLL_CTL_MOD, dev->fd, &ev) == -1)
+  {
+    ERROR("%s: epoll_ctl: %s", dev->device, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void finish(detector_t *det, detectdev_t *dev, detectstate_t state)
+{
+  struct timespec now;
+
+  timespec_now(&now);
+  dev->elapsed = timespec_diff_ns(&now, &dev->started);
+  dev->state = state;
+  det->pending--;
+  if (dev->fd >= 0 &&
+      epoll_ctl(det->epfd, EPOLL_CTL_DEL, dev->fd, NULL) == -1)
+  {
+    /* finished device must not be woken up by hangup of its line */
+    ERROR("%s: epoll_ctl: %s", dev->device, strerror(errno));
+  }
+}
+
+static void do_write(detector_t *det, detectdev_t *dev);
+
+/**
+ * \brief Switch device to next setting and send request
+ */
+static void next_try(detector_t *det, detectdev_t *dev)
+{
+  while (1)
+  {
+    if (dev->next < 0)
+    {
+      dev->line = dev->cached;
+      dev->next = 0;
+    }
+    else if (dev->next < det->count)
+    {
+      dev->line = det->candidates[dev->next++];
+      if (dev->has_cached && same_line(&dev->line, &dev->cached))
+      {
+        /* already tried */
+        continue;
+      }
+    }
+    else
+    {
+      ERROR("%s: no setting works", dev->device);
+      finish(det, dev, DETECT_FAILED);
+      return;
+    }
+
+    /* leftovers of previous setting would only confuse parser */
+    tcflush(dev->fd, TCIOFLUSH);
+    if (termios_params(dev->fd, dev->line.baudrate, DIR_BOTH,
+          dev->line.databits, dev->line.parity, dev->line.stopbits) == 0)
+    {
+      break;
+    }
+    DEBUG("%s: unable to set %d %d%c%d", dev->device, dev->line.baudrate,
+        dev->line.databits, dev->line.parity, dev->line.stopbits / 10);
+  }
+
+  DEBUG("%s: trying %d %d%c%d", dev->device, dev->line.baudrate,
+      dev->line.databits, dev->line.parity, dev->line.stopbits / 10);
+  dev->tries++;
+  dev->state = DETECT_WRITING;
+  dev->written = 0;
+  frame_parser_init(&dev->parser, CMD_GAS_CONCENTRATION);
+  timespec_now(&dev->deadline);
+  timespec_add_ns(&dev->deadline,
+      wire_time(&dev->line, sizeof(pkt_t)) + det->timeout);
+  do_write(det, dev);
+}
+
+static void do_write(detector_t *det, detectdev_t *dev)
+{
+  ssize_t processed;
+
+  while (dev->written < sizeof(det->request))
+  {
+    processed = write(dev->fd, (uint8_t*) &det->request + dev->written,
+        sizeof(det->request) - dev->written);
+    if (processed == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        set_events(det, dev, EPOLLOUT);
+        return;
+      }
+      ERROR("%s: write: %s", dev->device, strerror(errno));
+      finish(det, dev, DETECT_FAILED);
+      return;
+    }
+    if (det->capture != NULL)
+    {
+      capture_io(det->capture, dev->fd, CAPTURE_TX,
+          (uint8_t*) &det->request + dev->written, processed);
+    }
+    dev->written += processed;
+  }
+
+  dev->state = DETECT_READING;
+  set_events(det, dev, EPOLLIN);
+}
+
+static void do_read(detector_t *det, detectdev_t *dev)
+{
+  uint8_t buf[FRAME_BUFFER_SIZE];
+  ssize_t processed;
+  struct timespec until;
+  pkt_t response;
+  uint16_t result;
+
+  while (!frame_parser_next(&dev->parser, &response))
+  {
+    processed = read(dev->fd, buf, frame_parser_space(&dev->parser));
+    if (processed == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        return;
+      }
+      ERROR("%s: read: %s", dev->device, strerror(errno));
+      finish(det, dev, DETECT_FAILED);
+      return;
+    }
+    if (processed == 0)
+    {
+      return;
+    }
+    if (det->capture != NULL)
+    {
+      capture_io(det->capture, dev->fd, CAPTURE_RX, buf, processed);
+    }
+    frame_parser_feed(&dev->parser, buf, processed);
+
+    /* something answers, give rest of frame time to arrive */
+    timespec_now(&until);
+    timespec_add_ns(&until, wire_time(&dev->line,
+          frame_parser_missing(&dev->parser)) + det->timeout);
+    if (timespec_diff_ns(&until, &dev->deadline) > 0)
+    {
+      dev->deadline = until;
+    }
+  }
+
+  result = return_gas_concentration(response);
+  if (result == (uint16_t)-1)
+  {
+    DEBUG("%s: invalid response at %d %d%c%d", dev->device,
+        dev->line.baudrate, dev->line.databits, dev->line.parity,
+        dev->line.stopbits / 10);
+    next_try(det, dev);
+    return;
+  }
+  dev->gas_concentration = result;
+  finish(det, dev, DETECT_FOUND);
+}
+
+/**
+ * \brief Compute epoll timeout until earliest deadline of pending devices
+ */
+static int next_timeout(detector_t *det, detectdev_t *devs, int count)
+{
+  struct timespec now;
+  int64_t ns, min_ns = -1;
+  int i;
+
+  timespec_now(&now);
+  for (i = 0; i < count; i++)
+  {
+    if (devs[i].state != DETECT_WRITING && devs[i].state != DETECT_READING)
+    {
+      continue;
+    }
+    ns = timespec_diff_ns(&devs[i].deadline, &now);
+    if (ns < 0)
+    {
+      ns = 0;
+    }
+    if (min_ns < 0 || ns < min_ns)
+    {
+      min_ns = ns;
+    }
+  }
+
+  if (min_ns < 0)
+  {
+    return -1;
+  }
+  return (min_ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+static void expire(detector_t *det, detectdev_t *devs, int count)
+{
+  struct timespec now;
+  int i;
+
+  timespec_now(&now);
+  for (i = 0; i < count; i++)
+  {
+    detectdev_t *dev = &devs[i];
+    if ((dev->state != DETECT_WRITING && dev->state != DETECT_READING) ||
+        timespec_diff_ns(&dev->deadline, &now) > 0)
+    {
+      continue;
+    }
+    next_try(det, dev);
+  }
+}
+
+int detect_run(detectdev_t *devs, int count, const lineopt_t *candidates,
+    int ncandidates, int64_t timeout, int64_t lock_wait, capture_t *capture)
+{
+  struct epoll_event ev, events[MAX_EVENTS];
+  detector_t det;
+  int i, n, found = 0, result = 0;
+
+  memset(&det, 0, sizeof(det));
+  det.candidates = candidates;
+  det.count = ncandidates;
+  det.timeout = timeout * NSEC_PER_USEC;
+  det.capture = capture;
+  det.request = init_read_gas_packet();
+  det.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (det.epfd == -1)
+  {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  det.pending = count;
+  for (i = 0; i < count; i++)
+  {
+    detectdev_t *dev = &devs[i];
+    dev->next = dev->has_cached ? -1 : 0;
+    dev->tries = 0;
+    timespec_now(&dev->started);
+    /* another process may be talking to the sensor right now */
+    dev->fd = arb_open(dev->device, O_RDWR | O_NOCTTY | O_NDELAY | O_CLOEXEC,
+        lock_wait);
+    if (dev->fd < 0)
+    {
+      dev->fd = -1;
+      ERROR("unable to open %s", dev->device);
+      finish(&det, dev, DETECT_FAILED);
+      continue;
+    }
+    if (det.capture != NULL)
+    {
+      capture_device(det.capture, dev->fd, dev->device);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = dev;
+    if (epoll_ctl(det.epfd, EPOLL_CTL_ADD, dev->fd, &ev) == -1)
+    {
+      perror("epoll_ctl");
+      close(dev->fd);
+      dev->fd = -1;
+      finish(&det, dev, DETECT_FAILED);
+      continue;
+    }
+    next_try(&det, dev);
+  }
+
+  while (det.pending > 0)
+  {
+    n = epoll_wait(det.epfd, events, MAX_EVENTS,
+        next_timeout(&det, devs, count));
+    if (n == -1)
+    {
+      if (errno != EINTR)
+      {
+        ERROR("epoll_wait: %s", strerror(errno));
+      }
+      result = -1;
+      break;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      detectdev_t *dev = events[i].data.ptr;
+      if (dev->state != DETECT_WRITING && dev->state != DETECT_READING)
+      {
+        continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        ERROR("%s: error condition on device", dev->device);
+        finish(&det, dev, DETECT_FAILED);
+      }
+      else if (dev->state == DETECT_WRITING && (events[i].events & EPOLLOUT))
+      {
+        do_write(&det, dev);
+      }
+      else if (dev->state == DETECT_READING && (events[i].events & EPOLLIN))
+      {
+        do_read(&det, dev);
+      }
+    }
+
+    expire(&det, devs, count);
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    if (devs[i].fd >= 0)
+    {
+      close(devs[i].fd);
+      devs[i].fd = -1;
+    }
+    found += devs[i].state == DETECT_FOUND;
+  }
+  close(det.epfd);
+
+  return result ? result : found;
+}
+
+const char *detect_cache_default()
+{
+  static char path[CACHE_LINE];
+  const char *dir;
+
+  if ((dir = getenv("XDG_CACHE_HOME")) != NULL && dir[0] != '\0')
+  {
+    snprintf(path, sizeof(path), "%s/mhz14a-detect", dir);
+  }
+  else if ((dir = getenv("HOME")) != NULL && dir[0] != '\0')
+  {
+    snprintf(path, sizeof(path), "%s/.cache/mhz14a-detect", dir);
+  }
+  else
+  {
+    return NULL;
+  }
+  return path;
+}
+
+/**
+ * \brief Parse single cache entry in form of "DEVICE BAUD DPS"
+ *
+ * \return 0 on success or -1 if line is malformed
+ */
+static int parse_entry(char *line, char **device, lineopt_t *opts)
+{
+  char *baud, *mode;
+
+  *device = strtok(line, " \t\n");
+  baud = strtok(NULL, " \t\n");
+  mode = strtok(NULL, " \t\n");
+  if (*device == NULL || baud == NULL || mode == NULL || strlen(mode) != 3 ||
+      !isdigit(mode[0]) || !isalpha(mode[1]) || !isdigit(mode[2]))
+  {
+    return -1;
+  }
+  opts->baudrate = atol(baud);
+  opts->databits = mode[0] - '0';
+  opts->parity = mode[1];
+  opts->stopbits = (mode[2] - '0') * 10;
+  return opts->baudrate > 0 ? 0 : -1;
+}
+
+int detect_cache_load(const char *path, detectdev_t *devs, int count)
+{
+  char line[CACHE_LINE];
+  char *device;
+  lineopt_t opts;
+  FILE *fp;
+  int i, found = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      return 0;
+    }
+    perror("fopen");
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    if (parse_entry(line, &device, &opts))
+    {
+      continue;
+    }
+    for (i = 0; i < count; i++)
+    {
+      if (strcmp(devs[i].device, device) == 0 && !devs[i].has_cached)
+      {
+        devs[i].cached = opts;
+        devs[i].has_cached = 1;
+        found++;
+      }
+    }
+  }
+  fclose(fp);
+
+  return found;
+}
+
+int detect_cache_store(const char *path, detectdev_t *devs, int count)
+{
+  char tmp[CACHE_LINE], line[CACHE_LINE], entry[CACHE_LINE];
+  char *device;
+  lineopt_t opts;
+  FILE *in, *out;
+  int i, known;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  out = fopen(tmp, "w");
+  if (out == NULL)
+  {
+    perror("fopen");
+    return -1;
+  }
+
+  /* keep entries of devices not detected this time */
+  in = fopen(path, "r");
+  while (in != NULL && fgets(line, sizeof(line), in) != NULL)
+  {
+    memcpy(entry, line, sizeof(entry));
+    if (parse_entry(line, &device, &opts))
+    {
+      continue;
+    }
+    for (known = 0, i = 0; i < count && !known; i++)
+    {
+      known = strcmp(devs[i].device, device) == 0;
+    }
+    if (!known)
+    {
+      fputs(entry, out);
+    }
+  }
+  if (in != NULL)
+  {
+    fclose(in);
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    if (devs[i].state == DETECT_FOUND)
+    {
+      fprintf(out, "%s %d %d%c%d\n", devs[i].device, devs[i].line.baudrate,
+          devs[i].line.databits, devs[i].line.parity,
+          devs[i].line.stopbits / 10);
+    }
+  }
+
+  if (fclose(out) || rename(tmp, path))
+  {
+    perror("rename");
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mh.h"
+
+#define DETECT_DEFAULT_TIMEOUT 20000 /**< microseconds sensor may take to
+                                       *  respond at single setting */
+
+typedef struct {
+  int baudrate; /**< baudrate */
+  uint8_t databits; /**< number of data bits */
+  char parity; /**< parity as single character */
+  uint8_t stopbits; /**< number of stop bits x10 */
+} lineopt_t;
+
+typedef enum {
+  DETECT_WRITING = 0, /**< request is being written at current setting */
+  DETECT_READING, /**< waiting for response at current setting */
+  DETECT_FOUND, /**< valid response received */
+  DETECT_FAILED, /**< no setting worked or device could not be used */
+} detectstate_t;
+
+typedef struct {
+  char *device; /**< filename of UART device */
+  int has_cached; /**< non-zero if cached settings are to be tried first */
+  lineopt_t cached; /**< settings that worked last time */
+  int fd; /**< descriptor of opened device */
+  detectstate_t state; /**< state of detection */
+  int next; /**< index of next candidate to try (-1 - cached settings) */
+  size_t written; /**< number of request bytes already written */
+  frame_parser_t parser; /**< receive buffer resynchronizing on frames */
+  struct timespec started; /**< start of detection */
+  struct timespec deadline; /**< end of try at current setting */
+  lineopt_t line; /**< output - detected settings, if found */
+  int tries; /**< output - number of settings tried */
+  uint16_t gas_concentration; /**< output - concentration read at detection */
+  int64_t elapsed; /**< output - duration of detection in ns */
+} detectdev_t;
+
+/**
+ * \brief Build list of settings to try, ordered from the most likely one
+ *
+ * Every baudrate from speeds table is combined with 5 to 8 data bits, no, even
+ * or odd parity and 1 or 2 stop bits. 9600 bauds come first, followed by
+ * higher and then lower speeds, so that slow settings with long frame times
+ * are tried last. For every speed 8N1 is tried first.
+ *
+ * \param candidates Output array
+ * \param max Capacity of output array
+ *
+ * \return number of candidates stored
+ */
+int detect_candidates(lineopt_t *candidates, int max);
+
+/**
+ * \brief Find settings at which sensors respond, probing devices concurrently
+ *
+ * At every setting request for gas concentration is sent and the first valid
+ * response ends detection of the device. Each try lasts as long as transfer
+ * of request takes at given setting plus timeout, extended when response
+ * starts to arrive. Cached settings, if any, are tried before candidates.
+ *
+ * \param devs Devices with device and cached settings filled in
+ * \param count Number of devices
+ * \param candidates Settings to try in order
+ * \param ncandidates Number of candidates
+ * \param timeout Microseconds sensor may take to respond at single setting
+ * \param lock_wait Microseconds to wait for other users of device, as in
+ * \link arb_open \endlink
+ * \param capture Capture recording traffic of devices (NULL - not captured)
+ *
+ * \return number of devices for which settings were found or -1 on internal
+ * error
+ */
+int detect_run(detectdev_t *devs, int count, const lineopt_t *candidates,
+    int ncandidates, int64_t timeout, int64_t lock_wait, capture_t *capture);
+
+/**
+ * \brief Get default location of detection cache
+ *
+ * \return filename under $XDG_CACHE_HOME or ~/.cache, or NULL if neither is
+ * known
+ */
+const char *detect_cache_default();
+
+/**
+ * \brief Fill cached settings of devices from cache file
+ *
+ * \param path Filename of cache
+ * \param devs Devices to be looked up
+ * \param count Number of devices
+ *
+ * \return number of devices found in cache (0 if cache does not exist) or -1
+ * on error
+ */
+int detect_cache_load(const char *path, detectdev_t *devs, int count);
+
+/**
+ * \brief Store results of detection in cache file
+ *
+ * Entries of other devices are preserved, entries of devices which were not
+ * detected are removed. File is replaced atomically.
+ *
+ * \param path Filename of cache
+ * \param devs Devices after \link detect_run \endlink
+ * \param count Number of devices
+ *
+ * \return 0 on success or -1 on error
+ */
+int detect_cache_store(const char *path, detectdev_t *devs, int count);
+
+#endif // DETECT_H
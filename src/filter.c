@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+
+/* heap position i of median m */
+#define HEAP(m, i) ((m)->heap[(i) + (m)->window / 2])
+
+static int max_count(const median_t *median)
+{
+  return median->count / 2;
+}
+
+static int min_count(const median_t *median)
+{
+  return (median->count - 1) / 2;
+}
+
+static int less(const median_t *median, int i, int j)
+{
+  return median->values[HEAP(median, i)] < median->values[HEAP(median, j)];
+}
+
+/**
+ * \brief Swap samples at heap positions i and j if the one at i is smaller
+ *
+ * \return non-zero if samples were swapped
+ */
+static int exchange(median_t *median, int i, int j)
+{
+  int16_t t;
+
+  if (!less(median, i, j))
+  {
+    return 0;
+  }
+  t = HEAP(median, i);
+  HEAP(median, i) = HEAP(median, j);
+  HEAP(median, j) = t;
+  median->pos[HEAP(median, i)] = i;
+  median->pos[HEAP(median, j)] = j;
+  return 1;
+}
+
+static void min_sort_down(median_t *median, int i)
+{
+  for (i *= 2; i <= min_count(median); i *= 2)
+  {
+    if (i < min_count(median) && less(median, i + 1, i))
+    {
+      i++;
+    }
+    if (!exchange(median, i, i / 2))
+    {
+      break;
+    }
+  }
+}
+
+static void max_sort_down(median_t *median, int i)
+{
+  for (i *= 2; i >= -max_count(median); i *= 2)
+  {
+    if (i > -max_count(median) && less(median, i, i - 1))
+    {
+      i--;
+    }
+    if (!exchange(median, i / 2, i))
+    {
+      break;
+    }
+  }
+}
+
+/**
+ * \return non-zero if sample reached the median
+ */
+static int min_sort_up(median_t *median, int i)
+{
+  while (i > 0 && exchange(median, i, i / 2))
+  {
+    i /= 2;
+  }
+  return i == 0;
+}
+
+/**
+ * \return non-zero if sample reached the median
+ */
+static int max_sort_up(median_t *median, int i)
+{
+  while (i < 0 && exchange(median, i / 2, i))
+  {
+    i /= 2;
+  }
+  return i == 0;
+}
+
+/**
+ * \brief Move median to lower half if top of lower half is greater
+ */
+static void fix_lower(median_t *median)
+{
+  if (max_count(median) && max_sort_up(median, -1))
+  {
+    max_sort_down(median, -1);
+  }
+}
+
+/**
+ * \brief Move median to upper half if top of upper half is smaller
+ */
+static void fix_upper(median_t *median)
+{
+  if (min_count(median) && min_sort_up(median, 1))
+  {
+    min_sort_down(median, 1);
+  }
+}
+
+static void median_init(median_t *median, int window)
+{
+  int i;
+
+  memset(median, 0, sizeof(*median));
+  median->window = window;
+  /* samples are laid out alternately around the median */
+  for (i = 0; i < window; i++)
+  {
+    median->pos[i] = ((i + 1) / 2) * ((i & 1) ? -1 : 1);
+    HEAP(median, median->pos[i]) = i;
+  }
+}
+
+static void median_insert(median_t *median, uint16_t value)
+{
+  int fresh = median->count < median->window;
+  int p = median->pos[median->next];
+  uint16_t old = median->values[median->next];
+
+  median->values[median->next] = value;
+  median->next = (median->next + 1) % median->window;
+  median->count += fresh;
+
+  if (p > 0)
+  {
+    /* sample in upper half */
+    if (!fresh && old < value)
+    {
+      min_sort_down(median, p);
+    }
+    else if (min_sort_up(median, p))
+    {
+      fix_lower(median);
+    }
+  }
+  else if (p < 0)
+  {
+    /* sample in lower half */
+    if (!fresh && value < old)
+    {
+      max_sort_down(median, p);
+    }
+    else if (max_sort_up(median, p))
+    {
+      fix_upper(median);
+    }
+  }
+  else
+  {
+    /* median itself replaced, it may belong to either half now */
+    fix_lower(median);
+    fix_upper(median);
+  }
+}
+
+int filter_init(filter_t *filter, const filteropt_t *opts)
+{
+  if (opts->alpha < 0 || opts->alpha > 1 ||
+      opts->average < 0 || opts->average > FILTER_MAX_WINDOW ||
+      opts->median < 0 || opts->median > FILTER_MAX_WINDOW)
+  {
+    return -1;
+  }
+
+  memset(filter, 0, sizeof(*filter));
+  filter->opts = *opts;
+  if (opts->median > 0)
+  {
+    median_init(&filter->median, opts->median);
+  }
+  return 0;
+}
+
+void filter_update(filter_t *filter, uint16_t ppm)
+{
+  const filteropt_t *opts = &filter->opts;
+
+  if (opts->alpha > 0)
+  {
+    filter->ewma = filter->samples == 0 ? ppm :
+      filter->ewma + opts->alpha * (ppm - filter->ewma);
+  }
+
+  if (opts->average > 0)
+  {
+    /* running sum, sample leaving window is subtracted */
+    filter->sum += ppm - filter->ring[filter->next];
+    filter->ring[filter->next] = ppm;
+    filter->next = (filter->next + 1) % opts->average;
+  }
+
+  if (opts->median > 0)
+  {
+    median_insert(&filter->median, ppm);
+  }
+
+  filter->samples++;
+}
+
+double filter_ewma(const filter_t *filter)
+{
+  return filter->ewma;
+}
+
+double filter_average(const filter_t *filter)
+{
+  uint64_t count = filter->samples;
+
+  if (count == 0 || filter->opts.average == 0)
+  {
+    return 0;
+  }
+  if (count > (uint64_t) filter->opts.average)
+  {
+    count = filter->opts.average;
+  }
+  return (double) filter->sum / count;
+}
+
+double filter_median(const filter_t *filter)
+{
+  const median_t *median = &filter->median;
+  double value;
+
+  if (median->count == 0)
+  {
+    return 0;
+  }
+  value = median->values[HEAP(median, 0)];
+  if (median->count % 2 == 0)
+  {
+    /* lower middle value is top of lower half */
+    value = (value + median->values[HEAP(median, -1)]) / 2;
+  }
+  return value;
+}
+
+int filter_format(const filter_t *filter, char *buf, size_t size)
+{
+  const filteropt_t *opts = &filter->opts;
+  int len = 0;
+
+  buf[0] = '\0';
+  if (opts->alpha > 0)
+  {
+    len += snprintf(buf + len, size - len, " %.1f", filter_ewma(filter));
+  }
+  if (opts->average > 0 && (size_t) len < size)
+  {
+    len += snprintf(buf + len, size - len, " %.1f", filter_average(filter));
+  }
+  if (opts->median > 0 && (size_t) len < size)
+  {
+    len += snprintf(buf + len, size - len, " %.1f", filter_median(filter));
+  }
+  return len;
+}
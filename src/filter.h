@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILTER_MAX_WINDOW 256 /**< largest window of average and median */
+
+/**
+ * \brief Filters to be applied, every one can be disabled by zero
+ */
+typedef struct {
+  double alpha; /**< weight of new sample in exponentially weighted moving
+                  *  average, between 0 and 1 (0 - disabled) */
+  int average; /**< number of samples in moving average (0 - disabled) */
+  int median; /**< number of samples in running median (0 - disabled) */
+} filteropt_t;
+
+/**
+ * \brief Sliding window median kept as two heaps around the median
+ *
+ * Position 0 of heap is the median, negative positions form max-heap of
+ * lower half and positive ones min-heap of upper half. Every sample of window
+ * keeps its heap position, so the oldest one is replaced in place and moved
+ * up or down in O(log w).
+ */
+typedef struct {
+  uint16_t values[FILTER_MAX_WINDOW]; /**< samples in order of arrival */
+  int16_t pos[FILTER_MAX_WINDOW]; /**< heap position of every sample */
+  int16_t heap[FILTER_MAX_WINDOW]; /**< sample indexes, shifted by half of
+                                     *  window */
+  int window; /**< number of samples in window */
+  int next; /**< index of sample to be replaced next */
+  int count; /**< number of samples in window so far */
+} median_t;
+
+/**
+ * \brief State of all filters of single device
+ */
+typedef struct {
+  filteropt_t opts; /**< configuration of filters */
+  double ewma; /**< current exponentially weighted moving average */
+  uint16_t ring[FILTER_MAX_WINDOW]; /**< last samples of moving average */
+  int64_t sum; /**< sum of samples in ring */
+  int next; /**< index of ring to be overwritten next */
+  uint64_t samples; /**< number of samples seen */
+  median_t median; /**< running median */
+} filter_t;
+
+/**
+ * \brief Check filter options and reset filter state
+ *
+ * \param filter Filter to initialize
+ * \param opts Filters to be applied
+ *
+ * \return 0 on success, -1 on invalid options
+ */
+int filter_init(filter_t *filter, const filteropt_t *opts);
+
+/**
+ * \brief Feed new sample to all enabled filters
+ *
+ * \param filter Initialized filter
+ * \param ppm Gas concentration
+ */
+void filter_update(filter_t *filter, uint16_t ppm);
+
+/**
+ * \brief Get exponentially weighted moving average of samples so far
+ *
+ * \return average or 0 if no sample has been seen
+ */
+double filter_ewma(const filter_t *filter);
+
+/**
+ * \brief Get mean of last samples, up to average window
+ *
+ * \return average or 0 if no sample has been seen
+ */
+double filter_average(const filter_t *filter);
+
+/**
+ * \brief Get median of last samples, up to median window
+ *
+ * With even number of samples mean of both middle values is returned.
+ *
+ * \return median or 0 if no sample has been seen
+ */
+double filter_median(const filter_t *filter);
+
+/**
+ * \brief Format values of enabled filters, in order: EWMA, average, median
+ *
+ * \param filter Filter
+ * \param buf Output buffer, each value is preceded by space
+ * \param size Size of buffer
+ *
+ * \return number of characters written, as snprintf()
+ */
+int filter_format(const filter_t *filter, char *buf, size_t size);
+
+#endif // FILTER_H
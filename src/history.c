@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "logger.h"
+#include "history.h"
+
+#define HISTORY_MAGIC "MHZ14AHI"
+#define HISTORY_VERSION 1
+#define HISTORY_CHUNK_MAGIC 0x4b4e4843 /**< "CHNK" */
+#define HISTORY_NAME_SIZE 64 /**< size of single entry of device table */
+#define MAX_VARINT 10 /**< longest encoding of 64-bit value */
+
+struct history_header {
+  char magic[8]; /**< HISTORY_MAGIC */
+  uint32_t version; /**< HISTORY_VERSION */
+  uint32_t chunk_size; /**< size of chunk header */
+  uint32_t devices; /**< number of entries in device table */
+  uint32_t reserved;
+  uint64_t data_offset; /**< offset of first chunk from start of file */
+};
+
+static uint64_t data_offset(uint32_t devices)
+{
+  return sizeof(struct history_header) + (uint64_t)devices * HISTORY_NAME_SIZE;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t) value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static size_t put_varint(uint8_t *buf, uint64_t value)
+{
+  size_t len = 0;
+
+  while (value >= 0x80)
+  {
+    buf[len++] = value | 0x80;
+    value >>= 7;
+  }
+  buf[len++] = value;
+  return len;
+}
+
+/**
+ * \return 0 on success, -1 if value is truncated or too long
+ */
+static int get_varint(const uint8_t *buf, size_t size, size_t *pos,
+    uint64_t *value)
+{
+  unsigned shift = 0;
+
+  *value = 0;
+  while (*pos < size && shift < 64)
+  {
+    *value |= (uint64_t)(buf[*pos] & 0x7f) << shift;
+    if ((buf[(*pos)++] & 0x80) == 0)
+    {
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+static int valid_chunk(const history_t *history, const history_chunk_t *chunk)
+{
+  return chunk->magic == HISTORY_CHUNK_MAGIC &&
+    chunk->device < history->devices &&
+    chunk->count > 0 && chunk->count <= HISTORY_CHUNK_SAMPLES &&
+    chunk->time_size <= HISTORY_COLUMN_SIZE &&
+    chunk->ppm_size <= HISTORY_COLUMN_SIZE &&
+    chunk->first <= chunk->last && chunk->min <= chunk->max;
+}
+
+static void free_names(history_t *history)
+{
+  uint32_t i;
+
+  for (i = 0; history->names != NULL && i < history->devices; i++)
+  {
+    free(history->names[i]);
+  }
+  free(history->names);
+  history->names = NULL;
+}
+
+static int copy_names(history_t *history, char **devices, uint32_t count)
+{
+  uint32_t i;
+
+  history->names = calloc(count, sizeof(*history->names));
+  if (history->names == NULL)
+  {
+    return -1;
+  }
+  history->devices = count;
+  for (i = 0; i < count; i++)
+  {
+    history->names[i] = strndup(devices[i], HISTORY_NAME_SIZE - 1);
+    if (history->names[i] == NULL)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int read_header(history_t *history)
+{
+  struct history_header hdr;
+  char name[HISTORY_NAME_SIZE];
+  uint32_t i;
+
+  if (pread(history->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      memcmp(hdr.magic, HISTORY_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.version != HISTORY_VERSION ||
+      hdr.chunk_size != sizeof(history_chunk_t) ||
+      hdr.devices == 0 || hdr.data_offset != data_offset(hdr.devices))
+  {
+    return -2;
+  }
+
+  history->names = calloc(hdr.devices, sizeof(*history->names));
+  if (history->names == NULL)
+  {
+    return -1;
+  }
+  history->devices = hdr.devices;
+  for (i = 0; i < hdr.devices; i++)
+  {
+    if (pread(history->fd, name, sizeof(name),
+          sizeof(hdr) + (uint64_t) i * HISTORY_NAME_SIZE) != sizeof(name))
+    {
+      return -2;
+    }
+    name[sizeof(name) - 1] = '\0';
+    history->names[i] = strdup(name);
+    if (history->names[i] == NULL)
+    {
+      return -1;
+    }
+  }
+  history->data_offset = hdr.data_offset;
+  history->offset = hdr.data_offset;
+  return 0;
+}
+
+static int write_header(history_t *history)
+{
+  struct history_header hdr;
+  char name[HISTORY_NAME_SIZE];
+  uint32_t i;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, HISTORY_MAGIC, sizeof(hdr.magic));
+  hdr.version = HISTORY_VERSION;
+  hdr.chunk_size = sizeof(history_chunk_t);
+  hdr.devices = history->devices;
+  hdr.data_offset = data_offset(history->devices);
+  if (pwrite(history->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+  {
+    perror("pwrite");
+    return -1;
+  }
+  for (i = 0; i < history->devices; i++)
+  {
+    memset(name, 0, sizeof(name));
+    strncpy(name, history->names[i], sizeof(name) - 1);
+    if (pwrite(history->fd, name, sizeof(name),
+          sizeof(hdr) + (uint64_t) i * HISTORY_NAME_SIZE) != sizeof(name))
+    {
+      perror("pwrite");
+      return -1;
+    }
+  }
+  history->data_offset = hdr.data_offset;
+  history->offset = hdr.data_offset;
+  return 0;
+}
+
+int history_open(history_t *history, const char *path, char **devices,
+    int count)
+{
+  history_chunk_t chunk;
+  struct stat st;
+  uint64_t end;
+  int i, err;
+
+  memset(history, 0, sizeof(*history));
+  history->fd = -1;
+  if (count < 1)
+  {
+    return -2;
+  }
+
+  history->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (history->fd == -1)
+  {
+    perror("open");
+    return -1;
+  }
+  if (fstat(history->fd, &st) == -1)
+  {
+    perror("fstat");
+    history_close(history);
+    return -1;
+  }
+
+  if (st.st_size == 0)
+  {
+    if (copy_names(history, devices, count) || write_header(history))
+    {
+      history_close(history);
+      return -1;
+    }
+  }
+  else
+  {
+    if ((err = read_header(history)) != 0 ||
+        history->devices != (uint32_t) count)
+    {
+      ERROR("%s: not a compatible history", path);
+      history_close(history);
+      return err ? err : -2;
+    }
+    /* chunks refer to devices by index, so they must keep their order */
+    for (i = 0; i < count; i++)
+    {
+      if (strncmp(history->names[i], devices[i], HISTORY_NAME_SIZE - 1) != 0)
+      {
+        ERROR("%s: device %d is %s in history, not %s", path, i,
+            history->names[i], devices[i]);
+        history_close(history);
+        return -2;
+      }
+    }
+    /* find end of last complete chunk */
+    while (history_next_chunk(history, &chunk) == 1);
+    end = history->offset;
+    if ((uint64_t) st.st_size > end)
+    {
+      WARNING("%s: dropping incomplete chunk at the end", path);
+      if (ftruncate(history->fd, end) == -1)
+      {
+        perror("ftruncate");
+        history_close(history);
+        return -1;
+      }
+    }
+    history->offset = end;
+  }
+
+  /* builders of all devices are allocated once */
+  history->open = calloc(count, sizeof(*history->open));
+  if (history->open == NULL)
+  {
+    perror("calloc");
+    history_close(history);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int write_chunk(history_t *history, history_builder_t *builder)
+{
+  history_chunk_t *chunk = &builder->header;
+  struct iovec iov[3];
+  size_t size;
+  ssize_t written;
+
+  chunk->magic = HISTORY_CHUNK_MAGIC;
+  iov[0].iov_base = chunk;
+  iov[0].iov_len = sizeof(*chunk);
+  iov[1].iov_base = builder->times;
+  iov[1].iov_len = chunk->time_size;
+  iov[2].iov_base = builder->ppms;
+  iov[2].iov_len = chunk->ppm_size;
+  size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+  /* whole chunk with its header in single write */
+  written = pwritev(history->fd, iov, 3, history->offset);
+  chunk->count = 0;
+  if (written != (ssize_t) size)
+  {
+    if (written == -1)
+    {
+      perror("pwritev");
+    }
+    ERROR("unable to write history chunk");
+    return -1;
+  }
+  history->offset += size;
+  return 0;
+}
+
+int history_append(history_t *history, uint32_t device, int64_t wall,
+    uint16_t ppm)
+{
+  history_builder_t *builder;
+  history_chunk_t *chunk;
+  int64_t delta;
+  int err = 0;
+
+  if (history->open == NULL || device >= history->devices)
+  {
+    return -1;
+  }
+  builder = &history->open[device];
+  chunk = &builder->header;
+
+  if (chunk->count > 0)
+  {
+    if (wall < chunk->last)
+    {
+      wall = chunk->last;
+    }
+    if (chunk->count >= HISTORY_CHUNK_SAMPLES ||
+        wall - chunk->first > HISTORY_CHUNK_SPAN ||
+        chunk->time_size + MAX_VARINT > HISTORY_COLUMN_SIZE ||
+        chunk->ppm_size + MAX_VARINT > HISTORY_COLUMN_SIZE)
+    {
+      err = write_chunk(history, builder);
+    }
+  }
+
+  if (chunk->count == 0)
+  {
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->device = device;
+    chunk->first = chunk->last = wall;
+    chunk->min = chunk->max = ppm;
+    builder->delta = 0;
+    builder->ppm = 0;
+  }
+
+  /* regular sampling gives delta-of-delta close to zero */
+  delta = wall - chunk->last;
+  chunk->time_size += put_varint(builder->times + chunk->time_size,
+      zigzag(delta - builder->delta));
+  builder->delta = delta;
+  chunk->last = wall;
+
+  /* concentration changes slowly, so deltas are small */
+  chunk->ppm_size += put_varint(builder->ppms + chunk->ppm_size,
+      zigzag((int64_t) ppm - builder->ppm));
+  builder->ppm = ppm;
+  if (ppm < chunk->min)
+  {
+    chunk->min = ppm;
+  }
+  if (ppm > chunk->max)
+  {
+    chunk->max = ppm;
+  }
+  chunk->count++;
+
+  return err;
+}
+
+int history_flush(history_t *history)
+{
+  uint32_t i;
+  int err = 0;
+
+  for (i = 0; history->open != NULL && i < history->devices; i++)
+  {
+    if (history->open[i].header.count > 0 &&
+        write_chunk(history, &history->open[i]))
+    {
+      err = -1;
+    }
+  }
+  return err;
+}
+
+int history_open_reader(history_t *history, const char *path)
+{
+  int err;
+
+  memset(history, 0, sizeof(*history));
+  history->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (history->fd == -1)
+  {
+    perror("open");
+    return -1;
+  }
+  if ((err = read_header(history)) != 0)
+  {
+    history_close(history);
+    return err;
+  }
+  return 0;
+}
+
+const char *history_device(history_t *history, uint32_t device)
+{
+  if (device >= history->devices)
+  {
+    return NULL;
+  }
+  return history->names[device];
+}
+
+int history_next_chunk(history_t *history, history_chunk_t *chunk)
+{
+  struct stat st;
+  ssize_t len;
+  uint64_t end;
+
+  len = pread(history->fd, chunk, sizeof(*chunk), history->offset);
+  if (len == -1)
+  {
+    perror("pread");
+    return -1;
+  }
+  if (len < (ssize_t) sizeof(*chunk) || !valid_chunk(history, chunk))
+  {
+    /* end of file or chunk being written */
+    return 0;
+  }
+
+  end = history->offset + sizeof(*chunk) + chunk->time_size + chunk->ppm_size;
+  if (fstat(history->fd, &st) == -1)
+  {
+    perror("fstat");
+    return -1;
+  }
+  if ((uint64_t) st.st_size < end)
+  {
+    return 0;
+  }
+  history->offset = end;
+  return 1;
+}
+
+/**
+ * \return 0 if all samples were decoded, 1 if callback requested stop, -1 if
+ * chunk is corrupted
+ */
+static int decode(const history_chunk_t *chunk, const uint8_t *payload,
+    const history_filter_t *filter, history_cb_t cb, void *arg)
+{
+  history_sample_t sample;
+  size_t tpos = 0, ppos = chunk->time_size;
+  size_t size = chunk->time_size + chunk->ppm_size;
+  uint64_t value;
+  int64_t delta = 0;
+  int64_t ppm = 0;
+  uint32_t i;
+
+  sample.device = chunk->device;
+  sample.wall = chunk->first;
+  for (i = 0; i < chunk->count; i++)
+  {
+    if (get_varint(payload, chunk->time_size, &tpos, &value))
+    {
+      return -1;
+    }
+    delta += unzigzag(value);
+    sample.wall += delta;
+    if (get_varint(payload, size, &ppos, &value))
+    {
+      return -1;
+    }
+    ppm += unzigzag(value);
+    sample.ppm = ppm;
+
+    if (filter != NULL && (sample.wall < filter->from ||
+          sample.wall >= filter->to || sample.ppm < filter->min ||
+          sample.ppm > filter->max))
+    {
+      continue;
+    }
+    if (cb(&sample, arg))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int64_t history_scan(history_t *history, const history_filter_t *filter,
+    history_cb_t cb, void *arg)
+{
+  uint8_t payload[2 * HISTORY_COLUMN_SIZE];
+  history_chunk_t chunk;
+  uint64_t start;
+  size_t size;
+  int64_t decoded = 0;
+  int ret;
+
+  history->offset = history->data_offset;
+  while (1)
+  {
+    start = history->offset;
+    ret = history_next_chunk(history, &chunk);
+    if (ret <= 0)
+    {
+      return ret < 0 ? -1 : decoded;
+    }
+
+    /* headers alone decide whether chunk is worth reading */
+    if (filter != NULL && (chunk.last < filter->from ||
+          chunk.first >= filter->to || chunk.max < filter->min ||
+          chunk.min > filter->max))
+    {
+      continue;
+    }
+
+    size = chunk.time_size + chunk.ppm_size;
+    if (pread(history->fd, payload, size, start + sizeof(chunk)) !=
+        (ssize_t) size)
+    {
+      perror("pread");
+      return -1;
+    }
+    decoded++;
+    ret = decode(&chunk, payload, filter, cb, arg);
+    if (ret < 0)
+    {
+      ERROR("corrupted history chunk at offset %llu",
+          (unsigned long long) start);
+      return -1;
+    }
+    if (ret > 0)
+    {
+      return decoded;
+    }
+  }
+}
+
+void history_close(history_t *history)
+{
+  if (history->open != NULL)
+  {
+    history_flush(history);
+    free(history->open);
+    history->open = NULL;
+  }
+  free_names(history);
+  if (history->fd >= 0)
+  {
+    close(history->fd);
+  }
+  history->fd = -1;
+}
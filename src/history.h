@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HISTORY_CHUNK_SAMPLES 4096 /**< maximum number of samples in chunk */
+#define HISTORY_COLUMN_SIZE 4096 /**< maximum size of encoded column */
+#define HISTORY_CHUNK_SPAN 900000 /**< maximum time in ms between first and
+                                    *  last sample of chunk */
+
+/**
+ * \brief Header preceding every chunk in history file
+ *
+ * Chunk holds samples of single device, encoded column by column: first
+ * timestamps, each one as zigzag varint of difference between its delta and
+ * delta of previous sample (delta-of-delta), then concentrations, each one as
+ * zigzag varint of difference from previous sample. First sample of chunk is
+ * encoded against time of chunk and concentration 0.
+ */
+typedef struct {
+  uint32_t magic; /**< HISTORY_CHUNK_MAGIC, used to validate chunk */
+  uint32_t device; /**< index of device in device table */
+  uint32_t count; /**< number of samples */
+  uint16_t time_size; /**< size of encoded timestamps */
+  uint16_t ppm_size; /**< size of encoded concentrations */
+  int64_t first; /**< wall time of first sample in ms since epoch */
+  int64_t last; /**< wall time of last sample in ms since epoch */
+  uint16_t min; /**< lowest concentration in chunk */
+  uint16_t max; /**< highest concentration in chunk */
+  uint32_t reserved;
+} history_chunk_t;
+
+/**
+ * \brief Single decoded sample
+ */
+typedef struct {
+  int64_t wall; /**< wall time in ms since epoch */
+  uint32_t device; /**< index of device in device table */
+  uint16_t ppm; /**< gas concentration */
+} history_sample_t;
+
+/**
+ * \brief Chunk being filled by writer
+ */
+typedef struct {
+  history_chunk_t header; /**< header of chunk so far */
+  int64_t delta; /**< difference between last two timestamps */
+  uint16_t ppm; /**< last concentration */
+  uint8_t times[HISTORY_COLUMN_SIZE]; /**< encoded timestamps */
+  uint8_t ppms[HISTORY_COLUMN_SIZE]; /**< encoded concentrations */
+} history_builder_t;
+
+typedef struct {
+  int fd; /**< descriptor of history file */
+  char **names; /**< device table */
+  uint32_t devices; /**< number of devices */
+  uint64_t data_offset; /**< offset of first chunk */
+  history_builder_t *open; /**< chunk being filled for every device (writer
+                             *  only) */
+  uint64_t offset; /**< offset of next chunk to be read (reader only) */
+} history_t;
+
+/**
+ * \brief Filter of samples, chunks that cannot match are skipped unread
+ */
+typedef struct {
+  int64_t from; /**< earliest wall time in ms (inclusive) */
+  int64_t to; /**< latest wall time in ms (exclusive) */
+  uint16_t min; /**< lowest concentration */
+  uint16_t max; /**< highest concentration */
+} history_filter_t;
+
+/**
+ * \brief Callback receiving decoded samples
+ *
+ * \return 0 to continue, non-zero to stop scanning
+ */
+typedef int (*history_cb_t)(const history_sample_t *sample, void *arg);
+
+/**
+ * \brief Open history file for appending, creating it if it does not exist
+ *
+ * Existing file has to have the same device table. Incomplete chunk left at
+ * its end by interrupted write is cut off.
+ *
+ * \param history History to be initialized
+ * \param path Filename of history
+ * \param devices List of device names, index in list is device id
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be created or written
+ * \retval -2 existing file is not compatible
+ */
+int history_open(history_t *history, const char *path, char **devices,
+    int count);
+
+/**
+ * \brief Add sample of device to its chunk
+ *
+ * Chunk is written to file when it is full or spans more than
+ * HISTORY_CHUNK_SPAN. Timestamps going back are recorded as equal to the
+ * previous one.
+ *
+ * \param history History opened for appending
+ * \param device Device id
+ * \param wall Wall time in ms since epoch
+ * \param ppm Gas concentration
+ *
+ * \return 0 on success or -1 if chunk could not be written
+ */
+int history_append(history_t *history, uint32_t device, int64_t wall,
+    uint16_t ppm);
+
+/**
+ * \brief Write all partially filled chunks
+ *
+ * \param history History opened for appending
+ *
+ * \return 0 on success or -1 if some chunk could not be written
+ */
+int history_flush(history_t *history);
+
+/**
+ * \brief Open existing history read-only
+ *
+ * \param history History to be initialized
+ * \param path Filename of history
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be opened or read
+ * \retval -2 file is not a valid history
+ */
+int history_open_reader(history_t *history, const char *path);
+
+/**
+ * \brief Get name of device with given id
+ *
+ * \param history Opened history
+ * \param device Device id
+ *
+ * \return device name or NULL if id is out of range
+ */
+const char *history_device(history_t *history, uint32_t device);
+
+/**
+ * \brief Read header of next chunk without decoding its samples
+ *
+ * \param history History opened for reading
+ * \param chunk Output header
+ *
+ * \return 1 if chunk was read, 0 at end of history, -1 on error
+ */
+int history_next_chunk(history_t *history, history_chunk_t *chunk);
+
+/**
+ * \brief Decode samples of all chunks matching filter, oldest chunk first
+ *
+ * Headers are read one by one and chunks whose time range or concentration
+ * range does not overlap with filter are skipped without reading them.
+ *
+ * \param history History opened for reading, scanned from its beginning
+ * \param filter Filter of samples (NULL - all)
+ * \param cb Function called for every matching sample
+ * \param arg Argument passed to cb
+ *
+ * \return number of chunks decoded or -1 on error
+ */
+int64_t history_scan(history_t *history, const history_filter_t *filter,
+    history_cb_t cb, void *arg);
+
+/**
+ * \brief Close history, writing partially filled chunks of writer
+ *
+ * \param history Opened history
+ */
+void history_close(history_t *history);
+
+#endif // HISTORY_H
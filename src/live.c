@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "live.h"
+
+#define LIVE_MAGIC "MHZ14ALV"
+#define LIVE_VERSION 1
+#define LIVE_ALIGN 64
+#define LIVE_WORDS (sizeof(live_sample_t) / sizeof(uint64_t))
+#define LIVE_STALL_NS 100000000LL /**< time after which reader assumes that
+                                   *  writer died while updating */
+#define LIVE_CLOCK_SPINS 1024 /**< tries of reader between clock checks */
+
+struct live_header {
+  char magic[8]; /**< LIVE_MAGIC */
+  uint32_t version; /**< LIVE_VERSION */
+  uint32_t slot_size; /**< size of single slot */
+  uint32_t devices; /**< number of entries in device table */
+  uint32_t reserved;
+  uint64_t slots_offset; /**< offset of first slot from start of object */
+};
+
+struct live_slot {
+  /* every slot has its own cache line, so devices do not disturb each other */
+  _Alignas(LIVE_ALIGN) _Atomic uint32_t seq; /**< odd while being updated */
+  uint32_t reserved;
+  _Atomic uint64_t words[LIVE_WORDS]; /**< sample split into words, so that
+                                        *  torn copy is never undefined */
+};
+
+_Static_assert(sizeof(live_sample_t) % sizeof(uint64_t) == 0,
+    "sample has to consist of whole words");
+
+static uint64_t slots_offset(uint32_t devices)
+{
+  uint64_t offset = sizeof(struct live_header) +
+    (uint64_t)devices * LIVE_NAME_SIZE;
+
+  return (offset + LIVE_ALIGN - 1) / LIVE_ALIGN * LIVE_ALIGN;
+}
+
+static int map_live(live_t *live, int fd, int prot)
+{
+  live->map = mmap(NULL, live->size, prot, MAP_SHARED, fd, 0);
+  if (live->map == MAP_FAILED)
+  {
+    perror("mmap");
+    live->map = NULL;
+    return -1;
+  }
+  live->header = live->map;
+  return 0;
+}
+
+static char *names(live_t *live)
+{
+  return (char*) live->map + sizeof(struct live_header);
+}
+
+/**
+ * \brief Copy sample out of slot, possibly torn if writer is active
+ */
+static void load_sample(struct live_slot *slot, live_sample_t *sample)
+{
+  uint64_t words[LIVE_WORDS];
+  size_t i;
+
+  for (i = 0; i < LIVE_WORDS; i++)
+  {
+    words[i] = atomic_load_explicit(&slot->words[i], memory_order_relaxed);
+  }
+  memcpy(sample, words, sizeof(*sample));
+}
+
+int live_open(live_t *live, const char *name, char **devices, int count)
+{
+  struct live_header *hdr;
+  int i, fd;
+
+  memset(live, 0, sizeof(*live));
+  if (count < 1 || strlen(name) >= sizeof(live->name))
+  {
+    return -2;
+  }
+  strcpy(live->name, name);
+
+  /* readers of stale object keep their mapping, new ones get this one */
+  if (shm_unlink(name) == -1 && errno != ENOENT)
+  {
+    perror("shm_unlink");
+    return -1;
+  }
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    perror("shm_open");
+    return -1;
+  }
+
+  live->size = slots_offset(count) + count * sizeof(struct live_slot);
+  if (ftruncate(fd, live->size) == -1)
+  {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  if (map_live(live, fd, PROT_READ | PROT_WRITE))
+  {
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  close(fd);
+  live->writer = 1;
+
+  /* new object is zeroed, so every slot starts unused with even sequence */
+  hdr = live->header;
+  hdr->version = LIVE_VERSION;
+  hdr->slot_size = sizeof(struct live_slot);
+  hdr->devices = count;
+  hdr->slots_offset = slots_offset(count);
+  live->slots = (struct live_slot*)((char*) live->map + hdr->slots_offset);
+  for (i = 0; i < count; i++)
+  {
+    strncpy(names(live) + i * LIVE_NAME_SIZE, devices[i],
+        LIVE_NAME_SIZE - 1);
+  }
+  /* magic goes last, readers ignore object until it is initialized */
+  atomic_thread_fence(memory_order_release);
+  memcpy(hdr->magic, LIVE_MAGIC, sizeof(hdr->magic));
+
+  return 0;
+}
+
+int live_open_reader(live_t *live, const char *name)
+{
+  struct live_header *hdr;
+  struct stat st;
+  int fd;
+
+  memset(live, 0, sizeof(*live));
+  fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    perror("shm_open");
+    return -1;
+  }
+  if (fstat(fd, &st) == -1)
+  {
+    perror("fstat");
+    close(fd);
+    return -1;
+  }
+  if ((size_t) st.st_size < sizeof(struct live_header))
+  {
+    close(fd);
+    return -2;
+  }
+
+  live->size = st.st_size;
+  if (map_live(live, fd, PROT_READ))
+  {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  hdr = live->header;
+  if (memcmp(hdr->magic, LIVE_MAGIC, sizeof(hdr->magic)) != 0)
+  {
+    live_close(live);
+    return -2;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  if (hdr->version != LIVE_VERSION ||
+      hdr->slot_size != sizeof(struct live_slot) ||
+      hdr->slots_offset != slots_offset(hdr->devices) ||
+      hdr->slots_offset + (uint64_t) hdr->devices * hdr->slot_size >
+      live->size)
+  {
+    live_close(live);
+    return -2;
+  }
+  live->slots = (struct live_slot*)((char*) live->map + hdr->slots_offset);
+
+  return 0;
+}
+
+void live_publish(live_t *live, const store_record_t *record)
+{
+  struct live_slot *slot;
+  live_sample_t sample;
+  uint64_t words[LIVE_WORDS];
+  uint32_t seq;
+  size_t i;
+
+  if (record->device >= live->header->devices)
+  {
+    return;
+  }
+  slot = &live->slots[record->device];
+
+  /* writer is the only one modifying slot, so its copy is never torn */
+  load_sample(slot, &sample);
+  sample.mono = record->mono;
+  sample.wall = record->wall;
+  sample.status = record->status;
+  sample.updates++;
+  if (record->status == 0)
+  {
+    sample.ppm = record->ppm;
+    sample.valid_wall = record->wall;
+  }
+  memcpy(words, &sample, sizeof(sample));
+
+  seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (i = 0; i < LIVE_WORDS; i++)
+  {
+    atomic_store_explicit(&slot->words[i], words[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+uint32_t live_count(live_t *live)
+{
+  return live->header->devices;
+}
+
+const char *live_device(live_t *live, uint32_t device)
+{
+  if (device >= live->header->devices)
+  {
+    return NULL;
+  }
+  return names(live) + device * LIVE_NAME_SIZE;
+}
+
+int live_find(live_t *live, const char *name)
+{
+  uint32_t i;
+
+  for (i = 0; i < live->header->devices; i++)
+  {
+    if (strncmp(names(live) + i * LIVE_NAME_SIZE, name, LIVE_NAME_SIZE) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int live_read(live_t *live, uint32_t device, live_sample_t *sample)
+{
+  struct live_slot *slot;
+  struct timespec start, now;
+  uint32_t seq;
+  int spins;
+
+  if (device >= live->header->devices)
+  {
+    return -1;
+  }
+  slot = &live->slots[device];
+
+  for (spins = 1; ; spins++)
+  {
+    if (spins % LIVE_CLOCK_SPINS == 0)
+    {
+      /* clock is read through vDSO, so even this is not a system call */
+      timespec_now(&now);
+      if (spins == LIVE_CLOCK_SPINS)
+      {
+        start = now;
+      }
+      else if (timespec_diff_ns(&now, &start) > LIVE_STALL_NS)
+      {
+        return -2;
+      }
+    }
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq & 1)
+    {
+      /* writer is in the middle of update */
+      continue;
+    }
+    load_sample(slot, sample);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+    {
+      return 0;
+    }
+  }
+}
+
+void live_close(live_t *live)
+{
+  if (live->map != NULL)
+  {
+    munmap(live->map, live->size);
+    live->map = NULL;
+  }
+  if (live->writer)
+  {
+    shm_unlink(live->name);
+    live->writer = 0;
+  }
+  live->header = NULL;
+  live->slots = NULL;
+}
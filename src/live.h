@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "store.h"
+
+#define LIVE_NAME_SIZE 64 /**< size of single entry of device table */
+
+/**
+ * \brief Latest state of single device
+ */
+typedef struct {
+  int64_t mono; /**< monotonic clock time of last transaction in ns */
+  int64_t wall; /**< wall clock time of last transaction in ns since epoch */
+  int64_t valid_wall; /**< wall clock time at which ppm was read (0 - no valid
+                        *  reading yet) */
+  uint16_t ppm; /**< last valid gas concentration */
+  int16_t status; /**< 0 on success or error code of last transaction */
+  uint32_t updates; /**< number of transactions published so far */
+} live_sample_t;
+
+struct live_header;
+struct live_slot;
+
+typedef struct {
+  char name[LIVE_NAME_SIZE]; /**< name of shared memory object */
+  void *map; /**< whole object mapped to memory */
+  size_t size; /**< size of mapping */
+  struct live_header *header; /**< header at the beginning of mapping */
+  struct live_slot *slots; /**< seqlock-protected sample of every device */
+  int writer; /**< non-zero if object was created by this handle */
+} live_t;
+
+/**
+ * \brief Create shared memory object publishing latest readings
+ *
+ * Object left by previous writer is replaced, so its readers have to reopen
+ * it to see new readings.
+ *
+ * \param live Handle to be initialized
+ * \param name Name of object as for shm_open(), e.g. /mhz14a
+ * \param devices List of device names, index in list is device id
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 object could not be created or mapped
+ * \retval -2 invalid parameters
+ */
+int live_open(live_t *live, const char *name, char **devices, int count);
+
+/**
+ * \brief Open existing object read-only
+ *
+ * Samples are read without any system calls and without locks, so any number
+ * of readers never delays the writer.
+ *
+ * \param live Handle to be initialized
+ * \param name Name of object as for shm_open()
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 object could not be opened or mapped
+ * \retval -2 object is not valid
+ */
+int live_open_reader(live_t *live, const char *name);
+
+/**
+ * \brief Publish result of transaction as latest sample of its device
+ *
+ * If transaction failed, concentration from the last successful one is kept,
+ * together with its time.
+ *
+ * \param live Handle opened for writing
+ * \param record Result of transaction, device id indexes device table
+ */
+void live_publish(live_t *live, const store_record_t *record);
+
+/**
+ * \brief Get number of devices in object
+ *
+ * \param live Opened handle
+ *
+ * \return number of entries in device table
+ */
+uint32_t live_count(live_t *live);
+
+/**
+ * \brief Get name of device with given id
+ *
+ * \param live Opened handle
+ * \param device Device id
+ *
+ * \return device name or NULL if id is out of range
+ */
+const char *live_device(live_t *live, uint32_t device);
+
+/**
+ * \brief Find id of device with given name
+ *
+ * \param live Opened handle
+ * \param name Device name
+ *
+ * \return device id or -1 if device is not published
+ */
+int live_find(live_t *live, const char *name);
+
+/**
+ * \brief Read consistent copy of latest sample of device
+ *
+ * If writer is in the middle of update, read is repeated. Reader gives up
+ * only if slot stays inconsistent for 100ms, e.g. because writer died while
+ * updating it.
+ *
+ * \param live Opened handle
+ * \param device Device id
+ * \param sample Output sample
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 device id out of range
+ * \retval -2 consistent copy could not be obtained
+ */
+int live_read(live_t *live, uint32_t device, live_sample_t *sample);
+
+/**
+ * \brief Unmap object, removing it if handle is the writer
+ *
+ * \param live Opened handle
+ */
+void live_close(live_t *live);
+
+#endif // LIVE_H
@@ -18,16 +18,48 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "logger.h"
 
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_BATCH_SIZE 65536
+
+typedef struct {
+  uint64_t seq; /**< global order of the message */
+  level_t level;
+  char text[LOG_RECORD_SIZE]; /**< already formatted message */
+} logrec_t;
+
+typedef struct logring {
+  logrec_t records[LOG_RING_SIZE];
+  _Atomic uint32_t head; /**< written by owning thread only */
+  _Atomic uint32_t tail; /**< written by background thread only */
+  _Atomic uint32_t dropped; /**< messages dropped because ring was full */
+  struct logring *next; /**< next ring on list of all rings */
+} logring_t;
+
 levelopt_t levelopts[] = {
   LEVELOPT(ERROR), LEVELOPT(WARNING), LEVELOPT(INFO), LEVELOPT(DEBUG)
 };
 
 static level_t log_level = LEVEL_ERROR;
 
+static _Atomic int async_enabled = 0;
+static _Atomic int async_stopping = 0;
+static _Atomic(logring_t*) rings = NULL;
+static _Atomic uint64_t next_seq = 0;
+static _Atomic int consumer_sleeping = 0;
+static _Atomic int wakeups = 0;
+static pthread_t consumer;
+static _Thread_local logring_t *own_ring = NULL;
+
 int set_numeric_log_level(level_t level)
 {
   if (level >= LEVEL_MAX)
@@ -84,19 +116,297 @@ char *get_log_level()
   return levelopts[level].text;
 }
 
+/**
+ * \brief Format complete line, so that it can be written at once
+ *
+ * \return length of line without terminating null byte
+ */
+static int format_line(char *buf, size_t size, level_t level, char *format,
+    va_list va)
+{
+  int len, msglen;
+
+  len = snprintf(buf, size, "[%s] ", levelopts[level].text);
+  msglen = vsnprintf(buf + len, size - len, format, va);
+  if (msglen < 0)
+  {
+    msglen = 0;
+  }
+  len += msglen;
+  if (len > size - 2)
+  {
+    /* message truncated */
+    len = size - 2;
+  }
+  buf[len++] = '\n';
+  buf[len] = '\0';
+
+  return len;
+}
+
+static void futex(_Atomic int *addr, int op, int val, struct timespec *timeout)
+{
+  syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static logring_t *get_own_ring()
+{
+  logring_t *ring = own_ring;
+
+  if (ring != NULL)
+  {
+    return ring;
+  }
+
+  ring = calloc(1, sizeof(*ring));
+  if (ring == NULL)
+  {
+    return NULL;
+  }
+
+  /* rings are never released, so list can be pushed to without locking */
+  ring->next = atomic_load(&rings);
+  while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+  own_ring = ring;
+
+  return ring;
+}
+
+/**
+ * \brief Put message into ring of calling thread
+ *
+ * \return 0 if message was queued or dropped, 1 if it has to be written
+ * synchronously
+ */
+static int log_async(level_t level, char *format, va_list va)
+{
+  logring_t *ring = get_own_ring();
+  logrec_t *rec;
+  uint32_t head;
+
+  if (ring == NULL)
+  {
+    return 1;
+  }
+
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+      LOG_RING_SIZE)
+  {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return 0;
+  }
+
+  rec = &ring->records[head & LOG_RING_MASK];
+  rec->level = level;
+  format_line(rec->text, sizeof(rec->text), level, format, va);
+  /* sequence is taken last, so that consumer never waits for formatting */
+  rec->seq = atomic_fetch_add(&next_seq, 1);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&consumer_sleeping, memory_order_relaxed))
+  {
+    atomic_fetch_add(&wakeups, 1);
+    futex(&wakeups, FUTEX_WAKE_PRIVATE, 1, NULL);
+  }
+
+  return 0;
+}
+
+/**
+ * \brief Move pending records into batch in global order
+ *
+ * \return number of bytes placed in batch
+ */
+static size_t collect(char *batch, size_t size, uint64_t *expected)
+{
+  size_t used = 0;
+  size_t len;
+  logring_t *ring, *best;
+  logrec_t *rec;
+  uint32_t dropped;
+  int found;
+
+  /* report drops before messages that follow them */
+  for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+  {
+    dropped = atomic_exchange_explicit(&ring->dropped, 0,
+        memory_order_relaxed);
+    if (dropped > 0 && used < size)
+    {
+      used += snprintf(batch + used, size - used,
+          "[%s] %u log messages dropped\n", levelopts[LEVEL_WARNING].text,
+          dropped);
+      if (used > size)
+      {
+        used = size;
+      }
+    }
+  }
+
+  do
+  {
+    found = 0;
+    best = NULL;
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+    {
+      uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+      if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+      {
+        continue;
+      }
+      rec = &ring->records[tail & LOG_RING_MASK];
+      if (rec->seq == *expected)
+      {
+        best = ring;
+        break;
+      }
+    }
+    if (best == NULL)
+    {
+      /* next message not published yet */
+      break;
+    }
+
+    rec = &best->records[atomic_load_explicit(&best->tail,
+        memory_order_relaxed) & LOG_RING_MASK];
+    len = strlen(rec->text);
+    if (used + len > size)
+    {
+      break;
+    }
+    memcpy(batch + used, rec->text, len);
+    used += len;
+    (*expected)++;
+    atomic_fetch_add_explicit(&best->tail, 1, memory_order_release);
+    found = 1;
+  } while (found);
+
+  return used;
+}
+
+/**
+ * \brief Check if there is anything for background thread to write
+ */
+static int has_pending(uint64_t expected)
+{
+  logring_t *ring;
+
+  for (ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+  {
+    if (atomic_load_explicit(&ring->dropped, memory_order_relaxed) > 0 ||
+        atomic_load_explicit(&ring->head, memory_order_acquire) !=
+        atomic_load_explicit(&ring->tail, memory_order_relaxed))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static char batch[LOG_BATCH_SIZE];
+static uint64_t expected_seq = 0;
+
+static void *consume(void *arg)
+{
+  struct timespec timeout = {.tv_sec = 0, .tv_nsec = 100000000};
+  uint64_t expected = expected_seq;
+  size_t used;
+  int seen;
+
+  while (1)
+  {
+    seen = atomic_load(&wakeups);
+    used = collect(batch, sizeof(batch), &expected);
+    if (used > 0)
+    {
+      fwrite(batch, 1, used, stderr);
+      fflush(stderr);
+      continue;
+    }
+
+    if (atomic_load(&async_stopping) &&
+        expected == atomic_load(&next_seq))
+    {
+      break;
+    }
+
+    /* sleep until producer signals new message, timeout is only a safety
+     * net */
+    atomic_store_explicit(&consumer_sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!has_pending(expected) && !atomic_load(&async_stopping))
+    {
+      futex(&wakeups, FUTEX_WAIT_PRIVATE, seen, &timeout);
+    }
+    atomic_store_explicit(&consumer_sleeping, 0, memory_order_relaxed);
+  }
+
+  expected_seq = expected;
+  return NULL;
+}
+
+int log_async_start()
+{
+  if (atomic_load(&async_enabled))
+  {
+    return 0;
+  }
+
+  atomic_store(&async_stopping, 0);
+  if (pthread_create(&consumer, NULL, consume, NULL))
+  {
+    return 1;
+  }
+  atomic_store(&async_enabled, 1);
+  DEBUG("asynchronous logging started");
+
+  return 0;
+}
+
+void log_async_stop()
+{
+  size_t used;
+
+  if (!atomic_load(&async_enabled))
+  {
+    return;
+  }
+
+  atomic_store(&async_stopping, 1);
+  atomic_fetch_add(&wakeups, 1);
+  futex(&wakeups, FUTEX_WAKE_PRIVATE, 1, NULL);
+  pthread_join(consumer, NULL);
+  atomic_store(&async_enabled, 0);
+
+  /* pick up messages which raced with stop request */
+  used = collect(batch, sizeof(batch), &expected_seq);
+  fwrite(batch, 1, used, stderr);
+}
+
 void LOG(level_t level, char *format, ...)
 {
+  char line[LOG_RECORD_SIZE];
   va_list va;
+  int len;
+
   if (level > get_numeric_log_level())
   {
     return;
   }
 
-  fprintf(stderr, "[%s] ", levelopts[level].text);
-
   va_start(va, format);
-  vfprintf(stderr, format, va);
+  if (atomic_load_explicit(&async_enabled, memory_order_relaxed) &&
+      !atomic_load_explicit(&async_stopping, memory_order_relaxed) &&
+      log_async(level, format, va) == 0)
+  {
+    va_end(va);
+    return;
+  }
+  len = format_line(line, sizeof(line), level, format, va);
   va_end(va);
 
-  fprintf(stderr, "\n");
+  fwrite(line, 1, len, stderr);
 }
@@ -35,6 +35,9 @@ typedef struct {
   char *text;
 } levelopt_t;
 
+#define LOG_RECORD_SIZE 256 /**< size of single record in asynchronous mode */
+#define LOG_RING_SIZE 256 /**< number of records per thread, power of 2 */
+
 /**
  * \brief Set logging verbosity to numeric value
  *
@@ -71,6 +74,26 @@ level_t get_numeric_log_level();
  */
 char *get_log_level();
 
+/**
+ * \brief Switch logging to asynchronous mode
+ *
+ * In this mode every thread formats its messages into fixed-size records of
+ * its own lock-free ring and background thread writes them to stderr in
+ * batches, preserving order of messages across all threads. When ring of a
+ * thread is full, its new messages are dropped and number of dropped messages
+ * is reported instead.
+ *
+ * \return error code
+ * \retval 0 no error
+ * \retval 1 error occurred, logging stays synchronous
+ */
+int log_async_start();
+
+/**
+ * \brief Write all pending messages and return to synchronous mode
+ */
+void log_async_stop();
+
 /**
  * \brief Log message under given level
  *
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "metrics.h"
+
+#define REQUEST_TIMEOUT 100 /**< ms to wait for request before responding */
+
+/** upper bounds of latency histogram buckets in seconds */
+static const double buckets[] = {
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5,
+};
+#define BUCKETS (sizeof(buckets)/sizeof(buckets[0]))
+
+typedef struct {
+  _Atomic uint64_t transactions;
+  _Atomic uint64_t failures;
+  _Atomic uint64_t timeouts;
+  _Atomic uint64_t checksum_errors;
+  _Atomic uint64_t retries;
+  _Atomic uint64_t bytes_in;
+  _Atomic uint64_t bytes_out;
+  _Atomic uint64_t skipped;
+  _Atomic uint64_t ppm; /**< last valid reading */
+  _Atomic uint64_t latency_count;
+  _Atomic uint64_t latency_sum; /**< in ns */
+  _Atomic uint64_t latency_bucket[BUCKETS]; /**< not cumulative */
+} devmetrics_t;
+
+typedef struct {
+  char *device;
+  _Atomic uint32_t seq; /**< odd while publisher is updating values */
+  devmetrics_t values;
+} metricsdev_t;
+
+struct metrics {
+  char *path; /**< filename of socket */
+  int sock; /**< listening socket */
+  int stop[2]; /**< pipe waking server up on close */
+  pthread_t thread; /**< server thread */
+  metricsdev_t *devs; /**< per-device metrics */
+  int count; /**< number of devices */
+};
+
+#define STORE(field, value) \
+  atomic_store_explicit(&m->values.field, (value), memory_order_relaxed)
+#define LOAD(field) \
+  atomic_load_explicit(&m->values.field, memory_order_relaxed)
+
+void metrics_publish(metrics_t *metrics, int index, const polldev_t *dev)
+{
+  metricsdev_t *m = &metrics->devs[index];
+  size_t i;
+
+  /* seqlock - readers retry if sequence changed or was odd */
+  atomic_fetch_add_explicit(&m->seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  STORE(transactions, dev->stats.transactions);
+  STORE(failures, dev->stats.failures);
+  STORE(timeouts, dev->stats.timeouts);
+  STORE(checksum_errors, dev->stats.checksum_errors);
+  STORE(retries, dev->stats.retries);
+  STORE(bytes_in, dev->stats.bytes_in);
+  STORE(bytes_out, dev->stats.bytes_out);
+  STORE(skipped, dev->stats.skipped);
+  if (dev->state == POLL_DONE)
+  {
+    STORE(ppm, dev->gas_concentration);
+  }
+  if (dev->state == POLL_DONE || dev->state == POLL_FAILED)
+  {
+    for (i = 0; i < BUCKETS && dev->latency > buckets[i] * NSEC_PER_SEC; i++);
+    if (i < BUCKETS)
+    {
+      STORE(latency_bucket[i], LOAD(latency_bucket[i]) + 1);
+    }
+    STORE(latency_count, LOAD(latency_count) + 1);
+    STORE(latency_sum, LOAD(latency_sum) + dev->latency);
+  }
+
+  atomic_fetch_add_explicit(&m->seq, 1, memory_order_release);
+}
+
+/**
+ * \brief Take consistent copy of device metrics
+ */
+static void snapshot(metricsdev_t *m, uint64_t *out)
+{
+  _Atomic uint64_t *src = (_Atomic uint64_t*) &m->values;
+  size_t i, n = sizeof(devmetrics_t) / sizeof(uint64_t);
+  uint32_t before, after;
+
+  do
+  {
+    before = atomic_load_explicit(&m->seq, memory_order_acquire);
+    for (i = 0; i < n; i++)
+    {
+      out[i] = atomic_load_explicit(&src[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&m->seq, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+}
+
+typedef struct {
+  const char *name;
+  const char *type;
+  const char *help;
+  size_t offset;
+} metricdesc_t;
+
+#define COUNTER(field, name, help) \
+  {"mhz14a_" name, "counter", help, offsetof(devmetrics_t, field)}
+
+static const metricdesc_t descs[] = {
+  COUNTER(transactions, "reads_total", "Finished read transactions."),
+  COUNTER(failures, "read_failures_total", "Read transactions that failed."),
+  COUNTER(timeouts, "timeouts_total", "Tries that timed out."),
+  COUNTER(checksum_errors, "checksum_errors_total",
+      "Frames rejected because of invalid checksum."),
+  COUNTER(retries, "retries_total", "Tries other than the first one."),
+  COUNTER(bytes_in, "bytes_read_total", "Bytes read from device."),
+  COUNTER(bytes_out, "bytes_written_total", "Bytes written to device."),
+  COUNTER(skipped, "skipped_total",
+      "Cycles in which device was skipped by circuit breaker."),
+  {"mhz14a_ppm", "gauge", "Last gas concentration read.",
+    offsetof(devmetrics_t, ppm)},
+};
+
+void metrics_render(metrics_t *metrics, FILE *out)
+{
+  devmetrics_t *snaps;
+  uint64_t cumulative;
+  size_t d, i;
+  int dev;
+
+  snaps = calloc(metrics->count, sizeof(devmetrics_t));
+  if (snaps == NULL)
+  {
+    return;
+  }
+  for (dev = 0; dev < metrics->count; dev++)
+  {
+    snapshot(&metrics->devs[dev], (uint64_t*) &snaps[dev]);
+  }
+
+  for (d = 0; d < sizeof(descs)/sizeof(descs[0]); d++)
+  {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", descs[d].name, descs[d].help,
+        descs[d].name, descs[d].type);
+    for (dev = 0; dev < metrics->count; dev++)
+    {
+      fprintf(out, "%s{device=\"%s\"} %llu\n", descs[d].name,
+          metrics->devs[dev].device, (unsigned long long)
+          *(uint64_t*)((char*) &snaps[dev] + descs[d].offset));
+    }
+  }
+
+  fprintf(out, "# HELP mhz14a_read_latency_seconds Duration of read "
+      "transactions.\n# TYPE mhz14a_read_latency_seconds histogram\n");
+  for (dev = 0; dev < metrics->count; dev++)
+  {
+    devmetrics_t *s = &snaps[dev];
+    const char *name = metrics->devs[dev].device;
+
+    cumulative = 0;
+    for (i = 0; i < BUCKETS; i++)
+    {
+      cumulative += s->latency_bucket[i];
+      fprintf(out, "mhz14a_read_latency_seconds_bucket{device=\"%s\","
+          "le=\"%g\"} %llu\n", name, buckets[i],
+          (unsigned long long) cumulative);
+    }
+    fprintf(out, "mhz14a_read_latency_seconds_bucket{device=\"%s\","
+        "le=\"+Inf\"} %llu\n", name, (unsigned long long) s->latency_count);
+    fprintf(out, "mhz14a_read_latency_seconds_sum{device=\"%s\"} %.9f\n",
+        name, (double) s->latency_sum / NSEC_PER_SEC);
+    fprintf(out, "mhz14a_read_latency_seconds_count{device=\"%s\"} %llu\n",
+        name, (unsigned long long) s->latency_count);
+  }
+
+  free(snaps);
+}
+
+static void respond(metrics_t *metrics, int fd)
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  char request[1024];
+  char *body = NULL;
+  size_t size = 0;
+  FILE *out;
+
+  /* request itself does not matter, but read it so client is not reset */
+  if (poll(&pfd, 1, REQUEST_TIMEOUT) > 0)
+  {
+    if (read(fd, request, sizeof(request)) == -1)
+    {
+      return;
+    }
+  }
+
+  out = open_memstream(&body, &size);
+  if (out == NULL)
+  {
+    return;
+  }
+  metrics_render(metrics, out);
+  fclose(out);
+
+  dprintf(fd, "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %zu\r\n\r\n", size);
+  if (write(fd, body, size) == -1)
+  {
+    DEBUG("client disconnected before reading metrics");
+  }
+  free(body);
+}
+
+static void *serve(void *arg)
+{
+  metrics_t *metrics = arg;
+  struct pollfd fds[2] = {
+    {metrics->sock, POLLIN, 0},
+    {metrics->stop[0], POLLIN, 0},
+  };
+  int fd;
+
+  while (1)
+  {
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+    if (fds[1].revents)
+    {
+      break;
+    }
+    fd = accept4(metrics->sock, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      continue;
+    }
+    respond(metrics, fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+/**
+ * \brief Remove socket left behind by previous run from path
+ *
+ * \return 0 if path is free, -1 if it is taken by other file or live server
+ */
+static int remove_stale(const struct sockaddr_un *addr)
+{
+  struct stat st;
+  int sock, err;
+
+  if (lstat(addr->sun_path, &st) == -1)
+  {
+    if (errno == ENOENT)
+    {
+      return 0;
+    }
+    perror("lstat");
+    return -1;
+  }
+  if (!S_ISSOCK(st.st_mode))
+  {
+    ERROR("%s exists and is not a socket", addr->sun_path);
+    return -1;
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1)
+  {
+    perror("socket");
+    return -1;
+  }
+  err = connect(sock, (const struct sockaddr*) addr, sizeof(*addr)) == 0 ?
+    0 : errno;
+  close(sock);
+  if (err == 0)
+  {
+    ERROR("%s is served by another process", addr->sun_path);
+    return -1;
+  }
+  /* nobody listens, so socket is stale */
+  if (err != ECONNREFUSED)
+  {
+    errno = err;
+    perror("connect");
+    return -1;
+  }
+  if (unlink(addr->sun_path) == -1 && errno != ENOENT)
+  {
+    perror("unlink");
+    return -1;
+  }
+  return 0;
+}
+
+metrics_t *metrics_open(const char *path, char **devices, int count)
+{
+  struct sockaddr_un addr;
+  metrics_t *metrics;
+  int i, bound = 0;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    ERROR("socket path too long: %s", path);
+    return NULL;
+  }
+
+  metrics = calloc(1, sizeof(metrics_t));
+  if (metrics == NULL)
+  {
+    perror("calloc");
+    return NULL;
+  }
+  metrics->sock = metrics->stop[0] = metrics->stop[1] = -1;
+  metrics->count = count;
+  metrics->devs = calloc(count, sizeof(metricsdev_t));
+  metrics->path = strdup(path);
+  if (metrics->devs == NULL || metrics->path == NULL)
+  {
+    perror("calloc");
+    goto error;
+  }
+  for (i = 0; i < count; i++)
+  {
+    metrics->devs[i].device = devices[i];
+  }
+
+  metrics->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (metrics->sock == -1)
+  {
+    perror("socket");
+    goto error;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (remove_stale(&addr))
+  {
+    goto error;
+  }
+  if (bind(metrics->sock, (struct sockaddr*) &addr, sizeof(addr)) == -1)
+  {
+    perror("bind");
+    goto error;
+  }
+  bound = 1;
+  if (listen(metrics->sock, 8) == -1)
+  {
+    perror("listen");
+    goto error;
+  }
+
+  if (pipe2(metrics->stop, O_CLOEXEC) == -1)
+  {
+    perror("pipe2");
+    goto error;
+  }
+  if (pthread_create(&metrics->thread, NULL, serve, metrics))
+  {
+    ERROR("unable to start metrics thread");
+    goto error;
+  }
+
+  return metrics;
+
+error:
+  if (metrics->stop[0] >= 0)
+  {
+    close(metrics->stop[0]);
+    close(metrics->stop[1]);
+  }
+  if (metrics->sock >= 0)
+  {
+    close(metrics->sock);
+  }
+  if (bound)
+  {
+    unlink(path);
+  }
+  free(metrics->path);
+  free(metrics->devs);
+  free(metrics);
+  return NULL;
+}
+
+void metrics_close(metrics_t *metrics)
+{
+  if (write(metrics->stop[1], "", 1) == -1)
+  {
+    perror("write");
+  }
+  pthread_join(metrics->thread, NULL);
+  close(metrics->stop[0]);
+  close(metrics->stop[1]);
+  close(metrics->sock);
+  unlink(metrics->path);
+  free(metrics->path);
+  free(metrics->devs);
+  free(metrics);
+}
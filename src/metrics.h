@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+#include "poller.h"
+
+/**
+ * \brief Opaque server of metrics in Prometheus text exposition format
+ */
+typedef struct metrics metrics_t;
+
+/**
+ * \brief Start serving metrics on Unix domain socket
+ *
+ * Requests are handled by separate thread, every connection receives HTTP
+ * response with current values of all metrics and is closed.
+ *
+ * \param path Filename of socket, replaced only if it is a socket that nobody
+ * listens on anymore
+ * \param devices List of device names used as label of per-device metrics
+ * \param count Number of devices
+ *
+ * \return metrics server or NULL on error
+ */
+metrics_t *metrics_open(const char *path, char **devices, int count);
+
+/**
+ * \brief Publish state of device after finished cycle
+ *
+ * Values are published without taking any locks, server never sees partially
+ * updated device. Only one thread may publish.
+ *
+ * \param metrics Metrics server
+ * \param index Index of device in list given on opening
+ * \param dev Device state from poller
+ */
+void metrics_publish(metrics_t *metrics, int index, const polldev_t *dev);
+
+/**
+ * \brief Render all metrics as Prometheus text exposition
+ *
+ * \param metrics Metrics server
+ * \param out Stream to write to
+ */
+void metrics_render(metrics_t *metrics, FILE *out);
+
+/**
+ * \brief Stop server thread, remove socket and free resources
+ *
+ * \param metrics Metrics server
+ */
+void metrics_close(metrics_t *metrics);
+
+#endif // METRICS_H
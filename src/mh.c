@@ -13,16 +13,23 @@
  * You should have received a copy of the GNU General Public License along with
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include <stddef.h>
 #include <errno.h>
 #include <termios.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <poll.h>
 
 #include "logger.h"
+#include "timeutil.h"
+#include "retry.h"
+#include "profile.h"
+#include "arbiter.h"
+#include "capture.h"
 #include "mh.h"
 
 speedopt_t speeds[] = {
@@ -33,6 +40,7 @@ speedopt_t speeds[] = {
   speed(921600), speed(1000000), speed(1152000), speed(1500000), speed(2000000),
   speed(2500000), speed(3000000), speed(3500000), speed(4000000),
 };
+const size_t speeds_count = sizeof(speeds)/sizeof(speedopt_t);
 
 tcflag_t databitopts[] = {-1, -1, -1, -1, -1, CS5, CS6, CS7, CS8};
 
@@ -223,87 +231,148 @@ int termios_params(int fd, int baud, direction_t dir, uint8_t databits,
   return 0;
 }
 
-ssize_t perform_io(io_func_t func, int fd, void *buf, size_t count,
-    int timeout)
+/**
+ * \brief Body of \link perform_io \endlink, counting loop iterations
+ */
+static ssize_t perform_chunks(io_func_t func, int fd, void *buf, size_t count,
+    const struct timespec *deadline, capture_t *capture, int *chunks)
 {
   size_t left = 0;
   size_t processed = 0;
-  fd_set fds;
-  fd_set *rfd = NULL, *wfd = NULL, *efd = NULL;
-  struct timeval tv;
+  struct pollfd pfd;
+  struct timespec now, tmo;
+  int64_t remaining = 0;
   int result = -1;
 
+  pfd.fd = fd;
+  if (func == (io_func_t) &read)
+  {
+    pfd.events = POLLIN;
+  }
+  else if (func == (io_func_t) &write)
+  {
+    pfd.events = POLLOUT;
+  }
+  else
+  {
+    errno = ENOTSUP;
+    return (ssize_t)-1;
+  }
+
   left = count;
   while (left > 0)
   {
-    if (timeout != 0)
+    if (deadline != NULL)
     {
-      DEBUG("set timeout for data processing to %ds", timeout);
-      /* select descriptor to ensure that it will not block */
-      tv.tv_sec = timeout;
-      tv.tv_usec = 0;
-
-      FD_ZERO(&fds);
-      FD_SET(fd, &fds);
-
-      if (func == (io_func_t) &read)
-      {
-        rfd = &fds;
-      }
-      else if (func == (io_func_t) &write)
-      {
-        wfd = &fds;
-      }
-      else
+      /* whole operation shares one deadline, so only the time left is
+       * waited for on each partial chunk */
+      timespec_now(&now);
+      remaining = timespec_diff_ns(deadline, &now);
+      if (remaining <= 0)
       {
-        errno = ENOTSUP;
+        errno = ENODATA;
         return (ssize_t)-1;
       }
+    }
 
-      result = select(fd + 1, rfd, wfd, efd, &tv);
-      if (result == -1)
-      {
-        perror("select");
-        return (ssize_t)-1;
-      }
-      else if (!result)
+    /* descriptor is non-blocking, so try first and wait only if there is
+     * nothing to process yet */
+    PROFILE_BEGIN(prof_io);
+    processed = func(fd, buf + count - left, left);
+    PROFILE_END(pfd.events == POLLIN ? PROF_IO_READ : PROF_IO_WRITE, prof_io);
+    (*chunks)++;
+    if (processed != -1)
+    {
+      if (capture != NULL)
       {
-        /* timeout */
-        errno = ENODATA;
-        return (ssize_t)-1;
+        capture_io(capture, fd, pfd.events == POLLIN ? CAPTURE_RX : CAPTURE_TX,
+            buf + count - left, processed);
       }
+      left -= processed;
+      continue;
     }
-    processed = func(fd, buf + count - left, left);
-    if (processed == -1)
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      return (ssize_t)-1;
+    }
+
+    if (deadline != NULL)
+    {
+      DEBUG("set timeout for data processing to %lldns",
+          (long long)remaining);
+      tmo.tv_sec = remaining / NSEC_PER_SEC;
+      tmo.tv_nsec = remaining % NSEC_PER_SEC;
+    }
+    /* without deadline sleep in kernel until descriptor becomes ready */
+    PROFILE_BEGIN(prof_wait);
+    result = ppoll(&pfd, 1, deadline != NULL ? &tmo : NULL, NULL);
+    PROFILE_END(PROF_IO_WAIT, prof_wait);
+    if (result == -1)
     {
-      if (errno == EAGAIN)
+      if (errno == EINTR)
       {
+        /* signal handler ran (e.g. profile dump), ppoll is never restarted by
+         * kernel, so try again with what is left of deadline */
         continue;
       }
+      ERROR("ppoll: %s", strerror(errno));
+      return (ssize_t)-1;
+    }
+    else if (!result)
+    {
+      /* timeout */
+      errno = ENODATA;
       return (ssize_t)-1;
     }
-    left -= processed;
   }
   return count - left;
 }
 
-int process_command(mhopt_t *opts)
+ssize_t perform_io(io_func_t func, int fd, void *buf, size_t count,
+    const struct timespec *deadline, capture_t *capture)
+{
+  ssize_t result;
+  int chunks = 0;
+
+  PROFILE_BEGIN(prof_total);
+  result = perform_chunks(func, fd, buf, count, deadline, capture, &chunks);
+  PROFILE_END(PROF_IO_TOTAL, prof_total);
+  PROFILE_VALUE(PROF_IO_CHUNKS, chunks);
+
+  return result;
+}
+
+ssize_t read_frame(int fd, frame_parser_t *parser, pkt_t *packet,
+    const struct timespec *deadline, capture_t *capture)
+{
+  uint8_t buf[sizeof(pkt_t)];
+  size_t missing = 0;
+
+  while (!frame_parser_next(parser, packet))
+  {
+    missing = frame_parser_missing(parser);
+    if (perform_io((io_func_t) read, fd, buf, missing, deadline,
+          capture) != missing)
+    {
+      return (ssize_t)-1;
+    }
+    frame_parser_feed(parser, buf, missing);
+  }
+
+  return sizeof(*packet);
+}
+
+int open_device(mhopt_t *opts)
 {
-  int err = 0;
   int fd = -1;
-  pkt_t packet;
-  size_t left = 0;
-  size_t processed = 0;
-  uint16_t result = (uint16_t)-1;
-  int tries = 0;
 
-  if ((fd = open(opts->device, O_RDWR | O_NOCTTY | O_NDELAY)) == -1)
+  fd = arb_open(opts->device, O_RDWR | O_NOCTTY | O_NDELAY, opts->lock_wait);
+  if (fd < 0)
   {
-    perror("open");
-    return -1;
+    return fd;
   }
 
-  if (err = termios_params(
+  if (termios_params(
         fd, /* file descriptor */
         opts->baudrate,
         DIR_BOTH, /* direction */
@@ -311,115 +380,160 @@ int process_command(mhopt_t *opts)
         opts->parity,
         opts->stopbits))
   {
-    err = -2; goto error;
+    close(fd);
+    return -2;
   }
+  if (opts->capture != NULL)
+  {
+    capture_device(opts->capture, fd, opts->device);
+  }
+
+  return fd;
+}
+
+/**
+ * \brief Send packet to the device and optionally wait for response
+ *
+ * Failed try is repeated after exponential backoff, if one is configured.
+ *
+ * \param fd File descriptor of configured device
+ * \param opts Options holding timeout, number of tries and backoff
+ * \param packet Packet to send, on return filled with response if expected
+ * \param respond Non-zero if sensor is supposed to respond to the packet
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -3 IO error on last try
+ * \retval -4 no try has been made
+ */
+static int transact(int fd, mhopt_t *opts, pkt_t *packet, int respond)
+{
+  pkt_t request = *packet;
+  frame_parser_t parser;
+  struct timespec deadline;
+  struct timespec *limit = NULL;
+  int err = 0;
+  int tries = opts->tries;
+  uint64_t seed;
+
+  timespec_now(&deadline);
+  seed = deadline.tv_nsec ^ ((uint64_t) fd << 32) ^ 1;
+  while (tries--)
+  {
+    INFO("trying communications for %d time (out of %d)", opts->tries - tries, opts->tries);
+    if (tries < opts->tries - 1)
+    {
+      /* give device time to recover instead of hammering it */
+      backoff_sleep(backoff_delay(opts->backoff, opts->backoff_max,
+            opts->tries - tries - 1, &seed));
+    }
+    *packet = request;
+    if (opts->timeout != 0)
+    {
+      /* request and response share single deadline */
+      timespec_now(&deadline);
+      timespec_add_ns(&deadline, opts->timeout * NSEC_PER_USEC);
+      limit = &deadline;
+    }
+    err = perform_io((io_func_t) write, fd, packet, sizeof(*packet), limit,
+        opts->capture);
+    if (err != sizeof(*packet))
+    {
+      ERROR("during write to device: %s", strerror(errno));
+      continue;
+    }
+
+    if (!respond)
+    {
+      break;
+    }
+
+    /* read response */
+    frame_parser_init(&parser, ((read_gas_t*) &request)->command);
+    err = read_frame(fd, &parser, packet, limit, opts->capture);
+    if (err != sizeof(*packet))
+    {
+      ERROR("during read from device: %s", strerror(errno));
+      continue;
+    }
+    break;
+  }
+  if (err != sizeof(*packet))
+  {
+    return -3;
+  }
+  if (tries < 0)
+  {
+    return -4;
+  }
+
+  return 0;
+}
+
+int execute_command(int fd, mhopt_t *opts)
+{
+  int err = 0;
+  pkt_t packet;
+  uint16_t result = (uint16_t)-1;
 
   switch (opts->command)
   {
     case CMD_GAS_CONCENTRATION:
-      /* write request */
       packet = init_read_gas_packet();
-      tries = opts->tries;
-      while (tries--)
-      {
-        INFO("trying communications for %d time (out of %d)", opts->tries - tries, opts->tries);
-        err = perform_io((io_func_t) write, fd, &packet, sizeof(packet),
-            opts->timeout);
-        if (err != sizeof(packet))
-        {
-          ERROR("during write to device");
-          perror("write");
-          continue;
-        }
-
-      /* read response */
-        err = perform_io((io_func_t) read, fd, &packet, sizeof(packet),
-            opts->timeout);
-        if (err != sizeof(packet))
-        {
-          ERROR("during read from device");
-          perror("read");
-          continue;
-        }
-        break;
-      }
-      if (err != sizeof(packet))
+      if (err = transact(fd, opts, &packet, 1))
       {
-        err = -3; goto error;
-      }
-      if (tries < 0)
-      {
-        err = -4; goto error;
+        return err;
       }
 
       /* parse response */
       result = return_gas_concentration(packet);
       if (result == (uint16_t)-1)
       {
-        perror("return_gas_concentration");
-        err = -5; goto error;
+        ERROR("return_gas_concentration: %s", strerror(errno));
+        return -5;
       }
       opts->gas_concentration = result;
       break;
     case CMD_CALIBRATE_SPAN:
-      /* write request */
       packet = init_calibrate_span_packet(opts->span_point);
-      tries = opts->tries;
-      while (tries--)
-      {
-        INFO("trying communications for %d time (out of %d)", opts->tries - tries, opts->tries);
-        err = perform_io((io_func_t) write, fd, &packet, sizeof(packet),
-            opts->timeout);
-        if (err != sizeof(packet))
-        {
-          ERROR("during write to device");
-          perror("write");
-          continue;
-        }
-        break;
-      }
-      if (err != sizeof(packet))
+      if (err = transact(fd, opts, &packet, 0))
       {
-        err = -3; goto error;
-      }
-      if (tries < 0)
-      {
-        err = -4; goto error;
+        return err;
       }
       break;
     case CMD_CALIBRATE_ZERO:
-      /* write request */
       packet = init_calibrate_zero_packet();
-      tries = opts->tries;
-      while (tries--)
-      {
-        INFO("trying communications for %d time (out of %d)", opts->tries - tries, opts->tries);
-        err = perform_io((io_func_t) write, fd, &packet, sizeof(packet),
-            opts->timeout);
-        if (err != sizeof(packet))
-        {
-          ERROR("during write to device");
-          perror("write");
-          continue;
-        }
-        break;
-      }
-      if (err != sizeof(packet))
+      if (err = transact(fd, opts, &packet, 0))
       {
-        err = -3; goto error;
-      }
-      if (tries < 0)
-      {
-        err = -4; goto error;
+        return err;
       }
       break;
     default:
-        err = -6; goto error;
+      return -6;
   }
 
-  close(fd);
   return 0;
-error:
+}
+
+int process_command(mhopt_t *opts)
+{
+  int err = 0;
+  int fd = -1;
+
+  PROFILE_BEGIN(prof_command);
+  PROFILE_BEGIN(prof_open);
+  fd = open_device(opts);
+  PROFILE_END(PROF_OPEN, prof_open);
+  if (fd < 0)
+  {
+    return fd;
+  }
+
+  PROFILE_BEGIN(prof_execute);
+  err = execute_command(fd, opts);
+  PROFILE_END(PROF_EXECUTE, prof_execute);
+
   close(fd);
+  PROFILE_END(PROF_COMMAND, prof_command);
   return err;
 }
@@ -18,12 +18,17 @@
 
 #include <stdint.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mh_uart.h"
+#include "capture.h"
 
 #define speed(baudrate) { baudrate, B##baudrate }
 
+#define LOCK_WAIT_DEFAULT 5000000 /**< microseconds program waits for device
+                                    *  used by another process by default */
+
 typedef struct {
   char *device; /**< filename of UART device */
   int baudrate; /**< baudrate (usually 9600) */
@@ -36,9 +41,22 @@ typedef struct {
                                *  selected */
   uint16_t span_point; /**< input - span point to set if calibrate span point
                         *  selected */
-  int timeout; /**< number of seconds to wait before failing attempt (0 -
-                 infinity) */
+  int64_t timeout; /**< number of microseconds single attempt (request and
+                     *  response together) may take (0 - infinity) */
   int tries; /**< number of attempts to perform */
+  int64_t backoff; /**< microseconds to wait before second attempt, doubled
+                     *  for each following one (0 - retry immediately) */
+  int64_t backoff_max; /**< upper bound of backoff in microseconds
+                         *  (0 - unbounded) */
+  int breaker; /**< consecutive failed transactions after which device is
+                 *  only probed, in multi-device polling (0 - never) */
+  int64_t probe_interval; /**< microseconds between probes of device with
+                            *  open breaker */
+  int64_t lock_wait; /**< microseconds to wait for device used by another
+                       *  process (0 - infinity, negative - open without
+                       *  arbitration and locking) */
+  capture_t *capture; /**< capture recording traffic of device (NULL - not
+                        *  captured) */
 } mhopt_t;
 
 typedef enum {
@@ -53,24 +71,98 @@ typedef struct {
   speed_t speed;
 } speedopt_t;
 
+extern speedopt_t speeds[]; /**< baudrates supported by termios */
+extern const size_t speeds_count; /**< number of entries in speeds */
+
 typedef ssize_t (*io_func_t)(int fd, const void *buf, size_t count);
 
 /**
  * \brief Perform IO operation until desired buffer fully processed
  *
+ * Descriptor is expected to be non-blocking. Whenever it is not ready,
+ * function sleeps in ppoll until it becomes ready or deadline passes, so
+ * waiting for slow device does not consume CPU time. Waits interrupted by
+ * signals are resumed with the time left until deadline, or indefinitely if
+ * there is none.
+ *
  * \param func IO function to perform. This can be either read or write
  * \param fd File descriptor
  * \param buf Buffer to process
  * \param count Number of bytes in buffer
- * \param timeout Number of seconds after which function will give up
+ * \param deadline Point in time of monotonic clock after which function will
+ * give up (NULL - infinity)
+ * \param capture Capture recording processed bytes (NULL - not captured)
  *
  * \return Number of bytes processed. Usually same as count or -1 for errors
  * \retval ENODATA set in errno if timeout occurred
- * \retval ENOTSUP set in errno if timeout requested for not supported function
+ * \retval ENOTSUP set in errno if function is neither read nor write
  */
 ssize_t perform_io(io_func_t func, int fd, void *buf, size_t count,
-    int timeout);
+    const struct timespec *deadline, capture_t *capture);
+
+/**
+ * \brief Read bytes from descriptor until parser yields valid frame
+ *
+ * Only bytes missing from current frame candidate are requested, so nothing
+ * past the end of frame is consumed. Garbage and frames with invalid checksum
+ * are skipped by parser.
+ *
+ * \param fd File descriptor
+ * \param parser Parser holding bytes received so far
+ * \param packet Output frame
+ * \param deadline Point in time of monotonic clock after which function will
+ * give up (NULL - infinity)
+ * \param capture Capture recording received bytes (NULL - not captured)
+ *
+ * \return size of packet on success or -1 for errors (errno set as in
+ * \link perform_io \endlink)
+ */
+ssize_t read_frame(int fd, frame_parser_t *parser, pkt_t *packet,
+    const struct timespec *deadline, capture_t *capture);
+
+/**
+ * \brief Open UART device and apply serial parameters from options
+ *
+ * Device is opened for exclusive use through \link arb_open \endlink, so
+ * other processes wait in turn until descriptor is closed.
+ *
+ * \param opts Options holding device name, its serial parameters and time to
+ * wait for exclusive access
+ *
+ * \return file descriptor of configured device or negative value on error
+ * \retval -1 device could not be opened
+ * \retval -2 serial parameters could not be applied
+ * \retval -8 device was used by another process for longer than lock_wait
+ */
+int open_device(mhopt_t *opts);
+
+/**
+ * \brief Execute command from options on already configured device
+ *
+ * Device stays open after return, so this function can be called repeatedly
+ * on the same descriptor.
+ *
+ * \param fd File descriptor returned by \link open_device \endlink
+ * \param opts Options holding command and its parameters, output parameters
+ * are filled on success
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -3 IO error during communication
+ * \retval -4 no communication attempt was made
+ * \retval -5 invalid response received
+ * \retval -6 unsupported command
+ */
+int execute_command(int fd, mhopt_t *opts);
 
+/**
+ * \brief Open device, execute command from options on it and close it
+ *
+ * \param opts Options holding device, command and its parameters
+ *
+ * \return 0 on success or negative error code of \link open_device \endlink
+ * or \link execute_command \endlink
+ */
 int process_command(mhopt_t *opts);
 
 /**
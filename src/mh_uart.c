@@ -16,6 +16,7 @@
 #include <stddef.h>
 #include <endian.h>
 #include <errno.h>
+#include <string.h>
 
 #include "logger.h"
 #include "mh_uart.h"
@@ -117,3 +118,108 @@ uint8_t checksum(pkt_t *packet)
   cs++;
   return cs;
 }
+
+#define FRAME_MASK (FRAME_BUFFER_SIZE - 1)
+
+void frame_parser_init(frame_parser_t *parser, uint8_t command)
+{
+  memset(parser, 0, sizeof(*parser));
+  parser->command = command;
+}
+
+size_t frame_parser_space(frame_parser_t *parser)
+{
+  return FRAME_BUFFER_SIZE - (parser->head - parser->tail);
+}
+
+size_t frame_parser_missing(frame_parser_t *parser)
+{
+  uint32_t available = parser->head - parser->tail;
+
+  if (available >= sizeof(pkt_t))
+  {
+    return 1;
+  }
+  return sizeof(pkt_t) - available;
+}
+
+size_t frame_parser_feed(frame_parser_t *parser, const void *buf,
+    size_t count)
+{
+  const uint8_t *bytes = buf;
+  size_t space = frame_parser_space(parser);
+  size_t i;
+
+  if (count > space)
+  {
+    count = space;
+  }
+  for (i = 0; i < count; i++)
+  {
+    parser->data[(parser->head + i) & FRAME_MASK] = bytes[i];
+  }
+  parser->head += count;
+
+  return count;
+}
+
+/**
+ * \brief Drop single byte from the front of parser buffer
+ */
+static void frame_parser_drop(frame_parser_t *parser)
+{
+  if (!parser->skipping)
+  {
+    parser->skipping = 1;
+    parser->resyncs++;
+  }
+  parser->tail++;
+  parser->dropped++;
+}
+
+int frame_parser_next(frame_parser_t *parser, pkt_t *packet)
+{
+  uint8_t *bytes = (uint8_t*) packet;
+  size_t i;
+
+  while (parser->head != parser->tail)
+  {
+    if (parser->data[parser->tail & FRAME_MASK] != 0xff)
+    {
+      frame_parser_drop(parser);
+      continue;
+    }
+    if (parser->head - parser->tail < 2)
+    {
+      return 0;
+    }
+    if (parser->data[(parser->tail + 1) & FRAME_MASK] != parser->command)
+    {
+      frame_parser_drop(parser);
+      continue;
+    }
+    if (parser->head - parser->tail < sizeof(pkt_t))
+    {
+      return 0;
+    }
+
+    for (i = 0; i < sizeof(pkt_t); i++)
+    {
+      bytes[i] = parser->data[(parser->tail + i) & FRAME_MASK];
+    }
+    if (checksum(packet) != packet->checksum)
+    {
+      DEBUG("Dropping frame with invalid checksum 0x%x", packet->checksum);
+      parser->rejects++;
+      frame_parser_drop(parser);
+      continue;
+    }
+
+    parser->tail += sizeof(pkt_t);
+    parser->skipping = 0;
+    parser->frames++;
+    return 1;
+  }
+
+  return 0;
+}
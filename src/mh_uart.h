@@ -15,10 +15,13 @@
  */
 #ifndef MH_UART_H
 #define MH_UART_H
+#include <stddef.h>
 #include <stdint.h>
 
 #define __packed__ __attribute__ ((packed))
 
+#define FRAME_BUFFER_SIZE 64 /**< size of parser buffer, has to be power of 2 */
+
 typedef enum {
   CMD_SWITCH_ABC = 0x79,
   CMD_GAS_CONCENTRATION = 0x86,
@@ -80,6 +83,18 @@ typedef struct {
   uint8_t checksum;
 } __packed__ return_gas_t;
 
+typedef struct {
+  uint8_t data[FRAME_BUFFER_SIZE]; /**< ring buffer of received bytes */
+  uint32_t head; /**< free running index of next byte to be stored */
+  uint32_t tail; /**< free running index of oldest stored byte */
+  uint8_t command; /**< expected second byte of every frame */
+  uint8_t skipping; /**< non-zero if garbage is being skipped */
+  uint32_t frames; /**< number of valid frames extracted */
+  uint32_t rejects; /**< number of frames with invalid checksum */
+  uint32_t dropped; /**< number of bytes dropped as garbage */
+  uint32_t resyncs; /**< number of times stream had to be resynchronized */
+} frame_parser_t;
+
 /**
  * \brief Create packet for reading gas ready to be sent
  *
@@ -120,4 +135,63 @@ uint16_t return_gas_concentration(pkt_t packet);
  * \return checksum
  */
 uint8_t checksum(pkt_t *packet);
+
+/**
+ * \brief Initialize incremental frame parser
+ *
+ * \param parser parser to initialize
+ * \param command second byte of frames to be extracted (command for responses,
+ * sensor number for requests)
+ */
+void frame_parser_init(frame_parser_t *parser, uint8_t command);
+
+/**
+ * \brief Get number of bytes that can be fed into parser
+ *
+ * \param parser initialized parser
+ *
+ * \return free space in parser buffer
+ */
+size_t frame_parser_space(frame_parser_t *parser);
+
+/**
+ * \brief Get number of bytes still needed to complete current frame candidate
+ *
+ * Reading exactly this number of bytes never consumes anything past the end of
+ * frame, so it can be used with blocking reads.
+ *
+ * \param parser initialized parser
+ *
+ * \return number of missing bytes (at least 1)
+ */
+size_t frame_parser_missing(frame_parser_t *parser);
+
+/**
+ * \brief Append received bytes to parser buffer
+ *
+ * \param parser initialized parser
+ * \param buf received bytes
+ * \param count number of bytes in buf
+ *
+ * \return number of bytes accepted, limited by \link frame_parser_space
+ * \endlink
+ */
+size_t frame_parser_feed(frame_parser_t *parser, const void *buf,
+    size_t count);
+
+/**
+ * \brief Extract next valid frame from parser buffer
+ *
+ * Bytes not being part of frame starting with 0xff and expected command or
+ * having invalid checksum are dropped one at a time, so stream resynchronizes
+ * on the next frame boundary.
+ *
+ * \param parser initialized parser
+ * \param packet output frame
+ *
+ * \return extraction indicator
+ * \retval 1 packet filled with valid frame
+ * \retval 0 more data is needed
+ */
+int frame_parser_next(frame_parser_t *parser, pkt_t *packet);
 #endif // MH_UART_H
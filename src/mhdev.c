@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mhdev.h"
+
+struct mhdev {
+  int fd; /**< descriptor of configured device */
+  mhopt_t opts; /**< private copy of options used for every command */
+};
+
+mhdev_t *mhdev_open(const mhopt_t *opts)
+{
+  mhdev_t *dev = NULL;
+  int err = 0;
+
+  if (opts == NULL || opts->device == NULL)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  dev = calloc(1, sizeof(*dev));
+  if (dev == NULL)
+  {
+    return NULL;
+  }
+
+  dev->opts = *opts;
+  dev->opts.device = strdup(opts->device);
+  if (dev->opts.device == NULL)
+  {
+    free(dev);
+    return NULL;
+  }
+
+  dev->fd = open_device(&dev->opts);
+  if (dev->fd < 0)
+  {
+    err = errno;
+    free(dev->opts.device);
+    free(dev);
+    errno = err;
+    return NULL;
+  }
+
+  return dev;
+}
+
+void mhdev_set_timeout(mhdev_t *dev, int64_t timeout, int tries)
+{
+  dev->opts.timeout = timeout;
+  dev->opts.tries = tries;
+}
+
+int mhdev_fd(mhdev_t *dev)
+{
+  return dev->fd;
+}
+
+int mhdev_read_gas(mhdev_t *dev, uint16_t *concentration)
+{
+  int err = 0;
+
+  dev->opts.command = CMD_GAS_CONCENTRATION;
+  if (err = execute_command(dev->fd, &dev->opts))
+  {
+    return err;
+  }
+  *concentration = dev->opts.gas_concentration;
+
+  return 0;
+}
+
+int mhdev_calibrate_zero(mhdev_t *dev)
+{
+  dev->opts.command = CMD_CALIBRATE_ZERO;
+  return execute_command(dev->fd, &dev->opts);
+}
+
+int mhdev_calibrate_span(mhdev_t *dev, uint16_t span_point)
+{
+  dev->opts.command = CMD_CALIBRATE_SPAN;
+  dev->opts.span_point = span_point;
+  return execute_command(dev->fd, &dev->opts);
+}
+
+void mhdev_close(mhdev_t *dev)
+{
+  if (dev == NULL)
+  {
+    return;
+  }
+
+  close(dev->fd);
+  free(dev->opts.device);
+  free(dev);
+}
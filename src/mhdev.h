@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef MHDEV_H
+#define MHDEV_H
+
+#include <stdint.h>
+
+#include "mh.h"
+
+/**
+ * \brief Opaque handle of opened and configured sensor
+ *
+ * Handle keeps all state of the device, so different handles can be used from
+ * different threads at the same time. Single handle must not be used by more
+ * than one thread at once.
+ */
+typedef struct mhdev mhdev_t;
+
+/**
+ * \brief Open device and apply its serial parameters once
+ *
+ * Device stays reserved for the handle until it is closed, other processes
+ * opening it wait in turn (see \link arb_open \endlink).
+ *
+ * \param opts Device name, serial parameters, timeout and number of tries;
+ * command related fields are ignored and options are copied, so they do not
+ * have to outlive the handle (capture they point to has to)
+ *
+ * \return handle or NULL on error (errno set, EINVAL if no device was given,
+ * EBUSY if device was not available within lock_wait)
+ */
+mhdev_t *mhdev_open(const mhopt_t *opts);
+
+/**
+ * \brief Change timeout and number of tries used by following commands
+ *
+ * \param dev Opened handle
+ * \param timeout Number of microseconds single try may take (0 - infinity)
+ * \param tries Number of attempts to perform
+ */
+void mhdev_set_timeout(mhdev_t *dev, int64_t timeout, int tries);
+
+/**
+ * \brief Get descriptor of the device, e.g. for external event loops
+ *
+ * \param dev Opened handle
+ *
+ * \return file descriptor owned by the handle
+ */
+int mhdev_fd(mhdev_t *dev);
+
+/**
+ * \brief Read gas concentration
+ *
+ * \param dev Opened handle
+ * \param concentration Output concentration in ppm
+ *
+ * \return 0 on success or negative error code of \link execute_command
+ * \endlink
+ */
+int mhdev_read_gas(mhdev_t *dev, uint16_t *concentration);
+
+/**
+ * \brief Calibrate zero point
+ *
+ * \param dev Opened handle
+ *
+ * \return 0 on success or negative error code of \link execute_command
+ * \endlink
+ */
+int mhdev_calibrate_zero(mhdev_t *dev);
+
+/**
+ * \brief Calibrate span point
+ *
+ * \param dev Opened handle
+ * \param span_point Span point in ppm
+ *
+ * \return 0 on success or negative error code of \link execute_command
+ * \endlink
+ */
+int mhdev_calibrate_span(mhdev_t *dev, uint16_t span_point);
+
+/**
+ * \brief Close device and release handle
+ *
+ * \param dev Handle to be released (NULL is allowed)
+ */
+void mhdev_close(mhdev_t *dev);
+
+#endif // MHDEV_H
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "mhz14a.h"
+#include "history.h"
+#include "capture.h"
+#include "logger.h"
+#include "config.h"
+
+#define OPT_LOG (CHAR_MAX + 1)
+
+typedef struct {
+  history_t *history;
+  uint64_t samples; /**< number of samples printed */
+} dumpstate_t;
+
+void help(char usage, char *progname)
+{
+  printf("Usage: %s [-f MS] [-t MS] [-a PPM] [-b PPM] [-c] [-s] FILE | -v | -h\n"
+      "       %s -u FILE\n",
+      progname, progname);
+  if (!usage)
+  {
+    printf("\n"
+        "Print samples of history file written by mhz14a --history, one\n"
+        "TIME DEVICE PPM line per sample, TIME in milliseconds since epoch.\n"
+        "Chunks that cannot contain matching samples are not read at all.\n"
+        "\n"
+        "  -f, --from=MS       skip samples taken before MS\n"
+        "  -t, --to=MS         skip samples taken at MS or later\n"
+        "  -a, --above=PPM     skip samples with concentration below PPM\n"
+        "  -b, --below=PPM     skip samples with concentration above PPM\n"
+        "  -c, --chunks        print DEVICE FIRST LAST COUNT MIN MAX BYTES line\n"
+        "                      for every chunk instead of samples\n"
+        "  -s, --stats         print number of chunks and samples and size per\n"
+        "                      sample to stderr\n"
+        "  -u, --uart          FILE is UART capture written by mhz14a --capture,\n"
+        "                      print TIME DEVICE DIRECTION BYTES line for every\n"
+        "                      transfer, TIME in seconds since epoch, DIRECTION\n"
+        "                      > for written, < for read bytes\n"
+        "      --log=LEVEL     set logging verbosity to LEVEL (default: 0 - error)\n"
+        "                      One of the following is allowed (either number or text):\n"
+        "                        0/ERROR; 1/WARNING; 2/INFO; 3/DEBUG\n"
+        "  -v, --version       print version of the program and exit\n"
+        "  -h, --help          print this help information and exit\n"
+        "\n");
+  }
+}
+
+static int print_sample(const history_sample_t *sample, void *arg)
+{
+  dumpstate_t *state = arg;
+
+  printf("%lld %s %d\n", (long long) sample->wall,
+      history_device(state->history, sample->device), sample->ppm);
+  state->samples++;
+  return 0;
+}
+
+static int print_capture(const char *path)
+{
+  capture_reader_t reader;
+  capture_record_t record;
+  uint8_t data[CAPTURE_MAX_DATA + 1];
+  char **names = NULL, **grown;
+  size_t count = 0, i;
+  int64_t wall;
+  FILE *fp;
+  int ret;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+  {
+    perror(path);
+    return RET_FAILED;
+  }
+  if (capture_open_reader(&reader, fp))
+  {
+    ERROR("%s is not UART capture", path);
+    fclose(fp);
+    return RET_FAILED;
+  }
+
+  while ((ret = capture_next(&reader, &record, data)) == 1)
+  {
+    if (record.channel >= count)
+    {
+      grown = realloc(names, (record.channel + 1) * sizeof(char*));
+      if (grown == NULL)
+      {
+        ret = -1;
+        break;
+      }
+      names = grown;
+      while (count <= record.channel)
+      {
+        names[count++] = NULL;
+      }
+    }
+
+    wall = reader.header.realtime + record.time - reader.header.monotonic;
+    if (record.direction == CAPTURE_OPEN)
+    {
+      data[record.length] = '\0';
+      free(names[record.channel]);
+      names[record.channel] = strdup((char*) data);
+      printf("%lld.%09lld %s open\n", (long long)(wall / 1000000000),
+          (long long)(wall % 1000000000), data);
+      continue;
+    }
+    printf("%lld.%09lld %s %c", (long long)(wall / 1000000000),
+        (long long)(wall % 1000000000),
+        names[record.channel] != NULL ? names[record.channel] : "?",
+        record.direction == CAPTURE_TX ? '>' : '<');
+    for (i = 0; i < record.length; i++)
+    {
+      printf(" %02x", data[i]);
+    }
+    printf("\n");
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    free(names[i]);
+  }
+  free(names);
+  fclose(fp);
+  if (ret < 0)
+  {
+    ERROR("%s is corrupted", path);
+    return RET_FAILED;
+  }
+  return RET_SUCCESS;
+}
+
+static int print_chunks(history_t *history, int stats)
+{
+  history_chunk_t chunk;
+  uint64_t chunks = 0, samples = 0, bytes = 0;
+  int ret;
+
+  while ((ret = history_next_chunk(history, &chunk)) == 1)
+  {
+    printf("%s %lld %lld %u %d %d %zu\n",
+        history_device(history, chunk.device), (long long) chunk.first,
+        (long long) chunk.last, chunk.count, chunk.min, chunk.max,
+        sizeof(chunk) + chunk.time_size + chunk.ppm_size);
+    chunks++;
+    samples += chunk.count;
+    bytes += sizeof(chunk) + chunk.time_size + chunk.ppm_size;
+  }
+  if (stats)
+  {
+    fprintf(stderr, "%llu chunks, %llu samples, %.2f bytes per sample\n",
+        (unsigned long long) chunks, (unsigned long long) samples,
+        samples ? (double) bytes / samples : 0);
+  }
+  return ret < 0 ? RET_FAILED : RET_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+  int c;
+  history_t history;
+  history_filter_t filter = {
+    .from = INT64_MIN,
+    .to = INT64_MAX,
+    .min = 0,
+    .max = UINT16_MAX,
+  };
+  dumpstate_t state = { .history = &history, .samples = 0 };
+  int chunks = 0;
+  int stats = 0;
+  int uart = 0;
+  int64_t decoded;
+  int result;
+
+  while (1) {
+    int option_index = 0;
+    static struct option long_options[] = {
+      /* {name, has_arg, flag, val} */
+      {"from", required_argument, 0, 'f' },
+      {"to", required_argument, 0, 't' },
+      {"above", required_argument, 0, 'a' },
+      {"below", required_argument, 0, 'b' },
+      {"chunks", no_argument, 0, 'c' },
+      {"stats", no_argument, 0, 's' },
+      {"uart", no_argument, 0, 'u' },
+      {"log", required_argument, 0, OPT_LOG },
+      {"version", no_argument, 0, 'v' },
+      {"help", no_argument, 0, 'h' },
+      {0, 0, 0, 0 }
+    };
+
+    c = getopt_long(argc, argv, "f:t:a:b:csuvh", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'f':
+        filter.from = atoll(optarg);
+        break;
+
+      case 't':
+        filter.to = atoll(optarg);
+        break;
+
+      case 'a':
+        filter.min = atol(optarg);
+        break;
+
+      case 'b':
+        filter.max = atol(optarg);
+        break;
+
+      case 'c':
+        chunks = 1;
+        break;
+
+      case 's':
+        stats = 1;
+        break;
+
+      case 'u':
+        uart = 1;
+        break;
+
+      case OPT_LOG:
+        if (set_log_level(optarg))
+        {
+          ERROR("unknown log level: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case 'v':
+        printf("mh-z14a history dump version %s\n", MHZ14A_VERSION);
+        return RET_SUCCESS;
+
+      case 'h':
+        help(0, argv[0]);
+        return RET_SUCCESS;
+
+      case '?':
+        return RET_UNPARSED;
+
+      default:
+        WARNING("getopt returned character code 0%o", c);
+    }
+  }
+
+  if (optind != argc - 1) {
+    help(1, argv[0]);
+    return RET_UNPARSED;
+  }
+
+  if (uart)
+  {
+    return print_capture(argv[optind]);
+  }
+
+  if (history_open_reader(&history, argv[optind]))
+  {
+    ERROR("unable to open history %s", argv[optind]);
+    return RET_FAILED;
+  }
+
+  if (chunks)
+  {
+    result = print_chunks(&history, stats);
+    history_close(&history);
+    return result;
+  }
+
+  decoded = history_scan(&history, &filter, print_sample, &state);
+  history_close(&history);
+  if (stats)
+  {
+    fprintf(stderr, "%lld chunks decoded, %llu samples\n",
+        (long long) decoded, (unsigned long long) state.samples);
+  }
+  return decoded < 0 ? RET_FAILED : RET_SUCCESS;
+}
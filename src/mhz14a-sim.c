@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <ctype.h>
+
+#include "mhz14a.h"
+#include "sim.h"
+#include "mh.h"
+#include "logger.h"
+#include "timeutil.h"
+#include "config.h"
+
+#define OPT_LOG (CHAR_MAX + 1)
+
+static sim_t sim;
+
+static void handle_stop(int signum)
+{
+  sim_stop(&sim);
+}
+
+void help(char usage, char *progname)
+{
+  printf("Usage: %s [-n COUNT] [-l TIME] [-j TIME] [-c P] [-x P] [-p P]\n"
+      "       [-w WAVE] [-P PPM] [-a PPM] [-T MS] [-s SEED] [-b BAUD] [-m DPS]\n"
+      "       | -v | -h\n",
+      progname);
+  if (!usage)
+  {
+    printf("\n"
+        "Simulate MH-Z14A sensors on pseudo-terminals. Names of terminals are\n"
+        "printed one per line, then sensors are served until interrupted.\n"
+        "\n"
+        "  -n, --count=COUNT   number of simulated sensors (default: 1)\n"
+        "  -l, --latency=TIME  delay of every response; number of seconds, or\n"
+        "                      value with s, ms or us suffix (default: 0)\n"
+        "  -j, --jitter=TIME   maximum random delay added to latency (default: 0)\n"
+        "  -c, --corrupt=P     probability of corrupting one byte of response\n"
+        "  -x, --drop=P        probability of not responding at all\n"
+        "  -p, --partial=P     probability of sending only part of response\n"
+        "  -w, --waveform=WAVE concentration waveform, one of: constant, sine,\n"
+        "                      ramp, random (default: constant)\n"
+        "  -P, --ppm=PPM       base concentration (default: 600)\n"
+        "  -a, --amplitude=PPM amplitude of waveform (default: 200)\n"
+        "  -T, --period=MS     period of waveform in milliseconds\n"
+        "                      (default: 60000)\n"
+        "  -s, --seed=SEED     seed of fault and waveform generator (default: 1)\n"
+        "  -b, --baud=BAUDRATE only respond to requests sent at BAUDRATE\n"
+        "                      (default: any line settings)\n"
+        "  -m, --mode=DPS      only respond to requests sent in mode DPS, given as\n"
+        "                      D-databits, P-parity and S-stopbits, at 9600 bauds\n"
+        "                      unless -b is given; pseudo-terminals support only\n"
+        "                      8N1 and 8N2 (default: 8N1)\n"
+        "      --log=LEVEL     set logging verbosity to LEVEL (default: 0 - error)\n"
+        "                      One of the following is allowed (either number or text):\n"
+        "                        0/ERROR; 1/WARNING; 2/INFO; 3/DEBUG\n"
+        "  -v, --version       print version of the program and exit\n"
+        "  -h, --help          print this help information and exit\n"
+        "\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int c;
+  int i;
+  simopt_t opts = {
+    .count = 1,
+    .latency = 0,
+    .jitter = 0,
+    .corrupt = 0,
+    .drop = 0,
+    .partial = 0,
+    .waveform = WAVE_CONSTANT,
+    .ppm = 600,
+    .amplitude = 200,
+    .period = 60000,
+    .seed = 1,
+    .baudrate = 0,
+    .stopbits = 10,
+  };
+  struct sigaction sa;
+  int result;
+
+  while (1) {
+    int option_index = 0;
+    static struct option long_options[] = {
+      /* {name, has_arg, flag, val} */
+      {"count", required_argument, 0, 'n' },
+      {"latency", required_argument, 0, 'l' },
+      {"jitter", required_argument, 0, 'j' },
+      {"corrupt", required_argument, 0, 'c' },
+      {"drop", required_argument, 0, 'x' },
+      {"partial", required_argument, 0, 'p' },
+      {"waveform", required_argument, 0, 'w' },
+      {"ppm", required_argument, 0, 'P' },
+      {"amplitude", required_argument, 0, 'a' },
+      {"period", required_argument, 0, 'T' },
+      {"seed", required_argument, 0, 's' },
+      {"baud", required_argument, 0, 'b' },
+      {"mode", required_argument, 0, 'm' },
+      {"log", required_argument, 0, OPT_LOG },
+      {"version", no_argument, 0, 'v' },
+      {"help", no_argument, 0, 'h' },
+      {0, 0, 0, 0 }
+    };
+
+    c = getopt_long(argc, argv, "n:l:j:c:x:p:w:P:a:T:s:b:m:vh",
+        long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        opts.count = atol(optarg);
+        if (opts.count < 1)
+        {
+          ERROR("at least one sensor has to be simulated");
+          return RET_ARG;
+        }
+        break;
+
+      case 'l':
+      case 'j':
+        if (parse_timeout(optarg, c == 'l' ? &opts.latency : &opts.jitter))
+        {
+          ERROR("invalid time: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case 'c':
+        opts.corrupt = atof(optarg);
+        break;
+
+      case 'x':
+        opts.drop = atof(optarg);
+        break;
+
+      case 'p':
+        opts.partial = atof(optarg);
+        break;
+
+      case 'w':
+        if (strcmp(optarg, "constant") == 0)
+        {
+          opts.waveform = WAVE_CONSTANT;
+        }
+        else if (strcmp(optarg, "sine") == 0)
+        {
+          opts.waveform = WAVE_SINE;
+        }
+        else if (strcmp(optarg, "ramp") == 0)
+        {
+          opts.waveform = WAVE_RAMP;
+        }
+        else if (strcmp(optarg, "random") == 0)
+        {
+          opts.waveform = WAVE_RANDOM;
+        }
+        else
+        {
+          ERROR("unknown waveform: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case 'P':
+        opts.ppm = atol(optarg);
+        break;
+
+      case 'a':
+        opts.amplitude = atol(optarg);
+        break;
+
+      case 'T':
+        opts.period = atol(optarg);
+        break;
+
+      case 's':
+        opts.seed = atol(optarg);
+        break;
+
+      case 'b':
+        opts.baudrate = atol(optarg);
+        if (int_to_baud(opts.baudrate) == (speed_t)-1 || opts.baudrate == 0)
+        {
+          ERROR("unsupported baudrate: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case 'm':
+        /* terminal layer forces 8 data bits and no parity on ptys */
+        if (strlen(optarg) != 3 || optarg[0] != '8' ||
+            toupper(optarg[1]) != 'N' ||
+            (optarg[2] != '1' && optarg[2] != '2'))
+        {
+          ERROR("unsupported mode: %s", optarg);
+          return RET_MODE_ERR;
+        }
+        opts.stopbits = (optarg[2] - '0') * 10;
+        break;
+
+      case OPT_LOG:
+        if (set_log_level(optarg))
+        {
+          ERROR("unknown log level: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case 'v':
+        printf("mh-z14a simulator version %s\n", MHZ14A_VERSION);
+        return RET_SUCCESS;
+
+      case 'h':
+        help(0, argv[0]);
+        return RET_SUCCESS;
+
+      case '?':
+        return RET_UNPARSED;
+
+      default:
+        WARNING("getopt returned character code 0%o", c);
+    }
+  }
+
+  if (optind < argc) {
+    ERROR("too many arguments provided!");
+    return RET_UNPARSED;
+  }
+
+  if (opts.baudrate == 0 && opts.stopbits != 10)
+  {
+    /* speed is what enables line checks */
+    opts.baudrate = 9600;
+  }
+
+  if (sim_open(&sim, &opts))
+  {
+    ERROR("unable to create simulated sensors");
+    return RET_INTERNAL;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  for (i = 0; i < sim.opts.count; i++)
+  {
+    printf("%s\n", sim.sensors[i].name);
+  }
+  fflush(stdout);
+
+  result = sim_run(&sim);
+  sim_close(&sim);
+
+  return result ? RET_INTERNAL : RET_SUCCESS;
+}
@@ -23,15 +23,55 @@
 #include "mhz14a.h"
 #include "mh_uart.h"
 #include "mh.h"
+#include "daemon.h"
+#include "batch.h"
+#include "replay.h"
+#include "capture.h"
+#include "detect.h"
+#include "store.h"
+#include "readcache.h"
 #include "logger.h"
+#include "timeutil.h"
+#include "profile.h"
 #include "config.h"
 
 #define OPT_LOG (CHAR_MAX + 1)
+#define OPT_STORE (CHAR_MAX + 2)
+#define OPT_STORE_SIZE (CHAR_MAX + 3)
+#define OPT_BACKOFF (CHAR_MAX + 4)
+#define OPT_BACKOFF_MAX (CHAR_MAX + 5)
+#define OPT_BREAKER (CHAR_MAX + 6)
+#define OPT_PROBE (CHAR_MAX + 7)
+#define OPT_METRICS (CHAR_MAX + 8)
+#define OPT_AUTODETECT (CHAR_MAX + 9)
+#define OPT_DETECT_CACHE (CHAR_MAX + 10)
+#define OPT_IO (CHAR_MAX + 11)
+#define OPT_DEVICES (CHAR_MAX + 12)
+#define OPT_FORMAT (CHAR_MAX + 13)
+#define OPT_DEADLINE (CHAR_MAX + 14)
+#define OPT_SHM (CHAR_MAX + 15)
+#define OPT_MAX_AGE (CHAR_MAX + 16)
+#define OPT_CACHE_FILE (CHAR_MAX + 17)
+#define OPT_LOCK_WAIT (CHAR_MAX + 18)
+#define OPT_NO_LOCK (CHAR_MAX + 19)
+#define OPT_EWMA (CHAR_MAX + 20)
+#define OPT_AVERAGE (CHAR_MAX + 21)
+#define OPT_MEDIAN (CHAR_MAX + 22)
+#define OPT_ROLLUP (CHAR_MAX + 23)
+#define OPT_HISTORY (CHAR_MAX + 24)
+#define OPT_REPLAY (CHAR_MAX + 25)
+#define OPT_CAPTURE (CHAR_MAX + 26)
 
 void help(char usage, char *progname)
 {
-  printf("Usage: %s [-b BAUD] [-m DPS] [-d FILE] [-r | -z | -s SPAN] | -v | -h\n",
-      progname);
+  printf("Usage: %s [-b BAUD] [-m DPS] [-d FILE] [-r | -z | -s SPAN] | -v | -h\n"
+      "       %s [-b BAUD] [-m DPS] [-d FILE] -r [-i MS] [-c N]\n"
+      "       %s [-b BAUD] [-m DPS] [-d FILE]... [--devices=FILE] -r\n"
+      "           [--format=FORMAT] [--deadline=TIME]\n"
+      "       %s [-b BAUD] [-m DPS] [-d FILE]... -D [-i MS] [-c N]\n"
+      "       %s [-d FILE]... --autodetect [-t TIME]\n"
+      "       %s --replay=FILE\n",
+      progname, progname, progname, progname, progname, progname);
   if (!usage)
   {
     printf("\n"
@@ -42,10 +82,76 @@ void help(char usage, char *progname)
         "  -m, --mode=DPS      set mode to D-databits, P-parity and S-stopbits\n"
         "                      (default: 8N1)\n"
         "  -d, --dev=DEVICE    set device at which sensor can be found\n"
-        "                      (default: /dev/ttyS0)\n"
-        "  -t,--timeout=SEC    set number of seconds before timeout to SEC (default:\n"
-        "                      0 - infinity)\n"
+        "                      (default: /dev/ttyS0), can be repeated\n"
+        "      --devices=FILE  add devices listed in FILE, one per line\n"
+        "      --format=FORMAT read all devices at once, printing results as\n"
+        "                      FORMAT, one of: json, csv (default: json if more\n"
+        "                      than one device)\n"
+        "      --deadline=TIME finish reading all devices within TIME\n"
+        "                      (default: 0 - limited only by -t and -T)\n"
+        "      --max-age=MS    with -r, return reading of another process if it\n"
+        "                      is not older than MS, otherwise share own one\n"
+        "      --cache-file=FILE\n"
+        "                      keep readings shared by --max-age in FILE\n"
+        "                      (default: $XDG_RUNTIME_DIR/mhz14a-readings)\n"
+        "  -D, --daemon        keep devices open and read them periodically until\n"
+        "                      interrupted, printing DEVICE PPM lines\n"
+        "  -i, --interval=MS   set number of milliseconds between readings in\n"
+        "                      daemon mode to MS (default: 1000); with -r keep\n"
+        "                      reading until interrupted\n"
+        "  -c, --count=N       stop after N readings in daemon mode or with -r\n"
+        "      --ewma=ALPHA    in daemon mode or with -i, print exponentially\n"
+        "                      weighted moving average (0 < ALPHA <= 1) after\n"
+        "                      every reading\n"
+        "      --average=N     print mean of last N readings after every reading\n"
+        "      --median=N      print median of last N readings after every reading\n"
+        "      --store=FILE    append every reading of daemon to memory-mapped\n"
+        "                      store FILE\n"
+        "      --store-size=N  keep last N readings in store (default: 1048576)\n"
+        "      --history=FILE  append valid readings of daemon to compressed\n"
+        "                      history FILE (see mhz14a-dump)\n"
+        "      --rollup=PREFIX keep min, max, mean, count and last reading of every\n"
+        "                      second, minute and hour in daemon mode in files\n"
+        "                      PREFIX.1s, PREFIX.1m and PREFIX.1h\n"
+        "      --shm=NAME      publish latest reading of every device in daemon\n"
+        "                      mode in shared memory object NAME (e.g. /mhz14a)\n"
+        "      --metrics=SOCKET\n"
+        "                      serve Prometheus metrics on Unix socket SOCKET in\n"
+        "                      daemon mode\n"
+        "      --io=BACKEND    wait for many devices using BACKEND, one of:\n"
+        "                      epoll, uring (default: epoll)\n"
+        "      --autodetect    find baudrate and mode at which sensors on all\n"
+        "                      devices respond, printing DEVICE BAUD DPS lines;\n"
+        "                      -t sets time to wait at every setting\n"
+        "                      (default: 20ms)\n"
+        "      --detect-cache=FILE\n"
+        "                      try settings found last time first, remembering\n"
+        "                      them in FILE (default: ~/.cache/mhz14a-detect,\n"
+        "                      empty - no cache)\n"
+        "      --capture=FILE  record every byte written to and read from devices,\n"
+        "                      with timestamps, into FILE (see --replay and\n"
+        "                      mhz14a-dump -u)\n"
+        "      --replay=FILE   decode raw bytes received from sensor, captured in\n"
+        "                      FILE (- for stdin) as is or by --capture, and\n"
+        "                      print frame, reject and resynchronization counts\n"
+        "                      and decoding speed\n"
+        "  -t,--timeout=TIME   set time single try may take to TIME; number of\n"
+        "                      seconds, or value with s, ms or us suffix\n"
+        "                      (default: 0 - infinity)\n"
         "  -T,--times=TRIES    set number of tries to TRIES (default: 1 - no retry)\n"
+        "      --backoff=TIME  wait TIME before second try, doubling it for every\n"
+        "                      following one (default: 0 - retry immediately)\n"
+        "      --backoff-max=TIME\n"
+        "                      limit backoff to TIME (default: 0 - no limit)\n"
+        "      --breaker=N     in daemon mode, only probe device after N failed\n"
+        "                      readings in a row (default: 0 - never)\n"
+        "      --probe-interval=TIME\n"
+        "                      probe such device every TIME (default: 60s)\n"
+        "      --lock-wait=TIME\n"
+        "                      wait at most TIME for device used by another\n"
+        "                      process, 0 - infinity (default: 5s)\n"
+        "      --no-lock       open device without waiting for other processes\n"
+        "                      and locking it\n"
         "      --log=LEVEL     set logging verbosity to LEVEL (default: 0 - error)\n"
         "                      One of the following is allowed (either number or text):\n"
         "                        0/ERROR; 1/WARNING; 2/INFO; 3/DEBUG\n"
@@ -55,6 +161,124 @@ void help(char usage, char *progname)
   }
 }
 
+/**
+ * \brief Start capturing traffic of devices, if requested
+ *
+ * \param opts Options of devices to attach capture to
+ * \param path Filename of capture (NULL - no capture)
+ *
+ * \return non-zero if capture was requested but could not be started
+ */
+static int start_capture(mhopt_t *opts, const char *path)
+{
+  if (path == NULL)
+  {
+    return 0;
+  }
+  opts->capture = capture_open(path);
+  if (opts->capture == NULL)
+  {
+    ERROR("unable to capture traffic to %s", path);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * \brief Read device through cache shared with other processes
+ *
+ * \param opts Device and serial parameters
+ * \param max_age Maximum age of reading taken from cache in microseconds
+ * \param path Filename of cache
+ *
+ * \return result of \link process_command \endlink
+ */
+static int cached_read(mhopt_t *opts, int64_t max_age, const char *path)
+{
+  readcache_t cache;
+  int result, cached;
+
+  if (readcache_open(&cache, path))
+  {
+    /* cache is only an optimization, reading has to work without it */
+    WARNING("unable to open reading cache %s", path);
+    return process_command(opts);
+  }
+  result = readcache_read(&cache, opts, max_age, &cached);
+  if (cached)
+  {
+    INFO("%s: using reading shared by another process", opts->device);
+  }
+  readcache_close(&cache);
+  return result;
+}
+
+/**
+ * \brief Detect settings of all devices and print them
+ *
+ * \param devices List of device filenames
+ * \param count Number of devices
+ * \param timeout Microseconds to wait at every setting (0 - default)
+ * \param cache Filename of detection cache (NULL - no cache)
+ * \param lock_wait Microseconds to wait for other users of device
+ * \param capture Capture recording traffic of devices (NULL - not captured)
+ *
+ * \return exit code of the program
+ */
+static int run_autodetect(char **devices, int count, int64_t timeout,
+    const char *cache, int64_t lock_wait, capture_t *capture)
+{
+  lineopt_t candidates[1024];
+  detectdev_t *devs;
+  int i, ncandidates, found;
+
+  devs = calloc(count, sizeof(detectdev_t));
+  if (devs == NULL)
+  {
+    ERROR("out of memory");
+    return RET_INTERNAL;
+  }
+  for (i = 0; i < count; i++)
+  {
+    devs[i].device = devices[i];
+  }
+  if (cache != NULL && detect_cache_load(cache, devs, count) < 0)
+  {
+    WARNING("unable to load detection cache %s", cache);
+  }
+
+  ncandidates = detect_candidates(candidates,
+      sizeof(candidates) / sizeof(lineopt_t));
+  found = detect_run(devs, count, candidates, ncandidates,
+      timeout != 0 ? timeout : DETECT_DEFAULT_TIMEOUT, lock_wait, capture);
+  if (found < 0)
+  {
+    free(devs);
+    return RET_INTERNAL;
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    INFO("%s: %d settings tried in %lldms", devs[i].device, devs[i].tries,
+        (long long)(devs[i].elapsed / NSEC_PER_MSEC));
+    if (devs[i].state == DETECT_FOUND)
+    {
+      printf("%s %d %d%c%d\n", devs[i].device, devs[i].line.baudrate,
+          devs[i].line.databits, devs[i].line.parity,
+          devs[i].line.stopbits / 10);
+    }
+  }
+  fflush(stdout);
+
+  if (cache != NULL && detect_cache_store(cache, devs, count))
+  {
+    WARNING("unable to store detection cache %s", cache);
+  }
+  free(devs);
+
+  return found == count ? RET_SUCCESS : RET_UNDETECTED;
+}
+
 int main(int argc, char **argv)
 {
   int c;
@@ -72,9 +296,51 @@ int main(int argc, char **argv)
     .span_point = 0,
     .timeout = 0,
     .tries = 1,
+    .backoff = 0,
+    .backoff_max = 0,
+    .breaker = 0,
+    .probe_interval = 60000000,
+    .lock_wait = LOCK_WAIT_DEFAULT,
   };
+  daemonopt_t dopts = {
+    .devices = NULL,
+    .device_count = 0,
+    .interval = 1000,
+    .store = NULL,
+    .store_size = STORE_DEFAULT_CAPACITY,
+    .metrics = NULL,
+    .shm = NULL,
+    .rollup = NULL,
+    .history = NULL,
+    .count = 0,
+    .plain = 0,
+    .filters = { .alpha = 0, .average = 0, .median = 0 },
+    .uring = 0,
+  };
+  batchopt_t bopts = {
+    .devices = NULL,
+    .device_count = 0,
+    .deadline = 0,
+    .format = BATCH_JSON,
+    .uring = 0,
+  };
+  char *default_device = "/dev/ttyS0";
+  char **devices = NULL;
+  int daemon_mode = 0;
+  int continuous = 0;
+  int autodetect = 0;
+  const char *replay = NULL;
+  const char *capture = NULL;
+  int batch = 0;
+  int batch_output = 0;
+  int device_list = 0;
+  const char *detect_cache = detect_cache_default();
+  const char *cache_file = readcache_default();
+  int64_t max_age = 0;
   int result;
 
+  PROFILE_INIT();
+
   while (1) {
     int this_option_optind = optind ? optind : 1;
     int option_index = 0;
@@ -84,6 +350,32 @@ int main(int argc, char **argv)
       {"baud", required_argument, 0, 'b' },
       {"mode", required_argument, 0, 'm' },
       {"dev", required_argument, 0, 'd' },
+      {"devices", required_argument, 0, OPT_DEVICES },
+      /* batch reading */
+      {"format", required_argument, 0, OPT_FORMAT },
+      {"deadline", required_argument, 0, OPT_DEADLINE },
+      /* daemon mode */
+      {"daemon", no_argument, 0, 'D' },
+      {"interval", required_argument, 0, 'i' },
+      {"count", required_argument, 0, 'c' },
+      {"store", required_argument, 0, OPT_STORE },
+      {"store-size", required_argument, 0, OPT_STORE_SIZE },
+      {"metrics", required_argument, 0, OPT_METRICS },
+      {"shm", required_argument, 0, OPT_SHM },
+      {"rollup", required_argument, 0, OPT_ROLLUP },
+      {"history", required_argument, 0, OPT_HISTORY },
+      {"ewma", required_argument, 0, OPT_EWMA },
+      {"average", required_argument, 0, OPT_AVERAGE },
+      {"median", required_argument, 0, OPT_MEDIAN },
+      /* sharing readings between processes */
+      {"max-age", required_argument, 0, OPT_MAX_AGE },
+      {"cache-file", required_argument, 0, OPT_CACHE_FILE },
+      {"io", required_argument, 0, OPT_IO },
+      /* autodetection */
+      {"autodetect", no_argument, 0, OPT_AUTODETECT },
+      {"detect-cache", required_argument, 0, OPT_DETECT_CACHE },
+      {"replay", required_argument, 0, OPT_REPLAY },
+      {"capture", required_argument, 0, OPT_CAPTURE },
       /* MH-Z14A functions */
       {"read", no_argument, 0, 'r' },
       {"zero", no_argument, 0, 'z' },
@@ -91,13 +383,19 @@ int main(int argc, char **argv)
       /* general */
       {"timeout", required_argument, 0, 't' },
       {"times", required_argument, 0, 'T' },
+      {"backoff", required_argument, 0, OPT_BACKOFF },
+      {"backoff-max", required_argument, 0, OPT_BACKOFF_MAX },
+      {"breaker", required_argument, 0, OPT_BREAKER },
+      {"probe-interval", required_argument, 0, OPT_PROBE },
+      {"lock-wait", required_argument, 0, OPT_LOCK_WAIT },
+      {"no-lock", no_argument, 0, OPT_NO_LOCK },
       {"log", required_argument, 0, OPT_LOG },
       {"version", no_argument, 0, 'v' },
       {"help", no_argument, 0, 'h' },
       {0, 0, 0, 0 }
     };
 
-    c = getopt_long(argc, argv, "b:m:d:rzs:t:T:vh",
+    c = getopt_long(argc, argv, "b:m:d:Di:c:rzs:t:T:vh",
         long_options, &option_index);
     if (c == -1)
       break;
@@ -146,6 +444,204 @@ int main(int argc, char **argv)
       case 'd':
         /* --device=FILE */
         opts.device = strdup(optarg); // TODO: call free()
+        devices = realloc(devices, (dopts.device_count + 1) * sizeof(char*));
+        if (devices == NULL)
+        {
+          ERROR("out of memory");
+          return RET_INTERNAL;
+        }
+        devices[dopts.device_count++] = opts.device;
+        break;
+
+      case OPT_DEVICES:
+        /* --devices=FILE */
+        switch (batch_load_devices(optarg, &devices, &dopts.device_count))
+        {
+          case 0: break;
+          case -1:
+            ERROR("unable to read device list %s", optarg);
+            return RET_ARG;
+          default:
+            ERROR("out of memory");
+            return RET_INTERNAL;
+        }
+        batch = device_list = 1;
+        break;
+
+      case OPT_FORMAT:
+        /* --format=FORMAT */
+        if (strcmp(optarg, "json") == 0)
+        {
+          bopts.format = BATCH_JSON;
+        }
+        else if (strcmp(optarg, "csv") == 0)
+        {
+          bopts.format = BATCH_CSV;
+        }
+        else
+        {
+          ERROR("unknown output format: %s", optarg);
+          return RET_ARG;
+        }
+        batch = batch_output = 1;
+        break;
+
+      case OPT_DEADLINE:
+        /* --deadline=TIME */
+        if (parse_timeout(optarg, &bopts.deadline))
+        {
+          ERROR("invalid deadline: %s", optarg);
+          return RET_ARG;
+        }
+        batch = batch_output = 1;
+        break;
+
+      case 'D':
+        /* --daemon */
+        daemon_mode = 1;
+        break;
+
+      case 'i':
+        /* --interval=MS */
+        dopts.interval = atol(optarg); // TODO: maybe safer ?
+        if (dopts.interval < 1)
+        {
+          ERROR("interval has to be positive");
+          return RET_ARG;
+        }
+        continuous = 1;
+        break;
+
+      case 'c':
+        /* --count=N */
+        dopts.count = atol(optarg); // TODO: maybe safer ?
+        if (dopts.count < 1)
+        {
+          ERROR("count has to be positive");
+          return RET_ARG;
+        }
+        continuous = 1;
+        break;
+
+      case OPT_STORE:
+        /* --store=FILE */
+        dopts.store = optarg;
+        break;
+
+      case OPT_STORE_SIZE:
+        /* --store-size=N */
+        dopts.store_size = strtoull(optarg, NULL, 10);
+        if (dopts.store_size == 0)
+        {
+          ERROR("store size has to be positive");
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_METRICS:
+        /* --metrics=SOCKET */
+        dopts.metrics = optarg;
+        break;
+
+      case OPT_SHM:
+        /* --shm=NAME */
+        dopts.shm = optarg;
+        break;
+
+      case OPT_ROLLUP:
+        /* --rollup=PREFIX */
+        dopts.rollup = optarg;
+        break;
+
+      case OPT_HISTORY:
+        /* --history=FILE */
+        dopts.history = optarg;
+        break;
+
+      case OPT_EWMA:
+        /* --ewma=ALPHA */
+        dopts.filters.alpha = atof(optarg);
+        if (dopts.filters.alpha <= 0 || dopts.filters.alpha > 1)
+        {
+          ERROR("EWMA weight has to be between 0 and 1");
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_AVERAGE:
+        /* --average=N */
+        dopts.filters.average = atoi(optarg);
+        if (dopts.filters.average < 1 ||
+            dopts.filters.average > FILTER_MAX_WINDOW)
+        {
+          ERROR("average window has to be between 1 and %d",
+              FILTER_MAX_WINDOW);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_MEDIAN:
+        /* --median=N */
+        dopts.filters.median = atoi(optarg);
+        if (dopts.filters.median < 1 ||
+            dopts.filters.median > FILTER_MAX_WINDOW)
+        {
+          ERROR("median window has to be between 1 and %d",
+              FILTER_MAX_WINDOW);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_MAX_AGE:
+        /* --max-age=MS */
+        max_age = atol(optarg) * 1000LL;
+        if (max_age < 1)
+        {
+          ERROR("maximum age has to be positive");
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_CACHE_FILE:
+        /* --cache-file=FILE */
+        cache_file = optarg;
+        break;
+
+      case OPT_IO:
+        /* --io=BACKEND */
+        if (strcmp(optarg, "epoll") == 0)
+        {
+          dopts.uring = 0;
+        }
+        else if (strcmp(optarg, "uring") == 0)
+        {
+          dopts.uring = 1;
+        }
+        else
+        {
+          ERROR("unknown IO backend: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_AUTODETECT:
+        /* --autodetect */
+        autodetect = 1;
+        break;
+
+      case OPT_DETECT_CACHE:
+        /* --detect-cache=FILE */
+        detect_cache = optarg[0] != '\0' ? optarg : NULL;
+        break;
+
+      case OPT_REPLAY:
+        /* --replay=FILE */
+        replay = optarg;
+        break;
+
+      case OPT_CAPTURE:
+        /* --capture=FILE */
+        capture = optarg;
         break;
 
       case 'r':
@@ -183,8 +679,12 @@ int main(int argc, char **argv)
         break;
 
       case 't':
-        /* --timeout=SEC */
-        opts.timeout = atol(optarg); // TODO: maybe safer ?
+        /* --timeout=TIME */
+        if (parse_timeout(optarg, &opts.timeout))
+        {
+          ERROR("invalid timeout: %s", optarg);
+          return RET_ARG;
+        }
         break;
 
       case 'T':
@@ -192,6 +692,58 @@ int main(int argc, char **argv)
         opts.tries = atol(optarg); // TODO: maybe safer ?
         break;
 
+      case OPT_BACKOFF:
+        /* --backoff=TIME */
+        if (parse_timeout(optarg, &opts.backoff))
+        {
+          ERROR("invalid backoff: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_BACKOFF_MAX:
+        /* --backoff-max=TIME */
+        if (parse_timeout(optarg, &opts.backoff_max))
+        {
+          ERROR("invalid backoff limit: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_BREAKER:
+        /* --breaker=N */
+        opts.breaker = atol(optarg); // TODO: maybe safer ?
+        if (opts.breaker < 0)
+        {
+          ERROR("breaker threshold cannot be negative");
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_PROBE:
+        /* --probe-interval=TIME */
+        if (parse_timeout(optarg, &opts.probe_interval) ||
+            opts.probe_interval == 0)
+        {
+          ERROR("invalid probe interval: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_LOCK_WAIT:
+        /* --lock-wait=TIME */
+        if (parse_timeout(optarg, &opts.lock_wait))
+        {
+          ERROR("invalid lock wait time: %s", optarg);
+          return RET_ARG;
+        }
+        break;
+
+      case OPT_NO_LOCK:
+        /* --no-lock */
+        opts.lock_wait = -1;
+        break;
+
       case OPT_LOG:
         /* --log */
         if (set_log_level(optarg))
@@ -227,6 +779,196 @@ int main(int argc, char **argv)
     return RET_UNPARSED;
   }
 
+  if (replay != NULL)
+  {
+    if (opts.command != 0 || daemon_mode || continuous || autodetect ||
+        batch || dopts.device_count > 0 || capture != NULL)
+    {
+      ERROR("replay cannot be combined with devices, commands or other modes");
+      free(devices);
+      return RET_ARG;
+    }
+    return run_replay(replay, stdout) == 0 ? RET_SUCCESS : RET_FAILED;
+  }
+
+  if (autodetect)
+  {
+    if (opts.command != 0 || daemon_mode || continuous)
+    {
+      ERROR("autodetection cannot be combined with commands or daemon mode");
+      free(devices);
+      return RET_ARG;
+    }
+    if (start_capture(&opts, capture))
+    {
+      free(devices);
+      return RET_FAILED;
+    }
+    if (dopts.device_count == 0)
+    {
+      result = run_autodetect(&default_device, 1, opts.timeout, detect_cache,
+          opts.lock_wait, opts.capture);
+    }
+    else
+    {
+      result = run_autodetect(devices, dopts.device_count, opts.timeout,
+          detect_cache, opts.lock_wait, opts.capture);
+    }
+    capture_close(opts.capture);
+    free(devices);
+    return result;
+  }
+
+  if (max_age > 0 && (opts.command != CMD_GAS_CONCENTRATION || daemon_mode ||
+        continuous || batch || dopts.device_count > 1))
+  {
+    ERROR("maximum age applies only to single reading of one device");
+    free(devices);
+    return RET_ARG;
+  }
+
+  if (continuous && !daemon_mode)
+  {
+    /* repeated reading of single device, printed as plain -r would */
+    if (opts.command != CMD_GAS_CONCENTRATION)
+    {
+      ERROR("only reading can be repeated");
+      free(devices);
+      return RET_ARG;
+    }
+    if (dopts.device_count > 1)
+    {
+      ERROR("multiple devices are supported only in daemon mode");
+      free(devices);
+      return RET_ARG;
+    }
+    daemon_mode = 1;
+    dopts.plain = 1;
+  }
+
+  if (daemon_mode)
+  {
+    if (opts.command != 0 && opts.command != CMD_GAS_CONCENTRATION)
+    {
+      ERROR("only reading is supported in daemon mode");
+      free(devices);
+      return RET_ARG;
+    }
+    if (batch_output)
+    {
+      ERROR("output format and deadline apply only to single reading");
+      free(devices);
+      return RET_ARG;
+    }
+
+    if (dopts.device_count == 0)
+    {
+      dopts.devices = &default_device;
+      dopts.device_count = 1;
+    }
+    else
+    {
+      dopts.devices = devices;
+    }
+
+    /* keep stderr writes off the polling path */
+    if (log_async_start())
+    {
+      WARNING("unable to start asynchronous logging");
+    }
+    if (start_capture(&opts, capture))
+    {
+      log_async_stop();
+      free(devices);
+      return RET_FAILED;
+    }
+    result = run_daemon(&opts, &dopts);
+    capture_close(opts.capture);
+    if (result != 0)
+    {
+      ERROR("Daemon returned %d", result);
+    }
+    log_async_stop();
+    free(devices);
+    switch (result)
+    {
+      case 0:
+        fprintf(stderr, "%d cycles, %d failed readings, %d skipped deadlines, "
+            "jitter avg %lldus max %lldus\n", dopts.cycles, dopts.failed,
+            dopts.skipped, dopts.cycles > 1 ?
+            (long long)(dopts.jitter_sum / (dopts.cycles - 1) / NSEC_PER_USEC) :
+            0, (long long)(dopts.jitter_max / NSEC_PER_USEC));
+        return dopts.failed > 0 ? RET_FAILED : RET_SUCCESS;
+      case -1:
+        return RET_FAILED;
+      case -2:
+        return RET_ARG;
+      default:
+        return RET_INTERNAL;
+    }
+  }
+
+  if (dopts.filters.alpha > 0 || dopts.filters.average > 0 ||
+      dopts.filters.median > 0)
+  {
+    ERROR("filters apply only to continuous reading and daemon mode");
+    free(devices);
+    return RET_ARG;
+  }
+
+  if (dopts.store != NULL || dopts.metrics != NULL || dopts.shm != NULL ||
+      dopts.rollup != NULL || dopts.history != NULL)
+  {
+    ERROR("store, rollups, history, metrics and shared memory are supported "
+        "only in daemon mode");
+    free(devices);
+    return RET_ARG;
+  }
+
+  if (dopts.device_count > 1 || batch)
+  {
+    /* single pass over all devices at once */
+    if (opts.command != CMD_GAS_CONCENTRATION)
+    {
+      ERROR("only reading is supported for multiple devices");
+      free(devices);
+      return RET_ARG;
+    }
+    if (dopts.device_count == 0 && device_list)
+    {
+      ERROR("no devices listed");
+      free(devices);
+      return RET_ARG;
+    }
+
+    if (dopts.device_count == 0)
+    {
+      bopts.devices = &default_device;
+      bopts.device_count = 1;
+    }
+    else
+    {
+      bopts.devices = devices;
+      bopts.device_count = dopts.device_count;
+    }
+    bopts.uring = dopts.uring;
+    if (start_capture(&opts, capture))
+    {
+      free(devices);
+      return RET_FAILED;
+    }
+    result = run_batch(&opts, &bopts, stdout);
+    capture_close(opts.capture);
+    free(devices);
+    if (result != 0)
+    {
+      ERROR("Batch returned %d", result);
+      return RET_INTERNAL;
+    }
+    return bopts.failed > 0 ? RET_FAILED : RET_SUCCESS;
+  }
+  free(devices);
+
   /* check if command was already given */
   if (opts.command == 0)
   {
@@ -234,7 +976,23 @@ int main(int argc, char **argv)
     return RET_NOCMD;
   }
 
-  result = process_command(&opts);
+  if (start_capture(&opts, capture))
+  {
+    return RET_FAILED;
+  }
+  if (max_age > 0)
+  {
+    if (opts.device == NULL)
+    {
+      opts.device = default_device;
+    }
+    result = cached_read(&opts, max_age, cache_file);
+  }
+  else
+  {
+    result = process_command(&opts);
+  }
+  capture_close(opts.capture);
   if (result != 0)
   {
     ERROR("Execution returned %d", result);
@@ -23,6 +23,8 @@ typedef enum {
   RET_MODE_ERR,
   RET_ARG,
   RET_UNPARSED,
+  RET_UNDETECTED,
+  RET_FAILED,
   RET_INTERNAL = 255
 } result_t;
 
@@ -0,0 +1,980 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "profile.h"
+#include "capture.h"
+#include "poller.h"
+#include "config.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+
+#define MAX_EVENTS 64
+#define URING_MAX_ENTRIES 4096
+
+#ifdef HAVE_IO_URING
+typedef enum {
+  OP_WRITE = 1, /**< write of request */
+  OP_READ, /**< read of response */
+  OP_POLL, /**< wait for readiness of device */
+  OP_TIMEOUT, /**< timeout linked to read or wait */
+  OP_BACKOFF, /**< end of backoff */
+} uringop_t;
+
+typedef struct {
+  uint8_t buf[FRAME_BUFFER_SIZE]; /**< destination of read in flight */
+  struct __kernel_timespec deadline; /**< absolute end of try or backoff */
+  int inflight; /**< operations submitted but not completed yet */
+  int timed_out; /**< linked timeout expired */
+  int again; /**< device was not ready, readiness has to be awaited */
+  int error; /**< errno reported by last operations (0 - none) */
+} uringdev_t;
+
+typedef struct {
+  uring_t ring; /**< io_uring instance */
+  uringdev_t *devs; /**< backend state of every device */
+} uringstate_t;
+
+static void uring_send(poller_t *poller, polldev_t *dev);
+static void uring_backoff(poller_t *poller, polldev_t *dev);
+#endif
+
+/**
+ * \brief Change set of events device is waiting for
+ *
+ * Descriptor is registered only while it waits for some events, because epoll
+ * reports hangups and errors regardless of requested events, so idle
+ * disconnected device would wake up every wait.
+ */
+static int set_events(poller_t *poller, polldev_t *dev, uint32_t events)
+{
+  struct epoll_event ev;
+  int op;
+
+  if (dev->events == events)
+  {
+    return 0;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = dev;
+  if (events == 0)
+  {
+    op = EPOLL_CTL_DEL;
+  }
+  else
+  {
+    op = dev->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  }
+  if (epoll_ctl(poller->epfd, op, dev->fd, &ev) == -1)
+  {
+    ERROR("%s: epoll_ctl: %s", dev->device, strerror(errno));
+    return -1;
+  }
+  dev->events = events;
+  return 0;
+}
+
+static void finish(poller_t *poller, polldev_t *dev, int error)
+{
+  struct timespec now;
+
+  timespec_now(&now);
+  dev->latency = timespec_diff_ns(&now, &dev->started);
+  dev->error = error;
+  dev->stats.transactions++;
+  dev->stats.failures += error != 0;
+  dev->stats.checksum_errors += dev->parser.rejects + (error == -5);
+  dev->state = error ? POLL_FAILED : POLL_DONE;
+  poller->pending--;
+  set_events(poller, dev, 0);
+  if (breaker_record(&dev->breaker, error == 0, &now))
+  {
+    WARNING("%s: %d consecutive failures, device will only be probed",
+        dev->device, dev->breaker.failures);
+  }
+}
+
+static void start_try(poller_t *poller, polldev_t *dev);
+
+/**
+ * \brief Check if tries are bounded by time, either own or of whole cycle
+ */
+static int try_limited(poller_t *poller)
+{
+  return poller->opts.timeout != 0 || poller->has_limit;
+}
+
+/**
+ * \brief Check if deadline of whole cycle is reached before given time
+ */
+static int beyond_limit(poller_t *poller, struct timespec *when)
+{
+  return poller->has_limit && timespec_diff_ns(&poller->limit, when) <= 0;
+}
+
+/**
+ * \brief Check if wait interrupted by signal has to end the cycle
+ */
+static int cancelled(poller_t *poller)
+{
+  return poller->cancel != NULL && *poller->cancel;
+}
+
+/**
+ * \brief Handle failure of current try, either retrying or failing device
+ */
+static void fail_try(poller_t *poller, polldev_t *dev, int error)
+{
+  struct timespec now;
+
+  timespec_now(&now);
+  if (dev->tries > 0 && !beyond_limit(poller, &now))
+  {
+    INFO("%s: retrying, %d tries left", dev->device, dev->tries);
+    if (poller->opts.backoff > 0)
+    {
+      /* retry is started by expire() once backoff passes */
+      dev->state = POLL_BACKOFF;
+      set_events(poller, dev, 0);
+      dev->deadline = now;
+      timespec_add_ns(&dev->deadline, NSEC_PER_USEC * backoff_delay(
+            poller->opts.backoff, poller->opts.backoff_max,
+            poller->opts.tries - dev->tries, &poller->seed));
+      if (beyond_limit(poller, &dev->deadline))
+      {
+        /* there would be no time left for another try */
+        ERROR("%s: transaction failed", dev->device);
+        finish(poller, dev, error);
+        return;
+      }
+#ifdef HAVE_IO_URING
+      if (poller->uring != NULL)
+      {
+        uring_backoff(poller, dev);
+      }
+#endif
+      return;
+    }
+    start_try(poller, dev);
+    return;
+  }
+  ERROR("%s: transaction failed", dev->device);
+  finish(poller, dev, error);
+}
+
+static void do_write(poller_t *poller, polldev_t *dev)
+{
+  ssize_t processed;
+
+  while (dev->written < sizeof(dev->request))
+  {
+    PROFILE_BEGIN(prof_write);
+    processed = write(dev->fd, (uint8_t*) &dev->request + dev->written,
+        sizeof(dev->request) - dev->written);
+    PROFILE_END(PROF_IO_WRITE, prof_write);
+    if (processed == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        if (set_events(poller, dev, EPOLLOUT))
+        {
+          fail_try(poller, dev, -3);
+        }
+        return;
+      }
+      ERROR("%s: write: %s", dev->device, strerror(errno));
+      fail_try(poller, dev, -3);
+      return;
+    }
+    if (poller->opts.capture != NULL)
+    {
+      capture_io(poller->opts.capture, dev->fd, CAPTURE_TX,
+          (uint8_t*) &dev->request + dev->written, processed);
+    }
+    dev->written += processed;
+    dev->stats.bytes_out += processed;
+  }
+
+  dev->state = POLL_READING;
+  if (set_events(poller, dev, EPOLLIN))
+  {
+    fail_try(poller, dev, -3);
+  }
+}
+
+static void accept_response(poller_t *poller, polldev_t *dev, pkt_t response)
+{
+  uint16_t result;
+
+  result = return_gas_concentration(response);
+  if (result == (uint16_t)-1)
+  {
+    ERROR("%s: invalid response", dev->device);
+    finish(poller, dev, -5);
+    return;
+  }
+  dev->gas_concentration = result;
+  finish(poller, dev, 0);
+}
+
+static void do_read(poller_t *poller, polldev_t *dev)
+{
+  uint8_t buf[FRAME_BUFFER_SIZE];
+  ssize_t processed;
+  pkt_t response;
+
+  while (!frame_parser_next(&dev->parser, &response))
+  {
+    PROFILE_BEGIN(prof_read);
+    processed = read(dev->fd, buf, frame_parser_space(&dev->parser));
+    PROFILE_END(PROF_IO_READ, prof_read);
+    if (processed == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        return;
+      }
+      ERROR("%s: read: %s", dev->device, strerror(errno));
+      fail_try(poller, dev, -3);
+      return;
+    }
+    if (processed == 0)
+    {
+      /* nothing more to read now */
+      return;
+    }
+    if (poller->opts.capture != NULL)
+    {
+      capture_io(poller->opts.capture, dev->fd, CAPTURE_RX, buf, processed);
+    }
+    frame_parser_feed(&dev->parser, buf, processed);
+    dev->stats.bytes_in += processed;
+  }
+
+  accept_response(poller, dev, response);
+}
+
+static void start_try(poller_t *poller, polldev_t *dev)
+{
+  if (dev->tries < poller->opts.tries)
+  {
+    dev->stats.retries++;
+  }
+  dev->tries--;
+  dev->state = POLL_WRITING;
+  dev->written = 0;
+  if (poller->opts.timeout != 0)
+  {
+    timespec_now(&dev->deadline);
+    timespec_add_ns(&dev->deadline, poller->opts.timeout * NSEC_PER_USEC);
+  }
+  if (poller->has_limit &&
+      (poller->opts.timeout == 0 || beyond_limit(poller, &dev->deadline)))
+  {
+    /* no try may outlast the cycle */
+    dev->deadline = poller->limit;
+  }
+
+#ifdef HAVE_IO_URING
+  if (poller->uring != NULL)
+  {
+    uring_send(poller, dev);
+    return;
+  }
+#endif
+  /* most of the time whole request fits into output buffer at once */
+  do_write(poller, dev);
+}
+
+/**
+ * \brief Check if device has deadline that has to be waited for
+ */
+static int has_deadline(poller_t *poller, polldev_t *dev)
+{
+  if (dev->state == POLL_BACKOFF)
+  {
+    return 1;
+  }
+  return try_limited(poller) &&
+    (dev->state == POLL_WRITING || dev->state == POLL_READING);
+}
+
+/**
+ * \brief Compute epoll timeout until earliest deadline of pending devices
+ */
+static int next_timeout(poller_t *poller)
+{
+  struct timespec now;
+  int64_t ns, min_ns = -1;
+  int i;
+
+  if (!try_limited(poller) && poller->opts.backoff == 0)
+  {
+    return -1;
+  }
+
+  timespec_now(&now);
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    if (!has_deadline(poller, dev))
+    {
+      continue;
+    }
+    ns = timespec_diff_ns(&dev->deadline, &now);
+    if (ns < 0)
+    {
+      ns = 0;
+    }
+    if (min_ns < 0 || ns < min_ns)
+    {
+      min_ns = ns;
+    }
+  }
+
+  if (min_ns < 0)
+  {
+    return -1;
+  }
+  /* round up, so that deadline is already reached after waking up */
+  return (min_ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+static void expire(poller_t *poller)
+{
+  struct timespec now;
+  int i;
+
+  if (!try_limited(poller) && poller->opts.backoff == 0)
+  {
+    return;
+  }
+
+  timespec_now(&now);
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    if (!has_deadline(poller, dev) ||
+        timespec_diff_ns(&dev->deadline, &now) > 0)
+    {
+      continue;
+    }
+    if (dev->state == POLL_BACKOFF)
+    {
+      start_try(poller, dev);
+    }
+    else
+    {
+      ERROR("%s: timeout", dev->device);
+      dev->stats.timeouts++;
+      fail_try(poller, dev, -3);
+    }
+  }
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * \brief Queue operation of device, tagging it with device index and type
+ */
+static struct io_uring_sqe *queue_op(poller_t *poller, polldev_t *dev,
+    uringop_t op, uint8_t opcode)
+{
+  uringstate_t *state = poller->uring;
+  struct io_uring_sqe *sqe;
+  int index = dev - poller->devs;
+
+  sqe = uring_sqe(&state->ring);
+  if (sqe == NULL)
+  {
+    ERROR("%s: io_uring: %s", dev->device, strerror(errno));
+    return NULL;
+  }
+  sqe->opcode = opcode;
+  sqe->fd = (op == OP_TIMEOUT || op == OP_BACKOFF) ? -1 : dev->fd;
+  sqe->user_data = (uint64_t) index << 8 | op;
+  state->devs[index].inflight++;
+  return sqe;
+}
+
+/**
+ * \brief Queue rest of request and read of response, or wait for readiness,
+ * with timeout linked to the last operation
+ */
+static void uring_send(poller_t *poller, polldev_t *dev)
+{
+  uringstate_t *state = poller->uring;
+  uringdev_t *udev = &state->devs[dev - poller->devs];
+  struct io_uring_sqe *sqe;
+
+  udev->timed_out = 0;
+  udev->error = 0;
+  if (udev->again)
+  {
+    /* kernel did not wait for readiness itself */
+    udev->again = 0;
+    sqe = queue_op(poller, dev, OP_POLL, IORING_OP_POLL_ADD);
+    if (sqe == NULL)
+    {
+      finish(poller, dev, -3);
+      return;
+    }
+    sqe->poll_events = dev->state == POLL_WRITING ? POLLOUT : POLLIN;
+  }
+  else
+  {
+    if (dev->state == POLL_WRITING)
+    {
+      sqe = queue_op(poller, dev, OP_WRITE, IORING_OP_WRITE);
+      if (sqe == NULL)
+      {
+        finish(poller, dev, -3);
+        return;
+      }
+      sqe->addr = (uintptr_t)((uint8_t*) &dev->request + dev->written);
+      sqe->len = sizeof(dev->request) - dev->written;
+      /* read is started only once request is fully written */
+      sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe = queue_op(poller, dev, OP_READ, IORING_OP_READ);
+    if (sqe == NULL)
+    {
+      finish(poller, dev, -3);
+      return;
+    }
+    sqe->addr = (uintptr_t) udev->buf;
+    sqe->len = frame_parser_space(&dev->parser);
+  }
+
+  if (try_limited(poller))
+  {
+    sqe->flags |= IOSQE_IO_LINK;
+    udev->deadline.tv_sec = dev->deadline.tv_sec;
+    udev->deadline.tv_nsec = dev->deadline.tv_nsec;
+    sqe = queue_op(poller, dev, OP_TIMEOUT, IORING_OP_LINK_TIMEOUT);
+    if (sqe == NULL)
+    {
+      finish(poller, dev, -3);
+      return;
+    }
+    sqe->addr = (uintptr_t) &udev->deadline;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+  }
+}
+
+static void uring_backoff(poller_t *poller, polldev_t *dev)
+{
+  uringstate_t *state = poller->uring;
+  uringdev_t *udev = &state->devs[dev - poller->devs];
+  struct io_uring_sqe *sqe;
+
+  udev->deadline.tv_sec = dev->deadline.tv_sec;
+  udev->deadline.tv_nsec = dev->deadline.tv_nsec;
+  sqe = queue_op(poller, dev, OP_BACKOFF, IORING_OP_TIMEOUT);
+  if (sqe == NULL)
+  {
+    finish(poller, dev, -3);
+    return;
+  }
+  sqe->addr = (uintptr_t) &udev->deadline;
+  sqe->len = 1;
+  sqe->timeout_flags = IORING_TIMEOUT_ABS;
+}
+
+/**
+ * \brief Decide what to do with device once all its operations completed
+ */
+static void uring_settle(poller_t *poller, polldev_t *dev, uringdev_t *udev)
+{
+  pkt_t response;
+
+  switch (dev->state)
+  {
+    case POLL_BACKOFF:
+      start_try(poller, dev);
+      return;
+    case POLL_WRITING:
+    case POLL_READING:
+      break;
+    default:
+      /* completions of failed submission */
+      return;
+  }
+
+  if (frame_parser_next(&dev->parser, &response))
+  {
+    accept_response(poller, dev, response);
+  }
+  else if (udev->error != 0)
+  {
+    ERROR("%s: %s: %s", dev->device,
+        dev->state == POLL_WRITING ? "write" : "read", strerror(udev->error));
+    fail_try(poller, dev, -3);
+  }
+  else if (udev->timed_out)
+  {
+    ERROR("%s: timeout", dev->device);
+    dev->stats.timeouts++;
+    fail_try(poller, dev, -3);
+  }
+  else
+  {
+    /* only part of response arrived so far */
+    uring_send(poller, dev);
+  }
+}
+
+static void uring_complete(poller_t *poller, uint64_t data, int res)
+{
+  uringstate_t *state = poller->uring;
+  polldev_t *dev = &poller->devs[data >> 8];
+  uringdev_t *udev = &state->devs[data >> 8];
+
+  udev->inflight--;
+  switch ((uringop_t)(data & 0xff))
+  {
+    case OP_WRITE:
+      if (res >= 0)
+      {
+        if (poller->opts.capture != NULL)
+        {
+          capture_io(poller->opts.capture, dev->fd, CAPTURE_TX,
+              (uint8_t*) &dev->request + dev->written, res);
+        }
+        dev->written += res;
+        dev->stats.bytes_out += res;
+        if (dev->written == sizeof(dev->request))
+        {
+          dev->state = POLL_READING;
+        }
+      }
+      else if (res == -EAGAIN)
+      {
+        udev->again = 1;
+      }
+      else if (res != -ECANCELED)
+      {
+        udev->error = -res;
+      }
+      break;
+    case OP_READ:
+      if (res > 0)
+      {
+        if (poller->opts.capture != NULL)
+        {
+          capture_io(poller->opts.capture, dev->fd, CAPTURE_RX, udev->buf,
+              res);
+        }
+        frame_parser_feed(&dev->parser, udev->buf, res);
+        dev->stats.bytes_in += res;
+      }
+      else if (res == -EAGAIN)
+      {
+        udev->again = 1;
+      }
+      else if (res < 0 && res != -ECANCELED)
+      {
+        udev->error = -res;
+      }
+      break;
+    case OP_POLL:
+      if (res < 0 && res != -ECANCELED)
+      {
+        udev->error = -res;
+      }
+      break;
+    case OP_TIMEOUT:
+      udev->timed_out |= res == -ETIME;
+      break;
+    case OP_BACKOFF:
+      break;
+  }
+
+  if (udev->inflight == 0)
+  {
+    uring_settle(poller, dev, udev);
+  }
+}
+
+/**
+ * \brief Throw away operations in flight by recreating the ring
+ */
+static int uring_reset(poller_t *poller)
+{
+  uringstate_t *state = poller->uring;
+  unsigned entries = state->ring.entries;
+
+  uring_close(&state->ring);
+  memset(state->devs, 0, poller->count * sizeof(uringdev_t));
+  if (uring_open(&state->ring, entries))
+  {
+    ERROR("unable to recreate io_uring, falling back to epoll");
+    free(state->devs);
+    free(state);
+    poller->uring = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int uring_run(poller_t *poller)
+{
+  uringstate_t *state = poller->uring;
+  struct io_uring_cqe *cqe;
+  uint64_t data;
+  int res, ret, reaped;
+
+  while (poller->pending > 0)
+  {
+    /* everything queued since last wait goes to kernel at once */
+    PROFILE_BEGIN(prof_wait);
+    ret = uring_submit(&state->ring, 1);
+    PROFILE_END(PROF_IO_WAIT, prof_wait);
+    if (ret == -1 && errno != EINTR)
+    {
+      ERROR("io_uring_enter: %s", strerror(errno));
+    }
+
+    reaped = 0;
+    while ((cqe = uring_peek(&state->ring)) != NULL)
+    {
+      data = cqe->user_data;
+      res = cqe->res;
+      uring_seen(&state->ring);
+      uring_complete(poller, data, res);
+      reaped++;
+    }
+
+    if (ret == -1 && errno == EINTR && !cancelled(poller))
+    {
+      /* e.g. profile dump requested, wait for the rest of completions */
+      continue;
+    }
+    if (ret == -1 || reaped == 0)
+    {
+      /* interrupted, operations of this cycle must not leak into next one */
+      uring_reset(poller);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+#endif
+
+/**
+ * \brief Open devices, either failing on the first one that cannot be opened
+ * or leaving it out of polling
+ */
+static int open_devices(poller_t *poller, mhopt_t *opts, char **devices,
+    int count, int lenient, const struct timespec *limit)
+{
+  struct epoll_event ev;
+  struct timespec now;
+  int64_t left;
+  int i;
+
+  memset(poller, 0, sizeof(*poller));
+  poller->opts = *opts;
+  poller->opts.command = CMD_GAS_CONCENTRATION;
+  poller->seed = (uint64_t) getpid() << 32 | 1;
+  poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (poller->epfd == -1)
+  {
+    perror("epoll_create1");
+    return -2;
+  }
+
+  poller->devs = calloc(count, sizeof(polldev_t));
+  if (poller->devs == NULL)
+  {
+    perror("calloc");
+    close(poller->epfd);
+    return -2;
+  }
+  poller->count = count;
+  for (i = 0; i < count; i++)
+  {
+    poller->devs[i].fd = -1;
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    dev->device = devices[i];
+    breaker_init(&dev->breaker, opts->breaker, opts->probe_interval);
+    poller->opts.device = devices[i];
+    if (limit != NULL && opts->lock_wait >= 0)
+    {
+      /* device held by another process must not outlast the limit */
+      timespec_now(&now);
+      left = timespec_diff_ns(limit, &now) / NSEC_PER_USEC;
+      left = left > 0 ? left : 1;
+      poller->opts.lock_wait = opts->lock_wait == 0 ||
+        opts->lock_wait > left ? left : opts->lock_wait;
+    }
+    dev->fd = open_device(&poller->opts);
+    if (dev->fd < 0)
+    {
+      ERROR("unable to open %s", devices[i]);
+      if (lenient)
+      {
+        /* reported as failed in every cycle, fd keeps the reason */
+        continue;
+      }
+      poller_close(poller);
+      return -1;
+    }
+
+    /* descriptor is registered only during transactions, but make sure now
+     * it can be polled at all */
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = dev;
+    if (epoll_ctl(poller->epfd, EPOLL_CTL_ADD, dev->fd, &ev) == -1 ||
+        epoll_ctl(poller->epfd, EPOLL_CTL_DEL, dev->fd, &ev) == -1)
+    {
+      perror("epoll_ctl");
+      poller_close(poller);
+      return -2;
+    }
+  }
+
+  poller->opts.lock_wait = opts->lock_wait;
+
+  return 0;
+}
+
+int poller_open(poller_t *poller, mhopt_t *opts, char **devices, int count)
+{
+  return open_devices(poller, opts, devices, count, 0, NULL);
+}
+
+int poller_open_lenient(poller_t *poller, mhopt_t *opts, char **devices,
+    int count, const struct timespec *limit)
+{
+  return open_devices(poller, opts, devices, count, 1, limit);
+}
+
+int poller_use_uring(poller_t *poller)
+{
+#ifdef HAVE_IO_URING
+  uringstate_t *state;
+  unsigned entries = 4 * poller->count;
+
+  if (poller->uring != NULL)
+  {
+    return 0;
+  }
+  state = calloc(1, sizeof(uringstate_t));
+  if (state == NULL)
+  {
+    perror("calloc");
+    return -1;
+  }
+  state->devs = calloc(poller->count, sizeof(uringdev_t));
+  if (state->devs == NULL)
+  {
+    perror("calloc");
+    free(state);
+    return -1;
+  }
+  if (entries > URING_MAX_ENTRIES)
+  {
+    /* ring is flushed whenever it fills up */
+    entries = URING_MAX_ENTRIES;
+  }
+  if (uring_open(&state->ring, entries))
+  {
+    free(state->devs);
+    free(state);
+    return -1;
+  }
+  poller->uring = state;
+  return 0;
+#else
+  DEBUG("io_uring backend not compiled in");
+  return -1;
+#endif
+}
+
+/**
+ * \brief Count devices read successfully in last cycle
+ */
+static int succeeded(poller_t *poller)
+{
+  int i, count = 0;
+
+  for (i = 0; i < poller->count; i++)
+  {
+    if (poller->devs[i].state == POLL_DONE)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+int poller_cycle(poller_t *poller)
+{
+  return poller_cycle_until(poller, NULL);
+}
+
+int poller_cycle_until(poller_t *poller, const struct timespec *limit)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int i, n;
+
+  poller->has_limit = limit != NULL;
+  if (limit != NULL)
+  {
+    poller->limit = *limit;
+  }
+  poller->pending = poller->count;
+  for (i = 0; i < poller->count; i++)
+  {
+    polldev_t *dev = &poller->devs[i];
+    dev->request = init_read_gas_packet();
+    frame_parser_init(&dev->parser, CMD_GAS_CONCENTRATION);
+    dev->tries = poller->opts.tries;
+    timespec_now(&dev->started);
+    if (dev->fd < 0)
+    {
+      /* device that could not be opened, nothing is registered for it */
+      dev->state = POLL_FAILED;
+      dev->error = dev->fd;
+      dev->latency = 0;
+      dev->stats.transactions++;
+      dev->stats.failures++;
+      poller->pending--;
+      continue;
+    }
+    if (!breaker_allow(&dev->breaker, &dev->started))
+    {
+      /* do not let device that keeps failing slow down the others */
+      dev->state = POLL_SKIPPED;
+      dev->error = -7;
+      dev->latency = 0;
+      dev->stats.skipped++;
+      poller->pending--;
+      continue;
+    }
+    if (dev->tries < 1)
+    {
+      finish(poller, dev, -4);
+      continue;
+    }
+    start_try(poller, dev);
+  }
+
+#ifdef HAVE_IO_URING
+  if (poller->uring != NULL)
+  {
+    return uring_run(poller) ? -1 : succeeded(poller);
+  }
+#endif
+
+  while (poller->pending > 0)
+  {
+    PROFILE_BEGIN(prof_wait);
+    n = epoll_wait(poller->epfd, events, MAX_EVENTS, next_timeout(poller));
+    PROFILE_END(PROF_IO_WAIT, prof_wait);
+    if (n == -1)
+    {
+      if (errno != EINTR)
+      {
+        ERROR("epoll_wait: %s", strerror(errno));
+        return -1;
+      }
+      if (cancelled(poller))
+      {
+        return -1;
+      }
+      /* signal not meant to stop polling, deadlines keep running */
+      expire(poller);
+      continue;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      polldev_t *dev = events[i].data.ptr;
+      if (dev->state != POLL_WRITING && dev->state != POLL_READING)
+      {
+        /* stale event of device that finished within this wait */
+        continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        ERROR("%s: error condition on device", dev->device);
+        fail_try(poller, dev, -3);
+      }
+      else if (dev->state == POLL_WRITING && (events[i].events & EPOLLOUT))
+      {
+        do_write(poller, dev);
+      }
+      else if (dev->state == POLL_READING && (events[i].events & EPOLLIN))
+      {
+        do_read(poller, dev);
+      }
+    }
+
+    expire(poller);
+  }
+
+  return succeeded(poller);
+}
+
+void poller_close(poller_t *poller)
+{
+  int i;
+
+  for (i = 0; i < poller->count; i++)
+  {
+    if (poller->devs[i].fd >= 0)
+    {
+      close(poller->devs[i].fd);
+    }
+  }
+#ifdef HAVE_IO_URING
+  if (poller->uring != NULL)
+  {
+    uringstate_t *state = poller->uring;
+    /* closing the ring cancels whatever is still in flight */
+    uring_close(&state->ring);
+    free(state->devs);
+    free(state);
+    poller->uring = NULL;
+  }
+#endif
+  free(poller->devs);
+  poller->devs = NULL;
+  poller->count = 0;
+  if (poller->epfd >= 0)
+  {
+    close(poller->epfd);
+    poller->epfd = -1;
+  }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+#include "mh.h"
+#include "retry.h"
+
+typedef enum {
+  POLL_IDLE = 0, /**< no transaction in progress */
+  POLL_WRITING, /**< request is being written */
+  POLL_READING, /**< waiting for response */
+  POLL_BACKOFF, /**< waiting before next try */
+  POLL_DONE, /**< response received and valid */
+  POLL_FAILED, /**< all tries failed */
+  POLL_SKIPPED, /**< not polled in this cycle, because breaker is open */
+} pollstate_t;
+
+typedef struct {
+  uint64_t transactions; /**< finished transactions */
+  uint64_t failures; /**< transactions that failed */
+  uint64_t timeouts; /**< tries that timed out */
+  uint64_t checksum_errors; /**< frames rejected because of checksum */
+  uint64_t retries; /**< tries other than the first one */
+  uint64_t bytes_in; /**< bytes read from device */
+  uint64_t bytes_out; /**< bytes written to device */
+  uint64_t skipped; /**< cycles skipped because breaker was open */
+} pollstats_t;
+
+typedef struct {
+  char *device; /**< filename of UART device */
+  int fd; /**< descriptor of opened device (negative - error code of
+             *  open_device(), if device could not be opened) */
+  pollstate_t state; /**< state of current transaction */
+  uint32_t events; /**< epoll events currently registered for fd */
+  pkt_t request; /**< request being sent */
+  size_t written; /**< number of request bytes already written */
+  frame_parser_t parser; /**< receive buffer resynchronizing on frames */
+  int tries; /**< number of tries left in current transaction */
+  struct timespec started; /**< start of current transaction */
+  struct timespec deadline; /**< end of current try (valid if timeout set)
+                             *  or end of backoff */
+  uint16_t gas_concentration; /**< output - last concentration read */
+  int error; /**< output - error code of last transaction (same as in
+               *  \link execute_command \endlink, or -7 if device was
+               *  skipped), 0 on success */
+  int64_t latency; /**< output - duration of last transaction in ns */
+  breaker_t breaker; /**< circuit breaker suspending failing device */
+  pollstats_t stats; /**< output - counters accumulated since opening */
+} polldev_t;
+
+typedef struct {
+  int epfd; /**< epoll instance driving all devices */
+  polldev_t *devs; /**< array of devices */
+  int count; /**< number of devices */
+  int pending; /**< number of devices with transaction in progress */
+  mhopt_t opts; /**< serial parameters, timeout and tries */
+  uint64_t seed; /**< state of generator randomizing backoff */
+  void *uring; /**< state of io_uring backend (NULL - epoll is used) */
+  volatile sig_atomic_t *cancel; /**< flag that makes interrupted wait end
+                                   *  the cycle once set (NULL - waits
+                                   *  interrupted by signals are resumed) */
+  int has_limit; /**< non-zero if current cycle has deadline */
+  struct timespec limit; /**< deadline of current cycle */
+} poller_t;
+
+/**
+ * \brief Open and configure all devices and register them for polling
+ *
+ * \param poller Poller to be initialized
+ * \param opts Serial parameters, timeout and number of tries for all devices
+ * \param devices List of device filenames
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 some device could not be opened
+ * \retval -2 poller could not be created
+ */
+int poller_open(poller_t *poller, mhopt_t *opts, char **devices, int count);
+
+/**
+ * \brief Open devices like \link poller_open \endlink, but keep going when
+ * some of them cannot be opened
+ *
+ * Devices that could not be opened are reported as failed with error returned
+ * by open_device() (-1, or -8 if used by another process) in every cycle.
+ * Devices used by another process are waited for at most until limit, so
+ * opening cannot take longer than cycle is allowed to.
+ *
+ * \param poller Poller to be initialized
+ * \param opts Serial parameters, timeout and number of tries for all devices
+ * \param devices List of device filenames
+ * \param count Number of devices
+ * \param limit Absolute CLOCK_MONOTONIC deadline of opening all devices
+ * (NULL - only lock_wait of opts applies)
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -2 poller could not be created
+ */
+int poller_open_lenient(poller_t *poller, mhopt_t *opts, char **devices,
+    int count, const struct timespec *limit);
+
+/**
+ * \brief Switch poller to io_uring backend
+ *
+ * Requests and responses of all devices are then submitted in batches, each
+ * read having linked timeout, and their completions are reaped together, so
+ * cycle takes only a few system calls regardless of number of devices.
+ *
+ * \param poller Opened poller
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 backend not compiled in or not supported by kernel, poller keeps
+ * using epoll
+ */
+int poller_use_uring(poller_t *poller);
+
+/**
+ * \brief Read gas concentration from all devices concurrently
+ *
+ * Requests are sent to every device and responses are collected as they
+ * arrive, so duration of the cycle is bounded by the slowest device. Result
+ * of each device is stored in its \link polldev_t \endlink entry. Failed tries
+ * are repeated after backoff without blocking other devices. Device that
+ * failed too many cycles in a row is skipped (with error -7) except for
+ * occasional probes, until it responds again. Waits interrupted by signals
+ * are resumed, unless flag pointed to by poller->cancel is set.
+ *
+ * \param poller Opened poller
+ *
+ * \return number of devices read successfully or -1 on internal error or
+ * cancellation
+ */
+int poller_cycle(poller_t *poller);
+
+/**
+ * \brief Read all devices like \link poller_cycle \endlink, but finish the
+ * whole cycle by given deadline
+ *
+ * No try lasts past the deadline and no retry is started if it could not
+ * begin before it. Devices that did not respond by then fail with error -3.
+ *
+ * \param poller Opened poller
+ * \param limit Absolute CLOCK_MONOTONIC deadline of the cycle (NULL - none)
+ *
+ * \return number of devices read successfully or -1 on internal error
+ */
+int poller_cycle_until(poller_t *poller, const struct timespec *limit);
+
+/**
+ * \brief Close all devices and release poller resources
+ *
+ * \param poller Poller to be closed
+ */
+void poller_close(poller_t *poller);
+
+#endif // POLLER_H
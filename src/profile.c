@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "profile.h"
+
+histogram_t profile_histograms[PROF_PHASES];
+volatile sig_atomic_t profile_requested = 0;
+
+static const char *phase_names[PROF_PHASES] = {
+  [PROF_IO_WAIT] = "io_wait",
+  [PROF_IO_READ] = "io_read",
+  [PROF_IO_WRITE] = "io_write",
+  [PROF_IO_TOTAL] = "io_total",
+  [PROF_IO_CHUNKS] = "io_chunks",
+  [PROF_OPEN] = "open",
+  [PROF_EXECUTE] = "execute",
+  [PROF_COMMAND] = "command",
+};
+
+uint64_t histogram_value(int index)
+{
+  int shift;
+
+  if (index < PROFILE_SUB_BUCKETS)
+  {
+    return index;
+  }
+  shift = index / (PROFILE_SUB_BUCKETS / 2) - 1;
+  return (uint64_t)(index % (PROFILE_SUB_BUCKETS / 2) +
+      PROFILE_SUB_BUCKETS / 2) << shift;
+}
+
+uint64_t histogram_quantile(histogram_t *hist, double quantile)
+{
+  uint64_t total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  uint64_t rank, seen = 0, high;
+  int i;
+
+  if (total == 0)
+  {
+    return 0;
+  }
+  rank = quantile * total;
+  if (rank >= total)
+  {
+    rank = total - 1;
+  }
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+  {
+    seen += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+    if (seen > rank)
+    {
+      /* report highest value of the bucket, never more than seen maximum */
+      high = i + 1 < PROFILE_BUCKETS ? histogram_value(i + 1) - 1 : UINT64_MAX;
+      return high < max ? high : max;
+    }
+  }
+  return max;
+}
+
+void profile_dump(FILE *out)
+{
+  histogram_t *hist;
+  uint64_t total;
+  int i;
+
+  fprintf(out, "%-10s %10s %12s %12s %12s %12s %12s %12s\n", "phase",
+      "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (i = 0; i < PROF_PHASES; i++)
+  {
+    hist = &profile_histograms[i];
+    total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+    if (total == 0)
+    {
+      continue;
+    }
+    fprintf(out, "%-10s %10llu %12llu %12llu %12llu %12llu %12llu %12llu\n",
+        phase_names[i], (unsigned long long) total,
+        (unsigned long long)(atomic_load(&hist->sum) / total),
+        (unsigned long long) histogram_quantile(hist, 0.5),
+        (unsigned long long) histogram_quantile(hist, 0.9),
+        (unsigned long long) histogram_quantile(hist, 0.99),
+        (unsigned long long) histogram_quantile(hist, 0.999),
+        (unsigned long long) atomic_load(&hist->max));
+  }
+  fflush(out);
+}
+
+static void handle_dump(int signum)
+{
+  profile_requested = 1;
+}
+
+static void dump_at_exit()
+{
+  profile_dump(stderr);
+}
+
+void profile_init()
+{
+  struct sigaction sa;
+
+  /* histograms cannot be printed from signal handler, loops check flag */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_dump;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+  atexit(dump_at_exit);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+
+#include "config.h"
+#include "timeutil.h"
+
+#define PROFILE_SUB_BITS 4 /**< log2 of linear sub-buckets per power of 2 */
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BITS)
+#define PROFILE_BUCKETS ((64 - PROFILE_SUB_BITS + 2) * PROFILE_SUB_BUCKETS / 2)
+
+typedef enum {
+  PROF_IO_WAIT = 0, /**< waiting for descriptor to become ready */
+  PROF_IO_READ, /**< single read() call */
+  PROF_IO_WRITE, /**< single write() call */
+  PROF_IO_TOTAL, /**< whole perform_io() */
+  PROF_IO_CHUNKS, /**< number of iterations of perform_io() (not time) */
+  PROF_OPEN, /**< open_device() */
+  PROF_EXECUTE, /**< execute_command() */
+  PROF_COMMAND, /**< whole process_command() */
+  PROF_PHASES
+} profphase_t;
+
+/**
+ * \brief Log-linear histogram with bounded relative error
+ *
+ * Values below PROFILE_SUB_BUCKETS have their own buckets, every following
+ * power of two is split into PROFILE_SUB_BUCKETS / 2 linear buckets, so error
+ * of any value is below 1 / PROFILE_SUB_BUCKETS * 2.
+ */
+typedef struct {
+  _Atomic uint64_t counts[PROFILE_BUCKETS]; /**< number of values per bucket */
+  _Atomic uint64_t total; /**< number of recorded values */
+  _Atomic uint64_t sum; /**< sum of recorded values */
+  _Atomic uint64_t max; /**< maximum recorded value */
+} histogram_t;
+
+/**
+ * \brief Get index of bucket holding value
+ */
+static inline int histogram_index(uint64_t value)
+{
+  int shift;
+
+  if (value < PROFILE_SUB_BUCKETS)
+  {
+    return value;
+  }
+  shift = 63 - __builtin_clzll(value) - PROFILE_SUB_BITS + 1;
+  return shift * (PROFILE_SUB_BUCKETS / 2) + (int)(value >> shift);
+}
+
+/**
+ * \brief Get lowest value that falls into bucket
+ */
+uint64_t histogram_value(int index);
+
+/**
+ * \brief Record single value, safe to be called from many threads
+ */
+static inline void histogram_record(histogram_t *hist, uint64_t value)
+{
+  uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+
+  atomic_fetch_add_explicit(&hist->counts[histogram_index(value)], 1,
+      memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->total, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+  while (value > max && !atomic_compare_exchange_weak_explicit(&hist->max,
+        &max, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+ * \brief Get value below which given fraction of recorded values lies
+ *
+ * \param hist Histogram
+ * \param quantile Fraction in range [0, 1]
+ *
+ * \return highest value of bucket holding quantile, capped at recorded
+ * maximum (0 if histogram is empty)
+ */
+uint64_t histogram_quantile(histogram_t *hist, double quantile);
+
+/**
+ * \brief Print summary of every non-empty phase
+ *
+ * \param out Stream to print to
+ */
+void profile_dump(FILE *out);
+
+/**
+ * \brief Histograms of all phases, indexed by \link profphase_t \endlink
+ */
+extern histogram_t profile_histograms[PROF_PHASES];
+
+/**
+ * \brief Non-zero when dump was requested with SIGUSR1
+ */
+extern volatile sig_atomic_t profile_requested;
+
+/**
+ * \brief Install SIGUSR1 handler and dump at exit
+ */
+void profile_init();
+
+#ifdef MHZ14A_PROFILE
+
+/** start measuring phase, declares variable holding start time */
+#define PROFILE_BEGIN(var) \
+  struct timespec var; \
+  clock_gettime(CLOCK_MONOTONIC, &var)
+
+/** record time elapsed since PROFILE_BEGIN(var) in phase */
+#define PROFILE_END(phase, var) \
+  do { \
+    struct timespec profile_end_; \
+    clock_gettime(CLOCK_MONOTONIC, &profile_end_); \
+    histogram_record(&profile_histograms[phase], \
+        timespec_diff_ns(&profile_end_, &var)); \
+  } while (0)
+
+/** record arbitrary value in phase */
+#define PROFILE_VALUE(phase, value) \
+  histogram_record(&profile_histograms[phase], (value))
+
+/** print histograms if dump was requested by signal */
+#define PROFILE_CHECK() \
+  do { \
+    if (profile_requested) \
+    { \
+      profile_requested = 0; \
+      profile_dump(stderr); \
+    } \
+  } while (0)
+
+#define PROFILE_INIT() profile_init()
+
+#else
+
+#define PROFILE_BEGIN(var) do {} while (0)
+#define PROFILE_END(phase, var) do {} while (0)
+#define PROFILE_VALUE(phase, value) do {} while (0)
+#define PROFILE_CHECK() do {} while (0)
+#define PROFILE_INIT() do {} while (0)
+
+#endif // MHZ14A_PROFILE
+
+#endif // PROFILE_H
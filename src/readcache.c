@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "readcache.h"
+
+#define READCACHE_MAGIC "MHZ14ARC"
+#define READCACHE_VERSION 1
+#define READCACHE_ALIGN 64
+#define KEY_WORDS (READCACHE_NAME_SIZE / sizeof(uint64_t))
+#define MAX_SPINS 1000 /**< tries of lock-free lookup before taking lock */
+#define HEADER_LOCK 0 /**< offset of byte locked while assigning slots */
+
+struct readcache_header {
+  char magic[8]; /**< READCACHE_MAGIC */
+  uint32_t version; /**< READCACHE_VERSION */
+  uint32_t slot_size; /**< size of single slot */
+  uint32_t slots; /**< number of slots */
+  uint32_t reserved;
+};
+
+struct readcache_slot {
+  _Alignas(READCACHE_ALIGN) _Atomic uint32_t seq; /**< odd while being
+                                                    *  updated */
+  _Atomic uint32_t ppm; /**< cached concentration */
+  _Atomic int64_t mono; /**< monotonic time of reading in ns (0 - none) */
+  _Atomic uint64_t name[KEY_WORDS]; /**< device name padded with zeros */
+};
+
+static size_t slots_offset()
+{
+  return (sizeof(struct readcache_header) + READCACHE_ALIGN - 1) /
+    READCACHE_ALIGN * READCACHE_ALIGN;
+}
+
+static off_t slot_offset(readcache_t *cache, int index)
+{
+  return (char*) &cache->slots[index] - (char*) cache->map;
+}
+
+/**
+ * \brief Lock or unlock single byte of cache file
+ *
+ * Open file description locks are used, so that handles opened by threads of
+ * one process exclude each other too. Locks are released by kernel when
+ * process dies.
+ */
+static int lock_byte(readcache_t *cache, off_t offset, short type, int wait)
+{
+  struct flock fl;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = offset;
+  fl.l_len = 1;
+  while (fcntl(cache->fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl) == -1)
+  {
+    if (errno == EINTR && wait)
+    {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EACCES)
+    {
+      perror("fcntl");
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static int lock(readcache_t *cache, off_t offset, int wait)
+{
+  return lock_byte(cache, offset, F_WRLCK, wait);
+}
+
+static void unlock(readcache_t *cache, off_t offset)
+{
+  lock_byte(cache, offset, F_UNLCK, 0);
+}
+
+/**
+ * \brief Take consistent copy of slot
+ *
+ * \return 1 if slot belongs to device with given key, 0 otherwise or if
+ * consistent copy could not be taken
+ */
+static int snapshot(struct readcache_slot *slot, const uint64_t *key,
+    int64_t *mono, uint16_t *ppm)
+{
+  uint32_t seq;
+  size_t i;
+  int spins, match;
+
+  *mono = 0;
+  *ppm = 0;
+  for (spins = 0; spins < MAX_SPINS; spins++)
+  {
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq & 1)
+    {
+      continue;
+    }
+    match = 1;
+    for (i = 0; i < KEY_WORDS; i++)
+    {
+      match &= atomic_load_explicit(&slot->name[i], memory_order_relaxed) ==
+        key[i];
+    }
+    *mono = atomic_load_explicit(&slot->mono, memory_order_relaxed);
+    *ppm = atomic_load_explicit(&slot->ppm, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+    {
+      return match;
+    }
+  }
+  /* writer died in the middle of update, next one under lock repairs it */
+  return 0;
+}
+
+/**
+ * \brief Update slot, can be called only with slot locked
+ */
+static void update(struct readcache_slot *slot, const uint64_t *key,
+    int64_t mono, uint16_t ppm)
+{
+  uint32_t seq;
+  size_t i;
+
+  /* sequence left odd by writer that died is made even again */
+  seq = atomic_load_explicit(&slot->seq, memory_order_relaxed) | 1;
+  atomic_store_explicit(&slot->seq, seq, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (i = 0; i < KEY_WORDS; i++)
+  {
+    atomic_store_explicit(&slot->name[i], key[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&slot->mono, mono, memory_order_relaxed);
+  atomic_store_explicit(&slot->ppm, ppm, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+static int find(readcache_t *cache, const uint64_t *key)
+{
+  int64_t mono;
+  uint16_t ppm;
+  uint32_t i;
+
+  for (i = 0; i < cache->header->slots; i++)
+  {
+    if (snapshot(&cache->slots[i], key, &mono, &ppm))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * \brief Check if slot holds reading of device not older than max_age
+ */
+static int fresh(readcache_t *cache, int index, const uint64_t *key,
+    int64_t max_age, uint16_t *ppm)
+{
+  struct timespec now;
+  int64_t mono, age;
+
+  if (!snapshot(&cache->slots[index], key, &mono, ppm) || mono == 0)
+  {
+    return 0;
+  }
+  timespec_now(&now);
+  /* reading from before reboot looks like one from the future */
+  age = now.tv_sec * NSEC_PER_SEC + now.tv_nsec - mono;
+  return age >= 0 && age <= max_age * NSEC_PER_USEC;
+}
+
+/**
+ * \brief Assign least recently read slot that is not in use to device, can
+ * be called only with header locked
+ *
+ * \return index of assigned slot, which is left locked, or -1 if all slots
+ * are in use
+ */
+static int claim(readcache_t *cache, const uint64_t *key)
+{
+  char busy[READCACHE_SLOTS];
+  int64_t mono, oldest;
+  uint16_t ppm;
+  uint32_t i;
+  int index;
+
+  memset(busy, 0, sizeof(busy));
+  while (1)
+  {
+    index = -1;
+    oldest = INT64_MAX;
+    for (i = 0; i < cache->header->slots; i++)
+    {
+      if (busy[i])
+      {
+        continue;
+      }
+      snapshot(&cache->slots[i], key, &mono, &ppm);
+      if (mono < oldest)
+      {
+        oldest = mono;
+        index = i;
+      }
+    }
+    if (index < 0)
+    {
+      return -1;
+    }
+    if (lock(cache, slot_offset(cache, index), 0) == 0)
+    {
+      update(&cache->slots[index], key, 0, 0);
+      return index;
+    }
+    /* some other device is being read right now */
+    busy[index] = 1;
+  }
+}
+
+/**
+ * \brief Find slot of device, assigning one if needed, and lock it
+ *
+ * \return index of locked slot or -1 if no slot could be locked
+ */
+static int acquire(readcache_t *cache, const uint64_t *key)
+{
+  int64_t mono;
+  uint16_t ppm;
+  int index;
+
+  while (1)
+  {
+    index = find(cache, key);
+    if (index < 0)
+    {
+      /* slots are assigned under lock, so that device never gets two */
+      if (lock(cache, HEADER_LOCK, 1))
+      {
+        return -1;
+      }
+      index = find(cache, key);
+      if (index < 0)
+      {
+        index = claim(cache, key);
+        unlock(cache, HEADER_LOCK);
+        return index;
+      }
+      unlock(cache, HEADER_LOCK);
+    }
+
+    if (lock(cache, slot_offset(cache, index), 1))
+    {
+      return -1;
+    }
+    if (snapshot(&cache->slots[index], key, &mono, &ppm))
+    {
+      return index;
+    }
+    /* slot was given to another device while waiting for lock */
+    unlock(cache, slot_offset(cache, index));
+  }
+}
+
+const char *readcache_default()
+{
+  static char path[256];
+  const char *dir;
+
+  if ((dir = getenv("XDG_RUNTIME_DIR")) != NULL && dir[0] != '\0')
+  {
+    snprintf(path, sizeof(path), "%s/mhz14a-readings", dir);
+  }
+  else
+  {
+    snprintf(path, sizeof(path), "/tmp/mhz14a-readings-%d", (int) getuid());
+  }
+  return path;
+}
+
+int readcache_open(readcache_t *cache, const char *path)
+{
+  struct readcache_header *hdr;
+  struct stat st;
+  int ret = 0;
+
+  memset(cache, 0, sizeof(*cache));
+  cache->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (cache->fd == -1)
+  {
+    perror("open");
+    return -1;
+  }
+
+  /* only one process may initialize new file */
+  if (lock(cache, HEADER_LOCK, 1))
+  {
+    readcache_close(cache);
+    return -1;
+  }
+  if (fstat(cache->fd, &st) == -1)
+  {
+    perror("fstat");
+    readcache_close(cache);
+    return -1;
+  }
+
+  cache->size = slots_offset() +
+    READCACHE_SLOTS * sizeof(struct readcache_slot);
+  if (st.st_size == 0 && ftruncate(cache->fd, cache->size) == -1)
+  {
+    perror("ftruncate");
+    readcache_close(cache);
+    return -1;
+  }
+  if (st.st_size != 0 && (size_t) st.st_size < cache->size)
+  {
+    readcache_close(cache);
+    return -2;
+  }
+  cache->map = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      cache->fd, 0);
+  if (cache->map == MAP_FAILED)
+  {
+    perror("mmap");
+    cache->map = NULL;
+    readcache_close(cache);
+    return -1;
+  }
+  cache->header = hdr = cache->map;
+  cache->slots = (struct readcache_slot*)((char*) cache->map + slots_offset());
+
+  if (st.st_size == 0)
+  {
+    hdr->version = READCACHE_VERSION;
+    hdr->slot_size = sizeof(struct readcache_slot);
+    hdr->slots = READCACHE_SLOTS;
+    /* magic goes last, so that half-initialized file is never accepted */
+    atomic_thread_fence(memory_order_release);
+    memcpy(hdr->magic, READCACHE_MAGIC, sizeof(hdr->magic));
+  }
+  else if (memcmp(hdr->magic, READCACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != READCACHE_VERSION ||
+      hdr->slot_size != sizeof(struct readcache_slot) ||
+      hdr->slots != READCACHE_SLOTS)
+  {
+    ret = -2;
+  }
+  unlock(cache, HEADER_LOCK);
+
+  if (ret != 0)
+  {
+    readcache_close(cache);
+  }
+  return ret;
+}
+
+int readcache_read(readcache_t *cache, mhopt_t *opts, int64_t max_age,
+    int *cached)
+{
+  uint64_t key[KEY_WORDS];
+  struct timespec now;
+  int index, result;
+
+  *cached = 0;
+  if (strlen(opts->device) >= READCACHE_NAME_SIZE)
+  {
+    DEBUG("name of %s too long to be cached", opts->device);
+    return process_command(opts);
+  }
+  memset(key, 0, sizeof(key));
+  memcpy(key, opts->device, strlen(opts->device));
+
+  /* lock-free path for readers that find recent reading */
+  index = find(cache, key);
+  if (index >= 0 &&
+      fresh(cache, index, key, max_age, &opts->gas_concentration))
+  {
+    *cached = 1;
+    return 0;
+  }
+
+  index = acquire(cache, key);
+  if (index < 0)
+  {
+    WARNING("unable to lock %s in cache, reading it directly", opts->device);
+    return process_command(opts);
+  }
+  /* whoever held the lock before may have just read the device */
+  if (fresh(cache, index, key, max_age, &opts->gas_concentration))
+  {
+    unlock(cache, slot_offset(cache, index));
+    *cached = 1;
+    return 0;
+  }
+
+  result = process_command(opts);
+  if (result == 0)
+  {
+    timespec_now(&now);
+    update(&cache->slots[index], key, now.tv_sec * NSEC_PER_SEC + now.tv_nsec,
+        opts->gas_concentration);
+  }
+  unlock(cache, slot_offset(cache, index));
+  return result;
+}
+
+void readcache_close(readcache_t *cache)
+{
+  if (cache->map != NULL)
+  {
+    munmap(cache->map, cache->size);
+    cache->map = NULL;
+  }
+  if (cache->fd >= 0)
+  {
+    close(cache->fd);
+    cache->fd = -1;
+  }
+  cache->header = NULL;
+  cache->slots = NULL;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef READCACHE_H
+#define READCACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mh.h"
+
+#define READCACHE_SLOTS 64 /**< number of devices cache file can hold */
+#define READCACHE_NAME_SIZE 64 /**< maximum length of device name + 1 */
+
+struct readcache_header;
+struct readcache_slot;
+
+typedef struct {
+  int fd; /**< descriptor of cache file, also used for locking */
+  void *map; /**< whole file mapped to memory */
+  size_t size; /**< size of mapping */
+  struct readcache_header *header; /**< header at the beginning of mapping */
+  struct readcache_slot *slots; /**< readings of devices */
+} readcache_t;
+
+/**
+ * \brief Get default location of reading cache
+ *
+ * \return filename under $XDG_RUNTIME_DIR or per-user file in /tmp
+ */
+const char *readcache_default();
+
+/**
+ * \brief Open cache of readings shared between processes, creating it if it
+ * does not exist
+ *
+ * \param cache Cache to be initialized
+ * \param path Filename of cache
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be created or mapped
+ * \retval -2 existing file is not a valid cache
+ */
+int readcache_open(readcache_t *cache, const char *path);
+
+/**
+ * \brief Read gas concentration, reusing reading of another process if it is
+ * recent enough
+ *
+ * Cached reading is looked up without any locks. If there is none younger
+ * than max_age, lock of the device is taken, so that only one of processes
+ * reading the same device at once performs transaction, while the others wait
+ * for it and use its result. Failed transactions are not cached.
+ *
+ * \param cache Opened cache
+ * \param opts Device and serial parameters, concentration is returned in it
+ * \param max_age Maximum age of cached reading in microseconds
+ * \param cached Output - set to non-zero if reading came from cache
+ *
+ * \return result of \link process_command \endlink, 0 if cached reading was
+ * used
+ */
+int readcache_read(readcache_t *cache, mhopt_t *opts, int64_t max_age,
+    int *cached);
+
+/**
+ * \brief Unmap and close cache
+ *
+ * \param cache Opened cache
+ */
+void readcache_close(readcache_t *cache);
+
+#endif // READCACHE_H
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "mh_uart.h"
+#include "capture.h"
+#include "replay.h"
+
+#define REPLAY_MAX_CHANNELS 65536 /**< channels of capture above are invalid */
+
+typedef enum {
+  REPLAY_UNKNOWN = 0, /**< nothing read yet */
+  REPLAY_RAW, /**< raw bytes received from sensor */
+  REPLAY_CAPTURE, /**< file written by capture_open() */
+} replaymode_t;
+
+typedef struct {
+  replaystats_t *stats; /**< output statistics */
+  uint8_t command; /**< command of which responses are extracted */
+  replaymode_t mode; /**< format of input */
+  frame_parser_t parser; /**< parser of raw input */
+  frame_parser_t *channels; /**< parser of every channel of capture */
+  size_t channel_count; /**< number of entries in channels */
+  capture_header_t header; /**< header of capture */
+  size_t header_len; /**< bytes of header read so far */
+  capture_record_t record; /**< header of current record */
+  size_t record_len; /**< bytes of record header read so far */
+  size_t payload; /**< payload bytes of current record still to be read */
+} replay_t;
+
+/**
+ * \brief Move counters of parser into 64-bit statistics
+ *
+ * Parser counters are 32-bit, which large captures would overflow.
+ */
+static void replay_collect(frame_parser_t *parser, replaystats_t *stats)
+{
+  stats->frames += parser->frames;
+  stats->rejects += parser->rejects;
+  stats->dropped += parser->dropped;
+  stats->resyncs += parser->resyncs;
+  parser->frames = 0;
+  parser->rejects = 0;
+  parser->dropped = 0;
+  parser->resyncs = 0;
+}
+
+/**
+ * \brief Decode received bytes with parser of their stream
+ */
+static void replay_bytes(replay_t *replay, frame_parser_t *parser,
+    const uint8_t *buf, size_t count)
+{
+  replaystats_t *stats = replay->stats;
+  size_t offset = 0;
+  pkt_t pkt;
+  uint16_t ppm;
+
+  while (offset < count)
+  {
+    offset += frame_parser_feed(parser, buf + offset, count - offset);
+    while (frame_parser_next(parser, &pkt))
+    {
+      ppm = return_gas_concentration(pkt);
+      if (ppm < stats->ppm_min)
+      {
+        stats->ppm_min = ppm;
+      }
+      if (ppm > stats->ppm_max)
+      {
+        stats->ppm_max = ppm;
+      }
+      stats->ppm_sum += ppm;
+    }
+  }
+  replay_collect(parser, stats);
+}
+
+/**
+ * \brief Get parser of capture channel, creating it if needed
+ */
+static frame_parser_t *replay_channel(replay_t *replay, int32_t channel)
+{
+  frame_parser_t *channels;
+  size_t count;
+
+  if ((size_t) channel >= replay->channel_count)
+  {
+    count = channel + 1;
+    channels = realloc(replay->channels, count * sizeof(*channels));
+    if (channels == NULL)
+    {
+      return NULL;
+    }
+    while (replay->channel_count < count)
+    {
+      frame_parser_init(&channels[replay->channel_count++], replay->command);
+    }
+    replay->channels = channels;
+  }
+
+  return &replay->channels[channel];
+}
+
+/**
+ * \brief Decode part of capture, feeding received bytes to parser of their
+ * channel
+ *
+ * \return 0 on success, -2 if out of memory, -3 if capture is corrupted
+ */
+static int replay_capture(replay_t *replay, const uint8_t *buf, size_t count)
+{
+  frame_parser_t *parser;
+  size_t take;
+
+  while (count > 0)
+  {
+    if (replay->header_len < sizeof(replay->header))
+    {
+      take = sizeof(replay->header) - replay->header_len;
+      take = take < count ? take : count;
+      memcpy((uint8_t*) &replay->header + replay->header_len, buf, take);
+      replay->header_len += take;
+      if (replay->header_len == sizeof(replay->header) &&
+          (replay->header.version != CAPTURE_VERSION ||
+           replay->header.record_size != sizeof(capture_record_t)))
+      {
+        ERROR("unsupported capture version %d", replay->header.version);
+        return -3;
+      }
+    }
+    else if (replay->record_len < sizeof(replay->record))
+    {
+      take = sizeof(replay->record) - replay->record_len;
+      take = take < count ? take : count;
+      memcpy((uint8_t*) &replay->record + replay->record_len, buf, take);
+      replay->record_len += take;
+      if (replay->record_len == sizeof(replay->record))
+      {
+        if (replay->record.length > CAPTURE_MAX_DATA ||
+            replay->record.direction > CAPTURE_OPEN ||
+            replay->record.channel < 0 ||
+            replay->record.channel >= REPLAY_MAX_CHANNELS)
+        {
+          ERROR("corrupted capture record");
+          return -3;
+        }
+        parser = replay_channel(replay, replay->record.channel);
+        if (parser == NULL)
+        {
+          perror("realloc");
+          return -2;
+        }
+        if (replay->record.direction == CAPTURE_OPEN)
+        {
+          /* descriptor now belongs to another device */
+          replay->stats->dropped += parser->head - parser->tail;
+          frame_parser_init(parser, replay->command);
+        }
+        replay->payload = replay->record.length;
+        if (replay->payload == 0)
+        {
+          replay->record_len = 0;
+        }
+      }
+    }
+    else
+    {
+      take = replay->payload < count ? replay->payload : count;
+      if (replay->record.direction == CAPTURE_RX)
+      {
+        replay_bytes(replay, &replay->channels[replay->record.channel], buf,
+            take);
+      }
+      replay->payload -= take;
+      if (replay->payload == 0)
+      {
+        replay->record_len = 0;
+      }
+    }
+    buf += take;
+    count -= take;
+  }
+
+  return 0;
+}
+
+int replay_fd(int fd, uint8_t command, replaystats_t *stats)
+{
+  replay_t replay;
+  struct timespec start, end;
+  uint8_t *block;
+  ssize_t len;
+  uint32_t magic = CAPTURE_MAGIC;
+  size_t i;
+  int ret = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->ppm_min = UINT16_MAX;
+  memset(&replay, 0, sizeof(replay));
+  replay.stats = stats;
+  replay.command = command;
+  frame_parser_init(&replay.parser, command);
+  block = malloc(REPLAY_BLOCK_SIZE);
+  if (block == NULL)
+  {
+    perror("malloc");
+    return -2;
+  }
+
+  timespec_now(&start);
+  while (1)
+  {
+    len = read(fd, block, REPLAY_BLOCK_SIZE);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("read");
+      ret = -1;
+      break;
+    }
+    if (len == 0)
+    {
+      break;
+    }
+    stats->bytes += len;
+
+    if (replay.mode == REPLAY_UNKNOWN)
+    {
+      replay.mode = len >= sizeof(magic) &&
+        memcmp(block, &magic, sizeof(magic)) == 0 ?
+        REPLAY_CAPTURE : REPLAY_RAW;
+    }
+    if (replay.mode == REPLAY_RAW)
+    {
+      replay_bytes(&replay, &replay.parser, block, len);
+    }
+    else if ((ret = replay_capture(&replay, block, len)) != 0)
+    {
+      break;
+    }
+  }
+  timespec_now(&end);
+
+  /* bytes left in parsers are incomplete frames at end of capture */
+  stats->dropped += replay.parser.head - replay.parser.tail;
+  for (i = 0; i < replay.channel_count; i++)
+  {
+    stats->dropped += replay.channels[i].head - replay.channels[i].tail;
+  }
+  stats->elapsed = timespec_diff_ns(&end, &start);
+  if (stats->frames == 0)
+  {
+    stats->ppm_min = 0;
+  }
+  free(replay.channels);
+  free(block);
+  return ret;
+}
+
+int run_replay(const char *path, FILE *out)
+{
+  replaystats_t stats;
+  double seconds;
+  int fd, ret;
+
+  if (strcmp(path, "-") == 0)
+  {
+    fd = STDIN_FILENO;
+  }
+  else
+  {
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      perror(path);
+      return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+
+  ret = replay_fd(fd, CMD_GAS_CONCENTRATION, &stats);
+  if (fd != STDIN_FILENO)
+  {
+    close(fd);
+  }
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  INFO("Replayed %llu bytes of %s", (unsigned long long) stats.bytes, path);
+  seconds = (stats.elapsed > 0 ? stats.elapsed : 1) / (double) NSEC_PER_SEC;
+  fprintf(out, "{\"bytes\": %llu, \"frames\": %llu, \"rejects\": %llu, "
+      "\"resyncs\": %llu, \"dropped\": %llu, "
+      "\"ppm_min\": %u, \"ppm_max\": %u, \"ppm_mean\": %.1f, "
+      "\"seconds\": %.6f, \"frames_per_sec\": %.1f, \"mb_per_sec\": %.1f}\n",
+      (unsigned long long) stats.bytes, (unsigned long long) stats.frames,
+      (unsigned long long) stats.rejects, (unsigned long long) stats.resyncs,
+      (unsigned long long) stats.dropped, stats.ppm_min, stats.ppm_max,
+      stats.frames ? (double) stats.ppm_sum / stats.frames : 0, seconds,
+      stats.frames / seconds, stats.bytes / seconds / 1e6);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define REPLAY_BLOCK_SIZE (1 << 20) /**< number of bytes read at once */
+
+typedef struct {
+  uint64_t bytes; /**< number of bytes read from capture */
+  uint64_t frames; /**< number of valid frames extracted */
+  uint64_t rejects; /**< number of frames with invalid checksum */
+  uint64_t dropped; /**< number of bytes dropped as garbage */
+  uint64_t resyncs; /**< number of times stream had to be resynchronized */
+  uint64_t ppm_sum; /**< sum of concentrations of all valid frames */
+  uint16_t ppm_min; /**< lowest concentration (0 if no frames) */
+  uint16_t ppm_max; /**< highest concentration */
+  int64_t elapsed; /**< nanoseconds spent decoding, including reads */
+} replaystats_t;
+
+/**
+ * \brief Decode raw UART bytes read from descriptor until end of file
+ *
+ * Bytes go through the same frame parser and checksum validation as responses
+ * read from device, so every rejected frame or resynchronization seen on
+ * capture would happen on live device as well. Input starting with
+ * CAPTURE_MAGIC is decoded as file written by \link capture_open \endlink,
+ * with received bytes of every device parsed separately and written bytes
+ * skipped; any other input is treated as raw bytes received from single
+ * sensor.
+ *
+ * \param fd Descriptor to read capture from
+ * \param command Command of which responses are extracted
+ * \param stats Output statistics
+ *
+ * \return success indicator
+ * \retval 0 whole capture was decoded
+ * \retval -1 read failed
+ * \retval -2 out of memory
+ * \retval -3 capture is corrupted or has unsupported version
+ */
+int replay_fd(int fd, uint8_t command, replaystats_t *stats);
+
+/**
+ * \brief Decode gas concentration responses from capture file and print
+ * statistics
+ *
+ * Statistics are printed as single JSON object per line, like results of
+ * \c mhz14a-bench, so decoder throughput can be compared between commits.
+ *
+ * \param path Capture filename, - for standard input
+ * \param out Stream to print statistics to
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be read
+ * \retval -2 out of memory
+ * \retval -3 capture is corrupted or has unsupported version
+ */
+int run_replay(const char *path, FILE *out);
+
+#endif // REPLAY_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+
+#include "timeutil.h"
+#include "retry.h"
+
+static uint64_t next_random(uint64_t *seed)
+{
+  /* xorshift64* */
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * 0x2545f4914f6cdd1dULL;
+}
+
+int64_t backoff_delay(int64_t base, int64_t max, int attempt, uint64_t *seed)
+{
+  int64_t delay = base;
+  int i;
+
+  if (base <= 0)
+  {
+    return 0;
+  }
+  for (i = 1; i < attempt && (max <= 0 || delay < max); i++)
+  {
+    /* stop doubling before it could overflow */
+    if (delay > INT64_MAX / 2)
+    {
+      break;
+    }
+    delay *= 2;
+  }
+  if (max > 0 && delay > max)
+  {
+    delay = max;
+  }
+
+  return delay - delay / 2 + next_random(seed) % (delay / 2 + 1);
+}
+
+void backoff_sleep(int64_t delay)
+{
+  struct timespec ts;
+
+  if (delay <= 0)
+  {
+    return;
+  }
+  ts.tv_sec = delay / 1000000;
+  ts.tv_nsec = delay % 1000000 * NSEC_PER_USEC;
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+void breaker_init(breaker_t *breaker, int threshold, int64_t probe_interval)
+{
+  breaker->threshold = threshold;
+  breaker->probe_interval = probe_interval * NSEC_PER_USEC;
+  breaker->state = BREAKER_CLOSED;
+  breaker->failures = 0;
+  breaker->next_probe.tv_sec = 0;
+  breaker->next_probe.tv_nsec = 0;
+  breaker->trips = 0;
+}
+
+int breaker_allow(breaker_t *breaker, const struct timespec *now)
+{
+  switch (breaker->state)
+  {
+    case BREAKER_CLOSED:
+      return 1;
+    case BREAKER_OPEN:
+      if (timespec_diff_ns(now, &breaker->next_probe) < 0)
+      {
+        return 0;
+      }
+      breaker->state = BREAKER_HALF_OPEN;
+      return 1;
+    case BREAKER_HALF_OPEN:
+    default:
+      /* only one probe at a time */
+      return 0;
+  }
+}
+
+int breaker_record(breaker_t *breaker, int success,
+    const struct timespec *now)
+{
+  if (success)
+  {
+    breaker->failures = 0;
+    breaker->state = BREAKER_CLOSED;
+    return 0;
+  }
+
+  breaker->failures++;
+  if (breaker->state == BREAKER_HALF_OPEN ||
+      (breaker->threshold > 0 && breaker->state == BREAKER_CLOSED &&
+       breaker->failures >= breaker->threshold))
+  {
+    breaker->next_probe = *now;
+    timespec_add_ns(&breaker->next_probe, breaker->probe_interval);
+    if (breaker->state == BREAKER_CLOSED)
+    {
+      breaker->trips++;
+      breaker->state = BREAKER_OPEN;
+      return 1;
+    }
+    breaker->state = BREAKER_OPEN;
+  }
+  return 0;
+}
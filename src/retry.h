@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef RETRY_H
+#define RETRY_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+  BREAKER_CLOSED = 0, /**< device is polled normally */
+  BREAKER_OPEN, /**< device failed too many times, only probed occasionally */
+  BREAKER_HALF_OPEN, /**< probe in progress, its result decides the state */
+} breakerstate_t;
+
+typedef struct {
+  int threshold; /**< consecutive failures opening the breaker (0 - never) */
+  int64_t probe_interval; /**< ns between probes while open */
+  breakerstate_t state; /**< current state */
+  int failures; /**< number of consecutive failures */
+  struct timespec next_probe; /**< earliest time of next probe while open */
+  int trips; /**< number of times breaker opened */
+} breaker_t;
+
+/**
+ * \brief Compute delay before next try using exponential backoff
+ *
+ * Delay doubles with each attempt, starting at base and capped at max. Half
+ * of it is randomized, so that devices failing at once do not retry in
+ * lockstep.
+ *
+ * \param base Delay before second try in microseconds (0 - no delay)
+ * \param max Upper bound of delay in microseconds (0 - unbounded)
+ * \param attempt Number of failed tries so far (starting at 1)
+ * \param seed State of pseudo random generator, updated on every call; must
+ * not be 0
+ *
+ * \return delay in microseconds
+ */
+int64_t backoff_delay(int64_t base, int64_t max, int attempt, uint64_t *seed);
+
+/**
+ * \brief Sleep for given delay
+ *
+ * \param delay Number of microseconds to sleep
+ */
+void backoff_sleep(int64_t delay);
+
+/**
+ * \brief Initialize closed circuit breaker
+ *
+ * \param breaker Breaker to initialize
+ * \param threshold Number of consecutive failures opening the breaker
+ * (0 - breaker disabled)
+ * \param probe_interval Number of microseconds between probes of open breaker
+ */
+void breaker_init(breaker_t *breaker, int threshold, int64_t probe_interval);
+
+/**
+ * \brief Check whether device may be used now
+ *
+ * Open breaker lets single probe through once probe interval passed and
+ * becomes half-open until result of the probe is recorded.
+ *
+ * \param breaker Breaker of device
+ * \param now Current time of monotonic clock
+ *
+ * \return non-zero if transaction may be started
+ */
+int breaker_allow(breaker_t *breaker, const struct timespec *now);
+
+/**
+ * \brief Record result of transaction
+ *
+ * \param breaker Breaker of device
+ * \param success Non-zero if transaction succeeded
+ * \param now Current time of monotonic clock
+ *
+ * \return non-zero if this result opened the breaker
+ */
+int breaker_record(breaker_t *breaker, int success,
+    const struct timespec *now);
+
+#endif // RETRY_H
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "ring.h"
+
+#define RING_ALIGN 64
+
+struct ring_header {
+  char magic[8]; /**< magic of kind of file */
+  uint32_t version; /**< version of kind of file */
+  uint32_t record_size; /**< size of single record */
+  uint64_t capacity; /**< number of records in ring */
+  int64_t param; /**< kind-specific parameter */
+  uint32_t devices; /**< number of entries in device table */
+  uint32_t reserved;
+  uint64_t data_offset; /**< offset of first record from start of file */
+  _Atomic uint64_t committed; /**< number of records appended so far */
+};
+
+static uint64_t data_offset(uint32_t devices)
+{
+  uint64_t offset = sizeof(struct ring_header) +
+    (uint64_t)devices * RING_NAME_SIZE;
+
+  return (offset + RING_ALIGN - 1) / RING_ALIGN * RING_ALIGN;
+}
+
+static char *names(ring_t *ring)
+{
+  return (char*) ring->map + sizeof(struct ring_header);
+}
+
+static int map_ring(ring_t *ring, int prot)
+{
+  ring->map = mmap(NULL, ring->size, prot, MAP_SHARED, ring->fd, 0);
+  if (ring->map == MAP_FAILED)
+  {
+    perror("mmap");
+    ring->map = NULL;
+    return -1;
+  }
+  ring->header = ring->map;
+  return 0;
+}
+
+static int check_header(ring_t *ring, const ringtype_t *type)
+{
+  struct ring_header *hdr = ring->header;
+
+  if (memcmp(hdr->magic, type->magic, sizeof(hdr->magic)) != 0 ||
+      hdr->version != type->version ||
+      hdr->record_size != type->record_size ||
+      hdr->capacity == 0 ||
+      hdr->data_offset != data_offset(hdr->devices) ||
+      hdr->data_offset + hdr->capacity * hdr->record_size > ring->size)
+  {
+    return -1;
+  }
+  ring->records = (char*) ring->map + hdr->data_offset;
+  return 0;
+}
+
+int ring_open(ring_t *ring, const ringtype_t *type, const char *path,
+    uint64_t capacity, int64_t param, char **devices, int count)
+{
+  struct ring_header *hdr;
+  struct stat st;
+  char *name;
+  int i, err;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  if (capacity == 0 || count < 1)
+  {
+    return -2;
+  }
+
+  ring->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (ring->fd == -1)
+  {
+    perror("open");
+    return -1;
+  }
+  if (fstat(ring->fd, &st) == -1)
+  {
+    perror("fstat");
+    ring_close(ring);
+    return -1;
+  }
+
+  ring->size = data_offset(count) + capacity * type->record_size;
+  if (st.st_size == 0)
+  {
+    /* reserve all blocks now, so that appending cannot fail on full disk */
+    if ((err = posix_fallocate(ring->fd, 0, ring->size)) != 0)
+    {
+      errno = err;
+      perror("posix_fallocate");
+      ring_close(ring);
+      return -1;
+    }
+    if (map_ring(ring, PROT_READ | PROT_WRITE))
+    {
+      ring_close(ring);
+      return -1;
+    }
+    hdr = ring->header;
+    hdr->version = type->version;
+    hdr->record_size = type->record_size;
+    hdr->capacity = capacity;
+    hdr->param = param;
+    hdr->devices = count;
+    hdr->data_offset = data_offset(count);
+    atomic_store(&hdr->committed, 0);
+    for (i = 0; i < count; i++)
+    {
+      name = names(ring) + i * RING_NAME_SIZE;
+      strncpy(name, devices[i], RING_NAME_SIZE - 1);
+      name[RING_NAME_SIZE - 1] = '\0';
+    }
+    /* magic goes last, readers ignore file until it is initialized */
+    memcpy(hdr->magic, type->magic, sizeof(hdr->magic));
+  }
+  else if ((size_t) st.st_size != ring->size)
+  {
+    ERROR("%s: %s has different capacity or number of devices", path,
+        type->name);
+    ring_close(ring);
+    return -2;
+  }
+  else if (map_ring(ring, PROT_READ | PROT_WRITE))
+  {
+    ring_close(ring);
+    return -1;
+  }
+
+  if (check_header(ring, type) || ring->header->capacity != capacity ||
+      ring->header->param != param || ring->header->devices != count)
+  {
+    ERROR("%s: not a compatible %s", path, type->name);
+    ring_close(ring);
+    return -2;
+  }
+
+  /* records refer to devices by index, so they must keep their order */
+  for (i = 0; i < count; i++)
+  {
+    name = names(ring) + i * RING_NAME_SIZE;
+    if (strncmp(name, devices[i], RING_NAME_SIZE - 1) != 0)
+    {
+      ERROR("%s: device %d is %s in %s, not %s", path, i, name, type->name,
+          devices[i]);
+      ring_close(ring);
+      return -2;
+    }
+  }
+
+  return 0;
+}
+
+int ring_open_reader(ring_t *ring, const ringtype_t *type, const char *path)
+{
+  struct stat st;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (ring->fd == -1)
+  {
+    perror("open");
+    return -1;
+  }
+  if (fstat(ring->fd, &st) == -1)
+  {
+    perror("fstat");
+    ring_close(ring);
+    return -1;
+  }
+  if ((size_t) st.st_size < sizeof(struct ring_header))
+  {
+    ring_close(ring);
+    return -2;
+  }
+
+  ring->size = st.st_size;
+  if (map_ring(ring, PROT_READ))
+  {
+    ring_close(ring);
+    return -1;
+  }
+  if (check_header(ring, type))
+  {
+    ring_close(ring);
+    return -2;
+  }
+
+  return 0;
+}
+
+const void *ring_slot(ring_t *ring, uint64_t index)
+{
+  return ring->records +
+    (index % ring->header->capacity) * ring->header->record_size;
+}
+
+void ring_append(ring_t *ring, const void *record)
+{
+  struct ring_header *hdr = ring->header;
+  uint64_t committed = atomic_load_explicit(&hdr->committed,
+      memory_order_relaxed);
+
+  memcpy((void*) ring_slot(ring, committed), record, hdr->record_size);
+  /* publish only after record is fully written */
+  atomic_store_explicit(&hdr->committed, committed + 1, memory_order_release);
+}
+
+uint64_t ring_count(ring_t *ring)
+{
+  return atomic_load_explicit(&ring->header->committed,
+      memory_order_acquire);
+}
+
+int64_t ring_param(ring_t *ring)
+{
+  return ring->header->param;
+}
+
+const char *ring_device(ring_t *ring, uint32_t device)
+{
+  if (device >= ring->header->devices)
+  {
+    return NULL;
+  }
+  return names(ring) + (size_t)device * RING_NAME_SIZE;
+}
+
+static int64_t time_of(const void *record, size_t key)
+{
+  int64_t time;
+
+  memcpy(&time, (const char*) record + key, sizeof(time));
+  return time;
+}
+
+size_t ring_query(ring_t *ring, size_t key, int64_t from, int64_t to,
+    void *out, size_t max)
+{
+  uint64_t capacity = ring->header->capacity;
+  uint32_t size = ring->header->record_size;
+  uint64_t committed, oldest, lo, hi, mid;
+  char *dst;
+  size_t found;
+
+  do
+  {
+    committed = ring_count(ring);
+    /* slot following the newest record may be being overwritten right now,
+     * so it is skipped */
+    oldest = committed >= capacity ? committed - capacity + 1 : 0;
+
+    /* first record with time not before start of range */
+    lo = oldest;
+    hi = committed;
+    while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (time_of(ring_slot(ring, mid), key) < from)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+
+    for (found = 0; lo < committed && found < max; lo++)
+    {
+      dst = (char*) out + found * size;
+      memcpy(dst, ring_slot(ring, lo), size);
+      if (time_of(dst, key) >= to)
+      {
+        break;
+      }
+      found++;
+    }
+
+    /* records read above are valid only if none of them was reused since */
+    atomic_thread_fence(memory_order_acquire);
+  } while (oldest + capacity <= ring_count(ring));
+
+  return found;
+}
+
+void ring_close(ring_t *ring)
+{
+  if (ring->map != NULL)
+  {
+    munmap(ring->map, ring->size);
+    ring->map = NULL;
+  }
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+  ring->fd = -1;
+}
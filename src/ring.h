@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RING_NAME_SIZE 64 /**< size of single entry of device table */
+
+/**
+ * \brief Kind of file kept as a ring, e.g. store or rollup series
+ */
+typedef struct {
+  const char *name; /**< kind of file as used in messages */
+  const char *magic; /**< 8 characters identifying kind of file */
+  uint32_t version; /**< version of file layout */
+  uint32_t record_size; /**< size of single record */
+} ringtype_t;
+
+struct ring_header;
+
+/**
+ * \brief Memory-mapped file of fixed-size records, preallocated at creation
+ *
+ * File consists of header, table of device names and ring of records. Single
+ * writer appends records, overwriting the oldest ones when ring is full, while
+ * any number of readers query it without taking any locks.
+ */
+typedef struct {
+  int fd; /**< descriptor of file */
+  void *map; /**< whole file mapped to memory */
+  size_t size; /**< size of mapping */
+  struct ring_header *header; /**< header at the beginning of mapping */
+  char *records; /**< ring of records following device table */
+} ring_t;
+
+/**
+ * \brief Open ring for appending, creating it if it does not exist
+ *
+ * New file is preallocated for all records at once, so appending never
+ * extends it. Existing file is reused only if it has the same capacity and
+ * parameter and lists the same devices in the same order, as records refer to
+ * devices by their index.
+ *
+ * \param ring Ring to be initialized
+ * \param type Kind of file
+ * \param path Filename of ring
+ * \param capacity Number of records kept before the oldest are overwritten
+ * \param param Kind-specific parameter stored in header
+ * \param devices List of device names, index in list is device id of record
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be created or mapped
+ * \retval -2 existing file is not compatible
+ */
+int ring_open(ring_t *ring, const ringtype_t *type, const char *path,
+    uint64_t capacity, int64_t param, char **devices, int count);
+
+/**
+ * \brief Open existing ring read-only
+ *
+ * \param ring Ring to be initialized
+ * \param type Kind of file
+ * \param path Filename of ring
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be opened or mapped
+ * \retval -2 file is not a valid ring of given kind
+ */
+int ring_open_reader(ring_t *ring, const ringtype_t *type, const char *path);
+
+/**
+ * \brief Get record with given index
+ *
+ * \param ring Opened ring
+ * \param index Number of record since ring was created
+ *
+ * \return slot in which record is or was kept
+ */
+const void *ring_slot(ring_t *ring, uint64_t index);
+
+/**
+ * \brief Append record, overwriting the oldest one if ring is full
+ *
+ * Record becomes visible to readers only after it is completely written.
+ *
+ * \param ring Ring opened for appending
+ * \param record Record of size given by type of ring
+ */
+void ring_append(ring_t *ring, const void *record);
+
+/**
+ * \brief Get number of records appended since ring was created
+ *
+ * \param ring Opened ring
+ *
+ * \return total number of committed records, including overwritten ones
+ */
+uint64_t ring_count(ring_t *ring);
+
+/**
+ * \brief Get kind-specific parameter given at creation
+ *
+ * \param ring Opened ring
+ *
+ * \return parameter stored in header
+ */
+int64_t ring_param(ring_t *ring);
+
+/**
+ * \brief Get name of device with given id
+ *
+ * \param ring Opened ring
+ * \param device Device id from record
+ *
+ * \return device name or NULL if id is out of range
+ */
+const char *ring_device(ring_t *ring, uint32_t device);
+
+/**
+ * \brief Find records with time in range [from, to)
+ *
+ * Records have to be appended in order of their time. Start of range is found
+ * by binary search. If writer overwrote part of examined records in the
+ * meantime, lookup is repeated. Slot that is going to be overwritten next is
+ * never examined, so at most capacity - 1 newest records can be found.
+ *
+ * \param ring Opened ring
+ * \param key Offset of int64_t time within record
+ * \param from Beginning of range (inclusive)
+ * \param to End of range (exclusive)
+ * \param out Output buffer for records, oldest first
+ * \param max Capacity of output buffer in records
+ *
+ * \return number of records stored in out
+ */
+size_t ring_query(ring_t *ring, size_t key, int64_t from, int64_t to,
+    void *out, size_t max);
+
+/**
+ * \brief Unmap and close ring
+ *
+ * \param ring Opened ring
+ */
+void ring_close(ring_t *ring);
+
+#endif // RING_H
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+#include "timeutil.h"
+#include "rollup.h"
+
+static const ringtype_t rollup_type = {
+  .name = "rollup",
+  .magic = "MHZ14ARU",
+  .version = 1,
+  .record_size = sizeof(rollup_record_t),
+};
+
+const char *rollup_suffixes[ROLLUP_TIERS] = { ".1s", ".1m", ".1h" };
+
+const int64_t rollup_widths[ROLLUP_TIERS] = {
+  NSEC_PER_SEC,
+  60 * NSEC_PER_SEC,
+  3600 * NSEC_PER_SEC,
+};
+
+/* a day, 90 days and 5 years */
+const uint64_t rollup_capacities[ROLLUP_TIERS] = { 86400, 129600, 43800 };
+
+static rollup_record_t *bucket(rollup_t *rollup, uint32_t device, int tier)
+{
+  return &rollup->open[device * ROLLUP_TIERS + tier];
+}
+
+/**
+ * \brief Append aggregates of current period of all devices and start new one
+ */
+static void flush(rollup_t *rollup, int tier, int64_t start)
+{
+  rollup_record_t *open;
+  int i;
+
+  for (i = 0; i < rollup->devices; i++)
+  {
+    open = bucket(rollup, i, tier);
+    if (open->count > 0 || open->failures > 0)
+    {
+      ring_append(&rollup->series[tier], open);
+    }
+    memset(open, 0, sizeof(*open));
+    open->start = start;
+    open->device = i;
+  }
+  rollup->period[tier] = start;
+}
+
+int rollup_open(rollup_t *rollup, const char *prefix, char **devices,
+    int count)
+{
+  char path[PATH_MAX];
+  const rollup_record_t *last;
+  uint64_t committed;
+  int tier, i, err;
+
+  memset(rollup, 0, sizeof(*rollup));
+  rollup->last_wall = INT64_MIN;
+  if (count < 1)
+  {
+    return -2;
+  }
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    rollup->series[tier].fd = -1;
+  }
+
+  rollup->open = calloc((size_t) count * ROLLUP_TIERS,
+      sizeof(*rollup->open));
+  if (rollup->open == NULL)
+  {
+    perror("calloc");
+    return -1;
+  }
+  rollup->devices = count;
+
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    snprintf(path, sizeof(path), "%s%s", prefix, rollup_suffixes[tier]);
+    err = ring_open(&rollup->series[tier], &rollup_type, path,
+        rollup_capacities[tier] * count, rollup_widths[tier], devices, count);
+    if (err)
+    {
+      for (i = 0; i < tier; i++)
+      {
+        rollup_close_series(&rollup->series[i]);
+      }
+      free(rollup->open);
+      rollup->open = NULL;
+      return err;
+    }
+    rollup->period[tier] = INT64_MIN;
+    rollup->stored[tier] = INT64_MIN;
+
+    /* period written at previous close may still be in progress, it is
+     * already in file, so it is not written again */
+    committed = ring_count(&rollup->series[tier]);
+    if (committed > 0)
+    {
+      last = ring_slot(&rollup->series[tier], committed - 1);
+      rollup->period[tier] = rollup->stored[tier] = last->start;
+      if (last->start > rollup->last_wall)
+      {
+        rollup->last_wall = last->start;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void rollup_advance(rollup_t *rollup, int64_t wall)
+{
+  int64_t start;
+  int tier;
+
+  /* clock stepped back must not put periods out of order */
+  if (wall < rollup->last_wall)
+  {
+    wall = rollup->last_wall;
+  }
+  rollup->last_wall = wall;
+
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    /* periods are aligned to wall clock, e.g. hours start at full hour */
+    start = wall - ((wall % rollup_widths[tier]) + rollup_widths[tier]) %
+      rollup_widths[tier];
+    if (start > rollup->period[tier])
+    {
+      flush(rollup, tier, start);
+    }
+  }
+}
+
+void rollup_add(rollup_t *rollup, const store_record_t *record)
+{
+  rollup_record_t *open;
+  int tier;
+
+  if (record->device >= (uint32_t) rollup->devices)
+  {
+    return;
+  }
+
+  rollup_advance(rollup, record->wall);
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    if (rollup->period[tier] == rollup->stored[tier])
+    {
+      continue;
+    }
+    open = bucket(rollup, record->device, tier);
+    if (record->status != 0)
+    {
+      if (open->failures < UINT16_MAX)
+      {
+        open->failures++;
+      }
+      continue;
+    }
+    if (open->count == 0 || record->ppm < open->min)
+    {
+      open->min = record->ppm;
+    }
+    if (open->count == 0 || record->ppm > open->max)
+    {
+      open->max = record->ppm;
+    }
+    open->last = record->ppm;
+    open->sum += record->ppm;
+    open->count++;
+  }
+}
+
+void rollup_close(rollup_t *rollup)
+{
+  int tier;
+
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    if (rollup->open != NULL && rollup->period[tier] != INT64_MIN)
+    {
+      /* incomplete period is kept rather than lost */
+      flush(rollup, tier, rollup->period[tier]);
+    }
+    rollup_close_series(&rollup->series[tier]);
+  }
+  free(rollup->open);
+  rollup->open = NULL;
+}
+
+int rollup_open_reader(rollup_series_t *series, const char *path)
+{
+  int err;
+
+  err = ring_open_reader(series, &rollup_type, path);
+  if (err == 0 && ring_param(series) <= 0)
+  {
+    ring_close(series);
+    return -2;
+  }
+  return err;
+}
+
+int64_t rollup_width(rollup_series_t *series)
+{
+  return ring_param(series);
+}
+
+const char *rollup_device(rollup_series_t *series, uint32_t device)
+{
+  return ring_device(series, device);
+}
+
+size_t rollup_query(rollup_series_t *series, int64_t from, int64_t to,
+    rollup_record_t *out, size_t max)
+{
+  return ring_query(series, offsetof(rollup_record_t, start), from, to, out,
+      max);
+}
+
+double rollup_mean(const rollup_record_t *record)
+{
+  if (record->count == 0)
+  {
+    return 0;
+  }
+  return (double) record->sum / record->count;
+}
+
+void rollup_close_series(rollup_series_t *series)
+{
+  ring_close(series);
+}
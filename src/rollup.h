@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "store.h"
+
+#define ROLLUP_TIERS 3 /**< number of resolutions kept */
+
+/**
+ * \brief Resolution of rollup series
+ */
+typedef enum {
+  ROLLUP_SECOND = 0,
+  ROLLUP_MINUTE,
+  ROLLUP_HOUR,
+} rolluptier_t;
+
+/**
+ * \brief Aggregate of readings of single device in single period
+ */
+typedef struct {
+  int64_t start; /**< wall time of beginning of period in ns since epoch */
+  uint64_t sum; /**< sum of valid concentrations */
+  uint32_t device; /**< index of device in device table */
+  uint32_t count; /**< number of valid readings */
+  uint16_t min; /**< lowest concentration (valid only if count > 0) */
+  uint16_t max; /**< highest concentration (valid only if count > 0) */
+  uint16_t last; /**< latest concentration (valid only if count > 0) */
+  uint16_t failures; /**< number of failed transactions */
+} rollup_record_t;
+
+/**
+ * \brief Single series file of one resolution, period width is its parameter
+ */
+typedef ring_t rollup_series_t;
+
+/**
+ * \brief Writer of all resolutions
+ */
+typedef struct {
+  rollup_series_t series[ROLLUP_TIERS]; /**< file of every resolution */
+  int64_t period[ROLLUP_TIERS]; /**< start of currently aggregated period of
+                                  *  every resolution (INT64_MIN - none) */
+  int64_t stored[ROLLUP_TIERS]; /**< start of period found in file at open,
+                                  *  which is not written again
+                                  *  (INT64_MIN - none) */
+  int64_t last_wall; /**< latest wall time accounted, earlier times are
+                       *  clamped to it */
+  rollup_record_t *open; /**< aggregates of current periods, ROLLUP_TIERS
+                           *  entries per device */
+  int devices; /**< number of devices */
+} rollup_t;
+
+extern const char *rollup_suffixes[ROLLUP_TIERS]; /**< suffix of file name of
+                                                    *  every resolution */
+extern const int64_t rollup_widths[ROLLUP_TIERS]; /**< period of every
+                                                    *  resolution in ns */
+extern const uint64_t rollup_capacities[ROLLUP_TIERS]; /**< periods kept in
+                                                         *  every resolution
+                                                         *  per device */
+
+/**
+ * \brief Open series files PREFIX.1s, PREFIX.1m and PREFIX.1h for writing
+ *
+ * Files are created and preallocated for given number of devices, or reused
+ * like \link store_open \endlink does, only if they list the same devices in
+ * the same order. Latest period of every reused file was already written, so
+ * transactions that still fall into it are not accounted in that resolution
+ * again, and earlier wall times are treated as start of that period.
+ *
+ * \param rollup Writer to be initialized
+ * \param prefix Path to which suffixes of resolutions are appended
+ * \param devices List of device names, index in list is device id of record
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be created or mapped
+ * \retval -2 existing file is not compatible
+ */
+int rollup_open(rollup_t *rollup, const char *prefix, char **devices,
+    int count);
+
+/**
+ * \brief Account transaction in current period of every resolution
+ *
+ * Periods that ended before the record are flushed first. Record from before
+ * latest accounted time (e.g. after system clock was stepped back) is
+ * accounted as if it happened at that time.
+ *
+ * \param rollup Opened writer
+ * \param record Result of transaction, as appended to store
+ */
+void rollup_add(rollup_t *rollup, const store_record_t *record);
+
+/**
+ * \brief Flush aggregates of all periods that ended before given time
+ *
+ * Aggregates of all devices are appended at once, so every file stays sorted
+ * by start of period. Devices without any transaction in period are skipped.
+ *
+ * \param rollup Opened writer
+ * \param wall Current wall time in ns since epoch
+ */
+void rollup_advance(rollup_t *rollup, int64_t wall);
+
+/**
+ * \brief Flush current, incomplete periods and close all files
+ *
+ * \param rollup Opened writer
+ */
+void rollup_close(rollup_t *rollup);
+
+/**
+ * \brief Open existing series file read-only
+ *
+ * Readers do not take any locks, so any number of them can query the series
+ * while writer appends to it.
+ *
+ * \param series Series to be initialized
+ * \param path Filename of series, e.g. PREFIX.1m
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be opened or mapped
+ * \retval -2 file is not a valid series
+ */
+int rollup_open_reader(rollup_series_t *series, const char *path);
+
+/**
+ * \brief Get length of period of series
+ *
+ * \param series Opened series
+ *
+ * \return period in ns
+ */
+int64_t rollup_width(rollup_series_t *series);
+
+/**
+ * \brief Get name of device with given id
+ *
+ * \param series Opened series
+ * \param device Device id from record
+ *
+ * \return device name or NULL if id is out of range
+ */
+const char *rollup_device(rollup_series_t *series, uint32_t device);
+
+/**
+ * \brief Find aggregates of periods starting in range [from, to)
+ *
+ * Works as \link store_query \endlink.
+ *
+ * \param series Opened series
+ * \param from Beginning of range in ns since epoch (inclusive)
+ * \param to End of range in ns since epoch (exclusive)
+ * \param out Output buffer for records, oldest first
+ * \param max Capacity of output buffer
+ *
+ * \return number of records stored in out
+ */
+size_t rollup_query(rollup_series_t *series, int64_t from, int64_t to,
+    rollup_record_t *out, size_t max);
+
+/**
+ * \brief Compute mean concentration of aggregate
+ *
+ * \param record Aggregate
+ *
+ * \return mean or 0 if there were no valid readings
+ */
+double rollup_mean(const rollup_record_t *record);
+
+/**
+ * \brief Unmap and close series opened for reading
+ *
+ * \param series Opened series
+ */
+void rollup_close_series(rollup_series_t *series);
+
+#endif // ROLLUP_H
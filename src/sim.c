@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <math.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "logger.h"
+#include "timeutil.h"
+#include "mh.h"
+#include "sim.h"
+
+#define MAX_EVENTS 64
+#define FRESH_AIR_PPM 400
+
+/**
+ * \brief Get next pseudo-random number (xorshift64*)
+ */
+static uint64_t sim_random(sim_t *sim)
+{
+  uint64_t x = sim->rng;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sim->rng = x;
+
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * \brief Get pseudo-random number uniformly distributed in [0, 1)
+ */
+static double sim_uniform(sim_t *sim)
+{
+  return (sim_random(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int open_sensor(simsensor_t *sensor)
+{
+  struct termios options;
+
+  sensor->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (sensor->master == -1)
+  {
+    perror("posix_openpt");
+    return -1;
+  }
+  if (grantpt(sensor->master) || unlockpt(sensor->master) ||
+      ptsname_r(sensor->master, sensor->name, sizeof(sensor->name)))
+  {
+    perror("ptsname");
+    return -1;
+  }
+
+  /* without raw mode terminal layer would translate protocol bytes */
+  sensor->slave = open(sensor->name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (sensor->slave == -1)
+  {
+    perror("open");
+    return -1;
+  }
+  if (tcgetattr(sensor->slave, &options))
+  {
+    perror("tcgetattr");
+    return -1;
+  }
+  cfmakeraw(&options);
+  if (tcsetattr(sensor->slave, TCSANOW, &options))
+  {
+    perror("tcsetattr");
+    return -1;
+  }
+
+  frame_parser_init(&sensor->parser, 1);
+  return 0;
+}
+
+int sim_open(sim_t *sim, const simopt_t *opts)
+{
+  struct epoll_event ev;
+  int i;
+
+  memset(sim, 0, sizeof(*sim));
+  sim->opts = *opts;
+  sim->rng = opts->seed * 2654435761ULL + 1;
+  sim->stopfd = -1;
+  timespec_now(&sim->start);
+
+  sim->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (sim->epfd == -1)
+  {
+    perror("epoll_create1");
+    return -2;
+  }
+
+  sim->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (sim->stopfd == -1)
+  {
+    perror("eventfd");
+    sim_close(sim);
+    return -2;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(sim->epfd, EPOLL_CTL_ADD, sim->stopfd, &ev) == -1)
+  {
+    perror("epoll_ctl");
+    sim_close(sim);
+    return -2;
+  }
+
+  sim->sensors = calloc(opts->count, sizeof(simsensor_t));
+  if (sim->sensors == NULL)
+  {
+    perror("calloc");
+    sim_close(sim);
+    return -2;
+  }
+  for (i = 0; i < opts->count; i++)
+  {
+    sim->sensors[i].master = -1;
+    sim->sensors[i].slave = -1;
+  }
+
+  for (i = 0; i < opts->count; i++)
+  {
+    simsensor_t *sensor = &sim->sensors[i];
+
+    if (open_sensor(sensor))
+    {
+      sim->opts.count = i + 1;
+      sim_close(sim);
+      return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = sensor;
+    if (epoll_ctl(sim->epfd, EPOLL_CTL_ADD, sensor->master, &ev) == -1)
+    {
+      perror("epoll_ctl");
+      sim->opts.count = i + 1;
+      sim_close(sim);
+      return -2;
+    }
+  }
+
+  return 0;
+}
+
+uint16_t sim_concentration(sim_t *sim, int index, const struct timespec *now)
+{
+  simsensor_t *sensor = &sim->sensors[index];
+  int64_t period = sim->opts.period * NSEC_PER_MSEC;
+  int64_t elapsed = timespec_diff_ns(now, &sim->start);
+  double phase = 0;
+  int32_t ppm = sim->opts.ppm;
+
+  if (period > 0)
+  {
+    /* spread sensors evenly over the period, so that they differ */
+    elapsed += period * index / sim->opts.count;
+    phase = (double)(elapsed % period) / period;
+  }
+
+  switch (sim->opts.waveform)
+  {
+    case WAVE_SINE:
+      ppm += sim->opts.amplitude * sin(2 * M_PI * phase);
+      break;
+    case WAVE_RAMP:
+      ppm += sim->opts.amplitude * phase;
+      break;
+    case WAVE_RANDOM:
+      ppm += sensor->walk;
+      break;
+    case WAVE_CONSTANT:
+    default:
+      break;
+  }
+  ppm += sensor->offset;
+
+  if (ppm < 0)
+  {
+    ppm = 0;
+  }
+  if (ppm > UINT16_MAX)
+  {
+    ppm = UINT16_MAX;
+  }
+  return ppm;
+}
+
+static void send_response(simsensor_t *sensor, simresp_t *resp)
+{
+  if (resp->len == 0)
+  {
+    return;
+  }
+  if (write(sensor->master, resp->data, resp->len) == -1)
+  {
+    DEBUG("%s: unable to send response: %s", sensor->name, strerror(errno));
+    return;
+  }
+  sensor->responses++;
+}
+
+static void read_gas(sim_t *sim, int index, const struct timespec *now)
+{
+  simsensor_t *sensor = &sim->sensors[index];
+  simresp_t resp;
+  return_gas_t *packet = (return_gas_t*) resp.data;
+  int32_t step;
+
+  if (sim->opts.waveform == WAVE_RANDOM)
+  {
+    step = (int32_t)(sim_random(sim) % 21) - 10;
+    sensor->walk += step;
+    if (sensor->walk > sim->opts.amplitude ||
+        sensor->walk < -sim->opts.amplitude)
+    {
+      sensor->walk -= 2 * step;
+    }
+  }
+
+  memset(&resp, 0, sizeof(resp));
+  packet->start = 0xff;
+  packet->command = CMD_GAS_CONCENTRATION;
+  packet->concentration = htobe16(sim_concentration(sim, index, now));
+  packet->reserved[0] = 0x47;
+  packet->checksum = checksum((pkt_t*) packet);
+  resp.len = sizeof(pkt_t);
+
+  /* inject faults */
+  if (sim_uniform(sim) < sim->opts.drop)
+  {
+    DEBUG("%s: dropping response", sensor->name);
+    return;
+  }
+  if (sim_uniform(sim) < sim->opts.corrupt)
+  {
+    resp.data[1 + sim_random(sim) % (sizeof(pkt_t) - 1)] ^=
+      1 + sim_random(sim) % 255;
+  }
+  if (sim_uniform(sim) < sim->opts.partial)
+  {
+    resp.len = 1 + sim_random(sim) % (sizeof(pkt_t) - 1);
+  }
+
+  if (sim->opts.latency == 0 && sim->opts.jitter == 0 && sensor->queued == 0)
+  {
+    send_response(sensor, &resp);
+    return;
+  }
+
+  if (sensor->queued == SIM_QUEUE_SIZE)
+  {
+    DEBUG("%s: too many requests in flight", sensor->name);
+    return;
+  }
+  resp.due = *now;
+  timespec_add_ns(&resp.due, sim->opts.latency * NSEC_PER_USEC);
+  if (sim->opts.jitter > 0)
+  {
+    timespec_add_ns(&resp.due,
+        (sim_random(sim) % sim->opts.jitter) * NSEC_PER_USEC);
+  }
+  sensor->queue[sensor->queued++] = resp;
+}
+
+static void handle_request(sim_t *sim, int index, pkt_t *request)
+{
+  simsensor_t *sensor = &sim->sensors[index];
+  read_gas_t *packet = (read_gas_t*) request;
+  struct timespec now;
+
+  sensor->requests++;
+  timespec_now(&now);
+  switch (packet->command)
+  {
+    case CMD_GAS_CONCENTRATION:
+      read_gas(sim, index, &now);
+      break;
+    case CMD_CALIBRATE_ZERO:
+      /* sensor is assumed to be in fresh air now */
+      sensor->offset += FRESH_AIR_PPM - sim_concentration(sim, index, &now);
+      INFO("%s: zero point calibrated", sensor->name);
+      break;
+    case CMD_CALIBRATE_SPAN:
+      INFO("%s: span point calibrated at %d", sensor->name,
+          be16toh(((calibrate_span_t*) request)->span_point));
+      break;
+    default:
+      DEBUG("%s: unsupported command 0x%x", sensor->name, packet->command);
+      break;
+  }
+}
+
+/**
+ * \brief Check if line settings of terminal are the ones sensor expects
+ */
+static int line_matches(sim_t *sim, simsensor_t *sensor)
+{
+  struct termios options;
+  tcflag_t expected = 0;
+
+  if (sim->opts.baudrate == 0)
+  {
+    return 1;
+  }
+  if (tcgetattr(sensor->slave, &options))
+  {
+    perror("tcgetattr");
+    return 0;
+  }
+  if (int_to_stopbits(sim->opts.stopbits, &expected))
+  {
+    return 0;
+  }
+  return cfgetospeed(&options) == int_to_baud(sim->opts.baudrate) &&
+    (options.c_cflag & CSTOPB) == expected;
+}
+
+static void receive(sim_t *sim, simsensor_t *sensor)
+{
+  uint8_t buf[FRAME_BUFFER_SIZE];
+  ssize_t processed;
+  pkt_t request;
+
+  while ((processed = read(sensor->master, buf,
+          frame_parser_space(&sensor->parser))) > 0)
+  {
+    if (!line_matches(sim, sensor))
+    {
+      /* on real line, sensor would only see garbage */
+      DEBUG("%s: ignoring %zd bytes sent with wrong line settings",
+          sensor->name, processed);
+      continue;
+    }
+    frame_parser_feed(&sensor->parser, buf, processed);
+    while (frame_parser_next(&sensor->parser, &request))
+    {
+      handle_request(sim, sensor - sim->sensors, &request);
+    }
+  }
+}
+
+/**
+ * \brief Send responses which are due and find nearest future one
+ *
+ * \return number of milliseconds until next response or -1 if none is queued
+ */
+static int send_due(sim_t *sim)
+{
+  struct timespec now;
+  int64_t ns, min_ns = -1;
+  int i, j;
+
+  timespec_now(&now);
+  for (i = 0; i < sim->opts.count; i++)
+  {
+    simsensor_t *sensor = &sim->sensors[i];
+
+    while (sensor->queued > 0)
+    {
+      ns = timespec_diff_ns(&sensor->queue[0].due, &now);
+      if (ns > 0)
+      {
+        if (min_ns < 0 || ns < min_ns)
+        {
+          min_ns = ns;
+        }
+        break;
+      }
+      send_response(sensor, &sensor->queue[0]);
+      for (j = 1; j < sensor->queued; j++)
+      {
+        sensor->queue[j - 1] = sensor->queue[j];
+      }
+      sensor->queued--;
+    }
+  }
+
+  if (min_ns < 0)
+  {
+    return -1;
+  }
+  return (min_ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+int sim_step(sim_t *sim, int timeout)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int i, n, due;
+
+  due = send_due(sim);
+  if (due >= 0 && (timeout < 0 || due < timeout))
+  {
+    timeout = due;
+  }
+
+  n = epoll_wait(sim->epfd, events, MAX_EVENTS, timeout);
+  if (n == -1)
+  {
+    if (errno == EINTR)
+    {
+      return 1;
+    }
+    perror("epoll_wait");
+    return -1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (events[i].data.ptr == NULL)
+    {
+      return 0;
+    }
+    receive(sim, events[i].data.ptr);
+  }
+  send_due(sim);
+
+  /* timeout is also progress, only stop request returns 0 */
+  return n > 0 ? n : 1;
+}
+
+int sim_run(sim_t *sim)
+{
+  int result;
+
+  while ((result = sim_step(sim, -1)) > 0);
+
+  return result;
+}
+
+void sim_stop(sim_t *sim)
+{
+  uint64_t one = 1;
+
+  if (write(sim->stopfd, &one, sizeof(one)) == -1)
+  {
+    perror("write");
+  }
+}
+
+void sim_close(sim_t *sim)
+{
+  int i;
+
+  for (i = 0; sim->sensors != NULL && i < sim->opts.count; i++)
+  {
+    if (sim->sensors[i].slave >= 0)
+    {
+      close(sim->sensors[i].slave);
+    }
+    if (sim->sensors[i].master >= 0)
+    {
+      close(sim->sensors[i].master);
+    }
+  }
+  free(sim->sensors);
+  sim->sensors = NULL;
+  if (sim->stopfd >= 0)
+  {
+    close(sim->stopfd);
+  }
+  if (sim->epfd >= 0)
+  {
+    close(sim->epfd);
+  }
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mh_uart.h"
+
+#define SIM_QUEUE_SIZE 4 /**< responses waiting for latency per sensor */
+
+typedef enum {
+  WAVE_CONSTANT = 0, /**< always base concentration */
+  WAVE_SINE, /**< sine around base concentration */
+  WAVE_RAMP, /**< sawtooth from base up by amplitude */
+  WAVE_RANDOM, /**< random walk within amplitude around base */
+} waveform_t;
+
+typedef struct {
+  int count; /**< number of simulated sensors */
+  int64_t latency; /**< microseconds between request and response */
+  int64_t jitter; /**< maximum random microseconds added to latency */
+  double corrupt; /**< probability that one byte of response is corrupted */
+  double drop; /**< probability that response is not sent at all */
+  double partial; /**< probability that only part of response is sent */
+  waveform_t waveform; /**< shape of concentration over time */
+  uint16_t ppm; /**< base concentration */
+  uint16_t amplitude; /**< amplitude of waveform */
+  int64_t period; /**< period of waveform in milliseconds */
+  unsigned int seed; /**< seed of random generator */
+  int baudrate; /**< speed sensor communicates at, requests sent with other
+                  *  line settings are ignored (0 - any settings) */
+  uint8_t stopbits; /**< number of stop bits x10 sensor expects; data bits
+                      *  and parity cannot be checked, because
+                      *  pseudo-terminals always use 8 bits without parity */
+} simopt_t;
+
+typedef struct {
+  uint8_t data[sizeof(pkt_t)]; /**< response bytes */
+  size_t len; /**< number of bytes to be actually sent */
+  struct timespec due; /**< time at which response is to be sent */
+} simresp_t;
+
+typedef struct {
+  int master; /**< master side of pseudo-terminal */
+  int slave; /**< slave side, kept open to preserve raw mode */
+  char name[64]; /**< filename of slave side to be opened by reader */
+  frame_parser_t parser; /**< incoming request parser */
+  simresp_t queue[SIM_QUEUE_SIZE]; /**< responses waiting for latency */
+  int queued; /**< number of entries in queue */
+  int16_t offset; /**< correction applied by zero calibration */
+  int32_t walk; /**< current state of random walk */
+  uint32_t requests; /**< number of valid requests received */
+  uint32_t responses; /**< number of responses sent */
+} simsensor_t;
+
+typedef struct {
+  simopt_t opts; /**< simulation parameters */
+  simsensor_t *sensors; /**< array of simulated sensors */
+  int epfd; /**< epoll instance driving all sensors */
+  int stopfd; /**< eventfd used to stop \link sim_run \endlink */
+  struct timespec start; /**< start of simulation, origin of waveforms */
+  uint64_t rng; /**< state of random generator */
+} sim_t;
+
+/**
+ * \brief Create pseudo-terminals for all simulated sensors
+ *
+ * \param sim Simulator to be initialized
+ * \param opts Simulation parameters
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 pseudo-terminal could not be created
+ * \retval -2 simulator could not be created
+ */
+int sim_open(sim_t *sim, const simopt_t *opts);
+
+/**
+ * \brief Compute concentration of sensor at given time
+ *
+ * \param sim Opened simulator
+ * \param index Number of sensor
+ * \param now Point in time of monotonic clock
+ *
+ * \return concentration in ppm
+ */
+uint16_t sim_concentration(sim_t *sim, int index, const struct timespec *now);
+
+/**
+ * \brief Process requests and responses due until timeout passes
+ *
+ * \param sim Opened simulator
+ * \param timeout Maximum number of milliseconds to wait (-1 - infinity)
+ *
+ * \return positive value if simulation goes on, -1 on error or 0 on stop
+ * request
+ */
+int sim_step(sim_t *sim, int timeout);
+
+/**
+ * \brief Serve sensors until \link sim_stop \endlink is called
+ *
+ * \param sim Opened simulator
+ *
+ * \return 0 on stop request, -1 on error
+ */
+int sim_run(sim_t *sim);
+
+/**
+ * \brief Request \link sim_run \endlink to return, can be called from other
+ * thread or signal handler
+ *
+ * \param sim Opened simulator
+ */
+void sim_stop(sim_t *sim);
+
+/**
+ * \brief Close all pseudo-terminals and release simulator
+ *
+ * \param sim Simulator to be closed
+ */
+void sim_close(sim_t *sim);
+
+#endif // SIM_H
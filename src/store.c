@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stddef.h>
+
+#include "store.h"
+
+static const ringtype_t store_type = {
+  .name = "store",
+  .magic = "MHZ14AST",
+  .version = 2,
+  .record_size = sizeof(store_record_t),
+};
+
+int store_open(store_t *store, const char *path, uint64_t capacity,
+    char **devices, int count)
+{
+  const store_record_t *last;
+  uint64_t committed;
+  int err;
+
+  memset(store, 0, sizeof(*store));
+  err = ring_open(&store->ring, &store_type, path, capacity, 0, devices,
+      count);
+  if (err)
+  {
+    return err;
+  }
+
+  store->last_wall = INT64_MIN;
+  committed = ring_count(&store->ring);
+  if (committed > 0)
+  {
+    last = ring_slot(&store->ring, committed - 1);
+    store->last_wall = last->wall;
+  }
+
+  return 0;
+}
+
+int store_open_reader(store_t *store, const char *path)
+{
+  memset(store, 0, sizeof(*store));
+  return ring_open_reader(&store->ring, &store_type, path);
+}
+
+void store_append(store_t *store, const store_record_t *record)
+{
+  store_record_t dst = *record;
+
+  if (dst.wall < store->last_wall)
+  {
+    dst.wall = store->last_wall;
+  }
+  store->last_wall = dst.wall;
+  ring_append(&store->ring, &dst);
+}
+
+uint64_t store_count(store_t *store)
+{
+  return ring_count(&store->ring);
+}
+
+const char *store_device(store_t *store, uint32_t device)
+{
+  return ring_device(&store->ring, device);
+}
+
+size_t store_query(store_t *store, int64_t from, int64_t to,
+    store_record_t *out, size_t max)
+{
+  return ring_query(&store->ring, offsetof(store_record_t, wall), from, to,
+      out, max);
+}
+
+void store_close(store_t *store)
+{
+  ring_close(&store->ring);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ring.h"
+
+#define STORE_NAME_SIZE RING_NAME_SIZE /**< size of single entry of device
+                                         *  table */
+#define STORE_DEFAULT_CAPACITY 1048576 /**< records kept by default */
+
+/**
+ * \brief Single reading as kept in store file
+ */
+typedef struct {
+  int64_t mono; /**< monotonic clock time of reading in ns */
+  int64_t wall; /**< wall clock time of reading in ns since epoch */
+  uint32_t device; /**< index of device in device table */
+  uint16_t ppm; /**< gas concentration (valid only if status is 0) */
+  int16_t status; /**< 0 on success or error code of transaction */
+} store_record_t;
+
+typedef struct {
+  ring_t ring; /**< file of records */
+  int64_t last_wall; /**< wall time of last appended record (writer only) */
+} store_t;
+
+/**
+ * \brief Open store for appending, creating it if it does not exist
+ *
+ * New file is preallocated for all records at once, so appending never
+ * extends it. Existing file is reused only if it has the same capacity and
+ * lists the same devices in the same order, as records refer to devices by
+ * their index.
+ *
+ * \param store Store to be initialized
+ * \param path Filename of store
+ * \param capacity Number of records kept before the oldest are overwritten
+ * \param devices List of device names, index in list is device id of record
+ * \param count Number of devices
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be created or mapped
+ * \retval -2 existing file is not compatible
+ */
+int store_open(store_t *store, const char *path, uint64_t capacity,
+    char **devices, int count);
+
+/**
+ * \brief Open existing store read-only
+ *
+ * Readers do not take any locks, so any number of them can query the store
+ * while writer appends to it.
+ *
+ * \param store Store to be initialized
+ * \param path Filename of store
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 file could not be opened or mapped
+ * \retval -2 file is not a valid store
+ */
+int store_open_reader(store_t *store, const char *path);
+
+/**
+ * \brief Append record, overwriting the oldest one if store is full
+ *
+ * Record becomes visible to readers only after it is completely written.
+ * Wall time is never allowed to go back, so that store stays sorted even if
+ * system clock is stepped backwards.
+ *
+ * \param store Store opened for appending
+ * \param record Record to be appended
+ */
+void store_append(store_t *store, const store_record_t *record);
+
+/**
+ * \brief Get number of records appended since store was created
+ *
+ * \param store Opened store
+ *
+ * \return total number of committed records, including overwritten ones
+ */
+uint64_t store_count(store_t *store);
+
+/**
+ * \brief Get name of device with given id
+ *
+ * \param store Opened store
+ * \param device Device id from record
+ *
+ * \return device name or NULL if id is out of range
+ */
+const char *store_device(store_t *store, uint32_t device);
+
+/**
+ * \brief Find records with wall time in range [from, to)
+ *
+ * Start of range is found by binary search. If writer overwrote part of
+ * examined records in the meantime, lookup is repeated. Slot that is going to
+ * be overwritten next is never examined, so at most capacity - 1 newest records
+ * can be found.
+ *
+ * \param store Opened store
+ * \param from Beginning of range in ns since epoch (inclusive)
+ * \param to End of range in ns since epoch (exclusive)
+ * \param out Output buffer for records, oldest first
+ * \param max Capacity of output buffer
+ *
+ * \return number of records stored in out
+ */
+size_t store_query(store_t *store, int64_t from, int64_t to,
+    store_record_t *out, size_t max);
+
+/**
+ * \brief Unmap and close store
+ *
+ * \param store Opened store
+ */
+void store_close(store_t *store);
+
+#endif // STORE_H
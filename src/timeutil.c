@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeutil.h"
+
+void timespec_now(struct timespec *ts)
+{
+  clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+void timespec_add_ns(struct timespec *ts, int64_t ns)
+{
+  ns += ts->tv_nsec;
+  ts->tv_sec += ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+  if (ts->tv_nsec < 0)
+  {
+    ts->tv_sec--;
+    ts->tv_nsec += NSEC_PER_SEC;
+  }
+}
+
+int64_t timespec_diff_ns(const struct timespec *end,
+    const struct timespec *start)
+{
+  return (int64_t)(end->tv_sec - start->tv_sec) * NSEC_PER_SEC +
+    (end->tv_nsec - start->tv_nsec);
+}
+
+int parse_timeout(const char *arg, int64_t *us)
+{
+  char *end = NULL;
+  long long value;
+
+  errno = 0;
+  value = strtoll(arg, &end, 10);
+  if (errno != 0 || end == arg || value < 0)
+  {
+    return -1;
+  }
+
+  if (*end == '\0' || strcmp(end, "s") == 0)
+  {
+    *us = value * 1000000;
+  }
+  else if (strcmp(end, "ms") == 0)
+  {
+    *us = value * 1000;
+  }
+  else if (strcmp(end, "us") == 0)
+  {
+    *us = value;
+  }
+  else
+  {
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_USEC 1000LL
+
+/**
+ * \brief Get current time of monotonic clock
+ *
+ * \param ts Structure to be filled with current time
+ */
+void timespec_now(struct timespec *ts);
+
+/**
+ * \brief Advance timestamp by given number of nanoseconds
+ *
+ * \param ts Timestamp to be modified
+ * \param ns Number of nanoseconds to add (may be negative)
+ */
+void timespec_add_ns(struct timespec *ts, int64_t ns);
+
+/**
+ * \brief Compute difference between two timestamps
+ *
+ * \param end Later timestamp
+ * \param start Earlier timestamp
+ *
+ * \return number of nanoseconds from start to end (negative if end is earlier)
+ */
+int64_t timespec_diff_ns(const struct timespec *end,
+    const struct timespec *start);
+
+/**
+ * \brief Parse duration with optional unit suffix
+ *
+ * \param arg text in form of number optionally followed by s, ms or us (plain
+ * number means seconds)
+ * \param us output number of microseconds
+ *
+ * \return 0 on success, -1 on invalid input
+ */
+int parse_timeout(const char *arg, int64_t *us);
+
+#endif // TIMEUTIL_H
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+
+#ifdef HAVE_IO_URING
+#include "logger.h"
+#include "uring.h"
+
+#define RING_PTR(base, offset) ((void*)((char*)(base) + (offset)))
+
+int uring_open(uring_t *ring, unsigned entries)
+{
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd == -1)
+  {
+    perror("io_uring_setup");
+    return -1;
+  }
+  if (!(params.features & IORING_FEAT_FAST_POLL) ||
+      !(params.features & IORING_FEAT_NODROP))
+  {
+    /* reads of idle devices would fail instead of waiting */
+    DEBUG("io_uring lacks required features (0x%x)", params.features);
+    close(ring->fd);
+    return -2;
+  }
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    /* both rings share single mapping */
+    if (ring->cq_size > ring->sq_size)
+    {
+      ring->sq_size = ring->cq_size;
+    }
+    ring->cq_size = 0;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+  {
+    perror("mmap");
+    close(ring->fd);
+    return -1;
+  }
+  ring->cq_ring = ring->sq_ring;
+  if (ring->cq_size != 0)
+  {
+    ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+    {
+      perror("mmap");
+      munmap(ring->sq_ring, ring->sq_size);
+      close(ring->fd);
+      return -1;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    perror("mmap");
+    if (ring->cq_size != 0)
+    {
+      munmap(ring->cq_ring, ring->cq_size);
+    }
+    munmap(ring->sq_ring, ring->sq_size);
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sq_head = RING_PTR(ring->sq_ring, params.sq_off.head);
+  ring->sq_tail = RING_PTR(ring->sq_ring, params.sq_off.tail);
+  ring->sq_mask = RING_PTR(ring->sq_ring, params.sq_off.ring_mask);
+  ring->sq_array = RING_PTR(ring->sq_ring, params.sq_off.array);
+  ring->cq_head = RING_PTR(ring->cq_ring, params.cq_off.head);
+  ring->cq_tail = RING_PTR(ring->cq_ring, params.cq_off.tail);
+  ring->cq_mask = RING_PTR(ring->cq_ring, params.cq_off.ring_mask);
+  ring->cqes = RING_PTR(ring->cq_ring, params.cq_off.cqes);
+  ring->entries = params.sq_entries;
+
+  return 0;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *ring)
+{
+  struct io_uring_sqe *sqe;
+  unsigned head, tail, index;
+
+  head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  tail = *ring->sq_tail + ring->queued;
+  if (tail - head >= ring->entries)
+  {
+    if (uring_submit(ring, 0) < 0)
+    {
+      return NULL;
+    }
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    tail = *ring->sq_tail;
+    if (tail - head >= ring->entries)
+    {
+      errno = EBUSY;
+      return NULL;
+    }
+  }
+
+  index = tail & *ring->sq_mask;
+  sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ring->queued++;
+
+  return sqe;
+}
+
+int uring_submit(uring_t *ring, unsigned wait)
+{
+  unsigned submit = ring->queued;
+  int ret;
+
+  /* entries have to be visible before kernel sees new tail */
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued,
+      __ATOMIC_RELEASE);
+  ring->queued = 0;
+
+  ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret == -1)
+  {
+    return -1;
+  }
+
+  return ret;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_seen(uring_t *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_close(uring_t *ring)
+{
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_size != 0)
+  {
+    munmap(ring->cq_ring, ring->cq_size);
+  }
+  munmap(ring->sq_ring, ring->sq_size);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+  int fd; /**< descriptor of io_uring instance */
+  void *sq_ring; /**< mapping of submission ring */
+  size_t sq_size; /**< size of submission ring mapping */
+  void *cq_ring; /**< mapping of completion ring (may equal sq_ring) */
+  size_t cq_size; /**< size of completion ring mapping */
+  struct io_uring_sqe *sqes; /**< array of submission entries */
+  size_t sqes_size; /**< size of submission entries mapping */
+  unsigned *sq_head; /**< first entry not consumed by kernel */
+  unsigned *sq_tail; /**< next entry to be filled */
+  unsigned *sq_mask; /**< mask of submission ring index */
+  unsigned *sq_array; /**< indices of submission entries */
+  unsigned *cq_head; /**< first completion not consumed */
+  unsigned *cq_tail; /**< next completion to be filled by kernel */
+  unsigned *cq_mask; /**< mask of completion ring index */
+  struct io_uring_cqe *cqes; /**< array of completions */
+  unsigned entries; /**< number of submission entries */
+  unsigned queued; /**< entries filled but not submitted yet */
+} uring_t;
+
+/**
+ * \brief Create io_uring instance and map its rings
+ *
+ * \param ring Ring to be initialized
+ * \param entries Minimum number of submission entries
+ *
+ * \return success indicator
+ * \retval 0 success
+ * \retval -1 io_uring is not available
+ * \retval -2 kernel cannot wait for readiness of files internally
+ */
+int uring_open(uring_t *ring, unsigned entries);
+
+/**
+ * \brief Get free submission entry, zeroed
+ *
+ * When submission ring is full, queued entries are submitted first.
+ *
+ * \param ring Opened ring
+ *
+ * \return entry to be filled or NULL on error
+ */
+struct io_uring_sqe *uring_sqe(uring_t *ring);
+
+/**
+ * \brief Submit queued entries and wait for completions
+ *
+ * \param ring Opened ring
+ * \param wait Minimum number of completions to wait for (0 - do not wait)
+ *
+ * \return number of entries submitted or -1 on error (errno set)
+ */
+int uring_submit(uring_t *ring, unsigned wait);
+
+/**
+ * \brief Get oldest completion not consumed yet
+ *
+ * \param ring Opened ring
+ *
+ * \return completion or NULL if there is none, has to be released with
+ * \link uring_seen \endlink
+ */
+struct io_uring_cqe *uring_peek(uring_t *ring);
+
+/**
+ * \brief Release completion returned by \link uring_peek \endlink
+ *
+ * \param ring Opened ring
+ */
+void uring_seen(uring_t *ring);
+
+/**
+ * \brief Unmap rings and close instance, cancelling requests in flight
+ *
+ * \param ring Ring to be closed
+ */
+void uring_close(uring_t *ring);
+
+#endif // URING_H
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PTY_HELPER_H
+#define PTY_HELPER_H
+
+/* _GNU_SOURCE has to be defined before first include of including file */
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+typedef struct {
+  int master;
+  int slave;
+  char name[64];
+} pty_t;
+
+/* open pseudo-terminal pair in raw mode, slave is kept open to preserve its
+ * settings while device is being reopened by code under test */
+static inline void open_pty(pty_t *pty)
+{
+  struct termios options;
+
+  pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+  assert_true(pty->master >= 0);
+  assert_int_equal(0, grantpt(pty->master));
+  assert_int_equal(0, unlockpt(pty->master));
+  assert_int_equal(0, ptsname_r(pty->master, pty->name, sizeof(pty->name)));
+  pty->slave = open(pty->name, O_RDWR | O_NOCTTY);
+  assert_true(pty->slave >= 0);
+  assert_int_equal(0, tcgetattr(pty->slave, &options));
+  cfmakeraw(&options);
+  assert_int_equal(0, tcsetattr(pty->slave, TCSANOW, &options));
+}
+
+static inline void close_pty(pty_t *pty)
+{
+  close(pty->slave);
+  close(pty->master);
+}
+
+#endif // PTY_HELPER_H
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+
+#include "testutil.h"
+#include "arbiter.h"
+#include "timeutil.h"
+
+#define WAITERS 3
+
+static char path[64];
+static _Atomic int arrivals = 0;
+static int order[WAITERS];
+
+static void make_device()
+{
+  temp_file(path, "arbiter");
+}
+
+static void sleep_ms(int ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * NSEC_PER_MSEC };
+
+  nanosleep(&ts, NULL);
+}
+
+static int64_t elapsed_ms(const struct timespec *start)
+{
+  struct timespec now;
+
+  timespec_now(&now);
+  return timespec_diff_ns(&now, start) / NSEC_PER_MSEC;
+}
+
+static void test_arb_open_free(void **state)
+{
+  int fd;
+
+  make_device();
+  fd = arb_open(path, O_RDWR, 100000);
+  assert_true(fd >= 0);
+  close(fd);
+
+  /* lock is released together with descriptor */
+  fd = arb_open(path, O_RDWR, 100000);
+  assert_true(fd >= 0);
+  close(fd);
+  unlink(path);
+}
+
+static void test_arb_open_missing(void **state)
+{
+  assert_int_equal(-1, arb_open("/nonexistent/ttyS0", O_RDWR, 100000));
+  assert_int_equal(ENOENT, errno);
+}
+
+static void test_arb_open_timeout(void **state)
+{
+  struct timespec start;
+  int holder;
+  int fd;
+
+  make_device();
+  holder = arb_open(path, O_RDWR, 0);
+  assert_true(holder >= 0);
+
+  timespec_now(&start);
+  assert_int_equal(-8, arb_open(path, O_RDWR, 50000));
+  assert_int_equal(EBUSY, errno);
+  assert_true(elapsed_ms(&start) >= 50);
+
+  /* without locking device can still be opened */
+  fd = arb_open(path, O_RDWR, -1);
+  assert_true(fd >= 0);
+  close(fd);
+
+  close(holder);
+  unlink(path);
+}
+
+static void *waiter(void *arg)
+{
+  int fd = arb_open(path, O_RDWR, 0);
+
+  if (fd >= 0)
+  {
+    order[atomic_fetch_add(&arrivals, 1)] = (int) (intptr_t) arg;
+    sleep_ms(10);
+    close(fd);
+  }
+  return NULL;
+}
+
+static void test_arb_open_fifo(void **state)
+{
+  pthread_t threads[WAITERS];
+  int holder;
+  int i;
+
+  make_device();
+  atomic_store(&arrivals, 0);
+  holder = arb_open(path, O_RDWR, 0);
+  assert_true(holder >= 0);
+
+  for (i = 0; i < WAITERS; i++)
+  {
+    assert_int_equal(0, pthread_create(&threads[i], NULL, waiter,
+          (void *) (intptr_t) i));
+    /* let thread take its ticket before the next one */
+    sleep_ms(20);
+  }
+  close(holder);
+
+  for (i = 0; i < WAITERS; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  assert_int_equal(WAITERS, atomic_load(&arrivals));
+  for (i = 0; i < WAITERS; i++)
+  {
+    assert_int_equal(i, order[i]);
+  }
+  unlink(path);
+}
+
+static void *impatient(void *arg)
+{
+  *(int *) arg = arb_open(path, O_RDWR, 30000);
+  return NULL;
+}
+
+static void test_arb_open_abandoned(void **state)
+{
+  struct timespec start;
+  pthread_t thread;
+  int result = 0;
+  int holder;
+  int fd;
+
+  make_device();
+  holder = arb_open(path, O_RDWR, 0);
+  assert_true(holder >= 0);
+
+  assert_int_equal(0, pthread_create(&thread, NULL, impatient, &result));
+  pthread_join(thread, NULL);
+  assert_int_equal(-8, result);
+
+  /* ticket of thread that gave up does not hold the queue */
+  close(holder);
+  timespec_now(&start);
+  fd = arb_open(path, O_RDWR, 2000000);
+  assert_true(fd >= 0);
+  assert_true(elapsed_ms(&start) < 500);
+  close(fd);
+  unlink(path);
+}
+
+static void test_arb_open_dead(void **state)
+{
+  struct timespec start;
+  pid_t child;
+  int holder;
+  int fd;
+
+  make_device();
+  holder = arb_open(path, O_RDWR, 0);
+  assert_true(holder >= 0);
+
+  child = fork();
+  assert_true(child >= 0);
+  if (child == 0)
+  {
+    arb_open(path, O_RDWR, 0);
+    _exit(0);
+  }
+  /* child gets killed while first in queue */
+  sleep_ms(50);
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+
+  close(holder);
+  timespec_now(&start);
+  fd = arb_open(path, O_RDWR, 2000000);
+  assert_true(fd >= 0);
+  assert_true(elapsed_ms(&start) < 500);
+  close(fd);
+  unlink(path);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_arb_open_free),
+    cmocka_unit_test(test_arb_open_missing),
+    cmocka_unit_test(test_arb_open_timeout),
+    cmocka_unit_test(test_arb_open_fifo),
+    cmocka_unit_test(test_arb_open_abandoned),
+    cmocka_unit_test(test_arb_open_dead),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pty_helper.h"
+#include "sim.h"
+#include "timeutil.h"
+#include "batch.h"
+
+static void *serve(void *arg)
+{
+  sim_run(arg);
+  return NULL;
+}
+
+static void test_batch_load_devices(void **state)
+{
+  char list[] = "/tmp/test_batch_XXXXXX";
+  char **devices = NULL;
+  int count = 0, fd;
+  FILE *fp;
+
+  fd = mkstemp(list);
+  assert_true(fd >= 0);
+  fp = fdopen(fd, "w");
+  assert_non_null(fp);
+  fprintf(fp, "# sensors in server room\n\n  /dev/ttyUSB0  \n/dev/ttyUSB1\n"
+      "   # spare\n/dev/ttyUSB2");
+  fclose(fp);
+
+  assert_int_equal(0, batch_load_devices(list, &devices, &count));
+  assert_int_equal(3, count);
+  assert_string_equal("/dev/ttyUSB0", devices[0]);
+  assert_string_equal("/dev/ttyUSB1", devices[1]);
+  assert_string_equal("/dev/ttyUSB2", devices[2]);
+
+  /* entries are appended to devices given before */
+  assert_int_equal(0, batch_load_devices(list, &devices, &count));
+  assert_int_equal(6, count);
+  assert_string_equal("/dev/ttyUSB0", devices[3]);
+
+  assert_int_equal(-1, batch_load_devices("/nonexistent", &devices, &count));
+  assert_int_equal(6, count);
+
+  for (fd = 0; fd < count; fd++)
+  {
+    free(devices[fd]);
+  }
+  free(devices);
+  unlink(list);
+}
+
+static void test_batch_json(void **state)
+{
+  simopt_t sopts = {
+    .count = 2,
+    .ppm = 600,
+  };
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 0,
+    .tries = 3,
+  };
+  batchopt_t bopts = {
+    .device_count = 4,
+    .deadline = 100000,
+    .format = BATCH_JSON,
+  };
+  char *devices[4], *output = NULL, *entry;
+  struct timespec start, end;
+  pthread_t thread;
+  pty_t silent;
+  size_t size;
+  sim_t sim;
+  FILE *out;
+
+  assert_int_equal(0, sim_open(&sim, &sopts));
+  assert_int_equal(0, pthread_create(&thread, NULL, serve, &sim));
+  open_pty(&silent);
+  devices[0] = sim.sensors[0].name;
+  devices[1] = silent.name;
+  devices[2] = "/nonexistent";
+  devices[3] = sim.sensors[1].name;
+  bopts.devices = devices;
+
+  out = open_memstream(&output, &size);
+  assert_non_null(out);
+  timespec_now(&start);
+  assert_int_equal(0, run_batch(&opts, &bopts, out));
+  timespec_now(&end);
+  fclose(out);
+
+  /* silent device would block forever without deadline, missing one must not
+   * prevent reading the others */
+  assert_int_equal(2, bopts.failed);
+  assert_true(timespec_diff_ns(&end, &start) < 500 * NSEC_PER_MSEC);
+
+  assert_int_equal('[', output[0]);
+  assert_int_equal(']', output[size - 2]);
+  entry = strstr(output, sim.sensors[0].name);
+  assert_non_null(entry);
+  assert_non_null(strstr(entry, "\"ppm\": 600, \"latency_us\": "));
+  entry = strstr(entry, silent.name);
+  assert_non_null(entry);
+  assert_non_null(strstr(entry, "\"ppm\": null, \"latency_us\": "));
+  assert_non_null(strstr(entry, "\"error\": -3},"));
+  entry = strstr(entry, "{\"device\": \"/nonexistent\", \"ppm\": null, "
+      "\"latency_us\": 0, \"error\": -1},");
+  assert_non_null(entry);
+  entry = strstr(entry, sim.sensors[1].name);
+  assert_non_null(entry);
+  assert_non_null(strstr(entry, "\"error\": 0}\n]\n"));
+
+  free(output);
+  sim_stop(&sim);
+  pthread_join(thread, NULL);
+  close_pty(&silent);
+  sim_close(&sim);
+}
+
+static void test_batch_csv(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .tries = 1,
+  };
+  char *devices[] = { "/nonexistent", "/nonexistent,\"quoted\"" };
+  batchopt_t bopts = {
+    .devices = devices,
+    .device_count = 2,
+    .format = BATCH_CSV,
+  };
+  char *output = NULL;
+  size_t size;
+  FILE *out;
+
+  out = open_memstream(&output, &size);
+  assert_non_null(out);
+  assert_int_equal(0, run_batch(&opts, &bopts, out));
+  fclose(out);
+
+  assert_int_equal(2, bopts.failed);
+  assert_string_equal("device,ppm,latency_us,error\n"
+      "/nonexistent,,0,-1\n"
+      "\"/nonexistent,\"\"quoted\"\"\",,0,-1\n", output);
+  free(output);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_batch_load_devices),
+    cmocka_unit_test(test_batch_json),
+    cmocka_unit_test(test_batch_csv),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
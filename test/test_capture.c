@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "testutil.h"
+#include "capture.h"
+
+static void test_capture_roundtrip(void **state)
+{
+  static const uint8_t request[] = {0xff, 0x01, 0x86, 0, 0, 0, 0, 0, 0x79};
+  static const uint8_t response[] = {0xff, 0x86, 0x02, 0x58};
+  char path[32];
+  capture_reader_t reader;
+  capture_record_t record;
+  uint8_t data[CAPTURE_MAX_DATA];
+  capture_t *capture;
+  int64_t last = 0;
+  FILE *fp;
+
+  temp_file(path, "capture");
+  capture = capture_open(path);
+  assert_non_null(capture);
+  capture_device(capture, 5, "/dev/ttyS0");
+  capture_io(capture, 5, CAPTURE_TX, request, sizeof(request));
+  capture_io(capture, 5, CAPTURE_RX, response, sizeof(response));
+  capture_io(capture, 5, CAPTURE_RX, response, 0);
+  assert_int_equal(0, capture_dropped(capture));
+  capture_close(capture);
+  capture_close(NULL);
+
+  fp = fopen(path, "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  assert_true(reader.header.realtime > 0);
+
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(CAPTURE_OPEN, record.direction);
+  assert_int_equal(5, record.channel);
+  assert_int_equal(strlen("/dev/ttyS0"), record.length);
+  assert_memory_equal("/dev/ttyS0", data, record.length);
+  assert_true(record.time >= reader.header.monotonic);
+  last = record.time;
+
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(CAPTURE_TX, record.direction);
+  assert_int_equal(sizeof(request), record.length);
+  assert_memory_equal(request, data, sizeof(request));
+  assert_true(record.time >= last);
+  last = record.time;
+
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(CAPTURE_RX, record.direction);
+  assert_int_equal(sizeof(response), record.length);
+  assert_memory_equal(response, data, sizeof(response));
+  assert_true(record.time >= last);
+
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(0, record.length);
+
+  assert_int_equal(0, capture_next(&reader, &record, data));
+  fclose(fp);
+  unlink(path);
+}
+
+static void test_capture_split(void **state)
+{
+  uint8_t big[CAPTURE_MAX_DATA * 2 + 10];
+  uint8_t data[CAPTURE_MAX_DATA];
+  char path[32];
+  capture_reader_t reader;
+  capture_record_t record;
+  capture_t *capture;
+  size_t total = 0, i;
+  int records = 0;
+  FILE *fp;
+
+  for (i = 0; i < sizeof(big); i++)
+  {
+    big[i] = i;
+  }
+  temp_file(path, "capture");
+  capture = capture_open(path);
+  assert_non_null(capture);
+  capture_io(capture, 3, CAPTURE_TX, big, sizeof(big));
+  capture_close(capture);
+
+  fp = fopen(path, "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  while (capture_next(&reader, &record, data) == 1)
+  {
+    assert_true(record.length <= CAPTURE_MAX_DATA);
+    assert_memory_equal(big + total, data, record.length);
+    total += record.length;
+    records++;
+  }
+  assert_int_equal(sizeof(big), total);
+  assert_int_equal(3, records);
+  fclose(fp);
+  unlink(path);
+}
+
+static void test_capture_many(void **state)
+{
+  uint8_t data[CAPTURE_MAX_DATA];
+  uint8_t payload[9];
+  char path[32];
+  capture_reader_t reader;
+  capture_record_t record;
+  capture_t *capture;
+  uint32_t expected = 0, seq;
+  int count = CAPTURE_BUFFER_SIZE / 8, ret, i;
+  FILE *fp;
+
+  /* several buffer swaps; records are either stored in order or dropped */
+  temp_file(path, "capture");
+  capture = capture_open(path);
+  assert_non_null(capture);
+  for (i = 0; i < count; i++)
+  {
+    memcpy(payload, &i, sizeof(i));
+    capture_io(capture, 1, CAPTURE_RX, payload, sizeof(payload));
+  }
+  capture_close(capture);
+
+  fp = fopen(path, "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  while ((ret = capture_next(&reader, &record, data)) == 1)
+  {
+    memcpy(&seq, data, sizeof(seq));
+    assert_true(seq >= expected);
+    expected = seq + 1;
+  }
+  assert_int_equal(0, ret);
+  assert_true(expected > 0);
+  fclose(fp);
+  unlink(path);
+}
+
+static void test_capture_not_capture(void **state)
+{
+  capture_reader_t reader;
+  FILE *fp = tmpfile();
+
+  assert_non_null(fp);
+  fputs("definitely not a capture file", fp);
+  rewind(fp);
+  assert_int_equal(-1, capture_open_reader(&reader, fp));
+  fclose(fp);
+
+  assert_null(capture_open("/nonexistent/capture"));
+  assert_int_equal(ENOENT, errno);
+}
+
+static void test_capture_separate(void **state)
+{
+  uint8_t data[CAPTURE_MAX_DATA];
+  char paths[2][32];
+  capture_t *captures[2];
+  capture_reader_t reader;
+  capture_record_t record;
+  FILE *fp;
+  int i;
+
+  /* captures are independent, e.g. of two library users in one process */
+  for (i = 0; i < 2; i++)
+  {
+    temp_file(paths[i], "capture");
+    captures[i] = capture_open(paths[i]);
+    assert_non_null(captures[i]);
+  }
+  capture_io(captures[0], 3, CAPTURE_TX, "a", 1);
+  capture_io(captures[1], 4, CAPTURE_TX, "bb", 2);
+  capture_close(captures[1]);
+  capture_io(captures[0], 3, CAPTURE_RX, "c", 1);
+  capture_close(captures[0]);
+
+  fp = fopen(paths[0], "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(3, record.channel);
+  assert_memory_equal("a", data, 1);
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(CAPTURE_RX, record.direction);
+  assert_int_equal(0, capture_next(&reader, &record, data));
+  fclose(fp);
+
+  fp = fopen(paths[1], "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(4, record.channel);
+  assert_memory_equal("bb", data, 2);
+  assert_int_equal(0, capture_next(&reader, &record, data));
+  fclose(fp);
+
+  unlink(paths[0]);
+  unlink(paths[1]);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_capture_roundtrip),
+    cmocka_unit_test(test_capture_split),
+    cmocka_unit_test(test_capture_many),
+    cmocka_unit_test(test_capture_not_capture),
+    cmocka_unit_test(test_capture_separate),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
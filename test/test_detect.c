@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "testutil.h"
+#include "pty_helper.h"
+#include "sim.h"
+#include "timeutil.h"
+#include "arbiter.h"
+#include "detect.h"
+
+static const lineopt_t candidates[] = {
+  {9600, 8, 'N', 10},
+  {19200, 8, 'N', 10},
+  {19200, 8, 'N', 20},
+  {38400, 8, 'N', 10},
+};
+#define CANDIDATES (sizeof(candidates) / sizeof(lineopt_t))
+
+static void *serve(void *arg)
+{
+  sim_run(arg);
+  return NULL;
+}
+
+static void test_detect_candidates(void **state)
+{
+  lineopt_t list[1024];
+  int i, j, n;
+
+  n = detect_candidates(list, 1024);
+  /* every speed except 0 with 4 sizes, 3 parities and 2 stop bit counts */
+  assert_int_equal((speeds_count - 1) * 24, n);
+  assert_int_equal(9600, list[0].baudrate);
+  assert_int_equal(8, list[0].databits);
+  assert_int_equal('N', list[0].parity);
+  assert_int_equal(10, list[0].stopbits);
+  assert_int_equal(9600, list[23].baudrate);
+  assert_int_equal(19200, list[24].baudrate);
+  assert_int_equal(50, list[n - 1].baudrate);
+
+  for (i = 0; i < n; i++)
+  {
+    assert_true(list[i].baudrate > 0);
+    for (j = 0; j < i; j++)
+    {
+      assert_false(memcmp(&list[i], &list[j], sizeof(lineopt_t)) == 0);
+    }
+  }
+
+  assert_int_equal(5, detect_candidates(list, 5));
+}
+
+static void test_detect_run(void **state)
+{
+  simopt_t opts = {
+    .count = 2,
+    .ppm = 600,
+    .baudrate = 19200,
+    .stopbits = 20,
+  };
+  char cache[32];
+  detectdev_t devs[3];
+  pthread_t thread;
+  pty_t silent;
+  sim_t sim;
+  FILE *fp;
+  int i;
+
+  temp_file(cache, "detect");
+  /* entry of unrelated device has to survive */
+  fp = fopen(cache, "w");
+  assert_non_null(fp);
+  fprintf(fp, "/dev/unrelated 4800 8N1\n");
+  fclose(fp);
+
+  assert_int_equal(0, sim_open(&sim, &opts));
+  assert_int_equal(0, pthread_create(&thread, NULL, serve, &sim));
+  open_pty(&silent);
+
+  memset(devs, 0, sizeof(devs));
+  devs[0].device = sim.sensors[0].name;
+  devs[1].device = silent.name;
+  devs[2].device = sim.sensors[1].name;
+  assert_int_equal(0, detect_cache_load(cache, devs, 3));
+  assert_int_equal(2, detect_run(devs, 3, candidates, CANDIDATES, 20000,
+        LOCK_WAIT_DEFAULT, NULL));
+
+  for (i = 0; i < 3; i += 2)
+  {
+    assert_int_equal(DETECT_FOUND, devs[i].state);
+    assert_int_equal(3, devs[i].tries);
+    assert_int_equal(19200, devs[i].line.baudrate);
+    assert_int_equal(8, devs[i].line.databits);
+    assert_int_equal('N', devs[i].line.parity);
+    assert_int_equal(20, devs[i].line.stopbits);
+    assert_int_equal(600, devs[i].gas_concentration);
+  }
+  assert_int_equal(DETECT_FAILED, devs[1].state);
+  assert_int_equal(CANDIDATES, devs[1].tries);
+
+  /* devices are probed concurrently, so detection takes as long as the
+   * slowest one instead of sum of them */
+  assert_true(devs[1].elapsed < 4 * 100 * NSEC_PER_MSEC);
+
+  assert_int_equal(0, detect_cache_store(cache, devs, 3));
+
+  /* second time cached settings work right away */
+  memset(devs, 0, sizeof(devs));
+  devs[0].device = sim.sensors[0].name;
+  devs[1].device = silent.name;
+  devs[2].device = sim.sensors[1].name;
+  assert_int_equal(2, detect_cache_load(cache, devs, 3));
+  assert_false(devs[1].has_cached);
+  assert_int_equal(2, detect_run(devs, 3, candidates, CANDIDATES, 20000,
+        LOCK_WAIT_DEFAULT, NULL));
+  assert_int_equal(1, devs[0].tries);
+  assert_int_equal(1, devs[2].tries);
+  assert_int_equal(CANDIDATES, devs[1].tries);
+
+  memset(devs, 0, sizeof(devs));
+  devs[0].device = "/dev/unrelated";
+  assert_int_equal(1, detect_cache_load(cache, devs, 1));
+  assert_int_equal(4800, devs[0].cached.baudrate);
+
+  sim_stop(&sim);
+  pthread_join(thread, NULL);
+  close_pty(&silent);
+  sim_close(&sim);
+  unlink(cache);
+}
+
+static void test_detect_missing(void **state)
+{
+  detectdev_t dev;
+
+  memset(&dev, 0, sizeof(dev));
+  dev.device = "/nonexistent";
+  assert_int_equal(0, detect_run(&dev, 1, candidates, CANDIDATES, 20000,
+        LOCK_WAIT_DEFAULT, NULL));
+  assert_int_equal(DETECT_FAILED, dev.state);
+  assert_int_equal(0, detect_cache_load("/nonexistent/cache", &dev, 1));
+  assert_int_equal(-1, detect_cache_store("/nonexistent/cache", &dev, 1));
+}
+
+static void test_detect_busy(void **state)
+{
+  struct timespec start, now;
+  detectdev_t dev;
+  pty_t pty;
+  int holder;
+
+  open_pty(&pty);
+  holder = arb_open(pty.name, O_RDWR | O_NOCTTY, 0);
+  assert_true(holder >= 0);
+
+  /* device used by another process is not probed behind its back */
+  memset(&dev, 0, sizeof(dev));
+  dev.device = pty.name;
+  timespec_now(&start);
+  assert_int_equal(0, detect_run(&dev, 1, candidates, CANDIDATES, 20000,
+        50000, NULL));
+  timespec_now(&now);
+  assert_int_equal(DETECT_FAILED, dev.state);
+  assert_int_equal(0, dev.tries);
+  assert_true(timespec_diff_ns(&now, &start) < 500 * NSEC_PER_MSEC);
+
+  close(holder);
+  close_pty(&pty);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_detect_candidates),
+    cmocka_unit_test(test_detect_run),
+    cmocka_unit_test(test_detect_missing),
+    cmocka_unit_test(test_detect_busy),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
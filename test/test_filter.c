@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+static int compare(const void *a, const void *b)
+{
+  return *(const uint16_t *) a - *(const uint16_t *) b;
+}
+
+/* median of last window samples computed from scratch */
+static double brute_median(const uint16_t *samples, int count, int window)
+{
+  uint16_t sorted[FILTER_MAX_WINDOW];
+  int n = count < window ? count : window;
+
+  memcpy(sorted, samples + count - n, n * sizeof(*sorted));
+  qsort(sorted, n, sizeof(*sorted), compare);
+  if (n % 2 == 0)
+  {
+    return (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+  }
+  return sorted[n / 2];
+}
+
+static void test_filter_invalid(void **state)
+{
+  filter_t filter;
+  filteropt_t alpha = { .alpha = 1.5 };
+  filteropt_t average = { .average = FILTER_MAX_WINDOW + 1 };
+  filteropt_t median = { .median = -1 };
+  filteropt_t none = { 0 };
+
+  assert_int_equal(-1, filter_init(&filter, &alpha));
+  assert_int_equal(-1, filter_init(&filter, &average));
+  assert_int_equal(-1, filter_init(&filter, &median));
+  assert_int_equal(0, filter_init(&filter, &none));
+
+  /* nothing enabled, nothing printed */
+  filter_update(&filter, 400);
+  char buf[32];
+  assert_int_equal(0, filter_format(&filter, buf, sizeof(buf)));
+  assert_string_equal("", buf);
+}
+
+static void test_filter_ewma(void **state)
+{
+  filter_t filter;
+  filteropt_t opts = { .alpha = 0.5 };
+
+  assert_int_equal(0, filter_init(&filter, &opts));
+  assert_true(filter_ewma(&filter) == 0);
+
+  /* first sample is taken as is */
+  filter_update(&filter, 400);
+  assert_true(filter_ewma(&filter) == 400);
+  filter_update(&filter, 800);
+  assert_true(filter_ewma(&filter) == 600);
+  filter_update(&filter, 800);
+  assert_true(filter_ewma(&filter) == 700);
+}
+
+static void test_filter_average(void **state)
+{
+  filter_t filter;
+  filteropt_t opts = { .average = 3 };
+
+  assert_int_equal(0, filter_init(&filter, &opts));
+  assert_true(filter_average(&filter) == 0);
+
+  /* window not full yet */
+  filter_update(&filter, 400);
+  filter_update(&filter, 500);
+  assert_true(filter_average(&filter) == 450);
+
+  filter_update(&filter, 600);
+  assert_true(filter_average(&filter) == 500);
+
+  /* oldest sample leaves window */
+  filter_update(&filter, 1000);
+  assert_true(filter_average(&filter) == 700);
+  filter_update(&filter, 1000);
+  filter_update(&filter, 1000);
+  assert_true(filter_average(&filter) == 1000);
+}
+
+static void test_filter_median(void **state)
+{
+  filter_t filter;
+  filteropt_t opts = { .median = 3 };
+
+  assert_int_equal(0, filter_init(&filter, &opts));
+  assert_true(filter_median(&filter) == 0);
+
+  filter_update(&filter, 500);
+  assert_true(filter_median(&filter) == 500);
+  filter_update(&filter, 400);
+  assert_true(filter_median(&filter) == 450);
+
+  /* single spike does not move median */
+  filter_update(&filter, 5000);
+  assert_true(filter_median(&filter) == 500);
+  filter_update(&filter, 450);
+  assert_true(filter_median(&filter) == 450);
+}
+
+static void test_filter_median_random(void **state)
+{
+  static const int windows[] = { 1, 2, 3, 4, 7, 16, 33, FILTER_MAX_WINDOW };
+  uint16_t samples[2000];
+  filter_t filter;
+  filteropt_t opts = { 0 };
+  size_t w;
+  int i;
+
+  srand(1);
+  for (w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+  {
+    opts.median = windows[w];
+    assert_int_equal(0, filter_init(&filter, &opts));
+    for (i = 0; i < 2000; i++)
+    {
+      /* narrow range, so equal values are common */
+      samples[i] = 400 + rand() % (i < 1000 ? 50 : 5000);
+      filter_update(&filter, samples[i]);
+      assert_true(filter_median(&filter) ==
+          brute_median(samples, i + 1, windows[w]));
+    }
+  }
+}
+
+static void test_filter_format(void **state)
+{
+  filter_t filter;
+  filteropt_t opts = { .alpha = 0.25, .average = 2, .median = 3 };
+  char buf[64];
+
+  assert_int_equal(0, filter_init(&filter, &opts));
+  filter_update(&filter, 400);
+  filter_update(&filter, 401);
+  filter_format(&filter, buf, sizeof(buf));
+  assert_string_equal(" 400.2 400.5 400.5", buf);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_filter_invalid),
+    cmocka_unit_test(test_filter_ewma),
+    cmocka_unit_test(test_filter_average),
+    cmocka_unit_test(test_filter_median),
+    cmocka_unit_test(test_filter_median_random),
+    cmocka_unit_test(test_filter_format),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
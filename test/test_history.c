@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "testutil.h"
+#include "history.h"
+#include "store.h"
+
+#define SAMPLES 10000
+#define BASE 1700000000000LL /**< some wall time in ms */
+
+static char *devices[] = {"/dev/ttyS0", "/dev/ttyS1"};
+
+typedef struct {
+  history_sample_t samples[SAMPLES];
+  int count;
+} collected_t;
+
+static collected_t collected;
+
+static int collect(const history_sample_t *sample, void *arg)
+{
+  collected_t *out = arg;
+
+  assert_true(out->count < SAMPLES);
+  out->samples[out->count++] = *sample;
+  return 0;
+}
+
+static int64_t scan(history_t *history, const history_filter_t *filter)
+{
+  collected.count = 0;
+  return history_scan(history, filter, collect, &collected);
+}
+
+static void test_history_roundtrip(void **state)
+{
+  static const uint16_t ppms[] = { 0, 65535, 400, 401, 399, 5000, 5000 };
+  static const int64_t offsets[] = { 0, 1000, 2003, 2999, 2999, 90000, 90001 };
+  static const history_sample_t expected[] = {
+    { BASE, 0, 0 },
+    { BASE + 2003, 0, 400 },
+    { BASE + 2999, 0, 399 },
+    { BASE + 90001, 0, 5000 },
+    { BASE + 90001, 0, 700 },
+    { BASE + 1000, 1, 65535 },
+    { BASE + 2999, 1, 401 },
+    { BASE + 90000, 1, 5000 },
+  };
+  char path[32];
+  history_t writer, reader;
+  size_t i;
+
+  /* empty file is created as new history */
+  temp_file(path, "history");
+  assert_int_equal(0, history_open(&writer, path, devices, 2));
+  for (i = 0; i < sizeof(ppms) / sizeof(ppms[0]); i++)
+  {
+    assert_int_equal(0, history_append(&writer, i % 2, BASE + offsets[i],
+          ppms[i]));
+  }
+  /* time going back is stored as no change */
+  assert_int_equal(0, history_append(&writer, 0, BASE, 700));
+  history_close(&writer);
+
+  assert_int_equal(0, history_open_reader(&reader, path));
+  assert_string_equal("/dev/ttyS1", history_device(&reader, 1));
+  assert_null(history_device(&reader, 2));
+  assert_int_equal(2, scan(&reader, NULL));
+  assert_int_equal(8, collected.count);
+
+  /* chunks are per device, flushed in order of device */
+  for (i = 0; i < 8; i++)
+  {
+    assert_int_equal(expected[i].device, collected.samples[i].device);
+    assert_true(expected[i].wall == collected.samples[i].wall);
+    assert_int_equal(expected[i].ppm, collected.samples[i].ppm);
+  }
+  history_close(&reader);
+  unlink(path);
+}
+
+static void test_history_chunks(void **state)
+{
+  char path[32];
+  history_t writer, reader;
+  history_chunk_t chunk;
+  history_filter_t filter = {
+    .from = BASE + 1000 * 1000,
+    .to = BASE + 1010 * 1000,
+    .min = 0,
+    .max = UINT16_MAX,
+  };
+  int i, chunks = 0;
+
+  temp_file(path, "history");
+  assert_int_equal(0, history_open(&writer, path, devices, 2));
+  /* every second for an hour, chunk is closed every 15 minutes */
+  for (i = 0; i < 3600; i++)
+  {
+    assert_int_equal(0, history_append(&writer, 1, BASE + i * 1000,
+          i < 1800 ? 400 : 800));
+  }
+  assert_int_equal(0, history_flush(&writer));
+
+  assert_int_equal(0, history_open_reader(&reader, path));
+  while (history_next_chunk(&reader, &chunk) == 1)
+  {
+    assert_int_equal(1, chunk.device);
+    assert_true(chunk.last - chunk.first <= HISTORY_CHUNK_SPAN);
+    chunks++;
+  }
+  assert_int_equal(4, chunks);
+
+  /* only chunk covering range is decoded */
+  assert_int_equal(1, scan(&reader, &filter));
+  assert_int_equal(10, collected.count);
+  assert_true(collected.samples[0].wall == BASE + 1000 * 1000);
+
+  /* chunks with concentration out of range are skipped too, the one in
+   * which concentration changes is decoded */
+  filter.from = INT64_MIN;
+  filter.to = INT64_MAX;
+  filter.min = 700;
+  assert_int_equal(3, scan(&reader, &filter));
+  assert_int_equal(1800, collected.count);
+
+  history_close(&reader);
+  history_close(&writer);
+  unlink(path);
+}
+
+static void test_history_size(void **state)
+{
+  char path[32];
+  history_t writer;
+  struct stat st;
+  uint16_t ppm = 600;
+  int i;
+
+  temp_file(path, "history");
+  assert_int_equal(0, history_open(&writer, path, devices, 2));
+  srand(1);
+  /* a day of readings every second with few ms of jitter */
+  for (i = 0; i < 86400; i++)
+  {
+    ppm += rand() % 5 - 2;
+    assert_int_equal(0, history_append(&writer, 0,
+          BASE + i * 1000LL + rand() % 8, ppm));
+  }
+  history_close(&writer);
+
+  /* fixed-size store records take more than ten times as much */
+  assert_int_equal(0, stat(path, &st));
+  assert_true(st.st_size * 10 < 86400 * (off_t) sizeof(store_record_t));
+  unlink(path);
+}
+
+static void test_history_reopen(void **state)
+{
+  char *swapped[] = {"/dev/ttyS1", "/dev/ttyS0"};
+  char path[32];
+  history_t writer, reader;
+  struct stat st;
+  int fd;
+
+  temp_file(path, "history");
+  assert_int_equal(0, history_open(&writer, path, devices, 2));
+  assert_int_equal(0, history_append(&writer, 0, BASE, 400));
+  history_close(&writer);
+
+  /* interrupted write leaves partial chunk behind */
+  assert_int_equal(0, stat(path, &st));
+  fd = open(path, O_WRONLY | O_APPEND);
+  assert_true(fd >= 0);
+  assert_int_equal(12, write(fd, "CHNK\0\0\0\0\1\0\0\0", 12));
+  close(fd);
+
+  assert_int_equal(-2, history_open(&writer, path, devices, 1));
+  /* devices in different order would relabel existing chunks */
+  assert_int_equal(-2, history_open(&writer, path, swapped, 2));
+  assert_int_equal(0, history_open(&writer, path, devices, 2));
+  assert_int_equal(0, history_append(&writer, 1, BASE + 1000, 500));
+  history_close(&writer);
+
+  assert_int_equal(0, history_open_reader(&reader, path));
+  assert_int_equal(2, scan(&reader, NULL));
+  assert_int_equal(2, collected.count);
+  assert_int_equal(400, collected.samples[0].ppm);
+  assert_int_equal(500, collected.samples[1].ppm);
+  history_close(&reader);
+  unlink(path);
+}
+
+static void test_history_invalid(void **state)
+{
+  char path[32];
+  history_t reader;
+  int fd;
+
+  temp_file(path, "history");
+  fd = open(path, O_WRONLY);
+  assert_true(fd >= 0);
+  assert_int_equal(16, write(fd, "not a history!!!", 16));
+  close(fd);
+
+  assert_int_equal(-2, history_open_reader(&reader, path));
+  assert_int_equal(-1, history_open_reader(&reader, "/nonexistent/history"));
+  unlink(path);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_history_roundtrip),
+    cmocka_unit_test(test_history_chunks),
+    cmocka_unit_test(test_history_size),
+    cmocka_unit_test(test_history_reopen),
+    cmocka_unit_test(test_history_invalid),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "live.h"
+
+static char *devices[] = {"/dev/ttyS0", "/dev/ttyS1"};
+
+static void temp_name(char *name, size_t size)
+{
+  snprintf(name, size, "/test_live.%d", getpid());
+}
+
+static void publish(live_t *live, uint32_t device, int64_t wall,
+    uint16_t ppm, int16_t status)
+{
+  store_record_t record = {
+    .mono = wall / 2,
+    .wall = wall,
+    .device = device,
+    .ppm = ppm,
+    .status = status,
+  };
+
+  live_publish(live, &record);
+}
+
+static void test_live_read(void **state)
+{
+  live_t writer, reader;
+  live_sample_t sample;
+  char name[64];
+
+  temp_name(name, sizeof(name));
+  assert_int_equal(0, live_open(&writer, name, devices, 2));
+  assert_int_equal(0, live_open_reader(&reader, name));
+
+  assert_int_equal(2, live_count(&reader));
+  assert_string_equal("/dev/ttyS1", live_device(&reader, 1));
+  assert_null(live_device(&reader, 2));
+  assert_int_equal(1, live_find(&reader, "/dev/ttyS1"));
+  assert_int_equal(-1, live_find(&reader, "/dev/ttyS2"));
+
+  /* nothing published yet */
+  assert_int_equal(0, live_read(&reader, 0, &sample));
+  assert_int_equal(0, sample.updates);
+  assert_int_equal(0, sample.valid_wall);
+
+  publish(&writer, 0, 1000, 600, 0);
+  publish(&writer, 1, 1000, 700, 0);
+  assert_int_equal(0, live_read(&reader, 0, &sample));
+  assert_int_equal(1, sample.updates);
+  assert_int_equal(600, sample.ppm);
+  assert_int_equal(1000, sample.wall);
+  assert_int_equal(500, sample.mono);
+  assert_int_equal(1000, sample.valid_wall);
+  assert_int_equal(0, sample.status);
+
+  /* failed transaction keeps last valid concentration */
+  publish(&writer, 0, 2000, 0, -3);
+  assert_int_equal(0, live_read(&reader, 0, &sample));
+  assert_int_equal(2, sample.updates);
+  assert_int_equal(600, sample.ppm);
+  assert_int_equal(2000, sample.wall);
+  assert_int_equal(1000, sample.valid_wall);
+  assert_int_equal(-3, sample.status);
+
+  assert_int_equal(0, live_read(&reader, 1, &sample));
+  assert_int_equal(700, sample.ppm);
+  assert_int_equal(-1, live_read(&reader, 2, &sample));
+
+  /* out of range device is ignored */
+  publish(&writer, 2, 3000, 800, 0);
+
+  live_close(&reader);
+  live_close(&writer);
+  assert_int_equal(-1, live_open_reader(&reader, name));
+}
+
+typedef struct {
+  live_t *live;
+  atomic_int stop;
+} writer_arg_t;
+
+static void *write_samples(void *arg)
+{
+  writer_arg_t *w = arg;
+  int64_t i;
+
+  for (i = 1; !atomic_load(&w->stop); i++)
+  {
+    publish(w->live, 0, i * 2, i & 0xffff, 0);
+  }
+  return NULL;
+}
+
+static void test_live_concurrent(void **state)
+{
+  live_t writer, reader;
+  live_sample_t sample;
+  writer_arg_t arg;
+  pthread_t thread;
+  char name[64];
+  uint32_t last = 0;
+  int i;
+
+  temp_name(name, sizeof(name));
+  assert_int_equal(0, live_open(&writer, name, devices, 2));
+  assert_int_equal(0, live_open_reader(&reader, name));
+  arg.live = &writer;
+  atomic_init(&arg.stop, 0);
+  assert_int_equal(0, pthread_create(&thread, NULL, write_samples, &arg));
+
+  for (i = 0; i < 1000000; i++)
+  {
+    assert_int_equal(0, live_read(&reader, 0, &sample));
+    /* all fields have to come from the same update */
+    assert_int_equal(sample.updates * 2, sample.wall);
+    assert_int_equal(sample.updates, sample.mono);
+    assert_int_equal(sample.updates & 0xffff, sample.ppm);
+    assert_true(sample.updates >= last);
+    last = sample.updates;
+  }
+
+  atomic_store(&arg.stop, 1);
+  pthread_join(thread, NULL);
+  live_close(&reader);
+  live_close(&writer);
+}
+
+static void test_live_invalid(void **state)
+{
+  live_t live;
+  char name[64];
+
+  temp_name(name, sizeof(name));
+  assert_int_equal(-2, live_open(&live, name, devices, 0));
+  assert_int_equal(-1, live_open(&live, "/in/valid", devices, 2));
+  assert_int_equal(-1, live_open_reader(&live, "/nonexistent_live"));
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_live_read),
+    cmocka_unit_test(test_live_concurrent),
+    cmocka_unit_test(test_live_invalid),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
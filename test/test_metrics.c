@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+static char *devices[] = {"/dev/ttyS0", "/dev/ttyS1"};
+
+static void publish(metrics_t *metrics)
+{
+  polldev_t dev;
+
+  memset(&dev, 0, sizeof(dev));
+  dev.state = POLL_DONE;
+  dev.gas_concentration = 608;
+  dev.latency = 3000000;
+  dev.stats.transactions = 1;
+  dev.stats.bytes_in = 9;
+  dev.stats.bytes_out = 9;
+  metrics_publish(metrics, 0, &dev);
+
+  dev.state = POLL_FAILED;
+  dev.latency = 40000000;
+  dev.stats.transactions = 2;
+  dev.stats.failures = 1;
+  dev.stats.timeouts = 2;
+  dev.stats.retries = 1;
+  dev.stats.checksum_errors = 1;
+  metrics_publish(metrics, 0, &dev);
+}
+
+static void test_metrics_render(void **state)
+{
+  metrics_t *metrics;
+  char *text = NULL;
+  size_t size = 0;
+  FILE *out;
+  char path[64];
+
+  snprintf(path, sizeof(path), "/tmp/test_metrics.%d", getpid());
+  metrics = metrics_open(path, devices, 2);
+  assert_non_null(metrics);
+  publish(metrics);
+
+  out = open_memstream(&text, &size);
+  metrics_render(metrics, out);
+  fclose(out);
+
+  assert_non_null(strstr(text, "# TYPE mhz14a_reads_total counter\n"));
+  assert_non_null(strstr(text, "mhz14a_reads_total{device=\"/dev/ttyS0\"} 2\n"));
+  assert_non_null(strstr(text, "mhz14a_reads_total{device=\"/dev/ttyS1\"} 0\n"));
+  assert_non_null(strstr(text,
+        "mhz14a_read_failures_total{device=\"/dev/ttyS0\"} 1\n"));
+  assert_non_null(strstr(text,
+        "mhz14a_timeouts_total{device=\"/dev/ttyS0\"} 2\n"));
+  assert_non_null(strstr(text,
+        "mhz14a_checksum_errors_total{device=\"/dev/ttyS0\"} 1\n"));
+  assert_non_null(strstr(text,
+        "mhz14a_bytes_read_total{device=\"/dev/ttyS0\"} 9\n"));
+  /* failed reading does not overwrite last concentration */
+  assert_non_null(strstr(text, "mhz14a_ppm{device=\"/dev/ttyS0\"} 608\n"));
+  /* histogram buckets are cumulative */
+  assert_non_null(strstr(text, "mhz14a_read_latency_seconds_bucket"
+        "{device=\"/dev/ttyS0\",le=\"0.0025\"} 0\n"));
+  assert_non_null(strstr(text, "mhz14a_read_latency_seconds_bucket"
+        "{device=\"/dev/ttyS0\",le=\"0.005\"} 1\n"));
+  assert_non_null(strstr(text, "mhz14a_read_latency_seconds_bucket"
+        "{device=\"/dev/ttyS0\",le=\"0.05\"} 2\n"));
+  assert_non_null(strstr(text, "mhz14a_read_latency_seconds_bucket"
+        "{device=\"/dev/ttyS0\",le=\"+Inf\"} 2\n"));
+  assert_non_null(strstr(text,
+        "mhz14a_read_latency_seconds_sum{device=\"/dev/ttyS0\"} 0.043000000\n"));
+
+  free(text);
+  metrics_close(metrics);
+  assert_int_equal(-1, access(path, F_OK));
+}
+
+static void test_metrics_socket(void **state)
+{
+  struct sockaddr_un addr;
+  metrics_t *metrics;
+  char response[16384];
+  size_t len = 0;
+  ssize_t n;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/test_metrics.%d",
+      getpid());
+  metrics = metrics_open(addr.sun_path, devices, 2);
+  assert_non_null(metrics);
+  publish(metrics);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert_true(fd >= 0);
+  assert_int_equal(0, connect(fd, (struct sockaddr*) &addr, sizeof(addr)));
+  assert_int_equal(18, write(fd, "GET /metrics\r\n\r\n\r\n", 18));
+  while ((n = read(fd, response + len, sizeof(response) - 1 - len)) > 0)
+  {
+    len += n;
+  }
+  response[len] = '\0';
+  close(fd);
+
+  assert_memory_equal("HTTP/1.0 200 OK\r\n", response, 17);
+  assert_non_null(strstr(response, "\r\n\r\n# HELP mhz14a_reads_total"));
+  assert_non_null(strstr(response, "mhz14a_ppm{device=\"/dev/ttyS0\"} 608\n"));
+
+  metrics_close(metrics);
+}
+
+static void test_metrics_path_taken(void **state)
+{
+  struct sockaddr_un addr;
+  metrics_t *metrics;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/test_metrics.%d",
+      getpid());
+
+  /* regular file is never removed */
+  fd = open(addr.sun_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  assert_true(fd >= 0);
+  close(fd);
+  assert_null(metrics_open(addr.sun_path, devices, 2));
+  assert_int_equal(0, access(addr.sun_path, F_OK));
+  unlink(addr.sun_path);
+
+  /* socket nobody listens on is left over from previous run */
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert_true(fd >= 0);
+  assert_int_equal(0, bind(fd, (struct sockaddr*) &addr, sizeof(addr)));
+  close(fd);
+  metrics = metrics_open(addr.sun_path, devices, 2);
+  assert_non_null(metrics);
+
+  /* running server is not taken over */
+  assert_null(metrics_open(addr.sun_path, devices, 2));
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert_true(fd >= 0);
+  assert_int_equal(0, connect(fd, (struct sockaddr*) &addr, sizeof(addr)));
+  close(fd);
+
+  metrics_close(metrics);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_metrics_render),
+    cmocka_unit_test(test_metrics_socket),
+    cmocka_unit_test(test_metrics_path_taken),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -13,17 +13,34 @@
  * You should have received a copy of the GNU General Public License along with
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 
 #include "mh.h"
+#include "timeutil.h"
 
 #include "mh.c"
 
+/* when set, I/O wrappers forward calls to real functions */
+static int passthrough = 0;
+/* when set, exclusive access to device is never granted */
+static int busy = 0;
+
+int __real_close(int fd);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_read(int fd, void *buf, size_t count);
+int __real_ppoll(struct pollfd *fds, nfds_t nfds,
+    const struct timespec *tmo_p, const sigset_t *sigmask);
+
 int __wrap_tcgetattr(int fd, struct termios *termios_p)
 {
   check_expected(fd);
@@ -102,8 +119,23 @@ int __wrap_open(const char *pathname, int flags)
   return mock();
 }
 
+int __wrap_arb_open(const char *device, int flags, int64_t wait)
+{
+  if (busy)
+  {
+    return -8;
+  }
+
+  return open(device, flags);
+}
+
 int __wrap_close(int fd)
 {
+  if (passthrough)
+  {
+    return __real_close(fd);
+  }
+
   check_expected(fd);
 
   return mock();
@@ -111,7 +143,14 @@ int __wrap_close(int fd)
 
 ssize_t __wrap_write(int fd, const void *buf, size_t count)
 {
-  size_t len = mock();
+  size_t len;
+
+  if (passthrough)
+  {
+    return __real_write(fd, buf, count);
+  }
+
+  len = mock();
 
   check_expected(fd);
   check_expected(buf);
@@ -127,8 +166,16 @@ ssize_t __wrap_write(int fd, const void *buf, size_t count)
 
 ssize_t __wrap_read(int fd, void *buf, size_t count)
 {
-  void *src = (void*) mock();
-  size_t src_len = mock();
+  void *src;
+  size_t src_len;
+
+  if (passthrough)
+  {
+    return __real_read(fd, buf, count);
+  }
+
+  src = (void*) mock();
+  src_len = mock();
   check_expected(fd);
   check_expected(buf);
 //check_expected(count);
@@ -145,23 +192,31 @@ ssize_t __wrap_read(int fd, void *buf, size_t count)
   return src_len;
 }
 
-int __wrap_select(int nfds, fd_set *readfds, fd_set *writefds,
-    fd_set *exceptfds, struct timeval *timeout)
+int __wrap_ppoll(struct pollfd *fds, nfds_t nfds,
+    const struct timespec *tmo_p, const sigset_t *sigmask)
 {
-  unsigned int sec = mock();
+  int fd = fds[0].fd;
+  int result;
+
+  if (passthrough)
+  {
+    return __real_ppoll(fds, nfds, tmo_p, sigmask);
+  }
 
-  check_expected(nfds);
-  check_expected(readfds);
-  check_expected(writefds);
-  check_expected(exceptfds);
-  check_expected(timeout);
+  check_expected(fd);
+  check_expected(tmo_p);
 
-//if (sec)
-//{
-//  sleep(sec);
-//}
+  result = mock();
+  if (result > 0)
+  {
+    fds[0].revents = fds[0].events;
+  }
+  else if (result < 0)
+  {
+    errno = mock();
+  }
 
-  return mock();
+  return result;
 }
 
 #define test_x_to_baud(x, speed, err) static void test_to_baud_##x(void **state) \
@@ -545,7 +600,7 @@ static void test_perform_io(void **state)
   expect_memory(__wrap_write, buf, "test\n\r", 6);
   will_return(__wrap_write, 6);
 
-  actual = perform_io(write, 1337, "test\n\r", 6, 0);
+  actual = perform_io(write, 1337, "test\n\r", 6, NULL, NULL);
 
   assert_int_equal(expected, actual);
 }
@@ -562,7 +617,7 @@ static void test_perform_io_intr(void **state)
   expect_memory(__wrap_write, buf, "est\n\r", 6);
   will_return(__wrap_write, 5);
 
-  actual = perform_io(write, 1337, "test\n\r", 6, 0);
+  actual = perform_io(write, 1337, "test\n\r", 6, NULL, NULL);
 
   assert_int_equal(expected, actual);
 }
@@ -581,7 +636,7 @@ static void test_perform_io_error(void **state)
   will_return(__wrap_write, -1);
   will_return(__wrap_write, EBADF);
 
-  actual = perform_io(write, 1337, "test\n\r", 6, 0);
+  actual = perform_io(write, 1337, "test\n\r", 6, NULL, NULL);
   acterror = errno;
 
   assert_int_equal(expected, actual);
@@ -593,32 +648,144 @@ static void test_perform_io_time(void **state)
   uint8_t expected = -1;
   uint8_t actual;
   int experror = ENODATA, acterror = 0;
-
-  expect_any(__wrap_select, nfds);
-  expect_any(__wrap_select, readfds);
-  expect_any(__wrap_select, writefds);
-  expect_any(__wrap_select, exceptfds);
-  expect_any(__wrap_select, timeout);
-  will_return(__wrap_select, 0); /* timeout */
-  will_return(__wrap_select, 1);
+  struct timespec deadline;
 
   expect_value(__wrap_write, fd, 1337);
   expect_memory(__wrap_write, buf, "test\n\r", 6);
   will_return(__wrap_write, 1);
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "est\n\r", 5);
+  will_return(__wrap_write, -1);
+  will_return(__wrap_write, EAGAIN);
 
-  expect_any(__wrap_select, nfds);
-  expect_any(__wrap_select, readfds);
-  expect_any(__wrap_select, writefds);
-  expect_any(__wrap_select, exceptfds);
-  expect_any(__wrap_select, timeout);
-  will_return(__wrap_select, 2); /* timeout */
-  will_return(__wrap_select, 0);
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_not_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, 0); /* timeout */
 
-//expect_value(__wrap_write, fd, 1337);
-//expect_memory(__wrap_write, buf, "est\n\r", 6);
-//will_return(__wrap_write, 5);
+  timespec_now(&deadline);
+  timespec_add_ns(&deadline, NSEC_PER_SEC);
+  actual = perform_io(write, 1337, "test\n\r", 6, &deadline, NULL);
+  acterror = errno;
+
+  assert_int_equal(expected, actual);
+  assert_int_equal(experror, acterror);
+}
 
-  actual = perform_io(write, 1337, "test\n\r", 6, 1);
+static void test_perform_io_signal(void **state)
+{
+  uint8_t expected = 6;
+  uint8_t actual;
+  struct timespec deadline;
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "test\n\r", 6);
+  will_return(__wrap_write, -1);
+  will_return(__wrap_write, EAGAIN);
+
+  /* signal arrives while waiting, transfer goes on */
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_not_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, -1);
+  will_return(__wrap_ppoll, EINTR);
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "test\n\r", 6);
+  will_return(__wrap_write, 6);
+
+  timespec_now(&deadline);
+  timespec_add_ns(&deadline, NSEC_PER_SEC);
+  actual = perform_io(write, 1337, "test\n\r", 6, &deadline, NULL);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_perform_io_wait(void **state)
+{
+  uint8_t expected = 6;
+  uint8_t actual;
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "test\n\r", 6);
+  will_return(__wrap_write, -1);
+  will_return(__wrap_write, EAGAIN);
+
+  /* no deadline - block until descriptor is ready, even across signals */
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, -1);
+  will_return(__wrap_ppoll, EINTR);
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "test\n\r", 6);
+  will_return(__wrap_write, -1);
+  will_return(__wrap_write, EAGAIN);
+
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, 1);
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf, "test\n\r", 6);
+  will_return(__wrap_write, 6);
+
+  actual = perform_io(write, 1337, "test\n\r", 6, NULL, NULL);
+
+  assert_int_equal(expected, actual);
+}
+
+static void *delayed_writer(void *arg)
+{
+  int fd = *(int*) arg;
+  struct timespec delay = {0, 200 * NSEC_PER_MSEC};
+
+  nanosleep(&delay, NULL);
+  __real_write(fd, "\xff\x86\x02\x60\x47\0\0\0\xd1", 9);
+
+  return NULL;
+}
+
+static void test_perform_io_cpu(void **state)
+{
+  uint8_t buf[9];
+  int fds[2];
+  pthread_t writer;
+  struct timespec start, end;
+  ssize_t actual;
+
+  /* real descriptor that becomes readable after 200ms, waiting for it must
+   * not consume CPU time */
+  assert_int_equal(0, pipe2(fds, O_NONBLOCK));
+  passthrough = 1;
+  assert_int_equal(0, pthread_create(&writer, NULL, delayed_writer, &fds[1]));
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+  actual = perform_io((io_func_t) read, fds[0], buf, sizeof(buf), NULL,
+      NULL);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+  pthread_join(writer, NULL);
+  close(fds[0]);
+  close(fds[1]);
+  passthrough = 0;
+
+  assert_int_equal(sizeof(buf), actual);
+  assert_memory_equal("\xff\x86\x02\x60\x47\0\0\0\xd1", buf, sizeof(buf));
+  /* busy waiting would burn whole 200ms, bound leaves plenty of room for
+   * slow test machines */
+  assert_true(timespec_diff_ns(&end, &start) < 100 * NSEC_PER_MSEC);
+}
+
+static void test_perform_io_deadline(void **state)
+{
+  uint8_t expected = -1;
+  uint8_t actual;
+  int experror = ENODATA, acterror = 0;
+  struct timespec deadline;
+
+  /* deadline already passed, nothing should be called */
+  timespec_now(&deadline);
+  timespec_add_ns(&deadline, -NSEC_PER_MSEC);
+  actual = perform_io(write, 1337, "test\n\r", 6, &deadline, NULL);
   acterror = errno;
 
   assert_int_equal(expected, actual);
@@ -882,6 +1049,9 @@ static void test_process_command_write_again(void **state)
       "\xff\x01\x86\0\0\0\0\0\x79", 9);
   will_return(__wrap_write, -1);
   will_return(__wrap_write, EAGAIN);
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, 1);
   expect_value(__wrap_write, fd, 1337);
   expect_memory(__wrap_write, buf,
       "\xff\x01\x86\0\0\0\0\0\x79", 9);
@@ -960,6 +1130,9 @@ static void test_process_command_read_again(void **state)
   will_return(__wrap_read, NULL);
   will_return(__wrap_read, -1);
   will_return(__wrap_read, EAGAIN);
+  expect_value(__wrap_ppoll, fd, 1337);
+  expect_value(__wrap_ppoll, tmo_p, NULL);
+  will_return(__wrap_ppoll, 1);
   expect_value(__wrap_read, fd, 1337);
   expect_any(__wrap_read, buf);
   will_return(__wrap_read, "\xff\x86\x02\x60\x47\0\0\0\xd1");
@@ -1118,6 +1291,79 @@ static void test_process_command_read_intr(void **state)
   assert_int_equal(0x260, opts.gas_concentration);
 }
 
+static void test_process_command_read_resync(void **state)
+{
+  mhopt_t opts = {
+    .device = "/dev/ttyS1",
+    .baudrate = 115200,
+    .databits = 7,
+    .parity = 'O',
+    .stopbits = 20,
+    .command = CMD_GAS_CONCENTRATION,
+    .tries = 1,
+  };
+  uint8_t expected = 0;
+  uint8_t actual;
+
+  expect_string(__wrap_open, pathname, "/dev/ttyS1");
+  expect_any(__wrap_open, flags);
+  will_return(__wrap_open, 1337);
+
+  expect_value(__wrap_tcgetattr, fd, 1337);
+  expect_not_value(__wrap_tcgetattr, termios_p, NULL);
+  will_return(__wrap_tcgetattr, IUTF8|IXON|ICRNL); /* c_iflag */
+  will_return(__wrap_tcgetattr, OPOST|ONLCR); /* c_oflag */
+  will_return(__wrap_tcgetattr, HUPCL|CREAD|CS8|B38400); /* c_cflag */
+  will_return(__wrap_tcgetattr,
+      IEXTEN|ECHOKE|ECHOCTL|ECHOK|ECHOE|ECHO|ICANON|ISIG); /* c_lflag */
+  will_return(__wrap_tcgetattr, 0); /* c_line */
+  will_return(__wrap_tcgetattr,
+      "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
+  /* c_cc */
+  will_return(__wrap_tcgetattr, B9600); /* c_ispeed */
+  will_return(__wrap_tcgetattr, B9600); /* c_ospeed */
+  will_return(__wrap_tcgetattr, 0);
+
+  expect_value(__wrap_tcsetattr, fd, 1337);
+  expect_value(__wrap_tcsetattr, optional_actions, TCSANOW);
+  expect_not_value(__wrap_tcsetattr, termios_p, NULL);
+  expect_value(__wrap_tcsetattr, c_iflag, IUTF8|IXON|ICRNL);
+  expect_value(__wrap_tcsetattr, c_oflag, OPOST|ONLCR);
+  expect_value(__wrap_tcsetattr, c_cflag,
+      CLOCAL|HUPCL|CREAD|PARENB|PARODD|CSTOPB|CS7|B115200);
+  expect_value(__wrap_tcsetattr, c_lflag,
+      IEXTEN|ECHOKE|ECHOCTL|ECHOK);
+  expect_value(__wrap_tcsetattr, c_line, 0);
+  expect_string(__wrap_tcsetattr, c_cc,
+      "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
+  expect_value(__wrap_tcsetattr, c_ispeed, B115200);
+  expect_value(__wrap_tcsetattr, c_ospeed, B115200);
+  will_return(__wrap_tcsetattr, 0);
+
+  expect_value(__wrap_write, fd, 1337);
+  expect_memory(__wrap_write, buf,
+      "\xff\x01\x86\0\0\0\0\0\x79", 9);
+  will_return(__wrap_write, 9);
+
+  /* stray byte shifts frame, parser asks only for the missing byte */
+  expect_value(__wrap_read, fd, 1337);
+  expect_any(__wrap_read, buf);
+  will_return(__wrap_read, "\x42\xff\x86\x02\x60\x47\0\0\0");
+  will_return(__wrap_read, 9);
+  expect_value(__wrap_read, fd, 1337);
+  expect_any(__wrap_read, buf);
+  will_return(__wrap_read, "\xd1");
+  will_return(__wrap_read, 1);
+
+  expect_value(__wrap_close, fd, 1337);
+  will_return(__wrap_close, 0);
+
+  actual = process_command(&opts);
+
+  assert_int_equal(expected, actual);
+  assert_int_equal(0x260, opts.gas_concentration);
+}
+
 static void test_process_command_write_error(void **state)
 {
   mhopt_t opts = {
@@ -1257,6 +1503,28 @@ static void test_process_command_read_error(void **state)
   assert_int_equal(expected, actual);
 }
 
+static void test_process_command_busy(void **state)
+{
+  mhopt_t opts = {
+    .device = "/dev/ttyS1",
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .command = CMD_GAS_CONCENTRATION,
+    .tries = 1,
+    .lock_wait = 1000,
+  };
+  int actual;
+
+  /* device is neither opened nor configured */
+  busy = 1;
+  actual = process_command(&opts);
+  busy = 0;
+
+  assert_int_equal(actual, -8);
+}
+
 int main()
 {
   const struct CMUnitTest tests[] = {
@@ -1332,15 +1600,21 @@ int main()
     cmocka_unit_test(test_perform_io_intr),
     cmocka_unit_test(test_perform_io_error),
     cmocka_unit_test(test_perform_io_time),
+    cmocka_unit_test(test_perform_io_signal),
+    cmocka_unit_test(test_perform_io_wait),
+    cmocka_unit_test(test_perform_io_cpu),
+    cmocka_unit_test(test_perform_io_deadline),
     cmocka_unit_test(test_process_command),
     cmocka_unit_test(test_process_command_span),
     cmocka_unit_test(test_process_command_zero),
     cmocka_unit_test(test_process_command_write_intr),
     cmocka_unit_test(test_process_command_read_intr),
+    cmocka_unit_test(test_process_command_read_resync),
     cmocka_unit_test(test_process_command_write_again),
     cmocka_unit_test(test_process_command_read_again),
     cmocka_unit_test(test_process_command_write_error),
     cmocka_unit_test(test_process_command_read_error),
+    cmocka_unit_test(test_process_command_busy),
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
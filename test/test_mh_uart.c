@@ -109,6 +109,91 @@ static void test_gas_return(void **state)
   assert_int_equal(expected, actual);
 }
 
+static void test_parser_frame(void **state)
+{
+  uint8_t input[] = {0xff, 0x86, 2, 0x60, 0x47, 0, 0, 0, 0xd1};
+  frame_parser_t parser;
+  pkt_t actual;
+
+  frame_parser_init(&parser, CMD_GAS_CONCENTRATION);
+
+  assert_int_equal(9, frame_parser_missing(&parser));
+  assert_int_equal(sizeof(input), frame_parser_feed(&parser, input,
+        sizeof(input)));
+  assert_int_equal(1, frame_parser_next(&parser, &actual));
+  assert_memory_equal(input, &actual, sizeof(pkt_t));
+  assert_int_equal(0, frame_parser_next(&parser, &actual));
+  assert_int_equal(1, parser.frames);
+  assert_int_equal(0, parser.dropped);
+  assert_int_equal(0, parser.resyncs);
+}
+
+static void test_parser_split(void **state)
+{
+  uint8_t input[] = {0xff, 0x86, 2, 0x60, 0x47, 0, 0, 0, 0xd1};
+  frame_parser_t parser;
+  pkt_t actual;
+
+  frame_parser_init(&parser, CMD_GAS_CONCENTRATION);
+
+  frame_parser_feed(&parser, input, 4);
+  assert_int_equal(0, frame_parser_next(&parser, &actual));
+  assert_int_equal(5, frame_parser_missing(&parser));
+  frame_parser_feed(&parser, input + 4, 5);
+  assert_int_equal(1, frame_parser_next(&parser, &actual));
+  assert_memory_equal(input, &actual, sizeof(pkt_t));
+}
+
+static void test_parser_garbage(void **state)
+{
+  uint8_t input[] = {0x12, 0xff, 0xff, 0x34, 0xff, 0x86, 2, 0x60, 0x47, 0, 0,
+    0, 0xd1, 0x56};
+  frame_parser_t parser;
+  pkt_t actual;
+
+  frame_parser_init(&parser, CMD_GAS_CONCENTRATION);
+
+  frame_parser_feed(&parser, input, sizeof(input));
+  assert_int_equal(1, frame_parser_next(&parser, &actual));
+  assert_memory_equal(input + 4, &actual, sizeof(pkt_t));
+  assert_int_equal(0, frame_parser_next(&parser, &actual));
+  assert_int_equal(1, parser.frames);
+  assert_int_equal(5, parser.dropped);
+  assert_int_equal(2, parser.resyncs);
+}
+
+static void test_parser_checksum(void **state)
+{
+  /* frame with invalid checksum hides valid one starting inside it */
+  uint8_t input[] = {0xff, 0x86, 0xff, 0x86, 2, 0x60, 0x47, 0, 0, 0, 0xd1};
+  frame_parser_t parser;
+  pkt_t actual;
+
+  frame_parser_init(&parser, CMD_GAS_CONCENTRATION);
+
+  frame_parser_feed(&parser, input, sizeof(input));
+  assert_int_equal(1, frame_parser_next(&parser, &actual));
+  assert_memory_equal(input + 2, &actual, sizeof(pkt_t));
+  assert_int_equal(1, parser.rejects);
+  assert_int_equal(2, parser.dropped);
+}
+
+static void test_parser_full(void **state)
+{
+  uint8_t input[FRAME_BUFFER_SIZE + 10] = {0};
+  frame_parser_t parser;
+  pkt_t actual;
+
+  frame_parser_init(&parser, CMD_GAS_CONCENTRATION);
+
+  assert_int_equal(FRAME_BUFFER_SIZE, frame_parser_feed(&parser, input,
+        sizeof(input)));
+  assert_int_equal(0, frame_parser_space(&parser));
+  assert_int_equal(0, frame_parser_next(&parser, &actual));
+  assert_int_equal(FRAME_BUFFER_SIZE, frame_parser_space(&parser));
+  assert_int_equal(FRAME_BUFFER_SIZE, parser.dropped);
+}
+
 int main()
 {
   const struct CMUnitTest tests[] = {
@@ -125,6 +210,11 @@ int main()
     cmocka_unit_test(test_zero_packet),
     cmocka_unit_test(test_span_packet),
     cmocka_unit_test(test_gas_return),
+    cmocka_unit_test(test_parser_frame),
+    cmocka_unit_test(test_parser_split),
+    cmocka_unit_test(test_parser_garbage),
+    cmocka_unit_test(test_parser_checksum),
+    cmocka_unit_test(test_parser_full),
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
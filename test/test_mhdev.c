@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <errno.h>
+
+#include "testutil.h"
+#include "pty_helper.h"
+#include "mhdev.h"
+
+#define RESPONSE "\xff\x86\x02\x60\x47\0\0\0\xd1"
+
+static void test_mhdev_read(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 1000000,
+    .tries = 1,
+  };
+  uint8_t request[sizeof(pkt_t)];
+  uint16_t concentration = 0;
+  mhdev_t *dev;
+  pty_t pty;
+  int i;
+
+  open_pty(&pty);
+  opts.device = pty.name;
+
+  dev = mhdev_open(&opts);
+  assert_non_null(dev);
+
+  /* same handle is reused for consecutive readings */
+  for (i = 0; i < 3; i++)
+  {
+    assert_int_equal(9, write(pty.master, RESPONSE, 9));
+    assert_int_equal(0, mhdev_read_gas(dev, &concentration));
+    assert_int_equal(0x260, concentration);
+    assert_int_equal(9, read(pty.master, request, sizeof(request)));
+    assert_memory_equal("\xff\x01\x86\0\0\0\0\0\x79", request, 9);
+  }
+
+  mhdev_close(dev);
+  close_pty(&pty);
+}
+
+static void test_mhdev_capture(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 1000000,
+    .tries = 1,
+  };
+  char path[32];
+  uint8_t request[sizeof(pkt_t)];
+  uint8_t data[CAPTURE_MAX_DATA];
+  size_t bytes[CAPTURE_OPEN + 1] = {0};
+  capture_reader_t reader;
+  capture_record_t record;
+  uint16_t concentration = 0;
+  mhdev_t *dev;
+  pty_t pty;
+  FILE *fp;
+
+  temp_file(path, "mhdev");
+  open_pty(&pty);
+  opts.device = pty.name;
+  opts.capture = capture_open(path);
+  assert_non_null(opts.capture);
+
+  /* traffic of handle goes to capture given in its options */
+  dev = mhdev_open(&opts);
+  assert_non_null(dev);
+  assert_int_equal(9, write(pty.master, RESPONSE, 9));
+  assert_int_equal(0, mhdev_read_gas(dev, &concentration));
+  assert_int_equal(9, read(pty.master, request, sizeof(request)));
+  mhdev_close(dev);
+  capture_close(opts.capture);
+
+  fp = fopen(path, "r");
+  assert_non_null(fp);
+  assert_int_equal(0, capture_open_reader(&reader, fp));
+  assert_int_equal(1, capture_next(&reader, &record, data));
+  assert_int_equal(CAPTURE_OPEN, record.direction);
+  assert_memory_equal(pty.name, data, record.length);
+  while (capture_next(&reader, &record, data) == 1)
+  {
+    bytes[record.direction] += record.length;
+  }
+  assert_int_equal(9, bytes[CAPTURE_TX]);
+  assert_int_equal(9, bytes[CAPTURE_RX]);
+  fclose(fp);
+  unlink(path);
+  close_pty(&pty);
+}
+
+static void test_mhdev_calibrate(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .tries = 1,
+  };
+  uint8_t request[sizeof(pkt_t)];
+  mhdev_t *dev;
+  pty_t pty;
+
+  open_pty(&pty);
+  opts.device = pty.name;
+
+  dev = mhdev_open(&opts);
+  assert_non_null(dev);
+
+  assert_int_equal(0, mhdev_calibrate_zero(dev));
+  assert_int_equal(9, read(pty.master, request, sizeof(request)));
+  assert_memory_equal("\xff\x01\x87\0\0\0\0\0\x78", request, 9);
+
+  assert_int_equal(0, mhdev_calibrate_span(dev, 0x7d0));
+  assert_int_equal(9, read(pty.master, request, sizeof(request)));
+  assert_memory_equal("\xff\x01\x88\x07\xd0\0\0\0\xa0", request, 9);
+
+  mhdev_close(dev);
+  close_pty(&pty);
+}
+
+static void test_mhdev_timeout(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .tries = 1,
+  };
+  uint16_t concentration = 0;
+  mhdev_t *dev;
+  pty_t pty;
+
+  open_pty(&pty);
+  opts.device = pty.name;
+
+  dev = mhdev_open(&opts);
+  assert_non_null(dev);
+  mhdev_set_timeout(dev, 10000, 2);
+
+  assert_int_equal(-3, mhdev_read_gas(dev, &concentration));
+  assert_int_equal(ENODATA, errno);
+
+  mhdev_close(dev);
+  close_pty(&pty);
+}
+
+static void test_mhdev_open_error(void **state)
+{
+  mhopt_t opts = {
+    .device = "/nonexistent/tty",
+    .baudrate = 9600,
+    .tries = 1,
+  };
+
+  assert_null(mhdev_open(&opts));
+  assert_int_equal(ENOENT, errno);
+
+  /* there is no default device in the library */
+  opts.device = NULL;
+  assert_null(mhdev_open(&opts));
+  assert_int_equal(EINVAL, errno);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_mhdev_read),
+    cmocka_unit_test(test_mhdev_capture),
+    cmocka_unit_test(test_mhdev_calibrate),
+    cmocka_unit_test(test_mhdev_timeout),
+    cmocka_unit_test(test_mhdev_open_error),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
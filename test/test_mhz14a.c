@@ -13,12 +13,14 @@
  * You should have received a copy of the GNU General Public License along with
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include <stdarg.h>
 #include <stddef.h>
 #include <limits.h>
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include "pty_helper.h"
 #include "mhz14a.h"
 
 #define main __real_main
@@ -82,6 +84,144 @@ char *wrong_mode_argv4[] = {
   "-m", "test"
 };
 
+char *multi_dev_argv[] = {
+  "./mhz14a",
+  "-d", "/dev/ttyS0",
+  "-d", "/dev/ttyS1",
+  "-z"
+};
+
+char *daemon_zero_argv[] = {
+  "./mhz14a",
+  "-D", "-z"
+};
+
+char *daemon_interval_argv[] = {
+  "./mhz14a",
+  "-D", "-i", "0"
+};
+
+char *continuous_zero_argv[] = {
+  "./mhz14a",
+  "-z", "-c", "5"
+};
+
+char *continuous_count_argv[] = {
+  "./mhz14a",
+  "-r", "-c", "0"
+};
+
+char *continuous_multi_dev_argv[] = {
+  "./mhz14a",
+  "-d", "/dev/ttyS0",
+  "-d", "/dev/ttyS1",
+  "-r", "-i", "100"
+};
+
+char *continuous_missing_argv[] = {
+  "./mhz14a",
+  "-d", "/nonexistent/ttyS0",
+  "-r", "-c", "2", "-i", "100"
+};
+
+char *wrong_backoff_argv[] = {
+  "./mhz14a",
+  "--backoff=fast",
+  "-r"
+};
+
+char *wrong_io_argv[] = {
+  "./mhz14a",
+  "--io=select",
+  "-D"
+};
+
+char *wrong_format_argv[] = {
+  "./mhz14a",
+  "--format=xml",
+  "-r"
+};
+
+char *daemon_format_argv[] = {
+  "./mhz14a",
+  "--format=csv",
+  "-D"
+};
+
+char *missing_devices_argv[] = {
+  "./mhz14a",
+  "--devices=/nonexistent",
+  "-r"
+};
+
+char *max_age_argv[] = {
+  "./mhz14a",
+  "--max-age=60000",
+  "--cache-file=/tmp/test_mhz14a_readings",
+  "-d", "/dev/ttyS0",
+  "-r"
+};
+
+char *max_age_daemon_argv[] = {
+  "./mhz14a",
+  "--max-age=1000",
+  "-D"
+};
+
+char *max_age_zero_argv[] = {
+  "./mhz14a",
+  "--max-age=0",
+  "-r"
+};
+
+char *filter_read_argv[] = {
+  "./mhz14a",
+  "--median=5",
+  "-r"
+};
+
+char *filter_window_argv[] = {
+  "./mhz14a",
+  "--average=1000",
+  "-D"
+};
+
+char *autodetect_read_argv[] = {
+  "./mhz14a",
+  "--autodetect",
+  "-r"
+};
+
+char *replay_read_argv[] = {
+  "./mhz14a",
+  "--replay=/dev/null",
+  "-r"
+};
+
+char *replay_capture_argv[] = {
+  "./mhz14a",
+  "--replay=/dev/null",
+  "--capture=/tmp/capture"
+};
+
+char *store_argv[] = {
+  "./mhz14a",
+  "--store=/tmp/readings",
+  "-r"
+};
+
+char *timeout_argv[] = {
+  "./mhz14a",
+  "-t", "250ms",
+  "-z"
+};
+
+char *wrong_timeout_argv[] = {
+  "./mhz14a",
+  "-t", "5min",
+  "-z"
+};
+
 int __wrap_printf (const char *format, ...)
 {
   return 1;
@@ -103,6 +243,7 @@ int __wrap_process_command (mhopt_t *opts)
   command_t command = opts->command;
   uint16_t gas_concentration = opts->gas_concentration;
   uint16_t span_point = opts->span_point;
+  int64_t timeout = opts->timeout;
 
   check_expected(device);
   check_expected(baudrate);
@@ -112,6 +253,7 @@ int __wrap_process_command (mhopt_t *opts)
   check_expected(command);
   check_expected(gas_concentration);
   check_expected(span_point);
+  check_expected(timeout);
 
   return mock();
 }
@@ -129,6 +271,7 @@ static void test_main_read(void **state)
   expect_value(__wrap_process_command, command, CMD_GAS_CONCENTRATION);
   expect_value(__wrap_process_command, gas_concentration, 0);
   expect_value(__wrap_process_command, span_point, 0);
+  expect_value(__wrap_process_command, timeout, 0);
 
   will_return(__wrap_process_command, 0);
 
@@ -150,6 +293,7 @@ static void test_main_span(void **state)
   expect_value(__wrap_process_command, command, CMD_CALIBRATE_SPAN);
   expect_value(__wrap_process_command, gas_concentration, 0);
   expect_value(__wrap_process_command, span_point, 65535);
+  expect_value(__wrap_process_command, timeout, 0);
 
   will_return(__wrap_process_command, 0);
 
@@ -181,6 +325,7 @@ static void test_main_zero(void **state)
   expect_value(__wrap_process_command, command, CMD_CALIBRATE_ZERO);
   expect_value(__wrap_process_command, gas_concentration, 0);
   expect_value(__wrap_process_command, span_point, 0);
+  expect_value(__wrap_process_command, timeout, 0);
 
   will_return(__wrap_process_command, 0);
 
@@ -219,6 +364,320 @@ static void test_main_wrongopt(void **state)
   assert_int_equal(expected, actual);
 }
 
+static void test_main_timeout(void **state)
+{
+  int expected = RET_SUCCESS;
+  int actual;
+
+  expect_value(__wrap_process_command, device, NULL);
+  expect_value(__wrap_process_command, baudrate, 9600);
+  expect_value(__wrap_process_command, databits, 8);
+  expect_value(__wrap_process_command, parity, 'N');
+  expect_value(__wrap_process_command, stopbits, 10);
+  expect_value(__wrap_process_command, command, CMD_CALIBRATE_ZERO);
+  expect_value(__wrap_process_command, gas_concentration, 0);
+  expect_value(__wrap_process_command, span_point, 0);
+  expect_value(__wrap_process_command, timeout, 250000);
+
+  will_return(__wrap_process_command, 0);
+
+  actual = __real_main(sizeof(timeout_argv)/sizeof(char*), timeout_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_wrong_timeout(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(wrong_timeout_argv)/sizeof(char*),
+      wrong_timeout_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+#define test_parse_timeout(name, text, err, value) \
+static void test_parse_timeout_##name(void **state) \
+{ \
+  int64_t actual = -1; \
+ \
+  assert_int_equal(err, parse_timeout(text, &actual)); \
+  assert_int_equal(value, actual); \
+}
+
+test_parse_timeout(plain, "30", 0, 30000000)
+test_parse_timeout(sec, "2s", 0, 2000000)
+test_parse_timeout(msec, "15ms", 0, 15000)
+test_parse_timeout(usec, "500us", 0, 500)
+test_parse_timeout(negative, "-1", -1, -1)
+test_parse_timeout(empty, "", -1, -1)
+test_parse_timeout(unit, "1h", -1, -1)
+
+static void test_main_multi_dev(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(multi_dev_argv)/sizeof(char*), multi_dev_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_daemon_zero(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(daemon_zero_argv)/sizeof(char*),
+      daemon_zero_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_daemon_interval(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(daemon_interval_argv)/sizeof(char*),
+      daemon_interval_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_continuous_zero(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(continuous_zero_argv)/sizeof(char*),
+      continuous_zero_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_continuous_count(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(continuous_count_argv)/sizeof(char*),
+      continuous_count_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_continuous_multi_dev(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(continuous_multi_dev_argv)/sizeof(char*),
+      continuous_multi_dev_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_continuous_missing(void **state)
+{
+  int expected = RET_FAILED;
+  int actual;
+
+  actual = __real_main(sizeof(continuous_missing_argv)/sizeof(char*),
+      continuous_missing_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+/* sensor that never answers must not look like success */
+static void test_main_continuous_silent(void **state)
+{
+  pty_t pty;
+  char *argv[] = {
+    "./mhz14a",
+    "-d", NULL,
+    "-r", "-c", "2", "-i", "100", "-t", "50ms"
+  };
+  int expected = RET_FAILED;
+  int actual;
+
+  open_pty(&pty);
+  argv[2] = pty.name;
+
+  actual = __real_main(sizeof(argv)/sizeof(char*), argv);
+
+  close_pty(&pty);
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_wrong_backoff(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(wrong_backoff_argv)/sizeof(char*),
+      wrong_backoff_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_wrong_io(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(wrong_io_argv)/sizeof(char*), wrong_io_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_wrong_format(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(wrong_format_argv)/sizeof(char*),
+      wrong_format_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_daemon_format(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(daemon_format_argv)/sizeof(char*),
+      daemon_format_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_missing_devices(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(missing_devices_argv)/sizeof(char*),
+      missing_devices_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_max_age(void **state)
+{
+  int expected = RET_SUCCESS;
+  int actual;
+
+  unlink("/tmp/test_mhz14a_readings");
+  expect_string(__wrap_process_command, device, "/dev/ttyS0");
+  expect_value(__wrap_process_command, baudrate, 9600);
+  expect_value(__wrap_process_command, databits, 8);
+  expect_value(__wrap_process_command, parity, 'N');
+  expect_value(__wrap_process_command, stopbits, 10);
+  expect_value(__wrap_process_command, command, CMD_GAS_CONCENTRATION);
+  expect_value(__wrap_process_command, gas_concentration, 0);
+  expect_value(__wrap_process_command, span_point, 0);
+  expect_value(__wrap_process_command, timeout, 0);
+  will_return(__wrap_process_command, 0);
+
+  actual = __real_main(sizeof(max_age_argv)/sizeof(char*), max_age_argv);
+  assert_int_equal(expected, actual);
+
+  /* second call is served from cache without touching device */
+  actual = __real_main(sizeof(max_age_argv)/sizeof(char*), max_age_argv);
+  assert_int_equal(expected, actual);
+  unlink("/tmp/test_mhz14a_readings");
+}
+
+static void test_main_max_age_daemon(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(max_age_daemon_argv)/sizeof(char*),
+      max_age_daemon_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_max_age_zero(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(max_age_zero_argv)/sizeof(char*),
+      max_age_zero_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_filter_read(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(filter_read_argv)/sizeof(char*),
+      filter_read_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_filter_window(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(filter_window_argv)/sizeof(char*),
+      filter_window_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_autodetect_read(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(autodetect_read_argv)/sizeof(char*),
+      autodetect_read_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_replay_read(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(replay_read_argv)/sizeof(char*),
+      replay_read_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_replay_capture(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(replay_capture_argv)/sizeof(char*),
+      replay_capture_argv);
+
+  assert_int_equal(expected, actual);
+}
+
+static void test_main_store(void **state)
+{
+  int expected = RET_ARG;
+  int actual;
+
+  actual = __real_main(sizeof(store_argv)/sizeof(char*), store_argv);
+
+  assert_int_equal(expected, actual);
+}
+
 #define test_main_wrong_mode(num) static void test_main_wrong_mode##num(void **state) \
 { \
   int expected = RET_MODE_ERR; \
@@ -244,6 +703,37 @@ int main()
     cmocka_unit_test(test_main_multi),
     cmocka_unit_test(test_main_nocmd),
     cmocka_unit_test(test_main_wrongopt),
+    cmocka_unit_test(test_main_timeout),
+    cmocka_unit_test(test_main_wrong_timeout),
+    cmocka_unit_test(test_parse_timeout_plain),
+    cmocka_unit_test(test_parse_timeout_sec),
+    cmocka_unit_test(test_parse_timeout_msec),
+    cmocka_unit_test(test_parse_timeout_usec),
+    cmocka_unit_test(test_parse_timeout_negative),
+    cmocka_unit_test(test_parse_timeout_empty),
+    cmocka_unit_test(test_parse_timeout_unit),
+    cmocka_unit_test(test_main_multi_dev),
+    cmocka_unit_test(test_main_daemon_zero),
+    cmocka_unit_test(test_main_daemon_interval),
+    cmocka_unit_test(test_main_continuous_zero),
+    cmocka_unit_test(test_main_continuous_count),
+    cmocka_unit_test(test_main_continuous_multi_dev),
+    cmocka_unit_test(test_main_continuous_missing),
+    cmocka_unit_test(test_main_continuous_silent),
+    cmocka_unit_test(test_main_wrong_backoff),
+    cmocka_unit_test(test_main_wrong_io),
+    cmocka_unit_test(test_main_wrong_format),
+    cmocka_unit_test(test_main_daemon_format),
+    cmocka_unit_test(test_main_missing_devices),
+    cmocka_unit_test(test_main_max_age),
+    cmocka_unit_test(test_main_max_age_daemon),
+    cmocka_unit_test(test_main_max_age_zero),
+    cmocka_unit_test(test_main_filter_read),
+    cmocka_unit_test(test_main_filter_window),
+    cmocka_unit_test(test_main_autodetect_read),
+    cmocka_unit_test(test_main_replay_read),
+    cmocka_unit_test(test_main_replay_capture),
+    cmocka_unit_test(test_main_store),
     cmocka_unit_test(test_main_wrong_mode1),
     cmocka_unit_test(test_main_wrong_mode2),
     cmocka_unit_test(test_main_wrong_mode3),
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "pty_helper.h"
+#include "arbiter.h"
+#include "timeutil.h"
+#include "poller.h"
+
+#define RESPONSE "\xff\x86\x02\x60\x47\0\0\0\xd1"
+
+static void test_poller_cycle(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 1000000,
+    .tries = 1,
+  };
+  pty_t ptys[3];
+  char *devices[3];
+  poller_t poller;
+  uint8_t request[sizeof(pkt_t)];
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    open_pty(&ptys[i]);
+    devices[i] = ptys[i].name;
+    /* response can be queued before request, poller has to pick it up */
+    assert_int_equal(9, write(ptys[i].master, RESPONSE, 9));
+  }
+
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 3));
+  assert_int_equal(3, poller_cycle(&poller));
+
+  for (i = 0; i < 3; i++)
+  {
+    assert_int_equal(POLL_DONE, poller.devs[i].state);
+    assert_int_equal(0, poller.devs[i].error);
+    assert_int_equal(0x260, poller.devs[i].gas_concentration);
+    assert_int_equal(9, read(ptys[i].master, request, sizeof(request)));
+    assert_memory_equal("\xff\x01\x86\0\0\0\0\0\x79", request, 9);
+  }
+
+  poller_close(&poller);
+  for (i = 0; i < 3; i++)
+  {
+    close_pty(&ptys[i]);
+  }
+}
+
+static void test_poller_resync(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 1000000,
+    .tries = 1,
+  };
+  pty_t ptys[2];
+  char *devices[2];
+  poller_t poller;
+
+  open_pty(&ptys[0]);
+  open_pty(&ptys[1]);
+  devices[0] = ptys[0].name;
+  devices[1] = ptys[1].name;
+  assert_int_equal(9, write(ptys[0].master, RESPONSE, 9));
+  /* stray byte and frame with invalid checksum before valid response */
+  assert_int_equal(19, write(ptys[1].master,
+        "\x42\xff\x86\x02\x60\x47\0\0\0\xd2" RESPONSE, 19));
+
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 2));
+  assert_int_equal(2, poller_cycle(&poller));
+
+  assert_int_equal(POLL_DONE, poller.devs[0].state);
+  assert_int_equal(POLL_DONE, poller.devs[1].state);
+  assert_int_equal(0x260, poller.devs[1].gas_concentration);
+  assert_int_equal(1, poller.devs[1].parser.rejects);
+
+  poller_close(&poller);
+  close_pty(&ptys[0]);
+  close_pty(&ptys[1]);
+}
+
+static void test_poller_timeout(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 20000,
+    .tries = 2,
+  };
+  pty_t ptys[2];
+  char *devices[2];
+  poller_t poller;
+
+  open_pty(&ptys[0]);
+  open_pty(&ptys[1]);
+  devices[0] = ptys[0].name;
+  devices[1] = ptys[1].name;
+  assert_int_equal(9, write(ptys[0].master, RESPONSE, 9));
+
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 2));
+  assert_int_equal(1, poller_cycle(&poller));
+
+  assert_int_equal(POLL_DONE, poller.devs[0].state);
+  assert_int_equal(POLL_FAILED, poller.devs[1].state);
+  assert_int_equal(-3, poller.devs[1].error);
+  /* both tries of silent device expired, healthy one was not delayed */
+  assert_true(poller.devs[1].latency >= 40000000);
+  assert_true(poller.devs[1].latency < 200000000);
+  assert_true(poller.devs[0].latency < 20000000);
+
+  poller_close(&poller);
+  close_pty(&ptys[0]);
+  close_pty(&ptys[1]);
+}
+
+static void test_poller_breaker(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 20000,
+    .tries = 2,
+    .backoff = 10000,
+    .breaker = 2,
+    .probe_interval = 60000000,
+  };
+  pty_t ptys[2];
+  char *devices[2];
+  poller_t poller;
+  int i;
+
+  open_pty(&ptys[0]);
+  open_pty(&ptys[1]);
+  devices[0] = ptys[0].name;
+  devices[1] = ptys[1].name;
+
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 2));
+  for (i = 0; i < 2; i++)
+  {
+    assert_int_equal(9, write(ptys[0].master, RESPONSE, 9));
+    assert_int_equal(1, poller_cycle(&poller));
+    assert_int_equal(POLL_FAILED, poller.devs[1].state);
+    /* two tries separated by backoff of 5-10ms */
+    assert_true(poller.devs[1].latency >= 45000000);
+  }
+  assert_int_equal(BREAKER_OPEN, poller.devs[1].breaker.state);
+
+  /* silent device is no longer polled, so it does not delay the cycle */
+  assert_int_equal(9, write(ptys[0].master, RESPONSE, 9));
+  assert_int_equal(1, poller_cycle(&poller));
+  assert_int_equal(POLL_DONE, poller.devs[0].state);
+  assert_int_equal(POLL_SKIPPED, poller.devs[1].state);
+  assert_int_equal(-7, poller.devs[1].error);
+
+  poller_close(&poller);
+  close_pty(&ptys[0]);
+  close_pty(&ptys[1]);
+}
+
+static void test_poller_uring(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 20000,
+    .tries = 2,
+    .backoff = 10000,
+  };
+  pty_t ptys[3];
+  char *devices[3];
+  poller_t poller;
+  uint8_t request[sizeof(pkt_t)];
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    open_pty(&ptys[i]);
+    devices[i] = ptys[i].name;
+  }
+
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 3));
+  if (poller_use_uring(&poller))
+  {
+    /* backend not available, nothing to test */
+    poller_close(&poller);
+    for (i = 0; i < 3; i++)
+    {
+      close_pty(&ptys[i]);
+    }
+    return;
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    assert_int_equal(9, write(ptys[0].master, RESPONSE, 9));
+    assert_int_equal(19, write(ptys[1].master,
+          "\x42\xff\x86\x02\x60\x47\0\0\0\xd2" RESPONSE, 19));
+    /* results of one cycle must not leak into the next one */
+    assert_int_equal(2, poller_cycle(&poller));
+
+    assert_int_equal(POLL_DONE, poller.devs[0].state);
+    assert_int_equal(0x260, poller.devs[0].gas_concentration);
+    assert_int_equal(9, read(ptys[0].master, request, sizeof(request)));
+    assert_memory_equal("\xff\x01\x86\0\0\0\0\0\x79", request, 9);
+    assert_int_equal(POLL_DONE, poller.devs[1].state);
+    assert_int_equal(0x260, poller.devs[1].gas_concentration);
+
+    /* silent device timed out twice with backoff in between */
+    assert_int_equal(POLL_FAILED, poller.devs[2].state);
+    assert_int_equal(-3, poller.devs[2].error);
+    assert_true(poller.devs[2].latency >= 45000000);
+    assert_true(poller.devs[2].latency < 200000000);
+  }
+  assert_int_equal(4, poller.devs[2].stats.timeouts);
+  assert_int_equal(2, poller.devs[2].stats.retries);
+  assert_int_equal(2, poller.devs[1].stats.checksum_errors);
+  assert_int_equal(18, poller.devs[0].stats.bytes_out);
+
+  poller_close(&poller);
+  for (i = 0; i < 3; i++)
+  {
+    close_pty(&ptys[i]);
+  }
+}
+
+static void test_poller_hangup(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 200000,
+    .tries = 1,
+  };
+  pty_t ptys[2];
+  char *devices[2];
+  poller_t poller;
+  struct timespec start, end;
+
+  open_pty(&ptys[0]);
+  open_pty(&ptys[1]);
+  devices[0] = ptys[0].name;
+  devices[1] = ptys[1].name;
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 2));
+  /* first line is unplugged, second one is slow */
+  close(ptys[0].master);
+  ptys[0].master = -1;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+  assert_int_equal(0, poller_cycle(&poller));
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+
+  assert_int_equal(POLL_FAILED, poller.devs[0].state);
+  assert_int_equal(POLL_FAILED, poller.devs[1].state);
+  assert_true(poller.devs[1].latency >= 200000000);
+  /* hangup of finished device does not keep waking the cycle up */
+  assert_true((end.tv_sec - start.tv_sec) * 1000000000LL +
+      end.tv_nsec - start.tv_nsec < 50000000);
+
+  poller_close(&poller);
+  close_pty(&ptys[0]);
+  close_pty(&ptys[1]);
+}
+
+static volatile sig_atomic_t alarmed = 0;
+
+static void handle_alarm(int sig)
+{
+  alarmed = 1;
+}
+
+static void test_poller_signal(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 100000,
+    .tries = 1,
+  };
+  struct itimerval timer = { .it_value = { .tv_usec = 20000 } };
+  struct sigaction sa;
+  pty_t pty;
+  char *devices[1];
+  poller_t poller;
+
+  /* epoll_wait and ppoll are never restarted, with or without SA_RESTART
+   * (which handler of profile dump sets) */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_alarm;
+  sigemptyset(&sa.sa_mask);
+  assert_int_equal(0, sigaction(SIGALRM, &sa, NULL));
+  open_pty(&pty);
+  devices[0] = pty.name;
+  assert_int_equal(0, poller_open(&poller, &opts, devices, 1));
+
+  /* unrelated signal does not end the cycle */
+  alarmed = 0;
+  assert_int_equal(0, setitimer(ITIMER_REAL, &timer, NULL));
+  assert_int_equal(0, poller_cycle(&poller));
+  assert_true(alarmed);
+  assert_int_equal(POLL_FAILED, poller.devs[0].state);
+  assert_true(poller.devs[0].latency >= 100000000);
+
+  /* unless it is meant to */
+  alarmed = 0;
+  poller.cancel = &alarmed;
+  assert_int_equal(0, setitimer(ITIMER_REAL, &timer, NULL));
+  assert_int_equal(-1, poller_cycle(&poller));
+  assert_true(alarmed);
+
+  poller_close(&poller);
+  close_pty(&pty);
+  signal(SIGALRM, SIG_DFL);
+}
+
+static void test_poller_open_error(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .tries = 1,
+  };
+  char *devices[] = {"/nonexistent/tty"};
+  poller_t poller;
+
+  assert_int_equal(-1, poller_open(&poller, &opts, devices, 1));
+}
+
+static void test_poller_open_busy(void **state)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 100000,
+    .tries = 1,
+    .lock_wait = 0,
+  };
+  struct timespec start, limit, now;
+  char *devices[1];
+  poller_t poller;
+  pty_t pty;
+  int holder;
+
+  open_pty(&pty);
+  devices[0] = pty.name;
+  holder = arb_open(pty.name, O_RDWR | O_NOCTTY, 0);
+  assert_true(holder >= 0);
+
+  /* waiting for device without limit must not outlast the deadline */
+  timespec_now(&start);
+  limit = start;
+  timespec_add_ns(&limit, 50 * NSEC_PER_MSEC);
+  assert_int_equal(0, poller_open_lenient(&poller, &opts, devices, 1, &limit));
+  timespec_now(&now);
+  assert_true(timespec_diff_ns(&now, &start) < 500 * NSEC_PER_MSEC);
+  assert_int_equal(0, poller_cycle(&poller));
+  assert_int_equal(POLL_FAILED, poller.devs[0].state);
+  assert_int_equal(-8, poller.devs[0].error);
+
+  poller_close(&poller);
+  close(holder);
+  close_pty(&pty);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_poller_cycle),
+    cmocka_unit_test(test_poller_resync),
+    cmocka_unit_test(test_poller_timeout),
+    cmocka_unit_test(test_poller_breaker),
+    cmocka_unit_test(test_poller_uring),
+    cmocka_unit_test(test_poller_hangup),
+    cmocka_unit_test(test_poller_signal),
+    cmocka_unit_test(test_poller_open_error),
+    cmocka_unit_test(test_poller_open_busy),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
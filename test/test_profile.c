@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "profile.h"
+
+static void test_histogram_buckets(void **state)
+{
+  uint64_t value;
+  int i;
+
+  /* buckets are contiguous and every lower bound maps to its own bucket */
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+  {
+    assert_int_equal(i, histogram_index(histogram_value(i)));
+    if (i > 0)
+    {
+      assert_true(histogram_value(i) > histogram_value(i - 1));
+    }
+  }
+  assert_int_equal(PROFILE_BUCKETS - 1, histogram_index(UINT64_MAX));
+
+  /* relative error stays bounded */
+  for (value = 1; value < (1ULL << 40); value = value * 3 + 1)
+  {
+    uint64_t low = histogram_value(histogram_index(value));
+    assert_true(low <= value);
+    assert_true(value - low <= value / (PROFILE_SUB_BUCKETS / 2));
+  }
+}
+
+static void test_histogram_quantile(void **state)
+{
+  static histogram_t hist;
+  uint64_t p50, p99;
+  int i;
+
+  memset(&hist, 0, sizeof(hist));
+  assert_int_equal(0, histogram_quantile(&hist, 0.5));
+
+  for (i = 1; i <= 1000; i++)
+  {
+    histogram_record(&hist, i * 1000);
+  }
+  assert_int_equal(1000, hist.total);
+  assert_int_equal(1000000, hist.max);
+
+  p50 = histogram_quantile(&hist, 0.5);
+  p99 = histogram_quantile(&hist, 0.99);
+  assert_true(p50 >= 500000 && p50 < 501000 * 9 / 8);
+  assert_true(p99 >= 990000 && p99 <= 1000000);
+  assert_int_equal(1000000, histogram_quantile(&hist, 1));
+}
+
+static void test_histogram_overhead(void **state)
+{
+  static histogram_t hist;
+  struct timespec start, end;
+  int i, n = 1000000;
+
+  memset(&hist, 0, sizeof(hist));
+  timespec_now(&start);
+  for (i = 0; i < n; i++)
+  {
+    histogram_record(&hist, i);
+  }
+  timespec_now(&end);
+
+  /* a few tens of ns are expected, bound is generous, so that unoptimized
+   * builds and loaded or emulated test machines pass too */
+  assert_true(timespec_diff_ns(&end, &start) / n < 2000);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_histogram_buckets),
+    cmocka_unit_test(test_histogram_quantile),
+    cmocka_unit_test(test_histogram_overhead),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
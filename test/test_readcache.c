@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "testutil.h"
+#include "readcache.h"
+
+#define THREADS 8
+
+static atomic_int calls;
+static int result;
+static useconds_t delay;
+
+/* counts transactions, safe to call from many threads unlike cmocka mocks */
+int __wrap_process_command(mhopt_t *opts)
+{
+  int n = atomic_fetch_add(&calls, 1) + 1;
+
+  usleep(delay);
+  opts->gas_concentration = 500 + n;
+  return result;
+}
+
+static void reset()
+{
+  atomic_store(&calls, 0);
+  result = 0;
+  delay = 0;
+}
+
+static void test_readcache_hit(void **state)
+{
+  mhopt_t opts = { .device = "/dev/ttyUSB0" };
+  readcache_t cache;
+  char path[64];
+  int cached;
+
+  reset();
+  temp_file(path, "readcache");
+  assert_int_equal(0, readcache_open(&cache, path));
+
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_false(cached);
+  assert_int_equal(501, opts.gas_concentration);
+
+  opts.gas_concentration = 0;
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_true(cached);
+  assert_int_equal(501, opts.gas_concentration);
+  assert_int_equal(1, atomic_load(&calls));
+
+  /* other device is not served from cache */
+  opts.device = "/dev/ttyUSB1";
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_false(cached);
+  assert_int_equal(502, opts.gas_concentration);
+
+  /* reading older than max age is refreshed */
+  usleep(2000);
+  opts.device = "/dev/ttyUSB0";
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000, &cached));
+  assert_false(cached);
+  assert_int_equal(503, opts.gas_concentration);
+  assert_int_equal(3, atomic_load(&calls));
+
+  readcache_close(&cache);
+
+  /* readings survive reopening */
+  assert_int_equal(0, readcache_open(&cache, path));
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_true(cached);
+  assert_int_equal(503, opts.gas_concentration);
+  readcache_close(&cache);
+  unlink(path);
+}
+
+static void test_readcache_failure(void **state)
+{
+  mhopt_t opts = { .device = "/dev/ttyUSB0" };
+  readcache_t cache;
+  char path[64];
+  int cached;
+
+  reset();
+  temp_file(path, "readcache");
+  assert_int_equal(0, readcache_open(&cache, path));
+
+  result = -3;
+  assert_int_equal(-3, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_false(cached);
+
+  /* failure is not cached */
+  result = 0;
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_false(cached);
+  assert_int_equal(2, atomic_load(&calls));
+
+  readcache_close(&cache);
+  unlink(path);
+}
+
+typedef struct {
+  const char *path;
+  uint16_t ppm;
+  int cached;
+  int result;
+} reader_t;
+
+static void *read_device(void *arg)
+{
+  reader_t *reader = arg;
+  mhopt_t opts = { .device = "/dev/ttyUSB0" };
+  readcache_t cache;
+
+  /* every thread has its own handle, as separate process would */
+  reader->result = readcache_open(&cache, reader->path);
+  if (reader->result == 0)
+  {
+    reader->result = readcache_read(&cache, &opts, 1000000, &reader->cached);
+    reader->ppm = opts.gas_concentration;
+    readcache_close(&cache);
+  }
+  return NULL;
+}
+
+static void test_readcache_concurrent(void **state)
+{
+  pthread_t threads[THREADS];
+  reader_t readers[THREADS];
+  char path[64];
+  int i, cached = 0;
+
+  reset();
+  temp_file(path, "readcache");
+  delay = 50000;
+  for (i = 0; i < THREADS; i++)
+  {
+    readers[i].path = path;
+    assert_int_equal(0, pthread_create(&threads[i], NULL, read_device,
+          &readers[i]));
+  }
+  for (i = 0; i < THREADS; i++)
+  {
+    pthread_join(threads[i], NULL);
+    assert_int_equal(0, readers[i].result);
+    assert_int_equal(501, readers[i].ppm);
+    cached += readers[i].cached;
+  }
+
+  /* N callers cost one transaction */
+  assert_int_equal(1, atomic_load(&calls));
+  assert_int_equal(THREADS - 1, cached);
+  unlink(path);
+}
+
+static void test_readcache_evict(void **state)
+{
+  mhopt_t opts;
+  readcache_t cache;
+  char path[64], name[READCACHE_SLOTS + 1][32];
+  int i, cached;
+
+  reset();
+  temp_file(path, "readcache");
+  assert_int_equal(0, readcache_open(&cache, path));
+
+  memset(&opts, 0, sizeof(opts));
+  for (i = 0; i <= READCACHE_SLOTS; i++)
+  {
+    snprintf(name[i], sizeof(name[i]), "/dev/ttyUSB%d", i);
+    opts.device = name[i];
+    assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+    assert_false(cached);
+  }
+
+  /* the oldest reading made room for the last one */
+  opts.device = name[READCACHE_SLOTS];
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_true(cached);
+  opts.device = name[1];
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_true(cached);
+  opts.device = name[0];
+  assert_int_equal(0, readcache_read(&cache, &opts, 1000000, &cached));
+  assert_false(cached);
+
+  readcache_close(&cache);
+  unlink(path);
+}
+
+static void test_readcache_invalid(void **state)
+{
+  static char garbage[8192];
+  readcache_t cache;
+  char path[64];
+  int fd;
+
+  temp_file(path, "readcache");
+  fd = open(path, O_WRONLY);
+  assert_true(fd >= 0);
+  assert_int_equal(sizeof(garbage), write(fd, garbage, sizeof(garbage)));
+  close(fd);
+  assert_int_equal(-2, readcache_open(&cache, path));
+  unlink(path);
+
+  assert_int_equal(-1, readcache_open(&cache, "/nonexistent/cache"));
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_readcache_hit),
+    cmocka_unit_test(test_readcache_failure),
+    cmocka_unit_test(test_readcache_concurrent),
+    cmocka_unit_test(test_readcache_evict),
+    cmocka_unit_test(test_readcache_invalid),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
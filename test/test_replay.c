@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include "testutil.h"
+#include "mh_uart.h"
+#include "capture.h"
+#include "replay.h"
+
+/* append gas concentration response to capture */
+static void put_response(FILE *fp, uint16_t ppm, int corrupt)
+{
+  pkt_t pkt = {0};
+  return_gas_t *ret = (return_gas_t*) &pkt;
+
+  ret->start = 0xff;
+  ret->command = CMD_GAS_CONCENTRATION;
+  ret->concentration = htobe16(ppm);
+  pkt.checksum = checksum(&pkt) ^ (corrupt ? 0x5a : 0);
+  fwrite(&pkt, sizeof(pkt), 1, fp);
+}
+
+/* decode capture written so far from the beginning */
+static void replay(FILE *fp, replaystats_t *stats)
+{
+  fflush(fp);
+  assert_int_equal(0, lseek(fileno(fp), 0, SEEK_SET));
+  assert_int_equal(0, replay_fd(fileno(fp), CMD_GAS_CONCENTRATION, stats));
+}
+
+static void test_replay_clean(void **state)
+{
+  replaystats_t stats;
+  FILE *fp = tmpfile();
+  int i;
+
+  assert_non_null(fp);
+  for (i = 0; i < 1000; i++)
+  {
+    put_response(fp, 400 + i % 10, 0);
+  }
+  replay(fp, &stats);
+
+  assert_int_equal(1000 * sizeof(pkt_t), stats.bytes);
+  assert_int_equal(1000, stats.frames);
+  assert_int_equal(0, stats.rejects);
+  assert_int_equal(0, stats.dropped);
+  assert_int_equal(0, stats.resyncs);
+  assert_int_equal(400, stats.ppm_min);
+  assert_int_equal(409, stats.ppm_max);
+  assert_int_equal(404500, stats.ppm_sum);
+  fclose(fp);
+}
+
+static void test_replay_garbage(void **state)
+{
+  static const uint8_t noise[] = {0x00, 0xff, 0xff, 0x01, 0x86, 0x12};
+  replaystats_t stats;
+  FILE *fp = tmpfile();
+
+  assert_non_null(fp);
+  /* garbage before first frame */
+  fwrite(noise, sizeof(noise), 1, fp);
+  put_response(fp, 500, 0);
+  /* frame with bad checksum, then valid one */
+  put_response(fp, 600, 1);
+  put_response(fp, 700, 0);
+  /* noise between two valid frames */
+  fwrite(noise, 1, 2, fp);
+  put_response(fp, 800, 0);
+  /* truncated frame at the end */
+  put_response(fp, 900, 0);
+  fflush(fp);
+  assert_int_equal(0, ftruncate(fileno(fp), ftell(fp) - 3));
+  replay(fp, &stats);
+
+  assert_int_equal(3, stats.frames);
+  assert_int_equal(1, stats.rejects);
+  assert_int_equal(3, stats.resyncs);
+  assert_int_equal(stats.bytes, stats.frames * sizeof(pkt_t) + stats.dropped);
+  assert_int_equal(500, stats.ppm_min);
+  assert_int_equal(800, stats.ppm_max);
+  fclose(fp);
+}
+
+static void test_replay_large(void **state)
+{
+  replaystats_t stats;
+  FILE *fp = tmpfile();
+  int i, count = 2 * REPLAY_BLOCK_SIZE / sizeof(pkt_t) + 7;
+
+  /* frames crossing block boundaries */
+  assert_non_null(fp);
+  fputc(0x42, fp);
+  for (i = 0; i < count; i++)
+  {
+    put_response(fp, i % 5000, 0);
+  }
+  replay(fp, &stats);
+
+  assert_int_equal(count, stats.frames);
+  assert_int_equal(1, stats.dropped);
+  assert_int_equal(1, stats.resyncs);
+  assert_int_equal(0, stats.ppm_min);
+  assert_int_equal(4999, stats.ppm_max);
+  fclose(fp);
+}
+
+static void test_replay_empty(void **state)
+{
+  replaystats_t stats;
+  FILE *fp = tmpfile();
+
+  assert_non_null(fp);
+  replay(fp, &stats);
+
+  assert_int_equal(0, stats.bytes);
+  assert_int_equal(0, stats.frames);
+  assert_int_equal(0, stats.ppm_min);
+  assert_int_equal(0, stats.ppm_max);
+  fclose(fp);
+}
+
+static void test_replay_capture(void **state)
+{
+  pkt_t request = init_read_gas_packet();
+  return_gas_t ret = {.start = 0xff, .command = CMD_GAS_CONCENTRATION};
+  pkt_t response;
+  char path[32];
+  replaystats_t stats;
+  capture_t *capture;
+  int fd;
+
+  temp_file(path, "replay");
+  ret.concentration = htobe16(1000);
+  memcpy(&response, &ret, sizeof(response));
+  response.checksum = checksum(&response);
+
+  capture = capture_open(path);
+  assert_non_null(capture);
+  capture_device(capture, 3, "/dev/ttyS0");
+  capture_device(capture, 4, "/dev/ttyS1");
+  /* requests are not responses, even though they look like frames */
+  capture_io(capture, 3, CAPTURE_TX, &request, sizeof(request));
+  capture_io(capture, 4, CAPTURE_TX, &request, sizeof(request));
+  /* responses of two devices arrive interleaved, in pieces */
+  capture_io(capture, 3, CAPTURE_RX, &response, 4);
+  capture_io(capture, 4, CAPTURE_RX, &response, 2);
+  capture_io(capture, 3, CAPTURE_RX, (uint8_t*) &response + 4, 5);
+  capture_io(capture, 4, CAPTURE_RX, (uint8_t*) &response + 2, 7);
+  /* half of frame is lost when descriptor is reopened */
+  capture_io(capture, 3, CAPTURE_RX, &response, 4);
+  capture_device(capture, 3, "/dev/ttyS2");
+  capture_io(capture, 3, CAPTURE_RX, &response, sizeof(response));
+  capture_close(capture);
+
+  fd = open(path, O_RDONLY);
+  assert_true(fd >= 0);
+  assert_int_equal(0, replay_fd(fd, CMD_GAS_CONCENTRATION, &stats));
+  close(fd);
+  unlink(path);
+
+  assert_int_equal(3, stats.frames);
+  assert_int_equal(0, stats.rejects);
+  assert_int_equal(0, stats.resyncs);
+  assert_int_equal(4, stats.dropped);
+  assert_int_equal(1000, stats.ppm_min);
+  assert_int_equal(1000, stats.ppm_max);
+}
+
+static void test_replay_missing(void **state)
+{
+  assert_int_equal(-1, run_replay("/nonexistent/capture", stdout));
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_replay_clean),
+    cmocka_unit_test(test_replay_garbage),
+    cmocka_unit_test(test_replay_large),
+    cmocka_unit_test(test_replay_empty),
+    cmocka_unit_test(test_replay_capture),
+    cmocka_unit_test(test_replay_missing),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "timeutil.h"
+#include "retry.h"
+
+static void test_backoff_none(void **state)
+{
+  uint64_t seed = 1;
+
+  assert_int_equal(0, backoff_delay(0, 0, 1, &seed));
+  assert_int_equal(0, backoff_delay(0, 1000, 5, &seed));
+}
+
+static void test_backoff_growth(void **state)
+{
+  uint64_t seed = 42;
+  int64_t delay;
+  int attempt, i;
+
+  for (attempt = 1; attempt <= 4; attempt++)
+  {
+    int64_t full = 1000 << (attempt - 1);
+
+    /* upper half of the full delay is randomized */
+    for (i = 0; i < 100; i++)
+    {
+      delay = backoff_delay(1000, 0, attempt, &seed);
+      assert_true(delay >= full / 2);
+      assert_true(delay <= full);
+    }
+  }
+}
+
+static void test_backoff_max(void **state)
+{
+  uint64_t seed = 42;
+  int64_t delay;
+  int i;
+
+  for (i = 0; i < 100; i++)
+  {
+    delay = backoff_delay(1000, 5000, 30, &seed);
+    assert_true(delay >= 2500);
+    assert_true(delay <= 5000);
+  }
+  /* must not overflow without limit */
+  assert_true(backoff_delay(1000, 0, 200, &seed) > 0);
+}
+
+static void test_breaker_disabled(void **state)
+{
+  breaker_t breaker;
+  struct timespec now = {100, 0};
+  int i;
+
+  breaker_init(&breaker, 0, 1000000);
+  for (i = 0; i < 100; i++)
+  {
+    assert_true(breaker_allow(&breaker, &now));
+    assert_false(breaker_record(&breaker, 0, &now));
+  }
+  assert_int_equal(BREAKER_CLOSED, breaker.state);
+}
+
+static void test_breaker_probe(void **state)
+{
+  breaker_t breaker;
+  struct timespec now = {100, 0};
+
+  breaker_init(&breaker, 3, 1000000);
+
+  assert_false(breaker_record(&breaker, 0, &now));
+  assert_false(breaker_record(&breaker, 0, &now));
+  /* success resets counter */
+  assert_false(breaker_record(&breaker, 1, &now));
+  assert_false(breaker_record(&breaker, 0, &now));
+  assert_false(breaker_record(&breaker, 0, &now));
+  assert_true(breaker_record(&breaker, 0, &now));
+  assert_int_equal(BREAKER_OPEN, breaker.state);
+  assert_int_equal(1, breaker.trips);
+
+  /* no probe until interval passes */
+  timespec_add_ns(&now, 999 * NSEC_PER_MSEC);
+  assert_false(breaker_allow(&breaker, &now));
+  timespec_add_ns(&now, NSEC_PER_MSEC);
+  assert_true(breaker_allow(&breaker, &now));
+  assert_int_equal(BREAKER_HALF_OPEN, breaker.state);
+  assert_false(breaker_allow(&breaker, &now));
+
+  /* failed probe waits for another interval */
+  assert_false(breaker_record(&breaker, 0, &now));
+  assert_int_equal(BREAKER_OPEN, breaker.state);
+  assert_false(breaker_allow(&breaker, &now));
+  timespec_add_ns(&now, NSEC_PER_SEC);
+  assert_true(breaker_allow(&breaker, &now));
+
+  /* successful probe closes breaker */
+  assert_false(breaker_record(&breaker, 1, &now));
+  assert_int_equal(BREAKER_CLOSED, breaker.state);
+  assert_true(breaker_allow(&breaker, &now));
+  assert_int_equal(1, breaker.trips);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_backoff_none),
+    cmocka_unit_test(test_backoff_growth),
+    cmocka_unit_test(test_backoff_max),
+    cmocka_unit_test(test_breaker_disabled),
+    cmocka_unit_test(test_breaker_probe),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
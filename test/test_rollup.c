@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutil.h"
+#include "rollup.h"
+#include "timeutil.h"
+
+#define BASE (400000 * 3600 * NSEC_PER_SEC) /**< some full hour */
+
+static char *devices[] = {"/dev/ttyS0", "/dev/ttyS1", "/dev/ttyS2"};
+
+static void remove_rollup(const char *prefix)
+{
+  char path[64];
+  int tier;
+
+  for (tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    snprintf(path, sizeof(path), "%s%s", prefix, rollup_suffixes[tier]);
+    unlink(path);
+  }
+  unlink(prefix);
+}
+
+static void open_tier(rollup_series_t *series, const char *prefix,
+    rolluptier_t tier)
+{
+  char path[64];
+
+  snprintf(path, sizeof(path), "%s%s", prefix, rollup_suffixes[tier]);
+  assert_int_equal(0, rollup_open_reader(series, path));
+}
+
+static void add(rollup_t *rollup, int64_t wall, uint32_t device, uint16_t ppm,
+    int16_t status)
+{
+  store_record_t record = {
+    .mono = wall,
+    .wall = wall,
+    .device = device,
+    .ppm = ppm,
+    .status = status,
+  };
+
+  rollup_add(rollup, &record);
+}
+
+static void test_rollup_tiers(void **state)
+{
+  char prefix[32];
+  rollup_t rollup;
+  rollup_series_t second, minute, hour;
+  rollup_record_t out[8];
+
+  temp_file(prefix, "rollup");
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 2));
+  open_tier(&second, prefix, ROLLUP_SECOND);
+  open_tier(&minute, prefix, ROLLUP_MINUTE);
+  open_tier(&hour, prefix, ROLLUP_HOUR);
+  assert_true(rollup_width(&minute) == 60 * NSEC_PER_SEC);
+  assert_string_equal("/dev/ttyS1", rollup_device(&second, 1));
+  assert_null(rollup_device(&second, 2));
+
+  add(&rollup, BASE + 100 * NSEC_PER_MSEC, 0, 400, 0);
+  add(&rollup, BASE + 200 * NSEC_PER_MSEC, 1, 600, 0);
+  add(&rollup, BASE + 500 * NSEC_PER_MSEC, 0, 500, 0);
+  add(&rollup, BASE + 700 * NSEC_PER_MSEC, 0, 0, -3);
+
+  /* nothing is written before period ends */
+  assert_int_equal(0, rollup_query(&second, 0, INT64_MAX, out, 8));
+
+  add(&rollup, BASE + 1200 * NSEC_PER_MSEC, 0, 700, 0);
+  assert_int_equal(2, rollup_query(&second, 0, INT64_MAX, out, 8));
+  assert_true(out[0].start == BASE);
+  assert_int_equal(0, out[0].device);
+  assert_int_equal(2, out[0].count);
+  assert_int_equal(400, out[0].min);
+  assert_int_equal(500, out[0].max);
+  assert_int_equal(500, out[0].last);
+  assert_int_equal(1, out[0].failures);
+  assert_true(rollup_mean(&out[0]) == 450);
+  assert_int_equal(1, out[1].device);
+  assert_int_equal(600, out[1].last);
+  assert_int_equal(0, rollup_query(&minute, 0, INT64_MAX, out, 8));
+
+  /* minute ends even without new readings */
+  rollup_advance(&rollup, BASE + 61 * NSEC_PER_SEC);
+  assert_int_equal(3, rollup_query(&second, 0, INT64_MAX, out, 8));
+  assert_true(out[2].start == BASE + NSEC_PER_SEC);
+  assert_int_equal(1, rollup_query(&second, BASE + NSEC_PER_SEC, INT64_MAX,
+        out, 8));
+  assert_int_equal(2, rollup_query(&minute, 0, INT64_MAX, out, 8));
+  assert_int_equal(3, out[0].count);
+  assert_int_equal(400, out[0].min);
+  assert_int_equal(700, out[0].max);
+  assert_int_equal(700, out[0].last);
+  assert_int_equal(0, rollup_query(&hour, 0, INT64_MAX, out, 8));
+
+  /* incomplete hour is written at close */
+  rollup_close(&rollup);
+  assert_int_equal(2, rollup_query(&hour, 0, INT64_MAX, out, 8));
+  assert_true(out[0].start == BASE);
+  assert_int_equal(3, out[0].count);
+  assert_int_equal(1, out[0].failures);
+  assert_true(rollup_mean(&out[0]) == 1600 / 3.0);
+
+  rollup_close_series(&second);
+  rollup_close_series(&minute);
+  rollup_close_series(&hour);
+  remove_rollup(prefix);
+}
+
+static void test_rollup_clock_step(void **state)
+{
+  char prefix[32];
+  rollup_t rollup;
+  rollup_series_t second;
+  rollup_record_t out[8];
+
+  temp_file(prefix, "rollup");
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 1));
+  open_tier(&second, prefix, ROLLUP_SECOND);
+
+  add(&rollup, BASE + 5 * NSEC_PER_SEC, 0, 400, 0);
+  /* reading from before current period goes to current period */
+  add(&rollup, BASE + 2 * NSEC_PER_SEC, 0, 500, 0);
+  rollup_advance(&rollup, BASE + 6 * NSEC_PER_SEC);
+
+  assert_int_equal(1, rollup_query(&second, 0, INT64_MAX, out, 8));
+  assert_true(out[0].start == BASE + 5 * NSEC_PER_SEC);
+  assert_int_equal(2, out[0].count);
+
+  rollup_close(&rollup);
+  rollup_close_series(&second);
+  remove_rollup(prefix);
+}
+
+static void test_rollup_reopen(void **state)
+{
+  char *swapped[] = {"/dev/ttyS1", "/dev/ttyS0"};
+  char prefix[32];
+  rollup_t rollup;
+  rollup_series_t second, minute, hour;
+  rollup_record_t out[8];
+
+  temp_file(prefix, "rollup");
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 2));
+  add(&rollup, BASE, 1, 400, 0);
+  rollup_close(&rollup);
+
+  /* different number of devices needs different files */
+  assert_int_equal(-2, rollup_open(&rollup, prefix, devices, 3));
+  /* and so do devices in different order */
+  assert_int_equal(-2, rollup_open(&rollup, prefix, swapped, 2));
+
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 2));
+  add(&rollup, BASE + 3 * NSEC_PER_SEC, 1, 500, 0);
+  rollup_close(&rollup);
+
+  open_tier(&second, prefix, ROLLUP_SECOND);
+  assert_int_equal(2, rollup_query(&second, 0, INT64_MAX, out, 8));
+  assert_int_equal(400, out[0].last);
+  assert_int_equal(500, out[1].last);
+  rollup_close_series(&second);
+
+  /* minute and hour written at first close are not written again */
+  open_tier(&minute, prefix, ROLLUP_MINUTE);
+  open_tier(&hour, prefix, ROLLUP_HOUR);
+  assert_int_equal(1, rollup_query(&minute, 0, INT64_MAX, out, 8));
+  assert_true(out[0].start == BASE);
+  assert_int_equal(400, out[0].last);
+  assert_int_equal(1, rollup_query(&hour, 0, INT64_MAX, out, 8));
+  assert_int_equal(1, out[0].count);
+
+  /* next minute is written once it is closed */
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 2));
+  add(&rollup, BASE + 61 * NSEC_PER_SEC, 0, 600, 0);
+  /* clock that is behind does not break order of periods */
+  add(&rollup, BASE - NSEC_PER_SEC, 0, 700, 0);
+  rollup_close(&rollup);
+  assert_int_equal(2, rollup_query(&minute, 0, INT64_MAX, out, 8));
+  assert_true(out[1].start == BASE + 60 * NSEC_PER_SEC);
+  assert_int_equal(0, out[1].device);
+  assert_int_equal(2, out[1].count);
+  assert_int_equal(700, out[1].last);
+  assert_int_equal(1, rollup_query(&hour, 0, INT64_MAX, out, 8));
+  assert_int_equal(1, out[0].count);
+
+  /* restart with clock behind all stored periods */
+  assert_int_equal(0, rollup_open(&rollup, prefix, devices, 2));
+  add(&rollup, BASE - 3600 * NSEC_PER_SEC, 1, 800, 0);
+  rollup_advance(&rollup, BASE + 2 * 3600 * NSEC_PER_SEC);
+  rollup_close(&rollup);
+  assert_int_equal(2, rollup_query(&minute, 0, INT64_MAX, out, 8));
+  assert_int_equal(1, rollup_query(&hour, 0, INT64_MAX, out, 8));
+  open_tier(&second, prefix, ROLLUP_SECOND);
+  assert_int_equal(3, rollup_query(&second, 0, INT64_MAX, out, 8));
+  assert_true(out[2].start == BASE + 61 * NSEC_PER_SEC);
+  assert_int_equal(2, rollup_query(&second, BASE + NSEC_PER_SEC, INT64_MAX,
+        out, 8));
+  rollup_close_series(&second);
+  rollup_close_series(&minute);
+  rollup_close_series(&hour);
+
+  /* file of other kind is rejected */
+  assert_int_equal(-2, rollup_open_reader(&second, prefix));
+  remove_rollup(prefix);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_rollup_tiers),
+    cmocka_unit_test(test_rollup_clock_step),
+    cmocka_unit_test(test_rollup_reopen),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
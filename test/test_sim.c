@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+
+#include "sim.h"
+#include "mhdev.h"
+
+static void *serve(void *arg)
+{
+  sim_run(arg);
+  return NULL;
+}
+
+static mhdev_t *open_simulated(sim_t *sim, int index)
+{
+  mhopt_t opts = {
+    .baudrate = 9600,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 10,
+    .timeout = 200000,
+    .tries = 1,
+  };
+
+  opts.device = sim->sensors[index].name;
+  return mhdev_open(&opts);
+}
+
+static void test_sim_read(void **state)
+{
+  simopt_t opts = {
+    .count = 2,
+    .latency = 1000,
+    .waveform = WAVE_CONSTANT,
+    .ppm = 600,
+  };
+  uint16_t concentration = 0;
+  pthread_t thread;
+  mhdev_t *dev;
+  sim_t sim;
+
+  assert_int_equal(0, sim_open(&sim, &opts));
+  assert_int_equal(0, pthread_create(&thread, NULL, serve, &sim));
+
+  dev = open_simulated(&sim, 1);
+  assert_non_null(dev);
+  assert_int_equal(0, mhdev_read_gas(dev, &concentration));
+  assert_int_equal(600, concentration);
+
+  /* zero calibration assumes fresh air */
+  assert_int_equal(0, mhdev_calibrate_zero(dev));
+  assert_int_equal(0, mhdev_read_gas(dev, &concentration));
+  assert_int_equal(400, concentration);
+  mhdev_close(dev);
+
+  sim_stop(&sim);
+  pthread_join(thread, NULL);
+  assert_int_equal(3, sim.sensors[1].requests);
+  assert_int_equal(2, sim.sensors[1].responses);
+  assert_int_equal(0, sim.sensors[0].requests);
+  sim_close(&sim);
+}
+
+static void test_sim_waveform(void **state)
+{
+  simopt_t opts = {
+    .count = 4,
+    .waveform = WAVE_RAMP,
+    .ppm = 400,
+    .amplitude = 400,
+    .period = 1000,
+  };
+  struct timespec now;
+  sim_t sim;
+
+  assert_int_equal(0, sim_open(&sim, &opts));
+
+  /* sensors are spread over period */
+  now = sim.start;
+  assert_int_equal(400, sim_concentration(&sim, 0, &now));
+  assert_int_equal(500, sim_concentration(&sim, 1, &now));
+  assert_int_equal(600, sim_concentration(&sim, 2, &now));
+  assert_int_equal(700, sim_concentration(&sim, 3, &now));
+
+  sim_close(&sim);
+}
+
+static void test_sim_drop(void **state)
+{
+  simopt_t opts = {
+    .count = 1,
+    .drop = 1,
+    .ppm = 600,
+  };
+  uint16_t concentration = 0;
+  pthread_t thread;
+  mhdev_t *dev;
+  sim_t sim;
+
+  assert_int_equal(0, sim_open(&sim, &opts));
+  assert_int_equal(0, pthread_create(&thread, NULL, serve, &sim));
+
+  dev = open_simulated(&sim, 0);
+  assert_non_null(dev);
+  mhdev_set_timeout(dev, 20000, 1);
+  assert_int_equal(-3, mhdev_read_gas(dev, &concentration));
+  mhdev_close(dev);
+
+  sim_stop(&sim);
+  pthread_join(thread, NULL);
+  assert_int_equal(1, sim.sensors[0].requests);
+  assert_int_equal(0, sim.sensors[0].responses);
+  sim_close(&sim);
+}
+
+static void test_sim_line(void **state)
+{
+  simopt_t opts = {
+    .count = 1,
+    .ppm = 600,
+    .baudrate = 19200,
+    .stopbits = 20,
+  };
+  mhopt_t devopts = {
+    .baudrate = 19200,
+    .databits = 8,
+    .parity = 'N',
+    .stopbits = 20,
+    .timeout = 200000,
+    .tries = 1,
+  };
+  uint16_t concentration = 0;
+  pthread_t thread;
+  mhdev_t *dev;
+  sim_t sim;
+
+  assert_int_equal(0, sim_open(&sim, &opts));
+  assert_int_equal(0, pthread_create(&thread, NULL, serve, &sim));
+
+  /* default 9600 8N1 is not what sensor listens at */
+  dev = open_simulated(&sim, 0);
+  assert_non_null(dev);
+  mhdev_set_timeout(dev, 20000, 1);
+  assert_int_equal(-3, mhdev_read_gas(dev, &concentration));
+  mhdev_close(dev);
+
+  devopts.device = sim.sensors[0].name;
+  dev = mhdev_open(&devopts);
+  assert_non_null(dev);
+  assert_int_equal(0, mhdev_read_gas(dev, &concentration));
+  assert_int_equal(600, concentration);
+  mhdev_close(dev);
+
+  sim_stop(&sim);
+  pthread_join(thread, NULL);
+  assert_int_equal(1, sim.sensors[0].requests);
+  sim_close(&sim);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_sim_read),
+    cmocka_unit_test(test_sim_waveform),
+    cmocka_unit_test(test_sim_drop),
+    cmocka_unit_test(test_sim_line),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
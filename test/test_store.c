@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "testutil.h"
+#include "store.h"
+
+static char *devices[] = {"/dev/ttyS0", "/dev/ttyS1"};
+
+static void append(store_t *store, int64_t wall, uint32_t device,
+    uint16_t ppm)
+{
+  store_record_t record = {
+    .mono = wall,
+    .wall = wall,
+    .device = device,
+    .ppm = ppm,
+  };
+
+  store_append(store, &record);
+}
+
+static void test_store_query(void **state)
+{
+  char path[32];
+  store_t writer, reader;
+  store_record_t out[8];
+  int i;
+
+  temp_file(path, "store");
+  assert_int_equal(0, store_open(&writer, path, 16, devices, 2));
+  assert_int_equal(0, store_open_reader(&reader, path));
+
+  for (i = 0; i < 10; i++)
+  {
+    append(&writer, 1000 + i * 10, i % 2, 400 + i);
+  }
+
+  /* reader sees records appended after it was opened */
+  assert_int_equal(10, store_count(&reader));
+  assert_string_equal("/dev/ttyS1", store_device(&reader, 1));
+  assert_null(store_device(&reader, 2));
+
+  assert_int_equal(3, store_query(&reader, 1025, 1060, out, 8));
+  assert_int_equal(1030, out[0].wall);
+  assert_int_equal(403, out[0].ppm);
+  assert_int_equal(1, out[0].device);
+  assert_int_equal(1050, out[2].wall);
+
+  /* output buffer limits number of records */
+  assert_int_equal(2, store_query(&reader, 0, 2000, out, 2));
+  assert_int_equal(1000, out[0].wall);
+
+  assert_int_equal(0, store_query(&reader, 2000, 3000, out, 8));
+
+  store_close(&reader);
+  store_close(&writer);
+  unlink(path);
+}
+
+static void test_store_wrap(void **state)
+{
+  char path[32];
+  store_t store;
+  store_record_t out[8];
+  int i;
+
+  temp_file(path, "store");
+  assert_int_equal(0, store_open(&store, path, 4, devices, 2));
+
+  for (i = 0; i < 10; i++)
+  {
+    append(&store, 1000 + i * 10, 0, 400 + i);
+  }
+
+  /* only newest records survive, slot to be overwritten next is skipped */
+  assert_int_equal(10, store_count(&store));
+  assert_int_equal(3, store_query(&store, 0, 2000, out, 8));
+  assert_int_equal(1070, out[0].wall);
+  assert_int_equal(1090, out[2].wall);
+
+  store_close(&store);
+  unlink(path);
+}
+
+static void test_store_reopen(void **state)
+{
+  char *swapped[] = {"/dev/ttyS1", "/dev/ttyS0"};
+  char path[32];
+  store_t store;
+  store_record_t out[8];
+
+  temp_file(path, "store");
+  assert_int_equal(0, store_open(&store, path, 8, devices, 2));
+  append(&store, 1000, 0, 400);
+  store_close(&store);
+
+  /* incompatible layout is refused */
+  assert_int_equal(-2, store_open(&store, path, 16, devices, 2));
+  assert_int_equal(-2, store_open(&store, path, 8, devices, 1));
+  /* so are devices in different order, records would be relabelled */
+  assert_int_equal(-2, store_open(&store, path, 8, swapped, 2));
+
+  assert_int_equal(0, store_open(&store, path, 8, devices, 2));
+  assert_int_equal(1, store_count(&store));
+
+  /* wall time cannot go back, so store stays sorted */
+  append(&store, 900, 1, 500);
+  assert_int_equal(2, store_query(&store, 1000, 1001, out, 8));
+  assert_int_equal(400, out[0].ppm);
+  assert_int_equal(500, out[1].ppm);
+  assert_int_equal(1000, out[1].wall);
+  assert_int_equal(900, out[1].mono);
+
+  store_close(&store);
+  unlink(path);
+}
+
+static void test_store_invalid(void **state)
+{
+  char path[32];
+  store_t store;
+  int fd;
+
+  temp_file(path, "store");
+  fd = open(path, O_WRONLY);
+  assert_int_equal(10, write(fd, "not store\n", 10));
+  close(fd);
+
+  assert_int_equal(-2, store_open_reader(&store, path));
+  assert_int_equal(-1, store_open_reader(&store, "/nonexistent/store"));
+
+  unlink(path);
+}
+
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_store_query),
+    cmocka_unit_test(test_store_wrap),
+    cmocka_unit_test(test_store_reopen),
+    cmocka_unit_test(test_store_invalid),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 Kamil Lorenc
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* create empty file with unique name /tmp/test_NAME.XXXXXX, path has to hold
+ * at least 32 characters */
+static inline void temp_file(char *path, const char *name)
+{
+  int fd;
+
+  sprintf(path, "/tmp/test_%s.XXXXXX", name);
+  fd = mkstemp(path);
+  assert_true(fd >= 0);
+  close(fd);
+}
+
+#endif // TESTUTIL_H